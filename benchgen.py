@@ -0,0 +1,149 @@
+# Generates a synthetic Wax project for measuring how the compiler scales.
+#
+#   python3 benchgen.py output-dir [--modules N] [--files M] [--functions F] [--depth D] [--seed S]
+#
+# Writes output-dir/manifest.json and N modules of M .wax files with F functions each. Expressions are
+# nested up to D levels deep. The same arguments always produce the same files.
+#
+# The generated code uses functions, assignments, if/else, foreach loops, calls, dot and bracket
+# access, + - == != and the ternary operator, inline dictionaries, strings, integers, booleans and null.
+# It has no classes, which were added to the compiler later. Leaving them out keeps the projects for a
+# given seed the same as before, so compile times can still be compared with earlier measurements.
+
+import json
+import os
+import random
+import sys
+
+FIELD_NAMES = ['data', 'length', 'items', 'value', 'count', 'name', 'result', 'status', 'total', 'next']
+WORDS = ['alpha', 'beta', 'gamma', 'delta', 'omega', 'sigma', 'kappa', 'theta', 'lambda', 'zeta']
+
+class Generator:
+    def __init__(self, seed, depth):
+        self.rng = random.Random(seed)
+        self.depth = depth
+
+    def word(self):
+        return self.rng.choice(WORDS)
+
+    def leaf(self, variables):
+        r = self.rng.random()
+        if r < 0.45 and len(variables) > 0: return self.rng.choice(variables)
+        if r < 0.65: return str(self.rng.randint(0, 100000))
+        if r < 0.85: return '"' + self.word() + ' ' + self.word() + '"'
+        if r < 0.90: return 'null'
+        return self.rng.choice(['true', 'false'])
+
+    def expression(self, variables, functions, depth):
+        if depth <= 0 or self.rng.random() < 0.2:
+            return self.leaf(variables)
+        r = self.rng.random()
+        sub = lambda: self.expression(variables, functions, depth - 1)
+        if r < 0.30:
+            ops = [self.rng.choice(['+', '-']) for _ in range(self.rng.randint(1, 3))]
+            parts = [sub()]
+            for op in ops:
+                parts.append(op)
+                parts.append(sub())
+            return '(' + ' '.join(parts) + ')'
+        if r < 0.40:
+            return '(' + sub() + ' ' + self.rng.choice(['==', '!=']) + ' ' + sub() + ')'
+        if r < 0.50:
+            return '(' + sub() + ' ? ' + sub() + ' : ' + sub() + ')'
+        if r < 0.65 and len(functions) > 0:
+            args = [sub() for _ in range(self.rng.randint(0, 3))]
+            return self.rng.choice(functions) + '(' + ', '.join(args) + ')'
+        if r < 0.75:
+            keys = self.rng.sample(FIELD_NAMES, self.rng.randint(1, 4))
+            return '{ ' + ', '.join('"' + k + '": ' + sub() for k in keys) + ' }'
+        root = self.rng.choice(variables) if len(variables) > 0 else 'input'
+        if r < 0.87:
+            return root + '.' + self.rng.choice(FIELD_NAMES)
+        return root + '[' + sub() + ']'
+
+    def block(self, lines, indent, variables, functions, statement_count, nesting):
+        prefix = '    ' * indent
+        for _ in range(statement_count):
+            r = self.rng.random()
+            if r < 0.15 and nesting > 0:
+                lines.append(prefix + 'if ' + '(' + self.expression(variables, functions, 2) + ') {')
+                self.block(lines, indent + 1, variables, functions, self.rng.randint(1, 4), nesting - 1)
+                if self.rng.random() < 0.5:
+                    lines.append(prefix + '} else {')
+                    self.block(lines, indent + 1, variables, functions, self.rng.randint(1, 3), nesting - 1)
+                lines.append(prefix + '}')
+            elif r < 0.25 and nesting > 0:
+                item = 'item' + str(indent)
+                lines.append(prefix + 'for (' + item + ' : ' + self.expression(variables, functions, 1) + ') {')
+                self.block(lines, indent + 1, variables + [item], functions, self.rng.randint(1, 4), nesting - 1)
+                lines.append(prefix + '}')
+            elif r < 0.40:
+                lines.append(prefix + self.rng.choice(functions) + '(' + self.expression(variables, functions, self.depth) + ');')
+            else:
+                name = 'v' + str(len(variables))
+                lines.append(prefix + name + ' = ' + self.expression(variables, functions, self.depth) + ';')
+                variables = variables + [name]
+
+    def function(self, name, functions):
+        args = ['a' + str(i) for i in range(self.rng.randint(0, 3))]
+        lines = ['function ' + name + '(' + ', '.join(args) + ') {']
+        self.block(lines, 1, args, functions, self.rng.randint(4, 14), 2)
+        lines.append('}')
+        return '\n'.join(lines)
+
+def generate(output_dir, module_count, file_count, function_count, depth, seed):
+    gen = Generator(seed, depth)
+    modules = []
+    total_lines = 0
+    for m in range(module_count):
+        module_name = 'Module' + str(m)
+        module_dir = os.path.join(output_dir, module_name)
+        os.makedirs(module_dir, exist_ok=True)
+        # Functions can call anything in their own module, including functions defined in later files.
+        names = ['f' + str(f) + '_' + str(i) for f in range(file_count) for i in range(function_count)]
+        callable_names = names + ['print', 'hub.sendRequestSync', 'response.send']
+        for f in range(file_count):
+            code = []
+            for i in range(function_count):
+                code.append(gen.function('f' + str(f) + '_' + str(i), callable_names))
+            text = '\n\n'.join(code) + '\n'
+            total_lines += text.count('\n')
+            with open(os.path.join(module_dir, 'file' + str(f) + '.wax'), 'wt') as file:
+                file.write(text)
+        modules.append({ 'name': module_name, 'src': module_name, 'lang': 'wax', 'action': 'bundle' })
+
+    manifest = {
+        'output': 'output',
+        'outputType': 'web',
+        'mainModule': 'Module0',
+        'moduleTargets': modules,
+    }
+    with open(os.path.join(output_dir, 'manifest.json'), 'wt') as file:
+        file.write(json.dumps(manifest, indent=2) + '\n')
+    return total_lines
+
+def main(args):
+    options = { '--modules': 4, '--files': 10, '--functions': 20, '--depth': 4, '--seed': 1 }
+    output_dir = None
+    i = 0
+    while i < len(args):
+        if args[i] in options and i + 1 < len(args):
+            options[args[i]] = int(args[i + 1])
+            i += 2
+        elif output_dir is None and not args[i].startswith('-'):
+            output_dir = args[i]
+            i += 1
+        else:
+            output_dir = None
+            break
+
+    if output_dir is None:
+        print('Usage: python3 benchgen.py output-dir [--modules N] [--files M] [--functions F] [--depth D] [--seed S]')
+        return 1
+
+    lines = generate(output_dir, options['--modules'], options['--files'], options['--functions'], options['--depth'], options['--seed'])
+    print('Generated ' + str(options['--modules'] * options['--files']) + ' files with ' + str(lines) + ' lines in ' + output_dir)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,146 @@
+# End-to-end compile benchmark. Runs waxcli on a project and reports throughput and peak memory.
+#
+#   python3 benchrun.py [--waxcli path] [--runs N] [--jobs N] [--json] manifest.json
+#   python3 benchrun.py [--waxcli path] [--runs N] [--jobs N] [--json] --scale small|medium|large
+#
+# With --scale, a project of a standard size is generated with benchgen.py into a temporary directory
+# first. Those sizes are the standard scaling test for the compiler, so keep them fixed.
+#
+# Each run reports wall time, lines/sec, tokens/sec (tokens as counted by waxcli --stats) and the peak
+# resident set size of the waxcli process. The best run is reported as well. --json prints one JSON
+# object per run instead of the table. Linux only, since peak RSS comes from wait4.
+
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import benchgen
+
+SCALES = {
+    # name: (modules, files per module, functions per file, expression depth)
+    'small': (2, 10, 20, 4),
+    'medium': (8, 20, 30, 4),
+    'large': (16, 25, 40, 4),
+}
+
+def count_lines(manifest_path):
+    with open(manifest_path, 'rt') as file:
+        manifest = json.loads(file.read())
+    root = os.path.dirname(os.path.abspath(manifest_path))
+    lines = 0
+    for module in manifest['moduleTargets']:
+        if module.get('lang') != 'wax': continue
+        for dir_path, _, files in os.walk(os.path.join(root, module['src'])):
+            for name in files:
+                if name.lower().endswith('.wax'):
+                    with open(os.path.join(dir_path, name), 'rt') as file:
+                        lines += file.read().count('\n')
+    return lines
+
+def parse_stats(output):
+    counters = {}
+    in_counters = False
+    for line in output.split('\n'):
+        if line.startswith('Counter'):
+            in_counters = True
+        elif in_counters and line.strip() != '':
+            parts = line.rsplit(None, 1)
+            if len(parts) == 2 and parts[1].isdigit():
+                counters[parts[0].strip()] = int(parts[1])
+    return counters
+
+def run_once(waxcli, manifest_path, jobs):
+    start = time.time()
+    process = subprocess.Popen([waxcli, '--stats', '--jobs', str(jobs), manifest_path], stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    output = process.stdout.read().decode('utf-8', 'replace')
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.time() - start
+    process.stdout.close()
+    if status != 0:
+        raise Exception('waxcli exited with status ' + str(status) + ':\n' + output)
+    if 'The following errors were countered' in output:
+        raise Exception('The project did not compile:\n' + output)
+    return elapsed, usage.ru_maxrss, parse_stats(output)
+
+def main(args):
+    waxcli = './waxcli'
+    runs = 3
+    jobs = 1
+    as_json = False
+    scale = None
+    manifest_path = None
+    i = 0
+    while i < len(args):
+        arg = args[i]
+        if arg == '--waxcli' and i + 1 < len(args):
+            waxcli = args[i + 1]
+            i += 1
+        elif arg == '--runs' and i + 1 < len(args):
+            runs = int(args[i + 1])
+            i += 1
+        elif arg == '--jobs' and i + 1 < len(args):
+            jobs = int(args[i + 1])
+            i += 1
+        elif arg == '--scale' and i + 1 < len(args) and args[i + 1] in SCALES:
+            scale = args[i + 1]
+            i += 1
+        elif arg == '--json':
+            as_json = True
+        elif manifest_path is None and not arg.startswith('-'):
+            manifest_path = arg
+        else:
+            manifest_path = None
+            scale = None
+            break
+        i += 1
+
+    if (manifest_path is None) == (scale is None):
+        print('Usage: python3 benchrun.py [--waxcli path] [--runs N] [--jobs N] [--json] (manifest.json | --scale ' + '|'.join(SCALES.keys()) + ')')
+        return 1
+
+    temp_dir = None
+    if scale is not None:
+        temp_dir = tempfile.TemporaryDirectory(prefix='waxbench_')
+        modules, files, functions, depth = SCALES[scale]
+        benchgen.generate(temp_dir.name, modules, files, functions, depth, 1)
+        manifest_path = os.path.join(temp_dir.name, 'manifest.json')
+
+    lines = count_lines(manifest_path)
+    project = scale if scale is not None else manifest_path
+    results = []
+    for run in range(runs):
+        elapsed, peak_rss_kb, counters = run_once(waxcli, manifest_path, jobs)
+        tokens = counters.get('tokens', 0)
+        result = {
+            'project': project,
+            'run': run + 1,
+            'jobs': jobs,
+            'lines': lines,
+            'tokens': tokens,
+            'seconds': round(elapsed, 4),
+            'lines_per_sec': round(lines / elapsed, 1),
+            'tokens_per_sec': round(tokens / elapsed, 1),
+            'peak_rss_kb': peak_rss_kb,
+        }
+        results.append(result)
+        if as_json:
+            print(json.dumps(result))
+            sys.stdout.flush()
+
+    if not as_json:
+        print('Project: ' + project + ' (' + str(lines) + ' lines, ' + str(results[0]['tokens']) + ' tokens, jobs=' + str(jobs) + ')')
+        print('%4s %10s %14s %14s %14s' % ('Run', 'Seconds', 'Lines/sec', 'Tokens/sec', 'Peak RSS KB'))
+        for r in results:
+            print('%4d %10.3f %14.1f %14.1f %14d' % (r['run'], r['seconds'], r['lines_per_sec'], r['tokens_per_sec'], r['peak_rss_kb']))
+        best = min(results, key = lambda r: r['seconds'])
+        print('%4s %10.3f %14.1f %14.1f %14d' % ('Best', best['seconds'], best['lines_per_sec'], best['tokens_per_sec'], min(r['peak_rss_kb'] for r in results)))
+
+    if temp_dir is not None:
+        temp_dir.cleanup()
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
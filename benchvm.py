@@ -0,0 +1,119 @@
+# Interpreter benchmark. Runs the prime factors workload in src/bench/primes on the bytecode interpreter
+# and on native ports of it, and reports each one's time relative to the interpreter.
+#
+#   python3 benchvm.py [--waxcli path] [--runs N] [--json] [n]
+#
+# The project is compiled with waxcli --emit-bytecode into a temporary directory and its main(n) is run
+# with waxcli --run. Copies of waxcli without the JIT (WAX_VM_NO_JIT) and with switch dispatch
+# (WAX_VM_NO_THREADING, which leaves out the JIT too) are built as well, to show what each tier is
+# worth. The project is also built with waxcli --emit-native, and the C port with cc -O2. The
+# JavaScript and PHP ports are skipped when node or php is not installed. Every runtime must print the
+# same total.
+
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.join('src', 'bench', 'primes')
+
+def run_best(command, runs):
+    best = None
+    output = None
+    for _ in range(runs):
+        start = time.time()
+        result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        elapsed = time.time() - start
+        output = result.stdout.decode('utf-8', 'replace').strip()
+        if result.returncode != 0:
+            raise Exception(' '.join(command) + ' exited with status ' + str(result.returncode) + ':\n' + output)
+        if best is None or elapsed < best:
+            best = elapsed
+    return best, output
+
+def build(command):
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    if result.returncode != 0:
+        raise Exception(' '.join(command) + ' failed:\n' + result.stdout.decode('utf-8', 'replace'))
+
+def main(args):
+    waxcli = './waxcli'
+    runs = 3
+    as_json = False
+    n = 20000
+    i = 0
+    while i < len(args):
+        arg = args[i]
+        if arg == '--waxcli' and i + 1 < len(args):
+            waxcli = args[i + 1]
+            i += 1
+        elif arg == '--runs' and i + 1 < len(args):
+            runs = int(args[i + 1])
+            i += 1
+        elif arg == '--json':
+            as_json = True
+        elif arg.isdigit():
+            n = int(arg)
+        else:
+            print('Usage: python3 benchvm.py [--waxcli path] [--runs N] [--json] [n]')
+            return 1
+        i += 1
+
+    temp_dir = tempfile.TemporaryDirectory(prefix='waxvm_')
+    build([waxcli, '--emit-bytecode', temp_dir.name, os.path.join(BENCH_DIR, 'manifest.json')])
+    bytecode_path = os.path.join(temp_dir.name, 'PrimeFactors.waxbc')
+    if not os.path.exists(bytecode_path):
+        raise Exception('waxcli did not produce ' + bytecode_path)
+
+    threaded_waxcli = os.path.join(temp_dir.name, 'waxcli_threaded')
+    build(['gcc', '-O2', '-DWAX_VM_NO_JIT', os.path.join('src', 'main.c'), '-o', threaded_waxcli, '-lm', '-lpthread'])
+    switch_waxcli = os.path.join(temp_dir.name, 'waxcli_switch')
+    build(['gcc', '-O2', '-DWAX_VM_NO_THREADING', os.path.join('src', 'main.c'), '-o', switch_waxcli, '-lm', '-lpthread'])
+    build([waxcli, '--emit-native', temp_dir.name, os.path.join(BENCH_DIR, 'manifest.json')])
+    native_wax = os.path.join(temp_dir.name, 'PrimeFactors')
+    if not os.path.exists(native_wax):
+        raise Exception('waxcli did not produce ' + native_wax)
+    native_c = os.path.join(temp_dir.name, 'prime_factors')
+    build(['cc', '-O2', os.path.join(BENCH_DIR, 'prime_factors.c'), '-o', native_c])
+
+    runtimes = [
+        ('wax (jit)', [waxcli, '--run', bytecode_path, 'main', str(n)]),
+        ('wax (threaded)', [threaded_waxcli, '--run', bytecode_path, 'main', str(n)]),
+        ('wax (switch)', [switch_waxcli, '--run', bytecode_path, 'main', str(n)]),
+        ('wax (native)', [native_wax, 'main', str(n)]),
+        ('c -O2', [native_c, str(n)]),
+        ('python', [sys.executable, os.path.join(BENCH_DIR, 'prime_factors.py'), str(n)]),
+    ]
+    if shutil.which('node') is not None:
+        runtimes.append(('node', ['node', os.path.join(BENCH_DIR, 'prime_factors.js'), str(n)]))
+    if shutil.which('php') is not None:
+        runtimes.append(('php', ['php', os.path.join(BENCH_DIR, 'prime_factors.php'), str(n)]))
+
+    results = []
+    for name, command in runtimes:
+        seconds, output = run_best(command, runs)
+        results.append({ 'runtime': name, 'n': n, 'seconds': round(seconds, 4), 'output': output })
+
+    expected = results[0]['output']
+    for r in results:
+        if r['output'] != expected:
+            raise Exception(r['runtime'] + ' printed ' + r['output'] + ' but wax printed ' + expected)
+        r['vs_wax'] = round(r['seconds'] / results[0]['seconds'], 3)
+
+    if as_json:
+        for r in results:
+            print(json.dumps(r))
+    else:
+        print('main(' + str(n) + ') = ' + expected + ', best of ' + str(runs) + ' runs')
+        print('%-16s %10s %10s' % ('Runtime', 'Seconds', 'vs wax'))
+        for r in results:
+            print('%-16s %10.3f %10.3f' % (r['runtime'], r['seconds'], r['vs_wax']))
+
+    temp_dir.cleanup()
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,432 @@
+#include <stdio.h>
+#include <string.h>
+#include "../util/strings.h"
+#include "../util/lists.h"
+#include "../util/dictionaries.h"
+#include "../util/valueutil.h"
+#include "../util/json.h"
+#include "../util/scan.h"
+#include "../util/gc.h"
+#include "../util/util.h"
+
+/*
+  Microbenchmarks for the util/ primitives. Built and run with `make bench`.
+
+  Every benchmark prints one JSON object per line:
+    {"benchmark":"dictionary_get","case":"hit size=10000","iterations":1000000,"ns_per_op":12.3,"min_ns_per_op":12.1}
+  ns_per_op is the median of BENCH_REPETITIONS timed runs and min_ns_per_op the fastest of them.
+  Inputs come from a fixed-seed generator, so runs are comparable across builds and releases.
+  Pass a substring as the only argument to run only the benchmarks whose name contains it.
+*/
+
+#define BENCH_REPETITIONS 7
+
+typedef void (*BenchFn)(void* arg, int iterations);
+
+const char* _bench_filter = NULL;
+unsigned int _bench_seed = 12345;
+
+int bench_random(int max) {
+  _bench_seed = _bench_seed * 1103515245 + 12345;
+  return (int) ((_bench_seed >> 8) % (unsigned int) max);
+}
+
+void bench_reset_random() {
+  _bench_seed = 12345;
+}
+
+// A string of exactly length characters from a fixed alphabet, distinct for distinct seeds.
+String* bench_make_string(int length, int seed) {
+  char* buffer = (char*) malloc(length + 1);
+  for (int i = 0; i < length; ++i) {
+    buffer[i] = 'a' + (char) ((seed + i * 7 + seed / (i + 1)) % 26);
+  }
+  int n = seed;
+  for (int i = 0; i < length && n > 0; ++i) {
+    buffer[i] = '0' + (char) (n % 10);
+    n /= 10;
+  }
+  buffer[length] = '\0';
+  String* value = new_string(buffer);
+  free(buffer);
+  return value;
+}
+
+int _bench_compare_doubles(const void* a, const void* b) {
+  double x = *(double*) a;
+  double y = *(double*) b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+  Times fn(arg, iterations) BENCH_REPETITIONS times after one untimed warm-up run. Garbage left over
+  by a run is collected before the next one starts so that GC work does not land in the timings of
+  benchmarks that do not ask for it. Anything arg points at must be gc_save'd by the caller.
+*/
+void bench_run(const char* name, const char* bench_case, BenchFn fn, void* arg, int iterations) {
+  if (_bench_filter != NULL && strstr(name, _bench_filter) == NULL) return;
+
+  double times[BENCH_REPETITIONS];
+  fn(arg, iterations);
+  gc_perform_pass();
+  for (int i = 0; i < BENCH_REPETITIONS; ++i) {
+    double start = get_time_millis();
+    fn(arg, iterations);
+    times[i] = (get_time_millis() - start) * 1000000.0 / iterations;
+    gc_perform_pass();
+  }
+  qsort(times, BENCH_REPETITIONS, sizeof(double), _bench_compare_doubles);
+  printf("{\"benchmark\":\"%s\",\"case\":\"%s\",\"iterations\":%d,\"ns_per_op\":%.2f,\"min_ns_per_op\":%.2f}\n",
+    name, bench_case, iterations, times[BENCH_REPETITIONS / 2], times[0]);
+  fflush(stdout);
+}
+
+volatile int bench_sink = 0; // keeps results alive so the compiler cannot drop the work
+
+// new_string
+
+void bench_new_string(void* arg, int iterations) {
+  const char* value = (const char*) arg;
+  for (int i = 0; i < iterations; ++i) {
+    bench_sink += new_string(value)->length;
+  }
+}
+
+// string_equals
+
+typedef struct _StringPair {
+  String* a;
+  String* b;
+} StringPair;
+
+void bench_string_equals(void* arg, int iterations) {
+  StringPair* pair = (StringPair*) arg;
+  for (int i = 0; i < iterations; ++i) {
+    bench_sink += string_equals(pair->a, pair->b);
+  }
+}
+
+// kind is 0 for two separate copies of the same content (a full compare), 1 for different content
+// and 2 for the same instance.
+void run_string_equals(int length, int kind) {
+  const char* kind_names[] = { "equal copies", "different", "same instance" };
+  StringPair pair;
+  pair.a = bench_make_string(length, 1);
+  pair.b = kind == 0 ? new_string(pair.a->cstring) : (kind == 1 ? bench_make_string(length, 2) : pair.a);
+  gc_save_item(pair.a);
+  gc_save_item(pair.b);
+  char bench_case[64];
+  sprintf(bench_case, "%s length=%d", kind_names[kind], length);
+  bench_run("string_equals", bench_case, bench_string_equals, &pair, 10000000);
+  gc_release_item(pair.a);
+  gc_release_item(pair.b);
+}
+
+// list_add
+
+void bench_list_add(void* arg, int iterations) {
+  int list_size = *(int*) arg;
+  void* item = new_string("item");
+  int added = 0;
+  while (added < iterations) {
+    List* list = new_list();
+    for (int i = 0; i < list_size && added < iterations; ++i, ++added) {
+      list_add(list, item);
+    }
+    bench_sink += list->length;
+  }
+}
+
+// dictionary_set / dictionary_get
+
+typedef struct _DictionaryBench {
+  List* keys;
+  List* missing_keys;
+  Dictionary* dict;
+} DictionaryBench;
+
+void bench_dictionary_set(void* arg, int iterations) {
+  DictionaryBench* db = (DictionaryBench*) arg;
+  int done = 0;
+  while (done < iterations) {
+    Dictionary* dict = new_dictionary();
+    for (int i = 0; i < db->keys->length && done < iterations; ++i, ++done) {
+      dictionary_set(dict, list_get_string(db->keys, i), db);
+    }
+    bench_sink += dict->size;
+  }
+}
+
+void bench_dictionary_get_hit(void* arg, int iterations) {
+  DictionaryBench* db = (DictionaryBench*) arg;
+  int key_count = db->keys->length;
+  for (int i = 0; i < iterations; ++i) {
+    bench_sink += dictionary_get(db->dict, list_get_string(db->keys, i % key_count)) != NULL;
+  }
+}
+
+void bench_dictionary_get_miss(void* arg, int iterations) {
+  DictionaryBench* db = (DictionaryBench*) arg;
+  int key_count = db->missing_keys->length;
+  for (int i = 0; i < iterations; ++i) {
+    bench_sink += dictionary_get(db->dict, list_get_string(db->missing_keys, i % key_count)) != NULL;
+  }
+}
+
+void run_dictionary(int size) {
+  DictionaryBench db;
+  db.keys = new_list();
+  gc_save_item(db.keys);
+  db.missing_keys = new_list();
+  gc_save_item(db.missing_keys);
+  db.dict = new_dictionary();
+  gc_save_item(db.dict);
+  for (int i = 0; i < size; ++i) {
+    String* key = bench_make_string(12, i);
+    list_add(db.keys, key);
+    list_add(db.missing_keys, bench_make_string(12, i + 1000000));
+    dictionary_set(db.dict, key, key);
+  }
+
+  char bench_case[64];
+  sprintf(bench_case, "size=%d", size);
+  bench_run("dictionary_set", bench_case, bench_dictionary_set, &db, 1000000);
+  sprintf(bench_case, "hit size=%d", size);
+  bench_run("dictionary_get", bench_case, bench_dictionary_get_hit, &db, 5000000);
+  sprintf(bench_case, "miss size=%d", size);
+  bench_run("dictionary_get", bench_case, bench_dictionary_get_miss, &db, 5000000);
+
+  gc_release_item(db.keys);
+  gc_release_item(db.missing_keys);
+  gc_release_item(db.dict);
+}
+
+// json_parse
+
+void bench_json_parse(void* arg, int iterations) {
+  char* json = (char*) arg;
+  for (int i = 0; i < iterations; ++i) {
+    JsonParseResult result = json_parse(json);
+    bench_sink += result.error;
+  }
+}
+
+// A manifest-like document with the given number of module entries.
+char* bench_make_json(int module_count) {
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, "{\n  \"output\": \"output/bundle\",\n  \"outputType\": \"web\",\n  \"mainModule\": \"Main\",\n  \"moduleTargets\": [\n");
+  for (int i = 0; i < module_count; ++i) {
+    char entry[256];
+    sprintf(entry, "    { \"name\": \"Module%d\", \"src\": \"src/module_%d\", \"lang\": \"wax\", \"action\": \"bundle\", \"priority\": %d, \"weight\": %d.%d, \"enabled\": %s, \"extra\": null }%s\n",
+      i, i, bench_random(1000), bench_random(100), bench_random(100), i % 2 == 0 ? "true" : "false", i + 1 < module_count ? "," : "");
+    string_builder_append_chars(sb, entry);
+  }
+  string_builder_append_chars(sb, "  ]\n}\n");
+  string_builder_append_char(sb, '\0');
+  char* json = (char*) malloc(sb->length);
+  memcpy(json, sb->chars, sb->length);
+  string_builder_free(sb);
+  return json;
+}
+
+void run_json_parse(int module_count, int iterations) {
+  bench_reset_random();
+  char* json = bench_make_json(module_count);
+  char bench_case[64];
+  sprintf(bench_case, "modules=%d bytes=%d", module_count, (int) strlen(json));
+  bench_run("json_parse", bench_case, bench_json_parse, json, iterations);
+  free(json);
+}
+
+// string_split / string_replace
+
+void bench_string_split(void* arg, int iterations) {
+  const char* value = ((String*) arg)->cstring;
+  for (int i = 0; i < iterations; ++i) {
+    bench_sink += string_split(value, ", ")->length;
+  }
+}
+
+void bench_string_replace(void* arg, int iterations) {
+  const char* value = ((String*) arg)->cstring;
+  for (int i = 0; i < iterations; ++i) {
+    bench_sink += string_replace(value, ", ", "; ")->length;
+  }
+}
+
+void run_split_and_replace(int field_count) {
+  bench_reset_random();
+  StringBuilder* sb = new_string_builder();
+  for (int i = 0; i < field_count; ++i) {
+    if (i > 0) string_builder_append_chars(sb, ", ");
+    string_builder_append_chars(sb, bench_make_string(4 + bench_random(12), i)->cstring);
+  }
+  String* value = string_builder_to_string_and_free(sb);
+  gc_save_item(value);
+  char bench_case[64];
+  sprintf(bench_case, "fields=%d bytes=%d", field_count, value->length);
+  bench_run("string_split", bench_case, bench_string_split, value, 200000 / field_count);
+  bench_run("string_replace", bench_case, bench_string_replace, value, 200000 / field_count);
+  gc_release_item(value);
+}
+
+// value_to_string
+
+void bench_value_to_string(void* arg, int iterations) {
+  for (int i = 0; i < iterations; ++i) {
+    bench_sink += value_to_string(arg)->length;
+  }
+}
+
+// Nested lists and dictionaries of strings, ints and floats, with breadth items per level.
+void* bench_make_value(int depth, int breadth) {
+  if (depth == 0) {
+    switch (bench_random(3)) {
+      case 0: return bench_make_string(8, bench_random(100000));
+      case 1: return wrap_int(bench_random(100000));
+      default: return wrap_float(bench_random(100000) / 100.0);
+    }
+  }
+  if (depth % 2 == 0) {
+    List* list = new_list();
+    for (int i = 0; i < breadth; ++i) list_add(list, bench_make_value(depth - 1, breadth));
+    return list;
+  }
+  Dictionary* dict = new_dictionary();
+  for (int i = 0; i < breadth; ++i) dictionary_set(dict, bench_make_string(6, i), bench_make_value(depth - 1, breadth));
+  return dict;
+}
+
+void run_value_to_string(int depth, int breadth, int iterations) {
+  bench_reset_random();
+  void* value = bench_make_value(depth, breadth);
+  gc_save_item(value);
+  char bench_case[64];
+  sprintf(bench_case, "depth=%d breadth=%d", depth, breadth);
+  bench_run("value_to_string", bench_case, bench_value_to_string, value, iterations);
+  gc_release_item(value);
+}
+
+// gc_perform_pass
+
+void bench_gc_perform_pass(void* arg, int iterations) {
+  for (int i = 0; i < iterations; ++i) {
+    gc_perform_pass();
+  }
+}
+
+/*
+  Keeps live_count objects reachable from a single saved root (a mix of strings, lists and structs,
+  the way compiler data looks) and times a full pass over them. Nothing is freed in the timed passes
+  so this measures the mark and sweep walk itself.
+*/
+void run_gc_perform_pass(int live_count) {
+  bench_reset_random();
+  List* root = new_list();
+  gc_save_item(root);
+  List* current = root;
+  for (int i = 0; i < live_count; ++i) {
+    switch (i % 4) {
+      case 0:
+        current = new_list();
+        list_add(root, current);
+        break;
+      case 1:
+        list_add(current, wrap_int(i));
+        break;
+      default:
+        list_add(current, bench_make_string(10, i));
+        break;
+    }
+  }
+  gc_perform_pass();
+
+  char bench_case[64];
+  sprintf(bench_case, "live objects=%d", live_count);
+  int iterations = 20000000 / (live_count + 1000);
+  bench_run("gc_perform_pass", bench_case, bench_gc_perform_pass, NULL, iterations < 5 ? 5 : iterations);
+  gc_release_item(root);
+  gc_perform_pass();
+}
+
+// scan
+
+// A string literal body of length bytes that only ends at its last byte, which is the worst case for
+// the tokenizer: every byte has to be looked at.
+char* bench_make_literal(int length) {
+  char* chars = (char*) malloc(length + 1);
+  for (int i = 0; i < length - 1; ++i) {
+    chars[i] = 'a' + (char) bench_random(26);
+  }
+  chars[length - 1] = '"';
+  chars[length] = '\0';
+  return chars;
+}
+
+void bench_scan_find_any3(void* arg, int iterations) {
+  const char* chars = (const char*) arg;
+  int length = (int) strlen(chars);
+  for (int i = 0; i < iterations; ++i) {
+    bench_sink += scan_find_any3(chars, 0, length, '"', '\\', '\n');
+  }
+}
+
+// The byte-at-a-time loop that scan_find_any3 replaces, for comparison.
+void bench_scan_find_any3_scalar(void* arg, int iterations) {
+  const char* chars = (const char*) arg;
+  int length = (int) strlen(chars);
+  for (int i = 0; i < iterations; ++i) {
+    int j = 0;
+    while (j < length && chars[j] != '"' && chars[j] != '\\' && chars[j] != '\n') j++;
+    bench_sink += j;
+  }
+}
+
+void run_scan(int length) {
+  bench_reset_random();
+  char* chars = bench_make_literal(length);
+  char bench_case[64];
+  sprintf(bench_case, "bytes=%d", length);
+  bench_run("scan_find_any3", bench_case, bench_scan_find_any3, chars, 200000000 / length);
+  sprintf(bench_case, "scalar bytes=%d", length);
+  bench_run("scan_find_any3", bench_case, bench_scan_find_any3_scalar, chars, 200000000 / length);
+  free(chars);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) _bench_filter = argv[1];
+
+  bench_run("new_string", "length=8", bench_new_string, "abcdefgh", 2000000);
+  bench_run("new_string", "length=64", bench_new_string, "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijkl", 2000000);
+
+  for (int kind = 0; kind < 3; ++kind) {
+    run_string_equals(16, kind);
+    run_string_equals(256, kind);
+  }
+
+  int small_list = 16;
+  int large_list = 100000;
+  bench_run("list_add", "list size=16", bench_list_add, &small_list, 5000000);
+  bench_run("list_add", "list size=100000", bench_list_add, &large_list, 5000000);
+
+  run_dictionary(100);
+  run_dictionary(10000);
+
+  run_json_parse(3, 20000);
+  run_json_parse(500, 100);
+
+  run_split_and_replace(20);
+  run_split_and_replace(2000);
+
+  run_value_to_string(2, 8, 20000);
+  run_value_to_string(4, 8, 200);
+
+  run_scan(64);
+  run_scan(4096);
+
+  run_gc_perform_pass(1000);
+  run_gc_perform_pass(100000);
+  run_gc_perform_pass(1000000);
+
+  return 0;
+}
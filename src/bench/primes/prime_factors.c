@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// The same workload as PrimeFactors/PrimeFactors.wax, for comparison.
+int sum_of_prime_factors(int num) {
+  int sum = 0;
+  while (num % 2 == 0) {
+    sum += 2;
+    num = num / 2;
+  }
+  int div = 3;
+  while (num > 1) {
+    while (num % div == 0) {
+      sum += div;
+      num /= div;
+    }
+    div += 2;
+  }
+  return sum;
+}
+
+int main(int argc, char** argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 20000;
+  int total = 0;
+  for (int i = 2; i <= n; ++i) {
+    total += sum_of_prime_factors(i);
+  }
+  printf("%d\n", total);
+  return 0;
+}
@@ -0,0 +1,28 @@
+// The same workload as PrimeFactors/PrimeFactors.wax, for comparison.
+
+function sumOfPrimeFactors(num) {
+  let sum = 0;
+  while (num % 2 === 0) {
+    sum += 2;
+    num = num / 2;
+  }
+  let div = 3;
+  while (num > 1) {
+    while (num % div === 0) {
+      sum += div;
+      num /= div;
+    }
+    div += 2;
+  }
+  return sum;
+}
+
+function main(n) {
+  let total = 0;
+  for (let i = 2; i <= n; i++) {
+    total += sumOfPrimeFactors(i);
+  }
+  return total;
+}
+
+console.log(main(process.argv.length > 2 ? parseInt(process.argv[2]) : 20000));
@@ -0,0 +1,29 @@
+<?php
+// The same workload as PrimeFactors/PrimeFactors.wax, for comparison.
+
+function sum_of_prime_factors($num) {
+  $sum = 0;
+  while ($num % 2 == 0) {
+    $sum += 2;
+    $num = intdiv($num, 2);
+  }
+  $div = 3;
+  while ($num > 1) {
+    while ($num % $div == 0) {
+      $sum += $div;
+      $num = intdiv($num, $div);
+    }
+    $div += 2;
+  }
+  return $sum;
+}
+
+function main($n) {
+  $total = 0;
+  for ($i = 2; $i <= $n; $i++) {
+    $total += sum_of_prime_factors($i);
+  }
+  return $total;
+}
+
+echo main($argc > 1 ? intval($argv[1]) : 20000) . "\n";
@@ -0,0 +1,24 @@
+# The same workload as PrimeFactors/PrimeFactors.wax, for comparison.
+
+import sys
+
+def sum_of_prime_factors(num):
+  total = 0
+  while num % 2 == 0:
+    total += 2
+    num = num // 2
+  div = 3
+  while num > 1:
+    while num % div == 0:
+      total += div
+      num //= div
+    div += 2
+  return total
+
+def main(n):
+  total = 0
+  for i in range(2, n + 1):
+    total += sum_of_prime_factors(i)
+  return total
+
+print(main(int(sys.argv[1]) if len(sys.argv) > 1 else 20000))
@@ -1,48 +1,118 @@
 #include <stdio.h>
+#include <string.h>
 #include "util/strings.h"
 #include "util/lists.h"
 #include "util/dictionaries.h"
 #include "util/valueutil.h"
 #include "util/gc.h"
+#include "util/profiler.h"
 #include "wax/manifest.h"
 #include "wax/compiler.h"
+#include "wax/vm.h"
+#include "wax/watch.h"
 
 int main(int argc, char** argv) {
-  argc = 2;
-  char* arg[2];
-  char* arg1 = "../samples/PrimeExample/manifest.python.json";
-  argv = arg;
-  argv[0] = arg1;
-  argv[1] = arg1;
-  argv = &arg;
-  if (argc != 2) {
-    printf("Usage: waxcli manifest-file.json\n");
+  CompileOptions options;
+  compile_options_init(&options);
+  const char* manifest_path = NULL;
+  const char* serve_socket = NULL;
+  const char* trace_path = NULL;
+  int watch = 0;
+  int stats = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--emit-ast") == 0 && i + 1 < argc) {
+      options.ast_output_dir = argv[++i];
+    } else if (strcmp(argv[i], "--emit-bytecode") == 0 && i + 1 < argc) {
+      options.bytecode_output_dir = argv[++i];
+    } else if (strcmp(argv[i], "--emit-native") == 0 && i + 1 < argc) {
+      options.native_output_dir = argv[++i];
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      if (!try_parse_int(argv[++i], &options.jobs) || options.jobs < 0) {
+        manifest_path = NULL;
+        break;
+      }
+      if (options.jobs == 0) options.jobs = get_cpu_count();
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = 1;
+    } else if (strcmp(argv[i], "--watch") == 0) {
+      watch = 1;
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      serve_socket = argv[++i];
+    } else if (strcmp(argv[i], "--send") == 0 && i + 2 == argc - 1) {
+      return wax_serve_request(argv[i + 1], argv[i + 2]);
+    } else if (strcmp(argv[i], "--run") == 0 && i + 2 < argc) {
+      const char* path = argv[i + 1];
+      int length = (int) strlen(path);
+      if (length < 7 || strcmp(path + length - 7, ".waxast") != 0) return vm_run_file(path, argv[i + 2], argv + i + 3, argc - i - 3);
+      BytecodeModule* module = wax_compiler_load_ast(path);
+      if (module == NULL) {
+        printf("Could not load AST file: %s\n", path);
+        return 1;
+      }
+      return vm_run_module(module, path, argv[i + 2], argv + i + 3, argc - i - 3);
+    } else if (manifest_path == NULL && argv[i][0] != '-') {
+      manifest_path = argv[i];
+    } else {
+      manifest_path = NULL;
+      break;
+    }
+  }
+
+  if (manifest_path == NULL) {
+    printf("Usage: waxcli [--jobs N] [--emit-ast output-dir] [--emit-bytecode output-dir]\n");
+    printf("              [--emit-native output-dir] [--stats] [--trace trace.json]\n");
+    printf("              [--watch | --serve socket-path] manifest-file.json\n");
+    printf("       waxcli --send socket-path command\n");
+    printf("       waxcli --run module-file function [arguments...]\n");
+    printf("  --jobs N      compile modules and parse files with up to N threads (0 = one per CPU)\n");
+    printf("  --emit-bytecode PATH  save the bytecode of each module to PATH/<module>.waxbc\n");
+    printf("  --emit-native PATH  compile each module to C and build it as PATH/<module>, a program that\n");
+    printf("                works like --run\n");
+    printf("  --stats       print how long each compiler phase took and how much was allocated. Except with\n");
+    printf("                --watch and --serve, files are tokenized as they are parsed, so that time is under\n");
+    printf("                tokenize + parse_first_pass\n");
+    printf("  --trace PATH  write a Chrome trace event file (chrome://tracing) of the compiler phases\n");
+    printf("  --watch       stay running and recompile whenever source files change\n");
+    printf("  --serve PATH  stay running and answer compile requests on a Unix socket at PATH\n");
+    printf("  --send PATH   send a command (compile or stop) to a running server and print the response\n");
+    printf("  --run PATH    call a function of a .waxbc file saved with --emit-bytecode, or of a .waxast file\n");
+    printf("                saved with --emit-ast, and print its result\n");
     return 0;
   }
 
-  ProjectManifest* manifest = wax_manifest_load(argv[1]);
+  if (stats || trace_path != NULL) profiler_enable();
+  int root_span = profiler_begin("waxcli", manifest_path);
+
+  int span = profiler_begin("wax_manifest_load", manifest_path);
+  ProjectManifest* manifest = wax_manifest_load(manifest_path);
+  profiler_end(span);
 
   if (manifest->has_error) {
     printf("%s\n", manifest->error->cstring);
   } else {
     gc_save_item(manifest);
-
-    List* modules = manifest->modules;
-    for (int i = 0; i < modules->length; ++i) {
-      ModuleMetadata* mm = (ModuleMetadata*) modules->items[i];
-      if (mm->lang == LANG_WAX) {
-        printf("Transpiling wax project '%s'...\n", mm->name->cstring);
-        wax_compile(manifest, mm);
-        printf("\n");
-      } else {
-        printf("TODO: wrap project %s from %s\n", mm->name->cstring, mm->src->cstring);
-      }
+    if (serve_socket != NULL) {
+      wax_serve(manifest, &options, serve_socket);
+    } else if (watch) {
+      wax_watch(manifest, &options);
+    } else {
+      wax_compile_project(manifest, &options);
     }
-
     gc_release_item(manifest);
   }
 
   gc_perform_pass();
+  profiler_end(root_span);
+
+  if (stats) {
+    printf("\n");
+    profiler_print_summary();
+  }
+  if (trace_path != NULL && !profiler_write_trace(trace_path)) {
+    printf("Could not write trace file: %s\n", trace_path);
+  }
 
   return 0;
 }
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+#include "../util/strings.h"
+#include "../util/fileio.h"
+#include "../util/gc.h"
+#include "../wax/compiler.h"
+
+/*
+  Checks the AST serializer on .waxast files saved with waxcli --emit-ast. Built and run by `make test`.
+
+  Each file is loaded and saved again, which has to give back exactly the same bytes. Then copies of
+  it with a byte changed or the end cut off are loaded and lowered to bytecode. The reader can reject
+  those or accept them, but it must never crash. Prints one line per file and exits with status 1 if
+  a round trip changed anything.
+*/
+
+#define ASTTEST_MUTATIONS 2000
+
+unsigned int _asttest_seed = 12345;
+
+int asttest_random(int max) {
+  _asttest_seed = _asttest_seed * 1103515245 + 12345;
+  return (int) ((_asttest_seed >> 8) % (unsigned int) max);
+}
+
+// Loads a .waxast file into a new context. Returns NULL if the reader rejects it.
+CompilerContext* asttest_load(const char* path) {
+  AstReader* reader = ast_reader_open(path);
+  if (reader == NULL) return NULL;
+  CompilerContext* ctx = new_compiler_context();
+  int loaded = ast_reader_load_into(reader, ctx);
+  ast_reader_close(reader);
+  return loaded ? ctx : NULL;
+}
+
+int asttest_round_trip(const char* path, unsigned char* bytes, int length) {
+  CompilerContext* ctx = asttest_load(path);
+  if (ctx == NULL) {
+    printf("%s: could not be loaded\n", path);
+    return 0;
+  }
+  StringBuilder* saved = wax_ast_serialize(ctx);
+  int same = saved->length == length && memcmp(saved->chars, bytes, length) == 0;
+  if (!same) printf("%s: saving it again gave different bytes (%d instead of %d)\n", path, saved->length, length);
+  string_builder_free(saved);
+  gc_perform_pass();
+  return same;
+}
+
+void asttest_mutations(const char* path, unsigned char* bytes, int length) {
+  String* mutated_path = string_concat(path, ".mutated");
+  gc_save_item(mutated_path);
+  char* mutated = (char*) malloc(length + 1);
+  int accepted = 0;
+  for (int i = 0; i < ASTTEST_MUTATIONS; ++i) {
+    memcpy(mutated, bytes, length);
+    int mutated_length = length;
+    if (i % 10 == 9) {
+      mutated_length = asttest_random(length);
+    } else {
+      mutated[asttest_random(length)] ^= (char) (1 + asttest_random(255));
+    }
+    file_write_bytes(mutated_path->cstring, mutated, mutated_length);
+    CompilerContext* ctx = asttest_load(mutated_path->cstring);
+    if (ctx != NULL) {
+      gc_save_item(ctx);
+      wax_bytecode_generate(ctx, new_string("Mutated"));
+      gc_release_item(ctx);
+      accepted++;
+    }
+    gc_perform_pass();
+  }
+  remove(mutated_path->cstring);
+  gc_release_item(mutated_path);
+  free(mutated);
+  printf("%s: %d of %d changed copies were accepted\n", path, accepted, ASTTEST_MUTATIONS);
+}
+
+int main(int argc, char** argv) {
+  int ok = 1;
+  for (int i = 1; i < argc; ++i) {
+    int length = 0;
+    unsigned char* bytes = file_map_bytes(argv[i], &length);
+    if (bytes == NULL) {
+      printf("%s: could not be read\n", argv[i]);
+      ok = 0;
+      continue;
+    }
+    if (asttest_round_trip(argv[i], bytes, length)) {
+      asttest_mutations(argv[i], bytes, length);
+    } else {
+      ok = 0;
+    }
+    file_unmap_bytes(bytes, length);
+  }
+  return ok ? 0 : 1;
+}
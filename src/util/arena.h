@@ -0,0 +1,134 @@
+#ifndef _UTIL_ARENA_H
+#define _UTIL_ARENA_H
+
+#include <stdlib.h>
+#include "gcbase.h"
+#include "gc.h"
+#include "lists.h"
+#include "profiler.h"
+#include "util.h"
+
+/*
+  An arena is a bump allocator for objects that all die at the same time, like the tokens and nodes
+  of one compilation unit. Memory is handed out from a list of large chunks and the whole arena is
+  freed at once with arena_free, in time proportional to the number of chunks.
+
+  Arena objects get a GCValue header like GC objects so gc_get_type and friends work on them, but
+  they belong to ARENA_HEAP_ID rather than to a thread's heap. The GC treats them like objects of
+  another heap: it never traces into them and never sweeps them. Since the GC does not look inside
+  arena objects, a GC object that is only referenced from arena objects must be passed to arena_keep,
+  which holds it until the arena is freed. Lists made with arena_new_list live in the arena as well.
+
+  The allocation functions use the arena set with arena_set_current on the current thread, and fall
+  back to the GC heap when there is none, so code that builds nodes works with or without one.
+*/
+
+#define ARENA_HEAP_ID 0
+#define ARENA_CHUNK_SIZE (256 * 1024)
+
+typedef struct _ArenaChunk {
+  struct _ArenaChunk* next;
+  int size;
+  int used;
+} ArenaChunk;
+
+typedef struct _Arena {
+  ArenaChunk* chunks;
+  List* kept; // gc_save'd for the lifetime of the arena
+  List** lists; // every arena list, whose item arrays are malloc'd
+  int list_count;
+  int list_capacity;
+} Arena;
+
+THREAD_LOCAL Arena* _arena_current = NULL;
+
+Arena* new_arena() {
+  Arena* arena = (Arena*) malloc_clean(sizeof(Arena));
+  arena->kept = new_list();
+  gc_save_item(arena->kept);
+  return arena;
+}
+
+Arena* arena_get_current() {
+  return _arena_current;
+}
+
+// Makes arena the one the allocation functions use on this thread. Returns the previous one.
+Arena* arena_set_current(Arena* arena) {
+  Arena* previous = _arena_current;
+  _arena_current = arena;
+  return previous;
+}
+
+// Returns size zeroed bytes from the arena, aligned to 8 bytes.
+void* arena_alloc(Arena* arena, int size) {
+  size = (size + 7) & ~7;
+  ArenaChunk* chunk = arena->chunks;
+  if (chunk == NULL || chunk->used + size > chunk->size) {
+    int chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    chunk = (ArenaChunk*) calloc(1, sizeof(ArenaChunk) + chunk_size);
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    if (_profiler_enabled) profiler_count("arena bytes reserved", sizeof(ArenaChunk) + chunk_size);
+  }
+  void* ptr = ((char*) (chunk + 1)) + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+void* _arena_create_item(Arena* arena, int size, char item_type) {
+  GCValue* item = (GCValue*) arena_alloc(arena, size + sizeof(GCValue));
+  item->type = item_type;
+  item->heap_id = ARENA_HEAP_ID;
+  return (void*) (item + 1);
+}
+
+// Like gc_create_struct, but in the current arena if there is one.
+void* arena_create_struct(int size, const char* name, int field_count) {
+  Arena* arena = _arena_current;
+  if (arena == NULL) return gc_create_struct(size, name, field_count);
+  void* item = _arena_create_item(arena, size, 'C');
+  GCValue* gc_item = ((GCValue*) item) - 1;
+  gc_item->gc_field_count = field_count;
+  gc_item->name = name;
+  return item;
+}
+
+// Like new_list, but in the current arena if there is one.
+List* arena_new_list() {
+  Arena* arena = _arena_current;
+  if (arena == NULL) return new_list();
+  if (arena->list_count == arena->list_capacity) {
+    arena->list_capacity = arena->list_capacity == 0 ? 64 : arena->list_capacity * 2;
+    arena->lists = (List**) realloc(arena->lists, sizeof(List*) * arena->list_capacity);
+  }
+  List* list = (List*) _arena_create_item(arena, sizeof(List), 'L');
+  arena->lists[arena->list_count++] = list;
+  return list;
+}
+
+// Keeps a GC object alive until the current arena is freed. Does nothing if there is no arena.
+void* arena_keep(void* item) {
+  if (_arena_current != NULL && item != NULL) list_add(_arena_current->kept, item);
+  return item;
+}
+
+// Frees the arena and everything allocated in it. Must not be the current arena of any thread.
+void arena_free(Arena* arena) {
+  for (int i = 0; i < arena->list_count; ++i) {
+    free(arena->lists[i]->items);
+  }
+  free(arena->lists);
+  ArenaChunk* chunk = arena->chunks;
+  while (chunk != NULL) {
+    ArenaChunk* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  gc_release_item(arena->kept);
+  free(arena);
+}
+
+#endif
@@ -149,6 +149,14 @@ List* dictionary_get_keys(Dictionary* dict) {
   return keys;
 }
 
+List* dictionary_get_values(Dictionary* dict) {
+  List* values = new_list();
+  for (int i = 0; i < dict->size; ++i) {
+    list_add(values, dict->values[i]);
+  }
+  return values;
+}
+
 int dictionary_has_key(Dictionary* dict, String* key) {
   int index = _dict_get_index(dict, key, 0);
   return index == -1 ? 0 : 1;
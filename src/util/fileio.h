@@ -12,6 +12,8 @@
 #else
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
 #include "strings.h"
@@ -49,9 +51,12 @@ String* normalize_path(const char* path) {
       list_add(path_parts, part);
     }
   }
-  if (path_parts->length == 0) return dot;
+  int is_absolute = path_str->length > 0 && path_str->cstring[0] == '/';
+  if (path_parts->length == 0) return is_absolute ? new_string("/") : dot;
 
-  return list_join(path_parts, new_string("/"));
+  String* output = list_join(path_parts, new_string("/"));
+  if (is_absolute) return string_concat("/", output->cstring);
+  return output;
 }
 
 int file_exists(const char* path) {
@@ -128,6 +133,68 @@ String* file_read_text(const char* path) {
   return string_builder_to_string_and_free(sb);
 }
 
+int file_write_bytes(const char* path, const char* bytes, int length) {
+  char* npath = _fileio_to_system_path(normalize_path(path)->cstring)->cstring;
+#ifdef WINDOWS
+  FILE* file;
+  if (fopen_s(&file, npath, "wb") != 0) return 0;
+#else
+  FILE* file = fopen(npath, "wb");
+#endif
+  if (!file) return 0;
+  int ok = fwrite(bytes, 1, length, file) == (size_t) length;
+  fclose(file);
+  return ok;
+}
+
+// Returns a read-only view of the file's bytes. On POSIX systems this is a memory mapping so
+// pages are only loaded as they are touched. Must be released with file_unmap_bytes.
+unsigned char* file_map_bytes(const char* path, int* length_out) {
+  char* npath = _fileio_to_system_path(normalize_path(path)->cstring)->cstring;
+#ifdef WINDOWS
+  FILE* file;
+  if (fopen_s(&file, npath, "rb") != 0) return NULL;
+  fseek(file, 0, SEEK_END);
+  int length = (int) ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (length <= 0) {
+    fclose(file);
+    return NULL;
+  }
+  unsigned char* bytes = (unsigned char*) malloc(length);
+  if (fread(bytes, 1, length, file) != (size_t) length) {
+    free(bytes);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  *length_out = length;
+  return bytes;
+#else
+  int fd = open(npath, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) != 0 || statbuf.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  int length = (int) statbuf.st_size;
+  void* bytes = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (bytes == MAP_FAILED) return NULL;
+  *length_out = length;
+  return (unsigned char*) bytes;
+#endif
+}
+
+void file_unmap_bytes(unsigned char* bytes, int length) {
+#ifdef WINDOWS
+  free(bytes);
+#else
+  munmap(bytes, length);
+#endif
+}
+
 List* directory_list(const char* path) {
   List* output = new_list();
 #ifdef WINDOWS
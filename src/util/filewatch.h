@@ -0,0 +1,126 @@
+#ifndef _UTIL_FILEWATCH_H
+#define _UTIL_FILEWATCH_H
+
+#include <stdlib.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
+
+#include "fileio.h"
+#include "gcbase.h"
+#include "lists.h"
+#include "util.h"
+
+/*
+  Watches directory trees for changes. On Linux this is backed by inotify. Everywhere else there is
+  no change notification and file_watcher_wait simply sleeps for the timeout and then reports a
+  possible change, so callers must still check what actually changed themselves.
+*/
+typedef struct _FileWatcher {
+  int fd; // inotify descriptor, or -1 if change notification is not available
+  List* roots; // directory paths, not owned by the GC (kept alive with gc_save_item)
+} FileWatcher;
+
+void _file_watcher_add_tree(FileWatcher* watcher, const char* path) {
+#if !defined(WINDOWS) && defined(__linux__)
+  // Adding a watch to a directory that is already watched returns the existing watch, so this is
+  // also how directories created since the last call get picked up.
+  inotify_add_watch(watcher->fd, path, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF);
+  List* files = directory_list(path);
+  for (int i = 0; i < files->length; ++i) {
+    String* full_path = string_concat3(path, "/", list_get_string(files, i)->cstring);
+    if (is_directory(full_path->cstring)) {
+      _file_watcher_add_tree(watcher, full_path->cstring);
+    }
+  }
+#endif
+}
+
+FileWatcher* new_file_watcher() {
+  FileWatcher* watcher = (FileWatcher*) malloc(sizeof(FileWatcher));
+#if !defined(WINDOWS) && defined(__linux__)
+  watcher->fd = inotify_init();
+#else
+  watcher->fd = -1;
+#endif
+  watcher->roots = new_list();
+  gc_save_item(watcher->roots);
+  return watcher;
+}
+
+void file_watcher_add_directory(FileWatcher* watcher, String* path) {
+  list_add(watcher->roots, path);
+  if (watcher->fd != -1) _file_watcher_add_tree(watcher, path->cstring);
+}
+
+void file_watcher_free(FileWatcher* watcher) {
+#ifndef WINDOWS
+  if (watcher->fd != -1) close(watcher->fd);
+#endif
+  gc_release_item(watcher->roots);
+  free(watcher);
+}
+
+void _file_watcher_sleep(int milliseconds) {
+#ifdef WINDOWS
+  Sleep(milliseconds);
+#else
+  poll(NULL, 0, milliseconds);
+#endif
+}
+
+// Reads and discards all pending events. Returns 1 if there were any.
+int file_watcher_drain(FileWatcher* watcher) {
+#if !defined(WINDOWS) && defined(__linux__)
+  if (watcher->fd == -1) return 1;
+  int found = 0;
+  char buffer[4096];
+  struct pollfd pfd;
+  pfd.fd = watcher->fd;
+  pfd.events = POLLIN;
+  while (poll(&pfd, 1, 0) > 0) {
+    if (read(watcher->fd, buffer, sizeof(buffer)) <= 0) break;
+    found = 1;
+  }
+  if (found) {
+    for (int i = 0; i < watcher->roots->length; ++i) {
+      _file_watcher_add_tree(watcher, list_get_string(watcher->roots, i)->cstring);
+    }
+  }
+  return found;
+#else
+  return 1;
+#endif
+}
+
+/*
+  Blocks until something under one of the watched directories changes or timeout_ms passes
+  (-1 waits forever). Returns 1 if there was a change. Editors tend to save a file in several
+  steps, so once the first event arrives this keeps collecting events until things have been
+  quiet for settle_ms.
+*/
+int file_watcher_wait(FileWatcher* watcher, int timeout_ms, int settle_ms) {
+#if !defined(WINDOWS) && defined(__linux__)
+  if (watcher->fd != -1) {
+    struct pollfd pfd;
+    pfd.fd = watcher->fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout_ms) <= 0) return 0;
+    while (file_watcher_drain(watcher)) {
+      _file_watcher_sleep(settle_ms);
+    }
+    return 1;
+  }
+#endif
+  _file_watcher_sleep(timeout_ms < 0 ? 1000 : timeout_ms);
+  return 1;
+}
+
+#endif
@@ -60,6 +60,7 @@ void gc_run() {
   GCQueue* queue = NULL;
   GCValue* head = _gc_get_allocations();
   GCValue* walker = head;
+  int heap_id = head->heap_id;
 
   do {
     int tagged = 0;
@@ -75,7 +76,7 @@ void gc_run() {
       queue = entry;
     }
     walker = walker->next;
-  } while (walker->next != head);
+  } while (walker != head);
 
   GCQueue* discard_queue = NULL;
   while (queue != NULL) {
@@ -90,9 +91,9 @@ void gc_run() {
           void** value = (void**) (current + 1);
           for (int i = 0; i < current->gc_field_count; ++i) {
             void* item = value[i];
-            if (item != NULL) {
+            if (item != NULL && (((intptr_t) item) & 1) == 0) {
               GCValue* gcitem = ((GCValue*)item) - 1;
-              if (gcitem->mark != pass_id) {
+              if (gcitem->mark != pass_id && gcitem->heap_id == heap_id) {
                 gcitem->mark = pass_id;
                 _gc_add_to_queue(&discard_queue, &queue, gcitem);
               }
@@ -105,9 +106,9 @@ void gc_run() {
           List* list = (List*) (current + 1);
           for (int i = 0; i < list->length; ++i) {
             void* item = list->items[i];
-            if (item != NULL) {
+            if (item != NULL && (((intptr_t) item) & 1) == 0) {
               GCValue* gcitem = ((GCValue*)item) - 1;
-              if (gcitem->mark != pass_id) {
+              if (gcitem->mark != pass_id && gcitem->heap_id == heap_id) {
                 gcitem->mark = pass_id;
                 _gc_add_to_queue(&discard_queue, &queue, gcitem);
               }
@@ -124,11 +125,11 @@ void gc_run() {
           // keys list, even if it is overwritten.
           for (int i = 0; i < dict->size; ++i) {
             GCValue* gckey = ((GCValue*)keys[i]) - 1;
-            gckey->mark = pass_id;
+            if (gckey->heap_id == heap_id) gckey->mark = pass_id;
 
-            if (values[i] != NULL) {
+            if (values[i] != NULL && (((intptr_t) values[i]) & 1) == 0) {
               GCValue* gcvalue = ((GCValue*)values[i]) - 1;
-              if (gcvalue->mark != pass_id) {
+              if (gcvalue->mark != pass_id && gcvalue->heap_id == heap_id) {
                 gcvalue->mark = pass_id;
                 _gc_add_to_queue(&discard_queue, &queue, gcvalue);
               }
@@ -142,9 +143,12 @@ void gc_run() {
     }
   }
 
+  int freed = 0;
+  int survivors = 0;
   walker = head->next;
   while (walker != head) {
     if (walker->mark != pass_id && walker->save == 0) {
+      ++freed;
       GCValue* prev = walker->prev;
       GCValue* next = walker->next;
       GCValue* remove_me = walker;
@@ -154,6 +158,7 @@ void gc_run() {
       switch (remove_me->type) {
         case 'I':
         case 'F':
+        case 'R':
           free(remove_me);
           break;
         case 'S':
@@ -195,10 +200,17 @@ void gc_run() {
           }
           break;
       }
+    } else {
+      ++survivors;
     }
     walker = walker->next;
   }
 
+  if (_profiler_enabled) {
+    profiler_count("gc objects freed", freed);
+    profiler_sample("gc heap objects", survivors);
+  }
+
   while (discard_queue != NULL) {
     GCQueue* next = discard_queue->next;
     free(discard_queue);
@@ -223,8 +235,10 @@ void gc_run_with_single_saved_item(void* item) {
 }
 
 void gc_perform_pass() {
+  int span = profiler_begin("gc_perform_pass", NULL);
   gc_init_pass();
   gc_run();
+  profiler_end(span);
 }
 
 String* new_common_string(const char* str) {
@@ -1,9 +1,11 @@
 #ifndef _UTIL_GCBASE_H
 #define _UTIL_GCBASE_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "profiler.h"
 #include "util.h"
 
 /*
@@ -15,6 +17,15 @@
     L - list
     D - dictionary
     C - instance of a struct (complex)
+    R - raw buffer of bytes that contains no references
+*/
+
+/*
+  Each thread allocates into its own heap (a ring of GCValues with a sentinel head) and a GC pass
+  only collects the heap of the thread that runs it. Objects belonging to another heap are treated
+  as roots that are never traced into, so worker threads must not point objects owned by another
+  heap at their own objects. When a worker finishes, its heap is handed to the thread that started
+  it with gc_detach_heap and gc_adopt_heap.
 */
 
 typedef struct _GCValue {
@@ -26,18 +37,24 @@ typedef struct _GCValue {
   int gc_field_count;
   int save;
   int type;
+  int heap_id;
 } GCValue;
 
+THREAD_LOCAL GCValue* _gc_thread_heap = NULL;
+
 GCValue* _gc_get_allocations() {
-  static GCValue* alloc_head = NULL;
+  static volatile int heap_id_alloc = 0;
+  GCValue* alloc_head = _gc_thread_heap;
   if (alloc_head == NULL) {
     alloc_head = (GCValue*) malloc_clean(sizeof(GCValue));
     alloc_head->mark = 0;
     alloc_head->gc_field_count = 0;
     alloc_head->type = 0;
     alloc_head->save = 1;
+    alloc_head->heap_id = atomic_increment(&heap_id_alloc);
     alloc_head->next = alloc_head;
     alloc_head->prev = alloc_head;
+    _gc_thread_heap = alloc_head;
   }
   return alloc_head;
 }
@@ -52,7 +69,13 @@ void* gc_create_item(int size, char item_type) {
   item->save = 0;
   item->id = 0;
 
+  if (_profiler_enabled) {
+    profiler_count("gc objects allocated", 1);
+    profiler_count("gc bytes allocated", size + sizeof(GCValue));
+  }
+
   GCValue* head = _gc_get_allocations();
+  item->heap_id = head->heap_id;
   if (head->next == head) {
     head->next = item;
     head->prev = item;
@@ -69,7 +92,7 @@ void* gc_create_item(int size, char item_type) {
 }
 
 void* gc_create_struct(int size, const char* name, int field_count) {
-  static int obj_id = 1;
+  static THREAD_LOCAL int obj_id = 1; // only used for debugging, so not unique across threads
 
   void* item = gc_create_item(size, 'C');
   GCValue* gc_item = ((GCValue*) item) - 1;
@@ -79,6 +102,24 @@ void* gc_create_struct(int size, const char* name, int field_count) {
   return item;
 }
 
+// A block of size bytes with no references in it, freed along with its owner. Zeroed.
+void* gc_create_buffer(int size) {
+  return gc_create_item(size, 'R');
+}
+
+/*
+  A GC field of a struct, a list item or a dictionary value can hold a small integer instead of a
+  reference if it is stored as gc_tag_int(value), or in any other encoding with the low bit set.
+  Allocations are never at odd addresses, so the GC skips words with the low bit set.
+*/
+intptr_t gc_tag_int(int value) {
+  return (((intptr_t) value) << 1) | 1;
+}
+
+int gc_untag_int(intptr_t word) {
+  return (int) (word >> 1);
+}
+
 char gc_get_type(void* value) {
   GCValue* gcvalue = (GCValue*)value;
   gcvalue -= 1;
@@ -92,8 +133,37 @@ int gc_is_type(void* value, char type) {
 }
 
 int* _gc_get_current_pass_id() {
-  static int pass_id = 1;
+  static THREAD_LOCAL int pass_id = 1;
   return &pass_id;
 }
 
+// Removes the current thread's heap and returns it. The next allocation on this thread starts a
+// new heap. The returned heap must be passed to gc_adopt_heap on the thread that will own it.
+GCValue* gc_detach_heap() {
+  GCValue* head = _gc_get_allocations();
+  _gc_thread_heap = NULL;
+  return head;
+}
+
+// Moves every object of a detached heap into the current thread's heap.
+void gc_adopt_heap(GCValue* other_head) {
+  GCValue* head = _gc_get_allocations();
+  if (other_head->next != other_head) {
+    GCValue* walker = other_head->next;
+    while (walker != other_head) {
+      walker->heap_id = head->heap_id;
+      walker->mark = 0; // marks from the other heap's passes mean nothing here
+      walker = walker->next;
+    }
+    GCValue* first = other_head->next;
+    GCValue* last = other_head->prev;
+    GCValue* next = head->next;
+    last->next = next;
+    next->prev = last;
+    head->next = first;
+    first->prev = head;
+  }
+  free(other_head);
+}
+
 #endif
@@ -212,8 +212,7 @@ void* json_parse_number(JsonParserContext* ctx) {
     return wrap_int(sign * (c - '0'));
   }
 
-  String* str = string_builder_to_string(sb);
-  free(sb);
+  String* str = string_builder_to_string_and_free(sb);
   if (decimal_found) {
     double value;
     if (!try_parse_float(str->cstring, &value)) return json_throw_error(ctx, JSON_ERROR_BAD_SYNTAX);
@@ -0,0 +1,149 @@
+#ifndef _UTIL_LOCALSOCKET_H
+#define _UTIL_LOCALSOCKET_H
+
+#include <string.h>
+
+#ifndef WINDOWS
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "strings.h"
+#include "util.h"
+
+/*
+  Minimal Unix domain socket helpers for talking to a local server. Not available on Windows, where
+  local_socket_listen and local_socket_connect always fail.
+*/
+
+// Creates a listening socket at path, replacing a stale socket file if there is one. Returns -1 on
+// failure, which includes there being something other than a socket at path.
+int local_socket_listen(const char* path) {
+#ifdef WINDOWS
+  return -1;
+#else
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  struct stat existing;
+  if (lstat(path, &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode) || unlink(path) != 0) return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) return -1;
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#endif
+}
+
+// Connects to the server listening at path. Returns -1 on failure.
+int local_socket_connect(const char* path) {
+#ifdef WINDOWS
+  return -1;
+#else
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) return -1;
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#endif
+}
+
+int local_socket_accept(int listen_fd) {
+#ifdef WINDOWS
+  return -1;
+#else
+  return accept(listen_fd, NULL, NULL);
+#endif
+}
+
+// Makes writes to fd give up after timeout_ms instead of waiting for a peer that doesn't read.
+void local_socket_set_send_timeout(int fd, int timeout_ms) {
+#ifndef WINDOWS
+  struct timeval timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#endif
+}
+
+// Reads a single line (without the newline) or everything up to the end of the stream if there is
+// no newline. Gives up after timeout_ms in all, or never if it is -1, so that a peer that sends
+// nothing can't hold up the reader. Returns NULL if nothing could be read.
+String* local_socket_read_line(int fd, int timeout_ms) {
+#ifdef WINDOWS
+  return NULL;
+#else
+  StringBuilder* sb = new_string_builder();
+  double deadline = get_time_millis() + timeout_ms;
+  char c;
+  int any = 0;
+  while (1) {
+    if (timeout_ms != -1) {
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      int remaining = (int) (deadline - get_time_millis());
+      if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0) break;
+    }
+    if (read(fd, &c, 1) != 1) break;
+    any = 1;
+    if (c == '\n') break;
+    if (c != '\r') string_builder_append_char(sb, c);
+  }
+  if (!any) {
+    string_builder_free(sb);
+    return NULL;
+  }
+  return string_builder_to_string_and_free(sb);
+#endif
+}
+
+// Returns the number of bytes read, 0 at the end of the stream or -1 on failure.
+int local_socket_read(int fd, char* buffer, int length) {
+#ifdef WINDOWS
+  return -1;
+#else
+  return (int) read(fd, buffer, length);
+#endif
+}
+
+int local_socket_write(int fd, const char* bytes, int length) {
+#ifdef WINDOWS
+  return 0;
+#else
+  while (length > 0) {
+    int written = (int) write(fd, bytes, length);
+    if (written <= 0) return 0;
+    bytes += written;
+    length -= written;
+  }
+  return 1;
+#endif
+}
+
+void local_socket_close(int fd) {
+#ifndef WINDOWS
+  close(fd);
+#endif
+}
+
+#endif
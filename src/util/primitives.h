@@ -48,6 +48,8 @@ Float* wrap_float(double value) {
       f->value = i + 0.0;
       GCValue* gcf = ((GCValue*)f) - 1;
       gcf->save = 1;
+      if (i == 0) ZERO = f;
+      else ONE = f;
     }
   }
   if (value <= 1.0) {
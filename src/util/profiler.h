@@ -0,0 +1,346 @@
+#ifndef _UTIL_PROFILER_H
+#define _UTIL_PROFILER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+/*
+  Hierarchical timers and counters for finding out where compile time and memory go.
+
+  Nothing is recorded until profiler_enable is called. After that, profiler_begin/profiler_end pairs
+  record nested spans and profiler_count adds to named counters. Each thread records into its own
+  buffers, so this is safe to use from worker threads without locking. A worker started by
+  parallel_for nests its spans under whichever span was open on the thread that started it.
+
+  Names are expected to be string literals and are not copied. Details (a file path, a module name)
+  are copied.
+
+  This deliberately does not allocate through the GC, since the GC itself reports to it.
+*/
+
+typedef struct _ProfilerEvent {
+  const char* name;
+  char* detail; // NULL if there is none
+  double start; // milliseconds since profiler_enable
+  double duration; // milliseconds, -1 while the span is still open
+  int parent; // index of the enclosing span on the same thread, or -1
+  long long value; // for counter samples
+  char kind; // 'X' for a span, 'C' for a counter sample
+} ProfilerEvent;
+
+typedef struct _ProfilerCounter {
+  const char* name;
+  long long value;
+} ProfilerCounter;
+
+typedef struct _ProfilerThread {
+  int id;
+  ProfilerEvent* events;
+  int event_count;
+  int event_capacity;
+  int current; // innermost open span or -1
+  ProfilerCounter* counters;
+  int counter_count;
+  int counter_capacity;
+  struct _ProfilerThread* root_parent_thread; // span that was open when this thread was started
+  int root_parent_span;
+  struct _ProfilerThread* next;
+} ProfilerThread;
+
+int _profiler_enabled = 0;
+double _profiler_start_time = 0;
+ProfilerThread* volatile _profiler_threads = NULL;
+THREAD_LOCAL ProfilerThread* _profiler_thread = NULL;
+
+void profiler_enable() {
+  if (_profiler_enabled) return;
+  _profiler_start_time = get_time_millis();
+  _profiler_enabled = 1;
+}
+
+int profiler_is_enabled() {
+  return _profiler_enabled;
+}
+
+ProfilerThread* _profiler_get_thread() {
+  static volatile int next_id = 0;
+  ProfilerThread* thread = _profiler_thread;
+  if (thread == NULL) {
+    thread = (ProfilerThread*) malloc_clean(sizeof(ProfilerThread));
+    thread->id = atomic_increment(&next_id);
+    thread->current = -1;
+    thread->root_parent_span = -1;
+    do {
+      thread->next = (ProfilerThread*) atomic_load_ptr((void* volatile*) &_profiler_threads);
+    } while (!atomic_compare_and_swap_ptr((void* volatile*) &_profiler_threads, thread->next, thread));
+    _profiler_thread = thread;
+  }
+  return thread;
+}
+
+ProfilerEvent* _profiler_add_event(ProfilerThread* thread, const char* name, char kind) {
+  if (thread->event_count == thread->event_capacity) {
+    thread->event_capacity = thread->event_capacity == 0 ? 256 : thread->event_capacity * 2;
+    thread->events = (ProfilerEvent*) realloc(thread->events, sizeof(ProfilerEvent) * thread->event_capacity);
+  }
+  ProfilerEvent* event = &thread->events[thread->event_count++];
+  event->name = name;
+  event->detail = NULL;
+  event->start = get_time_millis() - _profiler_start_time;
+  event->duration = -1;
+  event->parent = thread->current;
+  event->value = 0;
+  event->kind = kind;
+  return event;
+}
+
+// Opens a span and returns a handle for profiler_end. detail may be NULL.
+int profiler_begin(const char* name, const char* detail) {
+  if (!_profiler_enabled) return -1;
+  ProfilerThread* thread = _profiler_get_thread();
+  ProfilerEvent* event = _profiler_add_event(thread, name, 'X');
+  if (detail != NULL) {
+    int length = (int) strlen(detail);
+    event->detail = (char*) malloc(length + 1);
+    memcpy(event->detail, detail, length + 1);
+  }
+  thread->current = thread->event_count - 1;
+  return thread->current;
+}
+
+void profiler_end(int span) {
+  if (span < 0) return;
+  ProfilerThread* thread = _profiler_get_thread();
+  ProfilerEvent* event = &thread->events[span];
+  event->duration = get_time_millis() - _profiler_start_time - event->start;
+  thread->current = event->parent;
+}
+
+void profiler_count(const char* name, long long amount) {
+  if (!_profiler_enabled) return;
+  ProfilerThread* thread = _profiler_get_thread();
+  for (int i = 0; i < thread->counter_count; ++i) {
+    if (thread->counters[i].name == name) {
+      thread->counters[i].value += amount;
+      return;
+    }
+  }
+  if (thread->counter_count == thread->counter_capacity) {
+    thread->counter_capacity = thread->counter_capacity == 0 ? 8 : thread->counter_capacity * 2;
+    thread->counters = (ProfilerCounter*) realloc(thread->counters, sizeof(ProfilerCounter) * thread->counter_capacity);
+  }
+  thread->counters[thread->counter_count].name = name;
+  thread->counters[thread->counter_count].value = amount;
+  thread->counter_count++;
+}
+
+// Records the value of something at this moment, e.g. the size of a heap. Only shows up in traces.
+void profiler_sample(const char* name, long long value) {
+  if (!_profiler_enabled) return;
+  ProfilerEvent* event = _profiler_add_event(_profiler_get_thread(), name, 'C');
+  event->duration = 0;
+  event->value = value;
+}
+
+// Returns the current thread's profiler state, for handing to threads it starts. NULL if disabled.
+ProfilerThread* profiler_get_current_thread(int* span_out) {
+  if (!_profiler_enabled) return NULL;
+  ProfilerThread* thread = _profiler_get_thread();
+  *span_out = thread->current;
+  return thread;
+}
+
+// Makes spans on the current thread that have no parent nest under the given span of another thread.
+void profiler_set_root_parent(ProfilerThread* parent_thread, int parent_span) {
+  if (parent_thread == NULL) return;
+  ProfilerThread* thread = _profiler_get_thread();
+  thread->root_parent_thread = parent_thread;
+  thread->root_parent_span = parent_span;
+}
+
+typedef struct _ProfilerSummaryRow {
+  char* path; // span names from the root down, separated by \1 so that children sort right after their parent
+  const char* name;
+  int depth;
+  int calls;
+  double total;
+  double self;
+} ProfilerSummaryRow;
+
+char* _profiler_get_path(ProfilerThread* thread, int span, int* depth_out) {
+  const char* names[64];
+  int depth = 0;
+  while (thread != NULL && depth < 64) {
+    if (span == -1) {
+      span = thread->root_parent_span;
+      thread = thread->root_parent_thread;
+      continue;
+    }
+    names[depth++] = thread->events[span].name;
+    span = thread->events[span].parent;
+  }
+  int length = 0;
+  for (int i = 0; i < depth; ++i) length += (int) strlen(names[i]) + 1;
+  char* path = (char*) malloc(length + 1);
+  int offset = 0;
+  for (int i = depth - 1; i >= 0; --i) {
+    int name_length = (int) strlen(names[i]);
+    memcpy(path + offset, names[i], name_length);
+    offset += name_length;
+    path[offset++] = '\1';
+  }
+  path[offset] = '\0';
+  *depth_out = depth - 1;
+  return path;
+}
+
+int _profiler_compare_rows(const void* a, const void* b) {
+  return strcmp(((ProfilerSummaryRow*) a)->path, ((ProfilerSummaryRow*) b)->path);
+}
+
+/*
+  Prints one row per distinct span path with its call count, total time and self time (total minus
+  the time spent in child spans on the same thread), followed by the counter totals. Spans that ran
+  in parallel are summed, so the totals of a parallel phase can exceed the wall-clock time.
+*/
+void profiler_print_summary() {
+  int row_count = 0;
+  int row_capacity = 16;
+  ProfilerSummaryRow* rows = (ProfilerSummaryRow*) malloc(sizeof(ProfilerSummaryRow) * row_capacity);
+
+  for (ProfilerThread* thread = _profiler_threads; thread != NULL; thread = thread->next) {
+    double* child_time = (double*) malloc_clean(sizeof(double) * (thread->event_count + 1));
+    for (int i = 0; i < thread->event_count; ++i) {
+      ProfilerEvent* event = &thread->events[i];
+      if (event->kind == 'X' && event->duration >= 0 && event->parent != -1) {
+        child_time[event->parent] += event->duration;
+      }
+    }
+    for (int i = 0; i < thread->event_count; ++i) {
+      ProfilerEvent* event = &thread->events[i];
+      if (event->kind != 'X' || event->duration < 0) continue;
+      int depth;
+      char* path = _profiler_get_path(thread, i, &depth);
+      ProfilerSummaryRow* row = NULL;
+      for (int j = 0; j < row_count; ++j) {
+        if (strcmp(rows[j].path, path) == 0) {
+          row = &rows[j];
+          break;
+        }
+      }
+      if (row == NULL) {
+        if (row_count == row_capacity) {
+          row_capacity *= 2;
+          rows = (ProfilerSummaryRow*) realloc(rows, sizeof(ProfilerSummaryRow) * row_capacity);
+        }
+        row = &rows[row_count++];
+        row->path = path;
+        row->name = event->name;
+        row->depth = depth;
+        row->calls = 0;
+        row->total = 0;
+        row->self = 0;
+      } else {
+        free(path);
+      }
+      row->calls++;
+      row->total += event->duration;
+      row->self += event->duration - child_time[i];
+    }
+    free(child_time);
+  }
+
+  qsort(rows, row_count, sizeof(ProfilerSummaryRow), _profiler_compare_rows);
+  printf("%-44s %8s %12s %12s\n", "Phase", "Calls", "Total ms", "Self ms");
+  for (int i = 0; i < row_count; ++i) {
+    printf("%*s%-*s %8d %12.2f %12.2f\n", rows[i].depth * 2, "", 44 - rows[i].depth * 2, rows[i].name, rows[i].calls, rows[i].total, rows[i].self);
+    free(rows[i].path);
+  }
+  free(rows);
+
+  // Counters are summed across threads. Names are compared by content since each thread has its own list.
+  int printed_header = 0;
+  for (ProfilerThread* thread = _profiler_threads; thread != NULL; thread = thread->next) {
+    for (int i = 0; i < thread->counter_count; ++i) {
+      const char* name = thread->counters[i].name;
+      int seen = 0;
+      for (ProfilerThread* other = _profiler_threads; other != thread && !seen; other = other->next) {
+        for (int j = 0; j < other->counter_count; ++j) {
+          if (strcmp(other->counters[j].name, name) == 0) seen = 1;
+        }
+      }
+      if (seen) continue;
+      long long total = 0;
+      for (ProfilerThread* other = thread; other != NULL; other = other->next) {
+        for (int j = 0; j < other->counter_count; ++j) {
+          if (strcmp(other->counters[j].name, name) == 0) total += other->counters[j].value;
+        }
+      }
+      if (!printed_header) {
+        printf("\n%-44s %34s\n", "Counter", "Total");
+        printed_header = 1;
+      }
+      printf("%-44s %34lld\n", name, total);
+    }
+  }
+}
+
+void _profiler_write_json_string(FILE* file, const char* value) {
+  fputc('"', file);
+  for (int i = 0; value[i] != '\0'; ++i) {
+    char c = value[i];
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if ((unsigned char) c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+// Writes everything recorded so far as a Chrome trace event file (chrome://tracing, Perfetto). Returns 0 on failure.
+int profiler_write_trace(const char* path) {
+#ifdef WINDOWS
+  FILE* file;
+  if (fopen_s(&file, path, "wb") != 0) return 0;
+#else
+  FILE* file = fopen(path, "wb");
+#endif
+  if (!file) return 0;
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  int first = 1;
+  for (ProfilerThread* thread = _profiler_threads; thread != NULL; thread = thread->next) {
+    for (int i = 0; i < thread->event_count; ++i) {
+      ProfilerEvent* event = &thread->events[i];
+      if (event->duration < 0) continue;
+      fprintf(file, first ? "" : ",\n");
+      first = 0;
+      fprintf(file, "{\"name\":");
+      _profiler_write_json_string(file, event->name);
+      fprintf(file, ",\"cat\":\"wax\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", event->kind, thread->id, event->start * 1000);
+      if (event->kind == 'X') {
+        fprintf(file, ",\"dur\":%.3f", event->duration * 1000);
+        if (event->detail != NULL) {
+          fprintf(file, ",\"args\":{\"detail\":");
+          _profiler_write_json_string(file, event->detail);
+          fprintf(file, "}");
+        }
+      } else {
+        fprintf(file, ",\"args\":{\"value\":%lld}", event->value);
+      }
+      fprintf(file, "}");
+    }
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  return 1;
+}
+
+#endif
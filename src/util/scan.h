@@ -0,0 +1,81 @@
+#ifndef _UTIL_SCAN_H
+#define _UTIL_SCAN_H
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "util.h"
+
+/*
+  Byte scanning helpers for skipping over runs of uninteresting characters, like the body of a comment
+  or a string literal. With SSE2 (always available on x86-64) 16 bytes are checked per iteration;
+  elsewhere a plain loop is used. Every function looks at chars[start] up to but not including
+  chars[end] and never reads past chars[end - 1], so they are safe to use at the end of a buffer.
+*/
+
+// Returns the index of the first byte that is not a space or a tab, or end if there is none.
+int scan_skip_blanks(const char* chars, int start, int end) {
+  int i = start;
+#ifdef SCAN_SSE2
+  __m128i spaces = _mm_set1_epi8(' ');
+  __m128i tabs = _mm_set1_epi8('\t');
+  while (i + 16 <= end) {
+    __m128i block = _mm_loadu_si128((const __m128i*) (chars + i));
+    __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(block, spaces), _mm_cmpeq_epi8(block, tabs));
+    int mask = _mm_movemask_epi8(blank) ^ 0xFFFF;
+    if (mask != 0) return i + count_trailing_zeros(mask);
+    i += 16;
+  }
+#endif
+  while (i < end && (chars[i] == ' ' || chars[i] == '\t')) i++;
+  return i;
+}
+
+// Returns the index of the first occurrence of a or b, or end if there is none.
+int scan_find_either(const char* chars, int start, int end, char a, char b) {
+  int i = start;
+#ifdef SCAN_SSE2
+  __m128i as = _mm_set1_epi8(a);
+  __m128i bs = _mm_set1_epi8(b);
+  while (i + 16 <= end) {
+    __m128i block = _mm_loadu_si128((const __m128i*) (chars + i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, as), _mm_cmpeq_epi8(block, bs)));
+    if (mask != 0) return i + count_trailing_zeros(mask);
+    i += 16;
+  }
+#endif
+  while (i < end && chars[i] != a && chars[i] != b) i++;
+  return i;
+}
+
+// Returns the index of the first occurrence of a, b or c, or end if there is none.
+int scan_find_any3(const char* chars, int start, int end, char a, char b, char c) {
+  int i = start;
+#ifdef SCAN_SSE2
+  __m128i as = _mm_set1_epi8(a);
+  __m128i bs = _mm_set1_epi8(b);
+  __m128i cs = _mm_set1_epi8(c);
+  while (i + 16 <= end) {
+    __m128i block = _mm_loadu_si128((const __m128i*) (chars + i));
+    __m128i found = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, as), _mm_cmpeq_epi8(block, bs)), _mm_cmpeq_epi8(block, cs));
+    int mask = _mm_movemask_epi8(found);
+    if (mask != 0) return i + count_trailing_zeros(mask);
+    i += 16;
+  }
+#endif
+  while (i < end && chars[i] != a && chars[i] != b && chars[i] != c) i++;
+  return i;
+}
+
+// Returns the index of the first occurrence of c, or end if there is none.
+int scan_find_char(const char* chars, int start, int end, char c) {
+  if (start >= end) return end;
+  const char* found = (const char*) memchr(chars + start, c, end - start);
+  return found == NULL ? end : (int) (found - chars);
+}
+
+#endif
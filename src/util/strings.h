@@ -25,7 +25,7 @@ String* new_string(const char* value) {
     for (int i = 0; i < 128; ++i) {
       String* s = (String*) gc_create_item(sizeof(String), 'S');
       s->length = i == 0 ? 0 : 1;
-      s->hash = value[0];
+      s->hash = i == 0 ? 1319 : i;
       s->cstring = (char*) malloc_clean(sizeof(char) * 2);
       s->cstring[0] = (char) i;
       s->cstring[1] = '\0';
@@ -58,15 +58,26 @@ String* new_string(const char* value) {
 }
 
 String* new_string_from_range(const char* chars, int start, int end) {
-  if (start == end) return new_string("");
+  if (end - start <= 1 && (end == start || chars[start] >= 0)) {
+    char single[2];
+    single[0] = end == start ? '\0' : chars[start];
+    single[1] = '\0';
+    return new_string(single);
+  }
   int len = end - start;
-  char* buf = (char*) malloc(sizeof(char) * (len + 1));
+  int hash = 0;
+  char* cstring = (char*) malloc_clean(sizeof(char) * (len + 1));
   for (int i = 0; i < len; ++i) {
-    buf[i] = chars[i + start];
+    char c = chars[i + start];
+    hash = hash * 31 + c;
+    cstring[i] = c;
   }
-  buf[len] = '\0';
-  String* str = new_string(buf);
-  free(buf);
+  cstring[len] = '\0';
+  if (hash == 0) hash = 1319;
+  String* str = (String*) gc_create_item(sizeof(String), 'S');
+  str->length = len;
+  str->hash = hash;
+  str->cstring = cstring;
   return str;
 }
 
@@ -106,6 +117,18 @@ void string_builder_append_chars(StringBuilder* sb, const char* str) {
   }
 }
 
+void string_builder_append_int(StringBuilder* sb, int value) {
+  char buffer[12];
+  int length = 0;
+  unsigned int magnitude = value < 0 ? -(unsigned int) value : (unsigned int) value;
+  do {
+    buffer[length++] = '0' + (magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0) string_builder_append_char(sb, '-');
+  while (length > 0) string_builder_append_char(sb, buffer[--length]);
+}
+
 String* string_builder_to_string(StringBuilder* sb) {
   string_builder_append_char(sb, '\0');
   String* str = new_string(sb->chars);
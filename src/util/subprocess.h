@@ -0,0 +1,36 @@
+#ifndef _UTIL_SUBPROCESS_H
+#define _UTIL_SUBPROCESS_H
+
+#ifdef WINDOWS
+#include <process.h>
+#else
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/*
+  Runs a program and waits for it. argv is the program followed by its arguments and ends with NULL.
+  The program is looked up on the PATH and gets the arguments as they are, with no shell in between.
+  Returns the exit status of the program, or -1 if it could not be run or did not exit normally.
+*/
+int subprocess_run(const char** argv) {
+#ifdef WINDOWS
+  return (int) _spawnvp(_P_WAIT, argv[0], argv);
+#else
+  pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    execvp(argv[0], (char* const*) argv);
+    _exit(127);
+  }
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) return -1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef _UTIL_THREADS_H
+#define _UTIL_THREADS_H
+
+#include <stdlib.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "gcbase.h"
+#include "profiler.h"
+#include "util.h"
+
+typedef void (*ParallelTask)(void* arg, int index);
+
+typedef struct _ParallelForState {
+  ParallelTask task;
+  void* arg;
+  int count;
+  volatile int next_index;
+  ProfilerThread* profiler_parent;
+  int profiler_parent_span;
+} ParallelForState;
+
+typedef struct _ParallelWorker {
+  ParallelForState* state;
+  GCValue* heap;
+#ifdef WINDOWS
+  HANDLE handle;
+#else
+  pthread_t handle;
+#endif
+} ParallelWorker;
+
+int get_cpu_count() {
+#ifdef WINDOWS
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int) info.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count < 1 ? 1 : (int) count;
+#endif
+}
+
+void _parallel_worker_run(ParallelWorker* worker) {
+  ParallelForState* state = worker->state;
+  profiler_set_root_parent(state->profiler_parent, state->profiler_parent_span);
+  while (1) {
+    int index = atomic_increment(&state->next_index) - 1;
+    if (index >= state->count) break;
+    state->task(state->arg, index);
+  }
+  worker->heap = gc_detach_heap();
+}
+
+#ifdef WINDOWS
+DWORD WINAPI _parallel_worker_main(LPVOID arg) {
+  _parallel_worker_run((ParallelWorker*) arg);
+  return 0;
+}
+#else
+void* _parallel_worker_main(void* arg) {
+  _parallel_worker_run((ParallelWorker*) arg);
+  return NULL;
+}
+#endif
+
+/*
+  Runs task(arg, i) for each i in [0, count) on up to thread_count worker threads and returns once
+  all of them are done. Each worker allocates into its own GC heap, and those heaps are adopted by
+  the calling thread before this returns, so anything a task created is owned by the caller
+  afterwards. A GC pass inside a task only sees that worker's roots, so a task that runs one must
+  gc_save_item whatever it hands back.
+
+  Functions that lazily build static tables must have been called once on the calling thread
+  before this is used.
+*/
+void parallel_for(int count, int thread_count, ParallelTask task, void* arg) {
+  if (thread_count > count) thread_count = count;
+  if (thread_count <= 1) {
+    for (int i = 0; i < count; ++i) task(arg, i);
+    return;
+  }
+
+  ParallelForState state;
+  state.task = task;
+  state.arg = arg;
+  state.count = count;
+  state.next_index = 0;
+  state.profiler_parent = profiler_get_current_thread(&state.profiler_parent_span);
+
+  ParallelWorker* workers = (ParallelWorker*) malloc_clean(sizeof(ParallelWorker) * thread_count);
+  for (int i = 0; i < thread_count; ++i) {
+    workers[i].state = &state;
+#ifdef WINDOWS
+    workers[i].handle = CreateThread(NULL, 0, _parallel_worker_main, &workers[i], 0, NULL);
+#else
+    pthread_create(&workers[i].handle, NULL, _parallel_worker_main, &workers[i]);
+#endif
+  }
+
+  for (int i = 0; i < thread_count; ++i) {
+#ifdef WINDOWS
+    WaitForSingleObject(workers[i].handle, INFINITE);
+    CloseHandle(workers[i].handle);
+#else
+    pthread_join(workers[i].handle, NULL);
+#endif
+    gc_adopt_heap(workers[i].heap);
+  }
+  free(workers);
+}
+
+#endif
@@ -3,6 +3,65 @@
 
 #include <stdlib.h>
 
+#ifdef WINDOWS
+#include <windows.h>
+#define THREAD_LOCAL __declspec(thread)
+#else
+#include <time.h>
+#define THREAD_LOCAL __thread
+#endif
+
+// Returns the incremented value.
+int atomic_increment(volatile int* value) {
+#ifdef WINDOWS
+  return (int) InterlockedIncrement((volatile long*) value);
+#else
+  return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+// Sets *target to desired if it still holds expected. Returns 1 if it did.
+int atomic_compare_and_swap_ptr(void* volatile* target, void* expected, void* desired) {
+#ifdef WINDOWS
+  return InterlockedCompareExchangePointer(target, desired, expected) == expected;
+#else
+  return __sync_bool_compare_and_swap(target, expected, desired);
+#endif
+}
+
+void* atomic_load_ptr(void* volatile* target) {
+#ifdef WINDOWS
+  return InterlockedCompareExchangePointer(target, NULL, NULL);
+#else
+  return __atomic_load_n(target, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Index of the lowest set bit. value must not be 0.
+int count_trailing_zeros(unsigned int value) {
+#ifdef WINDOWS
+  unsigned long index;
+  _BitScanForward(&index, value);
+  return (int) index;
+#else
+  return __builtin_ctz(value);
+#endif
+}
+
+// Milliseconds from some arbitrary point in the past. Only useful for measuring durations.
+double get_time_millis() {
+#ifdef WINDOWS
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart * 1000.0 / frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+#endif
+}
+
 void** malloc_ptr_array(int length) {
   void** arr = (void**) malloc(sizeof(void*) * length);
   for (int i = 0; i < length; ++i) {
@@ -12,11 +71,7 @@ void** malloc_ptr_array(int length) {
 }
 
 void* malloc_clean(int size) {
-  char* ptr = (char*) malloc(size);
-  for (int i = 0; i < size; ++i) {
-    ptr[i] = '\0';
-  }
-  return ptr;
+  return calloc(1, size);
 }
 
 int try_parse_int(const char* value, int* value_out) {
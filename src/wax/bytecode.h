@@ -0,0 +1,487 @@
+#ifndef _WAX_BYTECODE_H
+#define _WAX_BYTECODE_H
+
+#include <string.h>
+#include "../util/dictionaries.h"
+#include "../util/fileio.h"
+#include "../util/gc.h"
+#include "../util/lists.h"
+#include "../util/primitives.h"
+#include "../util/strings.h"
+
+/*
+  Wax bytecode is for a stack machine. Each instruction is one 32 bit word with the opcode in the low
+  8 bits and a signed 24 bit argument above it. The few instructions that need two arguments take the
+  second one from the word that follows (noted below), so code is a dense int array that is decoded
+  with a mask and a shift.
+
+  Jump targets are word indexes into the function's code. Locals are the slots the resolver gave out.
+  In a function the arguments come first. In a method or constructor slot 0 holds this, and the
+  arguments follow it. Constant arguments index the module's constant pool, which holds Integer,
+  String and Boolean objects, the null object and Dictionary templates for constant inline
+  dictionaries.
+*/
+
+enum BytecodeOp {
+  BC_PUSH_NULL,
+  BC_PUSH_TRUE,
+  BC_PUSH_FALSE,
+  BC_PUSH_INT, // arg is the value
+  BC_PUSH_CONST, // arg is a constant of an immutable type
+  BC_CLONE_CONST, // arg is a dictionary template, pushes a fresh copy of it
+  BC_LOAD_LOCAL, // arg is a slot
+  BC_STORE_LOCAL, // arg is a slot, pops the value
+  BC_LOAD_GLOBAL, // arg indexes the module's global names
+  BC_LOAD_FUNCTION, // arg indexes the module's functions
+  BC_LOAD_CLASS, // arg indexes the module's classes
+  BC_DOT_GET, // arg is the field name constant. root -> value
+  BC_DOT_SET, // arg is the field name constant. root value ->
+  BC_GET_FIELD, // arg is the slot of a field of this. this -> value
+  BC_SET_FIELD, // arg is the slot of a field of this. this value ->
+  BC_INDEX_GET, // root index -> value
+  BC_INDEX_SET, // root index value ->
+  BC_NEW_DICT, // arg is the entry count. key1 value1 ... keyN valueN -> dictionary
+  BC_ADD,
+  BC_SUB,
+  BC_MUL,
+  BC_DIV,
+  BC_MOD,
+  BC_POW,
+  BC_BIT_AND,
+  BC_BIT_OR,
+  BC_BIT_XOR,
+  BC_SHL,
+  BC_SHR,
+  BC_EQ,
+  BC_NE,
+  BC_LT,
+  BC_GT,
+  BC_LE,
+  BC_GE,
+  BC_JUMP, // arg is the target
+  BC_JUMP_IF_FALSE, // pops the condition
+  BC_JUMP_IF_FALSE_OR_POP, // keeps the value if it jumps, for &&
+  BC_JUMP_IF_TRUE_OR_POP, // keeps the value if it jumps, for ||
+  BC_ITER_START, // list -> list 0, the state of a for-each loop
+  BC_ITER_NEXT, // arg is the loop variable's slot, next word the target to jump to when done
+  BC_CALL, // arg is the argument count. function args -> result
+  BC_CALL_FUNCTION, // arg indexes the module's functions, next word is the argument count
+  BC_CALL_METHOD, // arg is the method name constant, next word is the argument count. root args -> result
+  BC_POP,
+  BC_DUP,
+  BC_DUP2,
+  BC_RETURN,
+  BC_RETURN_NULL,
+  BC_OP_COUNT,
+};
+
+#define BYTECODE_ARG_MAX ((1 << 23) - 1)
+#define BYTECODE_ARG_MIN (-(1 << 23))
+
+int bytecode_make(int op, int arg) {
+  return (int) (((unsigned int) arg << 8) | (unsigned int) op);
+}
+
+int bytecode_op(int word) {
+  return word & 0xFF;
+}
+
+int bytecode_arg(int word) {
+  return word >> 8;
+}
+
+// Whether the instruction is followed by a word holding its second argument.
+int bytecode_has_extra_word(int op) {
+  return op == BC_ITER_NEXT || op == BC_CALL_FUNCTION || op == BC_CALL_METHOD;
+}
+
+// The name of each opcode, for diagnostics.
+const char* bytecode_op_name(int op) {
+  static const char* names[BC_OP_COUNT] = {
+    "PUSH_NULL", "PUSH_TRUE", "PUSH_FALSE", "PUSH_INT", "PUSH_CONST", "CLONE_CONST",
+    "LOAD_LOCAL", "STORE_LOCAL", "LOAD_GLOBAL", "LOAD_FUNCTION", "LOAD_CLASS",
+    "DOT_GET", "DOT_SET", "GET_FIELD", "SET_FIELD", "INDEX_GET", "INDEX_SET", "NEW_DICT",
+    "ADD", "SUB", "MUL", "DIV", "MOD", "POW", "BIT_AND", "BIT_OR", "BIT_XOR", "SHL", "SHR",
+    "EQ", "NE", "LT", "GT", "LE", "GE",
+    "JUMP", "JUMP_IF_FALSE", "JUMP_IF_FALSE_OR_POP", "JUMP_IF_TRUE_OR_POP",
+    "ITER_START", "ITER_NEXT", "CALL", "CALL_FUNCTION", "CALL_METHOD",
+    "POP", "DUP", "DUP2", "RETURN", "RETURN_NULL",
+  };
+  if (op < 0 || op >= BC_OP_COUNT) return "UNKNOWN";
+  return names[op];
+}
+
+/*
+  A caller can leave out arguments that have default values. The code starts with one initializer
+  for each of those, in order, so a call with n arguments starts at
+  arg_entry_points[n - required_arg_count] to skip the initializers of the arguments it passed.
+
+  Methods and constructors take the instance as local 0, which is not counted in arg_count. The
+  functions of a module are its own functions, by function index, and then the methods and
+  constructors of its classes, which are named Class.method and Class.constructor.
+*/
+typedef struct _BytecodeFunction {
+  String* name;
+  String* source_path;
+  int* code;
+  int* lines; // source line of each code word, for runtime errors
+  int* arg_entry_points; // arg_count - required_arg_count + 1 of them
+  int code_length;
+  int is_method;
+  int arg_count;
+  int required_arg_count;
+  int local_count;
+  int max_stack; // the most values the function ever has on its operand stack
+} BytecodeFunction;
+#define BYTECODE_FUNCTION_GC_FIELD_COUNT 5
+#define BYTECODE_FUNCTION_NAME "BytecodeFunction"
+
+BytecodeFunction* new_bytecode_function(String* name, String* source_path) {
+  BytecodeFunction* fn = (BytecodeFunction*) gc_create_struct(sizeof(BytecodeFunction), BYTECODE_FUNCTION_NAME, BYTECODE_FUNCTION_GC_FIELD_COUNT);
+  fn->name = name;
+  fn->source_path = source_path;
+  fn->code = NULL;
+  fn->lines = NULL;
+  fn->arg_entry_points = NULL;
+  return fn;
+}
+
+/*
+  Instances of a class are a fixed array of fields, laid out by the resolver with the fields of the
+  base classes first. A new instance starts with the default value of each field, then runs the
+  constructor of the class, or of its nearest base class that has one.
+*/
+typedef struct _BytecodeClass {
+  String* name;
+  List* field_names; // String, by slot
+  List* method_names; // String, the class's own methods
+  int* field_defaults; // the constant of each field's default value, or -1 for null
+  int* method_functions; // the function index of each of method_names
+  int base_class; // index into the module's classes, or -1
+  int constructor; // function index, or -1 if neither the class nor a base class has a constructor
+} BytecodeClass;
+#define BYTECODE_CLASS_GC_FIELD_COUNT 5
+#define BYTECODE_CLASS_NAME "BytecodeClass"
+
+BytecodeClass* new_bytecode_class(String* name) {
+  BytecodeClass* cls = (BytecodeClass*) gc_create_struct(sizeof(BytecodeClass), BYTECODE_CLASS_NAME, BYTECODE_CLASS_GC_FIELD_COUNT);
+  cls->name = name;
+  cls->field_names = new_list();
+  cls->method_names = new_list();
+  cls->field_defaults = NULL;
+  cls->method_functions = NULL;
+  cls->base_class = -1;
+  cls->constructor = -1;
+  return cls;
+}
+
+typedef struct _BytecodeModule {
+  String* name;
+  List* functions; // BytecodeFunction, by function index
+  List* constants;
+  List* global_names; // by BC_LOAD_GLOBAL index
+  List* classes; // BytecodeClass, by BC_LOAD_CLASS index
+} BytecodeModule;
+#define BYTECODE_MODULE_GC_FIELD_COUNT 5
+#define BYTECODE_MODULE_NAME "BytecodeModule"
+
+BytecodeModule* new_bytecode_module(String* name) {
+  BytecodeModule* module = (BytecodeModule*) gc_create_struct(sizeof(BytecodeModule), BYTECODE_MODULE_NAME, BYTECODE_MODULE_GC_FIELD_COUNT);
+  module->name = name;
+  module->functions = new_list();
+  module->constants = new_list();
+  module->global_names = new_list();
+  module->classes = new_list();
+  return module;
+}
+
+/*
+  Bytecode file format (.waxbc)
+
+    magic "WAXB", format version (u32, little endian)
+    module name, global names (count, then each), constants (count, then each), functions (count,
+    then each), classes (count, then each)
+
+  Strings are a varint length and the bytes. All other integers are varints, zig-zag encoded where
+  they can be negative. A constant is a type byte (the GC type: I, S, B, N or D) followed by its
+  value. A dictionary is its entry count and then a key string and a constant for each entry.
+  A function is its name, source path, whether it is a method (0 or 1), arg count, required arg
+  count, local count, max stack, code length, the code words, the arg entry points and then the line
+  of each word as a delta from the line of the word before. A class is its name, base class,
+  constructor, field count, the name and default of each field, method count and the name and
+  function of each method, with -1 for none where the field allows it.
+*/
+
+#define BYTECODE_FORMAT_MAGIC "WAXB"
+#define BYTECODE_FORMAT_VERSION 2
+
+void _bc_write_varint(StringBuilder* sb, unsigned int value) {
+  while (value >= 0x80) {
+    string_builder_append_char(sb, (char) ((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  string_builder_append_char(sb, (char) value);
+}
+
+void _bc_write_signed_varint(StringBuilder* sb, int value) {
+  _bc_write_varint(sb, (((unsigned int) value) << 1) ^ (unsigned int) (value >> 31));
+}
+
+void _bc_write_string(StringBuilder* sb, String* str) {
+  _bc_write_varint(sb, str->length);
+  for (int i = 0; i < str->length; ++i) {
+    string_builder_append_char(sb, str->cstring[i]);
+  }
+}
+
+void _bc_write_constant(StringBuilder* sb, void* value) {
+  char type = gc_get_type(value);
+  string_builder_append_char(sb, type);
+  switch (type) {
+    case 'I': _bc_write_signed_varint(sb, ((Integer*) value)->value); break;
+    case 'S': _bc_write_string(sb, (String*) value); break;
+    case 'B': string_builder_append_char(sb, ((Boolean*) value)->value ? 1 : 0); break;
+    case 'D':
+      {
+        Dictionary* dict = (Dictionary*) value;
+        _bc_write_varint(sb, dict->size);
+        for (int i = 0; i < dict->size; ++i) {
+          _bc_write_string(sb, dict->keys[i]);
+          _bc_write_constant(sb, dict->values[i]);
+        }
+      }
+      break;
+    default: break; // null has no value
+  }
+}
+
+// Returns the serialized module. The caller frees it.
+StringBuilder* bytecode_module_serialize(BytecodeModule* module) {
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, BYTECODE_FORMAT_MAGIC);
+  for (int i = 0; i < 4; ++i) {
+    string_builder_append_char(sb, (char) ((BYTECODE_FORMAT_VERSION >> (i * 8)) & 0xFF));
+  }
+  _bc_write_string(sb, module->name);
+  _bc_write_varint(sb, module->global_names->length);
+  for (int i = 0; i < module->global_names->length; ++i) {
+    _bc_write_string(sb, list_get_string(module->global_names, i));
+  }
+  _bc_write_varint(sb, module->constants->length);
+  for (int i = 0; i < module->constants->length; ++i) {
+    _bc_write_constant(sb, list_get(module->constants, i));
+  }
+  _bc_write_varint(sb, module->functions->length);
+  for (int i = 0; i < module->functions->length; ++i) {
+    BytecodeFunction* fn = (BytecodeFunction*) list_get(module->functions, i);
+    _bc_write_string(sb, fn->name);
+    _bc_write_string(sb, fn->source_path);
+    _bc_write_varint(sb, fn->is_method);
+    _bc_write_varint(sb, fn->arg_count);
+    _bc_write_varint(sb, fn->required_arg_count);
+    _bc_write_varint(sb, fn->local_count);
+    _bc_write_varint(sb, fn->max_stack);
+    _bc_write_varint(sb, fn->code_length);
+    for (int j = 0; j < fn->code_length; ++j) {
+      _bc_write_varint(sb, (unsigned int) fn->code[j]);
+    }
+    for (int j = 0; j <= fn->arg_count - fn->required_arg_count; ++j) {
+      _bc_write_varint(sb, fn->arg_entry_points[j]);
+    }
+    int line = 0;
+    for (int j = 0; j < fn->code_length; ++j) {
+      _bc_write_signed_varint(sb, fn->lines[j] - line);
+      line = fn->lines[j];
+    }
+  }
+  _bc_write_varint(sb, module->classes->length);
+  for (int i = 0; i < module->classes->length; ++i) {
+    BytecodeClass* cls = (BytecodeClass*) list_get(module->classes, i);
+    _bc_write_string(sb, cls->name);
+    _bc_write_signed_varint(sb, cls->base_class);
+    _bc_write_signed_varint(sb, cls->constructor);
+    _bc_write_varint(sb, cls->field_names->length);
+    for (int j = 0; j < cls->field_names->length; ++j) {
+      _bc_write_string(sb, list_get_string(cls->field_names, j));
+      _bc_write_signed_varint(sb, cls->field_defaults[j]);
+    }
+    _bc_write_varint(sb, cls->method_names->length);
+    for (int j = 0; j < cls->method_names->length; ++j) {
+      _bc_write_string(sb, list_get_string(cls->method_names, j));
+      _bc_write_varint(sb, cls->method_functions[j]);
+    }
+  }
+  return sb;
+}
+
+int bytecode_module_save(BytecodeModule* module, const char* path) {
+  StringBuilder* bytes = bytecode_module_serialize(module);
+  int ok = file_write_bytes(path, bytes->chars, bytes->length);
+  string_builder_free(bytes);
+  return ok;
+}
+
+typedef struct _BytecodeReader {
+  unsigned char* data;
+  int length;
+  int index;
+  int ok; // cleared when a read runs past the end
+} BytecodeReader;
+
+unsigned int _bc_read_varint(BytecodeReader* reader) {
+  unsigned int value = 0;
+  int shift = 0;
+  unsigned char b;
+  do {
+    if (reader->index >= reader->length) {
+      reader->ok = 0;
+      return 0;
+    }
+    b = reader->data[reader->index++];
+    value |= ((unsigned int) (b & 0x7F)) << shift;
+    shift += 7;
+  } while ((b & 0x80) != 0 && shift < 35);
+  return value;
+}
+
+int _bc_read_signed_varint(BytecodeReader* reader) {
+  unsigned int raw = _bc_read_varint(reader);
+  return (int) (raw >> 1) ^ -((int) (raw & 1));
+}
+
+// Reads a count that is about to be used to allocate, so a corrupt one can't ask for too much.
+int _bc_read_count(BytecodeReader* reader) {
+  unsigned int count = _bc_read_varint(reader);
+  if (count > (unsigned int) (reader->length - reader->index)) {
+    reader->ok = 0;
+    return 0;
+  }
+  return (int) count;
+}
+
+String* _bc_read_string(BytecodeReader* reader) {
+  int length = _bc_read_count(reader);
+  if (!reader->ok) return new_string("");
+  String* str = new_string_from_range((const char*) reader->data, reader->index, reader->index + length);
+  reader->index += length;
+  return str;
+}
+
+void* _bc_read_constant(BytecodeReader* reader) {
+  if (reader->index >= reader->length) {
+    reader->ok = 0;
+    return get_null();
+  }
+  char type = (char) reader->data[reader->index++];
+  switch (type) {
+    case 'I': return wrap_int(_bc_read_signed_varint(reader));
+    case 'S': return _bc_read_string(reader);
+    case 'B': return wrap_bool(reader->index < reader->length && reader->data[reader->index++] != 0);
+    case 'N': return get_null();
+    case 'D':
+      {
+        Dictionary* dict = new_dictionary();
+        int size = _bc_read_count(reader);
+        for (int i = 0; i < size && reader->ok; ++i) {
+          String* key = _bc_read_string(reader);
+          dictionary_set(dict, key, _bc_read_constant(reader));
+        }
+        return dict;
+      }
+  }
+  reader->ok = 0;
+  return get_null();
+}
+
+int* _bc_read_int_buffer(BytecodeReader* reader, int length, int is_signed) {
+  int* buffer = (int*) gc_create_buffer(sizeof(int) * (length + 1));
+  for (int i = 0; i < length; ++i) {
+    buffer[i] = is_signed ? _bc_read_signed_varint(reader) : (int) _bc_read_varint(reader);
+  }
+  return buffer;
+}
+
+// Returns NULL if the file does not exist or is not a compatible .waxbc file.
+BytecodeModule* bytecode_module_load(const char* path) {
+  BytecodeReader reader;
+  reader.data = file_map_bytes(path, &reader.length);
+  if (reader.data == NULL) return NULL;
+  reader.index = 8;
+  reader.ok = reader.length >= 8 && memcmp(reader.data, BYTECODE_FORMAT_MAGIC, 4) == 0;
+  for (int i = 0; i < 4 && reader.ok; ++i) {
+    if (reader.data[4 + i] != ((BYTECODE_FORMAT_VERSION >> (i * 8)) & 0xFF)) reader.ok = 0;
+  }
+  if (!reader.ok) {
+    file_unmap_bytes(reader.data, reader.length);
+    return NULL;
+  }
+
+  BytecodeModule* module = new_bytecode_module(_bc_read_string(&reader));
+  gc_save_item(module);
+  int global_count = _bc_read_count(&reader);
+  for (int i = 0; i < global_count && reader.ok; ++i) {
+    list_add(module->global_names, _bc_read_string(&reader));
+  }
+  int constant_count = _bc_read_count(&reader);
+  for (int i = 0; i < constant_count && reader.ok; ++i) {
+    list_add(module->constants, _bc_read_constant(&reader));
+  }
+  int function_count = _bc_read_count(&reader);
+  for (int i = 0; i < function_count && reader.ok; ++i) {
+    String* name = _bc_read_string(&reader);
+    BytecodeFunction* fn = new_bytecode_function(name, _bc_read_string(&reader));
+    list_add(module->functions, fn);
+    fn->is_method = _bc_read_varint(&reader) != 0;
+    fn->arg_count = _bc_read_count(&reader);
+    fn->required_arg_count = _bc_read_count(&reader);
+    fn->local_count = _bc_read_count(&reader);
+    fn->max_stack = _bc_read_count(&reader);
+    fn->code_length = _bc_read_count(&reader);
+    if (fn->required_arg_count > fn->arg_count || fn->local_count < fn->arg_count + fn->is_method) reader.ok = 0;
+    if (!reader.ok) break;
+    fn->code = _bc_read_int_buffer(&reader, fn->code_length, 0);
+    fn->arg_entry_points = _bc_read_int_buffer(&reader, fn->arg_count - fn->required_arg_count + 1, 0);
+    fn->lines = _bc_read_int_buffer(&reader, fn->code_length, 1);
+    int line = 0;
+    for (int j = 0; j < fn->code_length; ++j) {
+      line += fn->lines[j];
+      fn->lines[j] = line;
+    }
+  }
+  int class_count = reader.ok ? _bc_read_count(&reader) : 0;
+  for (int i = 0; i < class_count && reader.ok; ++i) {
+    BytecodeClass* cls = new_bytecode_class(_bc_read_string(&reader));
+    list_add(module->classes, cls);
+    cls->base_class = _bc_read_signed_varint(&reader);
+    cls->constructor = _bc_read_signed_varint(&reader);
+    int field_count = _bc_read_count(&reader);
+    cls->field_defaults = (int*) gc_create_buffer(sizeof(int) * (field_count + 1));
+    for (int j = 0; j < field_count && reader.ok; ++j) {
+      list_add(cls->field_names, _bc_read_string(&reader));
+      cls->field_defaults[j] = _bc_read_signed_varint(&reader);
+      if (cls->field_defaults[j] < -1 || cls->field_defaults[j] >= constant_count) reader.ok = 0;
+    }
+    int method_count = _bc_read_count(&reader);
+    cls->method_functions = (int*) gc_create_buffer(sizeof(int) * (method_count + 1));
+    for (int j = 0; j < method_count && reader.ok; ++j) {
+      list_add(cls->method_names, _bc_read_string(&reader));
+      unsigned int function_index = _bc_read_varint(&reader);
+      if (function_index >= (unsigned int) function_count) reader.ok = 0;
+      cls->method_functions[j] = (int) function_index;
+    }
+    if (cls->base_class < -1 || cls->base_class >= class_count || cls->constructor < -1 || cls->constructor >= function_count) reader.ok = 0;
+  }
+  // The interpreter follows base classes up to the root, so there can't be a cycle.
+  for (int i = 0; i < class_count && reader.ok; ++i) {
+    int base = i;
+    for (int depth = 0; base != -1 && reader.ok; ++depth) {
+      base = ((BytecodeClass*) list_get(module->classes, base))->base_class;
+      if (depth > class_count) reader.ok = 0;
+    }
+  }
+  file_unmap_bytes(reader.data, reader.length);
+  gc_release_item(module);
+  return reader.ok ? module : NULL;
+}
+
+#endif
@@ -0,0 +1,648 @@
+#ifndef _WAX_BYTECODEGEN_H
+#define _WAX_BYTECODEGEN_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "../util/dictionaries.h"
+#include "../util/lists.h"
+#include "../util/primitives.h"
+#include "../util/strings.h"
+#include "bytecode.h"
+#include "compilercontext.h"
+#include "nodes.h"
+
+/*
+  Lowers the resolved functions of a module to bytecode. The resolver has already given every
+  variable its slot or index and folded what could be folded, so this is a single walk over each
+  function body that appends instructions as it goes. Forward jumps are emitted with a target of 0
+  and patched once the target is known.
+
+  Methods and constructors are lowered like functions with this as local 0, after the module's own
+  functions. A constructor returns this, wherever it returns.
+
+  Nothing is checked here that the resolver checks already. The only error is a function too big
+  for the 24 bit instruction arguments.
+*/
+
+// The jumps of the break and continue statements of a loop, patched when the loop is done.
+typedef struct _BytecodeLoop {
+  struct _BytecodeLoop* outer;
+  int* breaks;
+  int break_count;
+  int* continues;
+  int continue_count;
+} BytecodeLoop;
+
+typedef struct _BytecodeEmitter {
+  BytecodeModule* module;
+  Dictionary* string_constants; // string -> index in the constant pool
+  int* code; // malloc'd, copied into the function when it is done
+  int* lines;
+  int length;
+  int capacity;
+  int line;
+  int depth; // values on the operand stack at the current instruction
+  int max_depth;
+  int too_large;
+  int in_constructor;
+  BytecodeLoop* loop; // the innermost loop around the code being lowered
+} BytecodeEmitter;
+
+void _bcg_add_jump(int** jumps, int* count, int at) {
+  *jumps = (int*) realloc(*jumps, sizeof(int) * (*count + 1));
+  (*jumps)[(*count)++] = at;
+}
+
+void _bcg_append_word(BytecodeEmitter* e, int word) {
+  if (e->length == e->capacity) {
+    e->capacity = e->capacity == 0 ? 64 : e->capacity * 2;
+    e->code = (int*) realloc(e->code, sizeof(int) * e->capacity);
+    e->lines = (int*) realloc(e->lines, sizeof(int) * e->capacity);
+  }
+  e->code[e->length] = word;
+  e->lines[e->length] = e->line;
+  e->length++;
+}
+
+// Appends an instruction that changes the stack depth by stack_delta. Returns its position.
+int _bcg_emit(BytecodeEmitter* e, int op, int arg, int stack_delta) {
+  if (arg < BYTECODE_ARG_MIN || arg > BYTECODE_ARG_MAX) e->too_large = 1;
+  int at = e->length;
+  _bcg_append_word(e, bytecode_make(op, arg));
+  e->depth += stack_delta;
+  if (e->depth > e->max_depth) e->max_depth = e->depth;
+  return at;
+}
+
+// Points the jump at position at to the current position.
+void _bcg_patch_here(BytecodeEmitter* e, int at) {
+  if (bytecode_op(e->code[at]) == BC_ITER_NEXT) {
+    e->code[at + 1] = e->length;
+  } else {
+    e->code[at] = bytecode_make(bytecode_op(e->code[at]), e->length);
+  }
+}
+
+void _bcg_set_line(BytecodeEmitter* e, Token* token) {
+  if (token != NULL) e->line = token_get_line(token);
+}
+
+int _bcg_add_constant(BytecodeEmitter* e, void* value) {
+  list_add(e->module->constants, value);
+  return e->module->constants->length - 1;
+}
+
+int _bcg_string_constant(BytecodeEmitter* e, String* value) {
+  Integer* id = (Integer*) dictionary_get(e->string_constants, value);
+  if (id == NULL) {
+    id = wrap_int(_bcg_add_constant(e, value));
+    dictionary_set(e->string_constants, value, id);
+  }
+  return id->value;
+}
+
+// The value of a constant node, or of a dictionary the resolver marked as constant.
+void* _bcg_constant_value(Node* node) {
+  switch (node_kind(node)) {
+    case NODE_KIND_BOOLEAN_CONSTANT: return wrap_bool(((BooleanConstant*) node)->value);
+    case NODE_KIND_INTEGER_CONSTANT: return wrap_int(((IntegerConstant*) node)->value);
+    case NODE_KIND_STRING_CONSTANT: return ((StringConstant*) node)->value;
+    case NODE_KIND_INLINE_DICTIONARY:
+      {
+        InlineDictionary* dict = (InlineDictionary*) node;
+        Dictionary* value = new_dictionary();
+        for (int i = 0; i < dict->keys->length; ++i) {
+          String* key = ((StringConstant*) list_get(dict->keys, i))->value;
+          dictionary_set(value, key, _bcg_constant_value((Node*) list_get(dict->values, i)));
+        }
+        return value;
+      }
+    default: return get_null();
+  }
+}
+
+// The instruction for a binary operator, or -1 for && and || which are lowered to jumps.
+int _bcg_binary_op(const char* op) {
+  switch (op[0]) {
+    case '+': return BC_ADD;
+    case '-': return BC_SUB;
+    case '*': return op[1] == '*' ? BC_POW : BC_MUL;
+    case '/': return BC_DIV;
+    case '%': return BC_MOD;
+    case '^': return BC_BIT_XOR;
+    case '&': return op[1] == '&' ? -1 : BC_BIT_AND;
+    case '|': return op[1] == '|' ? -1 : BC_BIT_OR;
+    case '=': return BC_EQ;
+    case '!': return BC_NE;
+    case '<': return op[1] == '<' ? BC_SHL : op[1] == '=' ? BC_LE : BC_LT;
+    case '>': return op[1] == '>' ? BC_SHR : op[1] == '=' ? BC_GE : BC_GT;
+    default: return -1;
+  }
+}
+
+// The instruction for a compound assignment operator like += or **=.
+int _bcg_assignment_op(String* op) {
+  char binary_op[4];
+  int length = op->length - 1 < 3 ? op->length - 1 : 3;
+  memcpy(binary_op, op->cstring, length);
+  binary_op[length] = '\0';
+  return _bcg_binary_op(binary_op);
+}
+
+void _bcg_lower_expression(BytecodeEmitter* e, Node* expr);
+void _bcg_lower_code_block(BytecodeEmitter* e, List* code);
+
+void _bcg_lower_op_chain(BytecodeEmitter* e, OpChain* oc) {
+  _bcg_lower_expression(e, (Node*) list_get(oc->expressions, 0));
+  String* first_op = ((Token*) list_get(oc->ops, 0))->value;
+  if (string_equals_chars(first_op, "&&") || string_equals_chars(first_op, "||")) {
+    // a && b && c leaves the first falsy operand on the stack, or c if there is none.
+    int jump_op = first_op->cstring[0] == '&' ? BC_JUMP_IF_FALSE_OR_POP : BC_JUMP_IF_TRUE_OR_POP;
+    int* jumps = (int*) malloc(sizeof(int) * oc->ops->length);
+    for (int i = 0; i < oc->ops->length; ++i) {
+      jumps[i] = _bcg_emit(e, jump_op, 0, -1);
+      _bcg_lower_expression(e, (Node*) list_get(oc->expressions, i + 1));
+    }
+    for (int i = 0; i < oc->ops->length; ++i) {
+      _bcg_patch_here(e, jumps[i]);
+    }
+    free(jumps);
+    return;
+  }
+  for (int i = 0; i < oc->ops->length; ++i) {
+    Token* op = (Token*) list_get(oc->ops, i);
+    _bcg_lower_expression(e, (Node*) list_get(oc->expressions, i + 1));
+    _bcg_set_line(e, op);
+    _bcg_emit(e, _bcg_binary_op(op->value->cstring), 0, -1);
+  }
+}
+
+void _bcg_lower_invocation(BytecodeEmitter* e, FunctionInvocation* fi) {
+  Node* root = fi->root;
+  int argc = fi->args->length;
+  int root_kind = node_kind(root);
+  if (root_kind == NODE_KIND_DOT_FIELD) {
+    _bcg_lower_expression(e, ((DotField*) root)->root);
+  } else if (root_kind != NODE_KIND_VARIABLE || ((Variable*) root)->scope != VARIABLE_SCOPE_FUNCTION) {
+    _bcg_lower_expression(e, root);
+  }
+  for (int i = 0; i < argc; ++i) {
+    _bcg_lower_expression(e, (Node*) list_get(fi->args, i));
+  }
+  _bcg_set_line(e, fi->open_paren);
+  if (root_kind == NODE_KIND_DOT_FIELD) {
+    _bcg_emit(e, BC_CALL_METHOD, _bcg_string_constant(e, ((DotField*) root)->field_token->value), -argc);
+    _bcg_append_word(e, argc);
+  } else if (root_kind == NODE_KIND_VARIABLE && ((Variable*) root)->scope == VARIABLE_SCOPE_FUNCTION) {
+    // Calls to the module's own functions are by far the most common, so they skip the function value.
+    _bcg_emit(e, BC_CALL_FUNCTION, ((Variable*) root)->index, 1 - argc);
+    _bcg_append_word(e, argc);
+  } else {
+    _bcg_emit(e, BC_CALL, argc, -argc);
+  }
+}
+
+void _bcg_lower_expression(BytecodeEmitter* e, Node* expr) {
+  switch (node_kind(expr)) {
+    case NODE_KIND_NULL_CONSTANT:
+      _bcg_emit(e, BC_PUSH_NULL, 0, 1);
+      break;
+    case NODE_KIND_BOOLEAN_CONSTANT:
+      _bcg_emit(e, ((BooleanConstant*) expr)->value ? BC_PUSH_TRUE : BC_PUSH_FALSE, 0, 1);
+      break;
+    case NODE_KIND_INTEGER_CONSTANT:
+      {
+        int value = ((IntegerConstant*) expr)->value;
+        if (value >= BYTECODE_ARG_MIN && value <= BYTECODE_ARG_MAX) {
+          _bcg_emit(e, BC_PUSH_INT, value, 1);
+        } else {
+          _bcg_emit(e, BC_PUSH_CONST, _bcg_add_constant(e, wrap_int(value)), 1);
+        }
+      }
+      break;
+    case NODE_KIND_STRING_CONSTANT:
+      _bcg_emit(e, BC_PUSH_CONST, _bcg_string_constant(e, ((StringConstant*) expr)->value), 1);
+      break;
+    case NODE_KIND_VARIABLE:
+      {
+        Variable* v = (Variable*) expr;
+        int op;
+        switch (v->scope) {
+          case VARIABLE_SCOPE_LOCAL: op = BC_LOAD_LOCAL; break;
+          case VARIABLE_SCOPE_FUNCTION: op = BC_LOAD_FUNCTION; break;
+          case VARIABLE_SCOPE_CLASS: op = BC_LOAD_CLASS; break;
+          default: op = BC_LOAD_GLOBAL; break;
+        }
+        _bcg_emit(e, op, v->index, 1);
+      }
+      break;
+    case NODE_KIND_INLINE_DICTIONARY:
+      {
+        InlineDictionary* dict = (InlineDictionary*) expr;
+        if (dict->is_constant) {
+          _bcg_emit(e, BC_CLONE_CONST, _bcg_add_constant(e, _bcg_constant_value(expr)), 1);
+          break;
+        }
+        for (int i = 0; i < dict->keys->length; ++i) {
+          _bcg_lower_expression(e, (Node*) list_get(dict->keys, i));
+          _bcg_lower_expression(e, (Node*) list_get(dict->values, i));
+        }
+        _bcg_emit(e, BC_NEW_DICT, dict->keys->length, 1 - 2 * dict->keys->length);
+      }
+      break;
+    case NODE_KIND_DOT_FIELD:
+      {
+        DotField* df = (DotField*) expr;
+        _bcg_lower_expression(e, df->root);
+        _bcg_set_line(e, df->dot_token);
+        if (df->field_index != -1) {
+          _bcg_emit(e, BC_GET_FIELD, df->field_index, 0);
+        } else {
+          _bcg_emit(e, BC_DOT_GET, _bcg_string_constant(e, df->field_token->value), 0);
+        }
+      }
+      break;
+    case NODE_KIND_BRACKET_INDEX:
+      {
+        BracketIndex* bi = (BracketIndex*) expr;
+        _bcg_lower_expression(e, bi->root);
+        _bcg_lower_expression(e, bi->index);
+        _bcg_set_line(e, bi->bracket_token);
+        _bcg_emit(e, BC_INDEX_GET, 0, -1);
+      }
+      break;
+    case NODE_KIND_OP_CHAIN:
+      _bcg_lower_op_chain(e, (OpChain*) expr);
+      break;
+    case NODE_KIND_TERNARY:
+      {
+        Ternary* ter = (Ternary*) expr;
+        _bcg_lower_expression(e, ter->condition);
+        int to_false = _bcg_emit(e, BC_JUMP_IF_FALSE, 0, -1);
+        _bcg_lower_expression(e, ter->true_expr);
+        int to_end = _bcg_emit(e, BC_JUMP, 0, -1); // the false branch starts without the true value
+        _bcg_patch_here(e, to_false);
+        _bcg_lower_expression(e, ter->false_expr);
+        _bcg_patch_here(e, to_end);
+      }
+      break;
+    case NODE_KIND_FUNCTION_INVOCATION:
+      _bcg_lower_invocation(e, (FunctionInvocation*) expr);
+      break;
+    default:
+      break;
+  }
+}
+
+void _bcg_lower_assignment(BytecodeEmitter* e, Assignment* asgn) {
+  Node* target = asgn->target;
+  int compound_op = string_equals_chars(asgn->assignment_op->value, "=") ? -1 : _bcg_assignment_op(asgn->assignment_op->value);
+  switch (node_kind(target)) {
+    case NODE_KIND_VARIABLE:
+      {
+        // The resolver makes every assigned name a local.
+        int slot = ((Variable*) target)->index;
+        if (compound_op != -1) _bcg_emit(e, BC_LOAD_LOCAL, slot, 1);
+        _bcg_lower_expression(e, asgn->value);
+        _bcg_set_line(e, asgn->assignment_op);
+        if (compound_op != -1) _bcg_emit(e, compound_op, 0, -1);
+        _bcg_emit(e, BC_STORE_LOCAL, slot, -1);
+      }
+      break;
+    case NODE_KIND_DOT_FIELD:
+      {
+        DotField* df = (DotField*) target;
+        int is_slot = df->field_index != -1;
+        int arg = is_slot ? df->field_index : _bcg_string_constant(e, df->field_token->value);
+        _bcg_lower_expression(e, df->root);
+        if (compound_op != -1) {
+          _bcg_emit(e, BC_DUP, 0, 1);
+          _bcg_emit(e, is_slot ? BC_GET_FIELD : BC_DOT_GET, arg, 0);
+        }
+        _bcg_lower_expression(e, asgn->value);
+        _bcg_set_line(e, asgn->assignment_op);
+        if (compound_op != -1) _bcg_emit(e, compound_op, 0, -1);
+        _bcg_emit(e, is_slot ? BC_SET_FIELD : BC_DOT_SET, arg, -2);
+      }
+      break;
+    case NODE_KIND_BRACKET_INDEX:
+      {
+        BracketIndex* bi = (BracketIndex*) target;
+        _bcg_lower_expression(e, bi->root);
+        _bcg_lower_expression(e, bi->index);
+        if (compound_op != -1) {
+          _bcg_emit(e, BC_DUP2, 0, 2);
+          _bcg_emit(e, BC_INDEX_GET, 0, -1);
+        }
+        _bcg_lower_expression(e, asgn->value);
+        _bcg_set_line(e, asgn->assignment_op);
+        if (compound_op != -1) _bcg_emit(e, compound_op, 0, -1);
+        _bcg_emit(e, BC_INDEX_SET, 0, -3);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// Lowers a loop body, with break and continue jumps collected for the caller to patch.
+void _bcg_lower_loop_body(BytecodeEmitter* e, BytecodeLoop* loop, List* code) {
+  loop->outer = e->loop;
+  loop->breaks = NULL;
+  loop->break_count = 0;
+  loop->continues = NULL;
+  loop->continue_count = 0;
+  e->loop = loop;
+  _bcg_lower_code_block(e, code);
+  e->loop = loop->outer;
+}
+
+void _bcg_patch_jumps_here(BytecodeEmitter* e, int* jumps, int count) {
+  for (int i = 0; i < count; ++i) {
+    _bcg_patch_here(e, jumps[i]);
+  }
+  free(jumps);
+}
+
+void _bcg_lower_executable(BytecodeEmitter* e, Node* line) {
+  _bcg_set_line(e, line->first_token);
+  switch (node_kind(line)) {
+    case NODE_KIND_ASSIGNMENT:
+      _bcg_lower_assignment(e, (Assignment*) line);
+      break;
+    case NODE_KIND_EXPR_EXEC:
+      _bcg_lower_expression(e, ((ExpressionAsExecutable*) line)->expression);
+      _bcg_emit(e, BC_POP, 0, -1);
+      break;
+    case NODE_KIND_IF_STATEMENT:
+      {
+        IfStatement* _if = (IfStatement*) line;
+        _bcg_lower_expression(e, _if->condition);
+        int to_false = _bcg_emit(e, BC_JUMP_IF_FALSE, 0, -1);
+        _bcg_lower_code_block(e, _if->true_code);
+        if (_if->false_code->length == 0) {
+          _bcg_patch_here(e, to_false);
+        } else {
+          int to_end = _bcg_emit(e, BC_JUMP, 0, 0);
+          _bcg_patch_here(e, to_false);
+          _bcg_lower_code_block(e, _if->false_code);
+          _bcg_patch_here(e, to_end);
+        }
+      }
+      break;
+    case NODE_KIND_WHILE_LOOP:
+      {
+        WhileLoop* wl = (WhileLoop*) line;
+        int start = e->length;
+        _bcg_lower_expression(e, wl->condition);
+        int to_end = _bcg_emit(e, BC_JUMP_IF_FALSE, 0, -1);
+        BytecodeLoop loop;
+        _bcg_lower_loop_body(e, &loop, wl->code);
+        _bcg_emit(e, BC_JUMP, start, 0);
+        for (int i = 0; i < loop.continue_count; ++i) {
+          e->code[loop.continues[i]] = bytecode_make(BC_JUMP, start);
+        }
+        free(loop.continues);
+        _bcg_patch_here(e, to_end);
+        _bcg_patch_jumps_here(e, loop.breaks, loop.break_count);
+      }
+      break;
+    case NODE_KIND_FOR_LOOP:
+      {
+        ForLoop* fl = (ForLoop*) line;
+        _bcg_lower_code_block(e, fl->inits);
+        int start = e->length;
+        int to_end = -1;
+        if (fl->condition != NULL) {
+          _bcg_lower_expression(e, fl->condition);
+          to_end = _bcg_emit(e, BC_JUMP_IF_FALSE, 0, -1);
+        }
+        BytecodeLoop loop;
+        _bcg_lower_loop_body(e, &loop, fl->code);
+        _bcg_patch_jumps_here(e, loop.continues, loop.continue_count);
+        _bcg_lower_code_block(e, fl->steps);
+        _bcg_emit(e, BC_JUMP, start, 0);
+        if (to_end != -1) _bcg_patch_here(e, to_end);
+        _bcg_patch_jumps_here(e, loop.breaks, loop.break_count);
+      }
+      break;
+    case NODE_KIND_FOR_EACH_LOOP:
+      {
+        // The list and the position in it stay on the stack while the loop runs. ITER_NEXT pops
+        // them when the list is done, and a break pops them itself.
+        ForEachLoop* fel = (ForEachLoop*) line;
+        _bcg_lower_expression(e, fel->list_expr);
+        _bcg_emit(e, BC_ITER_START, 0, 1);
+        int start = _bcg_emit(e, BC_ITER_NEXT, fel->variable_index, 0);
+        _bcg_append_word(e, 0);
+        BytecodeLoop loop;
+        _bcg_lower_loop_body(e, &loop, fel->code);
+        _bcg_emit(e, BC_JUMP, start, 0);
+        for (int i = 0; i < loop.continue_count; ++i) {
+          e->code[loop.continues[i]] = bytecode_make(BC_JUMP, start);
+        }
+        free(loop.continues);
+        if (loop.break_count > 0) {
+          _bcg_patch_jumps_here(e, loop.breaks, loop.break_count);
+          _bcg_emit(e, BC_POP, 0, 0);
+          _bcg_emit(e, BC_POP, 0, 0);
+        }
+        e->depth -= 2;
+        _bcg_patch_here(e, start);
+      }
+      break;
+    case NODE_KIND_RETURN:
+      {
+        Node* value = ((ReturnStatement*) line)->value;
+        if (value == NULL && e->in_constructor) {
+          _bcg_emit(e, BC_LOAD_LOCAL, 0, 1);
+          _bcg_emit(e, BC_RETURN, 0, -1);
+        } else if (value == NULL) {
+          _bcg_emit(e, BC_RETURN_NULL, 0, 0);
+        } else {
+          _bcg_lower_expression(e, value);
+          _bcg_emit(e, BC_RETURN, 0, -1);
+        }
+      }
+      break;
+    case NODE_KIND_BREAK:
+      _bcg_add_jump(&e->loop->breaks, &e->loop->break_count, _bcg_emit(e, BC_JUMP, 0, 0));
+      break;
+    case NODE_KIND_CONTINUE:
+      _bcg_add_jump(&e->loop->continues, &e->loop->continue_count, _bcg_emit(e, BC_JUMP, 0, 0));
+      break;
+    default:
+      break;
+  }
+}
+
+void _bcg_lower_code_block(BytecodeEmitter* e, List* code) {
+  for (int i = 0; i < code->length; ++i) {
+    _bcg_lower_executable(e, (Node*) list_get(code, i));
+  }
+}
+
+int* _bcg_copy_to_buffer(int* values, int length) {
+  int* buffer = (int*) gc_create_buffer(sizeof(int) * (length + 1));
+  memcpy(buffer, values, sizeof(int) * length);
+  return buffer;
+}
+
+// Lowers a function, or a method or constructor when is_method is set, and adds it to the module.
+BytecodeFunction* _bcg_lower_callable(BytecodeEmitter* e, String* name, Token* first_token, int is_method, List* arg_tokens, List* arg_default_values, List* code, int local_count) {
+  BytecodeFunction* fn = new_bytecode_function(name, first_token->source->path);
+  list_add(e->module->functions, fn);
+  e->length = 0;
+  e->depth = 0;
+  e->max_depth = 0;
+  e->too_large = 0;
+  e->loop = NULL;
+  _bcg_set_line(e, first_token);
+
+  // The initializers of the optional arguments come first, see BytecodeFunction.
+  int arg_count = arg_tokens->length;
+  int required = 0;
+  while (required < arg_count && list_get(arg_default_values, required) == NULL) required++;
+  int* entry_points = (int*) gc_create_buffer(sizeof(int) * (arg_count - required + 1));
+  for (int i = required; i < arg_count; ++i) {
+    entry_points[i - required] = e->length;
+    _bcg_lower_expression(e, (Node*) list_get(arg_default_values, i));
+    _bcg_emit(e, BC_STORE_LOCAL, is_method + i, -1);
+  }
+  entry_points[arg_count - required] = e->length;
+
+  _bcg_lower_code_block(e, code);
+  if (e->in_constructor) {
+    _bcg_emit(e, BC_LOAD_LOCAL, 0, 1);
+    _bcg_emit(e, BC_RETURN, 0, -1);
+  } else {
+    _bcg_emit(e, BC_RETURN_NULL, 0, 0);
+  }
+
+  fn->code = _bcg_copy_to_buffer(e->code, e->length);
+  fn->lines = _bcg_copy_to_buffer(e->lines, e->length);
+  fn->arg_entry_points = entry_points;
+  fn->code_length = e->length;
+  fn->is_method = is_method;
+  fn->arg_count = arg_count;
+  fn->required_arg_count = required;
+  fn->local_count = local_count;
+  fn->max_stack = e->max_depth;
+  return fn;
+}
+
+BytecodeFunction* _bcg_lower_function(BytecodeEmitter* e, FunctionDefinition* func_def) {
+  return _bcg_lower_callable(e, func_def->function_name->value, func_def->function_name, 0,
+    func_def->arg_tokens, func_def->arg_default_values, func_def->code, func_def->local_count);
+}
+
+// The constant of a field's default value, or -1 for null.
+int _bcg_field_default(BytecodeEmitter* e, FieldDefinition* fd) {
+  Node* value = fd->default_value;
+  if (value == NULL || node_kind(value) == NODE_KIND_NULL_CONSTANT) return -1;
+  if (node_kind(value) == NODE_KIND_STRING_CONSTANT) return _bcg_string_constant(e, ((StringConstant*) value)->value);
+  return _bcg_add_constant(e, _bcg_constant_value(value));
+}
+
+/*
+  Lowers the methods and constructor of a class and adds the class to the module. constructors holds
+  the function index of the constructor of each class that has its own, and -1 for the others. A
+  class without one uses the constructor of its nearest base class that has one.
+*/
+void _bcg_lower_class(BytecodeEmitter* e, ClassDefinition* cd, int* constructors) {
+  BytecodeClass* cls = (BytecodeClass*) list_get(e->module->classes, cd->index);
+  cls->base_class = cd->base_class_definition == NULL ? -1 : cd->base_class_definition->index;
+  for (ClassDefinition* walker = cd; walker != NULL && cls->constructor == -1; walker = walker->base_class_definition) {
+    cls->constructor = constructors[walker->index];
+  }
+
+  String** field_names = (String**) malloc_ptr_array(cd->field_count + 1);
+  cls->field_defaults = (int*) gc_create_buffer(sizeof(int) * (cd->field_count + 1));
+  for (ClassDefinition* walker = cd; walker != NULL; walker = walker->base_class_definition) {
+    for (int i = 0; i < walker->member_order->length; ++i) {
+      Node* member = (Node*) dictionary_get(walker->members, list_get_string(walker->member_order, i));
+      if (node_kind(member) != NODE_KIND_FIELD_DEFINITION) continue;
+      FieldDefinition* fd = (FieldDefinition*) member;
+      field_names[fd->index] = fd->field_name->value;
+      cls->field_defaults[fd->index] = _bcg_field_default(e, fd);
+    }
+  }
+  for (int i = 0; i < cd->field_count; ++i) {
+    list_add(cls->field_names, field_names[i]);
+  }
+  free(field_names);
+}
+
+// Lowers the methods and constructors of the classes. Returns 0 and reports an error on ctx if one is too large.
+int _bcg_lower_class_functions(BytecodeEmitter* e, CompilerContext* ctx, int* constructors) {
+  for (int i = 0; i < ctx->class_definitions->length; ++i) {
+    ClassDefinition* cd = (ClassDefinition*) list_get(ctx->class_definitions, i);
+    BytecodeClass* cls = new_bytecode_class(cd->class_name->value);
+    list_add(e->module->classes, cls);
+    constructors[i] = -1;
+    List* method_functions = new_list();
+    for (int j = 0; j < cd->member_order->length; ++j) {
+      String* member_name = list_get_string(cd->member_order, j);
+      Node* member = (Node*) dictionary_get(cd->members, member_name);
+      int function_index = e->module->functions->length;
+      int kind = node_kind(member);
+      if (kind == NODE_KIND_FUNCTION_DEFINITION) {
+        FunctionDefinition* fd = (FunctionDefinition*) member;
+        _bcg_lower_callable(e, string_concat3(cls->name->cstring, ".", member_name->cstring), fd->function_name, 1,
+          fd->arg_tokens, fd->arg_default_values, fd->code, fd->local_count);
+        list_add(cls->method_names, member_name);
+        list_add(method_functions, wrap_int(function_index));
+      } else if (kind == NODE_KIND_CONSTRUCTOR_DEFINITION) {
+        ConstructorDefinition* ctor = (ConstructorDefinition*) member;
+        e->in_constructor = 1;
+        _bcg_lower_callable(e, string_concat(cls->name->cstring, ".constructor"), member->first_token, 1,
+          ctor->arg_tokens, ctor->arg_default_values, ctor->code, ctor->local_count);
+        e->in_constructor = 0;
+        constructors[i] = function_index;
+      } else {
+        continue;
+      }
+      if (e->too_large) {
+        parser_error_chars(ctx, member->first_token, "This method is too large to compile to bytecode.");
+        return 0;
+      }
+    }
+    cls->method_functions = (int*) gc_create_buffer(sizeof(int) * (method_functions->length + 1));
+    for (int j = 0; j < method_functions->length; ++j) {
+      cls->method_functions[j] = ((Integer*) list_get(method_functions, j))->value;
+    }
+  }
+  return 1;
+}
+
+// Lowers the functions and classes of a resolved module. Returns NULL and reports an error on ctx if a function
+// can't be lowered.
+BytecodeModule* wax_bytecode_generate(CompilerContext* ctx, String* module_name) {
+  BytecodeModule* module = new_bytecode_module(module_name);
+  list_push_all(module->global_names, ctx->global_names);
+
+  BytecodeEmitter e;
+  memset(&e, 0, sizeof(BytecodeEmitter));
+  e.module = module;
+  e.string_constants = new_dictionary();
+  for (int i = 0; i < ctx->function_definitions->length; ++i) {
+    FunctionDefinition* func_def = (FunctionDefinition*) list_get(ctx->function_definitions, i);
+    _bcg_lower_function(&e, func_def);
+    if (e.too_large) {
+      parser_error_chars(ctx, func_def->function_name, "This function is too large to compile to bytecode.");
+      break;
+    }
+  }
+  int* constructors = (int*) malloc(sizeof(int) * (ctx->class_definitions->length + 1));
+  if (!ctx->has_error && _bcg_lower_class_functions(&e, ctx, constructors)) {
+    for (int i = 0; i < ctx->class_definitions->length; ++i) {
+      _bcg_lower_class(&e, (ClassDefinition*) list_get(ctx->class_definitions, i), constructors);
+    }
+  }
+  free(constructors);
+  free(e.code);
+  free(e.lines);
+  return ctx->has_error ? NULL : module;
+}
+
+#endif
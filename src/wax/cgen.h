@@ -0,0 +1,1548 @@
+#ifndef _WAX_CGEN_H
+#define _WAX_CGEN_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "../util/dictionaries.h"
+#include "../util/lists.h"
+#include "../util/primitives.h"
+#include "../util/strings.h"
+#include "bytecodegen.h"
+#include "compilercontext.h"
+#include "nodes.h"
+#include "typeinfer.h"
+
+/*
+  Translates the resolved functions of a module to C, for a native build. The generated file
+  includes cruntime.h and has a main that works like waxcli --run: it calls the function named by
+  its first argument.
+
+  The code follows the bytecode's evaluation order and its layout of a frame: a function gets the
+  arguments and locals in L and then the slots S that values in the middle of an expression are kept
+  in, where the GC can see them. Integers need no slot. A local that wax_infer_types found to only
+  ever hold an integer is an int64_t C variable, and operations on integers are C arithmetic with the
+  same overflow and division checks as the VM. Anything else goes through the runtime.
+
+  A module function whose body only ever deals in integers, assuming its arguments are integers,
+  and that always returns one also gets an int version, with int64_t arguments and result and no
+  frame on the shadow stack. The regular version calls it when the arguments are integers, and
+  the int versions call each other directly. Which functions qualify is decided together, since
+  whether a function qualifies can depend on the ones it calls.
+
+  The resolver has reported every error already, so nothing here fails.
+*/
+
+enum CGenType {
+  CGEN_INT, // int64_t in C
+  CGEN_BOOL, // int in C, 0 or 1
+  CGEN_ANY, // CrtValue
+};
+
+// A value while code is generated: a C expression and the type of C value it is.
+typedef struct _CGenValue {
+  String* code;
+  int type;
+} CGenValue;
+
+// A function, method or constructor of the module, by function index.
+typedef struct _CGenCallable {
+  String* name; // as in error messages, like Class.method
+  String* c_name;
+  Token* first_token;
+  List* code;
+  List* arg_tokens;
+  List* arg_default_values;
+  int local_count;
+  int is_method;
+  int is_constructor;
+  int required_arg_count;
+  int has_int_version;
+  String** local_names; // by slot, NULL for a slot nothing names
+  char* maybe_unassigned; // by slot, set if it can be read before anything is assigned to it
+  int* local_types; // by slot, CGEN_INT or CGEN_ANY in the regular version
+} CGenCallable;
+
+typedef struct _CGen {
+  CompilerContext* ctx;
+  CGenCallable* callables;
+  int callable_count;
+  List* strings; // the string constants, by their index in wax_strings
+  Dictionary* string_ids; // string -> Integer index
+  int dictionary_count;
+  StringBuilder* dictionaries; // the code that builds the dictionary constants
+  StringBuilder* sites;
+  Dictionary* site_ids; // "function:line" -> Integer index
+  int site_count;
+  int operation_count; // binary operations generated, compound assignments included
+  int specialized_count; // the ones generated as C on unboxed integers or booleans
+
+  // The function being generated
+  CGenCallable* fn;
+  int* local_types; // the types that apply to the version being generated
+  int* int_local_types; // every local an integer, for the int versions
+  int is_int_version;
+  StringBuilder* out;
+  int indent;
+  int max_slot; // slots of S used so far
+  int temp_count;
+  int label_count;
+  int loop_label; // the label before the steps of the innermost loop if it is a for loop, else -1
+  int loop_label_used;
+} CGen;
+
+String* _cg_int_string(int value) {
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_int(sb, value);
+  return string_builder_to_string_and_free(sb);
+}
+
+CGenValue _cg_value(String* code, int type) {
+  CGenValue value;
+  value.code = code;
+  value.type = type;
+  return value;
+}
+
+// A C string literal with the given contents.
+String* _cg_c_string(const char* chars) {
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_char(sb, '"');
+  for (int i = 0; chars[i] != '\0'; ++i) {
+    unsigned char c = (unsigned char) chars[i];
+    if (c == '"' || c == '\\') {
+      string_builder_append_char(sb, '\\');
+      string_builder_append_char(sb, (char) c);
+    } else if (c < 32 || c > 126 || c == '?') {
+      // Always three digits, so a digit after it can't become part of the escape.
+      string_builder_append_char(sb, '\\');
+      string_builder_append_char(sb, (char) ('0' + (c >> 6)));
+      string_builder_append_char(sb, (char) ('0' + ((c >> 3) & 7)));
+      string_builder_append_char(sb, (char) ('0' + (c & 7)));
+    } else {
+      string_builder_append_char(sb, (char) c);
+    }
+  }
+  string_builder_append_char(sb, '"');
+  return string_builder_to_string_and_free(sb);
+}
+
+// A C identifier for a Wax name, which may have a dot in it.
+String* _cg_identifier(const char* prefix, String* name) {
+  String* identifier = string_concat(prefix, name->cstring);
+  for (int i = 0; i < identifier->length; ++i) {
+    if (identifier->cstring[i] == '.') identifier->cstring[i] = '_';
+  }
+  return identifier;
+}
+
+void _cg_line(CGen* g, String* line) {
+  for (int i = 0; i < g->indent; ++i) {
+    string_builder_append_chars(g->out, "  ");
+  }
+  string_builder_append_chars(g->out, line->cstring);
+  string_builder_append_char(g->out, '\n');
+}
+
+void _cg_line_chars(CGen* g, const char* line) {
+  _cg_line(g, new_string(line));
+}
+
+String* _cg_string_constant(CGen* g, String* value) {
+  Integer* id = (Integer*) dictionary_get(g->string_ids, value);
+  if (id == NULL) {
+    id = wrap_int(g->strings->length);
+    dictionary_set(g->string_ids, value, id);
+    list_add(g->strings, value);
+  }
+  return string_concat3("wax_strings[", _cg_int_string(id->value)->cstring, "]");
+}
+
+// The index of the site for errors at the token's line, in the function being generated.
+String* _cg_site(CGen* g, Token* token) {
+  int line = token_get_line(token);
+  String* key = string_concat3(g->fn->name->cstring, ":", _cg_int_string(line)->cstring);
+  Integer* id = (Integer*) dictionary_get(g->site_ids, key);
+  if (id == NULL) {
+    id = wrap_int(g->site_count++);
+    dictionary_set(g->site_ids, key, id);
+    string_builder_append_chars(g->sites, "  { ");
+    string_builder_append_chars(g->sites, _cg_c_string(token->source->path->cstring)->cstring);
+    string_builder_append_chars(g->sites, ", ");
+    string_builder_append_chars(g->sites, _cg_c_string(g->fn->name->cstring)->cstring);
+    string_builder_append_chars(g->sites, ", ");
+    string_builder_append_int(g->sites, line);
+    string_builder_append_chars(g->sites, " },\n");
+  }
+  return _cg_int_string(id->value);
+}
+
+String* _cg_slot_name(CGen* g, int slot) {
+  if (slot + 1 > g->max_slot) g->max_slot = slot + 1;
+  return string_concat3("S[", _cg_int_string(slot)->cstring, "]");
+}
+
+// Stores a value in a slot unless it is there already. Returns the slot.
+CGenValue _cg_to_slot(CGen* g, int slot, String* code) {
+  String* name = _cg_slot_name(g, slot);
+  if (!string_equals(name, code)) _cg_line(g, string_concat4(name->cstring, " = ", code->cstring, ";"));
+  return _cg_value(name, CGEN_ANY);
+}
+
+// Declares a C temporary for an integer or boolean and initializes it with code.
+CGenValue _cg_to_temp(CGen* g, int type, String* code) {
+  String* name = string_concat("t", _cg_int_string(g->temp_count++)->cstring);
+  _cg_line(g, string_concat5(type == CGEN_INT ? "int64_t " : "int ", name->cstring, " = ", code->cstring, ";"));
+  return _cg_value(name, type);
+}
+
+String* _cg_boxed(CGenValue value) {
+  if (value.type == CGEN_INT) return string_concat3("crt_int(", value.code->cstring, ")");
+  if (value.type == CGEN_BOOL) return string_concat3("crt_bool(", value.code->cstring, ")");
+  return value.code;
+}
+
+// A C expression that is 1 if the value is true as a condition and 0 if it isn't.
+String* _cg_truthy(CGenValue value) {
+  if (value.type == CGEN_INT) return string_concat3("(", value.code->cstring, " != 0)");
+  if (value.type == CGEN_BOOL) return value.code;
+  return string_concat3("crt_truthy(", value.code->cstring, ")");
+}
+
+String* _cg_local_name(CGen* g, int slot) {
+  String* name = g->fn->local_names[slot];
+  return string_concat4("v", _cg_int_string(slot)->cstring, "_", name == NULL ? "local" : name->cstring);
+}
+
+int _cg_is_arithmetic(int op) {
+  return op >= BC_ADD && op <= BC_SHR;
+}
+
+int _cg_is_logical_chain(OpChain* oc) {
+  String* op = ((Token*) list_get(oc->ops, 0))->value;
+  return string_equals_chars(op, "&&") || string_equals_chars(op, "||");
+}
+
+// The function index a call is a direct call to the int version of, or -1.
+int _cg_int_call_target(CGen* g, FunctionInvocation* fi);
+
+int _cg_binary_type(int op, int left, int right) {
+  if (!_cg_is_arithmetic(op)) return CGEN_BOOL;
+  return left == CGEN_INT && right == CGEN_INT ? CGEN_INT : CGEN_ANY;
+}
+
+int _cg_value_type(CGen* g, Node* expr);
+
+// The type of the value the code for an expression computes.
+int _cg_computed_type(CGen* g, Node* expr) {
+  switch (node_kind(expr)) {
+    case NODE_KIND_BOOLEAN_CONSTANT: return CGEN_BOOL;
+    case NODE_KIND_INTEGER_CONSTANT: return CGEN_INT;
+    case NODE_KIND_VARIABLE:
+      {
+        Variable* v = (Variable*) expr;
+        return v->scope == VARIABLE_SCOPE_LOCAL ? g->local_types[v->index] : CGEN_ANY;
+      }
+    case NODE_KIND_OP_CHAIN:
+      {
+        OpChain* oc = (OpChain*) expr;
+        int type = _cg_value_type(g, (Node*) list_get(oc->expressions, 0));
+        int is_logical = _cg_is_logical_chain(oc);
+        for (int i = 0; i < oc->ops->length; ++i) {
+          int right = _cg_value_type(g, (Node*) list_get(oc->expressions, i + 1));
+          if (is_logical) {
+            // The value of a && b is one of the operands.
+            if (right != type) type = CGEN_ANY;
+          } else {
+            type = _cg_binary_type(_bcg_binary_op(((Token*) list_get(oc->ops, i))->value->cstring), type, right);
+          }
+        }
+        return type;
+      }
+    case NODE_KIND_TERNARY:
+      {
+        Ternary* ter = (Ternary*) expr;
+        int type = _cg_value_type(g, ter->true_expr);
+        return type == _cg_value_type(g, ter->false_expr) ? type : CGEN_ANY;
+      }
+    case NODE_KIND_FUNCTION_INVOCATION:
+      return _cg_int_call_target(g, (FunctionInvocation*) expr) == -1 ? CGEN_ANY : CGEN_INT;
+    default:
+      return CGEN_ANY;
+  }
+}
+
+// The type of an expression's value. Where the code computes a boxed value that the type inference
+// pass found to always be an integer or a boolean, the value is unboxed.
+int _cg_value_type(CGen* g, Node* expr) {
+  int type = _cg_computed_type(g, expr);
+  if (type != CGEN_ANY) return type;
+  int known = value_type_of(expr);
+  return known == VALUE_TYPE_INTEGER ? CGEN_INT : known == VALUE_TYPE_BOOLEAN ? CGEN_BOOL : CGEN_ANY;
+}
+
+int _cg_int_call_target(CGen* g, FunctionInvocation* fi) {
+  if (node_kind(fi->root) != NODE_KIND_VARIABLE || ((Variable*) fi->root)->scope != VARIABLE_SCOPE_FUNCTION) return -1;
+  int index = ((Variable*) fi->root)->index;
+  CGenCallable* target = &g->callables[index];
+  if (!target->has_int_version || fi->args->length != target->arg_tokens->length) return -1;
+  for (int i = 0; i < fi->args->length; ++i) {
+    if (_cg_value_type(g, (Node*) list_get(fi->args, i)) != CGEN_INT) return -1;
+  }
+  return index;
+}
+
+// Whether an expression can be computed without boxing anything, given the types of the locals.
+int _cg_is_unboxed(CGen* g, Node* expr) {
+  switch (node_kind(expr)) {
+    case NODE_KIND_BOOLEAN_CONSTANT:
+    case NODE_KIND_INTEGER_CONSTANT:
+      return 1;
+    case NODE_KIND_VARIABLE:
+      return _cg_value_type(g, expr) == CGEN_INT;
+    case NODE_KIND_OP_CHAIN:
+      {
+        OpChain* oc = (OpChain*) expr;
+        for (int i = 0; i < oc->expressions->length; ++i) {
+          if (!_cg_is_unboxed(g, (Node*) list_get(oc->expressions, i))) return 0;
+        }
+        if (_cg_is_logical_chain(oc)) return _cg_value_type(g, expr) != CGEN_ANY;
+        int type = _cg_value_type(g, (Node*) list_get(oc->expressions, 0));
+        for (int i = 0; i < oc->ops->length; ++i) {
+          int op = _bcg_binary_op(((Token*) list_get(oc->ops, i))->value->cstring);
+          int right = _cg_value_type(g, (Node*) list_get(oc->expressions, i + 1));
+          // Only == and != work on booleans, the rest are errors the runtime reports.
+          if (op != BC_EQ && op != BC_NE && (type != CGEN_INT || right != CGEN_INT)) return 0;
+          type = _cg_binary_type(op, type, right);
+        }
+        return 1;
+      }
+    case NODE_KIND_TERNARY:
+      {
+        Ternary* ter = (Ternary*) expr;
+        return _cg_is_unboxed(g, ter->condition) && _cg_is_unboxed(g, ter->true_expr) &&
+          _cg_is_unboxed(g, ter->false_expr) && _cg_value_type(g, expr) != CGEN_ANY;
+      }
+    case NODE_KIND_FUNCTION_INVOCATION:
+      return _cg_int_call_target(g, (FunctionInvocation*) expr) != -1;
+    default:
+      return 0;
+  }
+}
+
+int _cg_is_unboxed_block(CGen* g, List* code) {
+  for (int i = 0; i < code->length; ++i) {
+    Node* line = (Node*) list_get(code, i);
+    switch (node_kind(line)) {
+      case NODE_KIND_ASSIGNMENT:
+        {
+          Assignment* asgn = (Assignment*) line;
+          if (node_kind(asgn->target) != NODE_KIND_VARIABLE) return 0;
+          if (!_cg_is_unboxed(g, asgn->value) || _cg_value_type(g, asgn->value) != CGEN_INT) return 0;
+          if (!string_equals_chars(asgn->assignment_op->value, "=") && !_cg_is_arithmetic(_bcg_assignment_op(asgn->assignment_op->value))) return 0;
+        }
+        break;
+      case NODE_KIND_EXPR_EXEC:
+        if (!_cg_is_unboxed(g, ((ExpressionAsExecutable*) line)->expression)) return 0;
+        break;
+      case NODE_KIND_IF_STATEMENT:
+        {
+          IfStatement* _if = (IfStatement*) line;
+          if (!_cg_is_unboxed(g, _if->condition) || !_cg_is_unboxed_block(g, _if->true_code) || !_cg_is_unboxed_block(g, _if->false_code)) return 0;
+        }
+        break;
+      case NODE_KIND_WHILE_LOOP:
+        if (!_cg_is_unboxed(g, ((WhileLoop*) line)->condition) || !_cg_is_unboxed_block(g, ((WhileLoop*) line)->code)) return 0;
+        break;
+      case NODE_KIND_FOR_LOOP:
+        {
+          ForLoop* fl = (ForLoop*) line;
+          if (fl->condition != NULL && !_cg_is_unboxed(g, fl->condition)) return 0;
+          if (!_cg_is_unboxed_block(g, fl->inits) || !_cg_is_unboxed_block(g, fl->steps) || !_cg_is_unboxed_block(g, fl->code)) return 0;
+        }
+        break;
+      case NODE_KIND_RETURN:
+        {
+          Node* value = ((ReturnStatement*) line)->value;
+          if (value == NULL || !_cg_is_unboxed(g, value) || _cg_value_type(g, value) != CGEN_INT) return 0;
+        }
+        break;
+      case NODE_KIND_BREAK:
+      case NODE_KIND_CONTINUE:
+        break;
+      default:
+        return 0;
+    }
+  }
+  return 1;
+}
+
+// Whether every path through the code ends in a return statement.
+int _cg_block_returns(List* code) {
+  for (int i = 0; i < code->length; ++i) {
+    Node* line = (Node*) list_get(code, i);
+    if (node_kind(line) == NODE_KIND_RETURN) return 1;
+    if (node_kind(line) == NODE_KIND_IF_STATEMENT) {
+      IfStatement* _if = (IfStatement*) line;
+      if (_cg_block_returns(_if->true_code) && _cg_block_returns(_if->false_code)) return 1;
+    }
+  }
+  return 0;
+}
+
+// Notes the locals an expression reads, and which of them might not be assigned yet.
+void _cg_note_reads(CGenCallable* fn, Node* expr, char* assigned) {
+  switch (node_kind(expr)) {
+    case NODE_KIND_VARIABLE:
+      {
+        Variable* v = (Variable*) expr;
+        if (v->scope != VARIABLE_SCOPE_LOCAL) break;
+        if (fn->local_names[v->index] == NULL) fn->local_names[v->index] = v->name;
+        if (!assigned[v->index]) fn->maybe_unassigned[v->index] = 1;
+      }
+      break;
+    case NODE_KIND_INLINE_DICTIONARY:
+      {
+        InlineDictionary* dict = (InlineDictionary*) expr;
+        for (int i = 0; i < dict->values->length; ++i) {
+          _cg_note_reads(fn, (Node*) list_get(dict->values, i), assigned);
+        }
+      }
+      break;
+    case NODE_KIND_DOT_FIELD:
+      _cg_note_reads(fn, ((DotField*) expr)->root, assigned);
+      break;
+    case NODE_KIND_BRACKET_INDEX:
+      _cg_note_reads(fn, ((BracketIndex*) expr)->root, assigned);
+      _cg_note_reads(fn, ((BracketIndex*) expr)->index, assigned);
+      break;
+    case NODE_KIND_OP_CHAIN:
+      {
+        OpChain* oc = (OpChain*) expr;
+        for (int i = 0; i < oc->expressions->length; ++i) {
+          _cg_note_reads(fn, (Node*) list_get(oc->expressions, i), assigned);
+        }
+      }
+      break;
+    case NODE_KIND_TERNARY:
+      _cg_note_reads(fn, ((Ternary*) expr)->condition, assigned);
+      _cg_note_reads(fn, ((Ternary*) expr)->true_expr, assigned);
+      _cg_note_reads(fn, ((Ternary*) expr)->false_expr, assigned);
+      break;
+    case NODE_KIND_FUNCTION_INVOCATION:
+      {
+        FunctionInvocation* fi = (FunctionInvocation*) expr;
+        _cg_note_reads(fn, fi->root, assigned);
+        for (int i = 0; i < fi->args->length; ++i) {
+          _cg_note_reads(fn, (Node*) list_get(fi->args, i), assigned);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+char* _cg_copy_assigned(CGenCallable* fn, char* assigned) {
+  char* copy = (char*) malloc(fn->local_count + 1);
+  memcpy(copy, assigned, fn->local_count + 1);
+  return copy;
+}
+
+/*
+  Walks code in order with the locals that are definitely assigned when it starts, and updates them
+  to the ones that are when it ends. Returns 1 if the code always ends with a jump or return, so the
+  locals after it don't matter. What a loop body assigns doesn't count after the loop, since it may
+  not run at all.
+*/
+int _cg_note_block(CGenCallable* fn, List* code, char* assigned) {
+  int exits = 0;
+  for (int i = 0; i < code->length; ++i) {
+    Node* line = (Node*) list_get(code, i);
+    switch (node_kind(line)) {
+      case NODE_KIND_ASSIGNMENT:
+        {
+          Assignment* asgn = (Assignment*) line;
+          _cg_note_reads(fn, asgn->value, assigned);
+          if (node_kind(asgn->target) == NODE_KIND_VARIABLE) {
+            if (!string_equals_chars(asgn->assignment_op->value, "=")) _cg_note_reads(fn, asgn->target, assigned);
+            Variable* v = (Variable*) asgn->target;
+            if (fn->local_names[v->index] == NULL) fn->local_names[v->index] = v->name;
+            assigned[v->index] = 1;
+          } else {
+            _cg_note_reads(fn, asgn->target, assigned);
+          }
+        }
+        break;
+      case NODE_KIND_EXPR_EXEC:
+        _cg_note_reads(fn, ((ExpressionAsExecutable*) line)->expression, assigned);
+        break;
+      case NODE_KIND_IF_STATEMENT:
+        {
+          IfStatement* _if = (IfStatement*) line;
+          _cg_note_reads(fn, _if->condition, assigned);
+          char* true_assigned = _cg_copy_assigned(fn, assigned);
+          char* false_assigned = _cg_copy_assigned(fn, assigned);
+          int true_exits = _cg_note_block(fn, _if->true_code, true_assigned);
+          int false_exits = _cg_note_block(fn, _if->false_code, false_assigned);
+          for (int j = 0; j < fn->local_count; ++j) {
+            assigned[j] = true_exits ? false_assigned[j] : false_exits ? true_assigned[j] : true_assigned[j] && false_assigned[j];
+          }
+          free(true_assigned);
+          free(false_assigned);
+          if (true_exits && false_exits) exits = 1;
+        }
+        break;
+      case NODE_KIND_WHILE_LOOP:
+        {
+          WhileLoop* wl = (WhileLoop*) line;
+          _cg_note_reads(fn, wl->condition, assigned);
+          char* body_assigned = _cg_copy_assigned(fn, assigned);
+          _cg_note_block(fn, wl->code, body_assigned);
+          free(body_assigned);
+        }
+        break;
+      case NODE_KIND_FOR_LOOP:
+        {
+          ForLoop* fl = (ForLoop*) line;
+          _cg_note_block(fn, fl->inits, assigned);
+          if (fl->condition != NULL) _cg_note_reads(fn, fl->condition, assigned);
+          char* body_assigned = _cg_copy_assigned(fn, assigned);
+          _cg_note_block(fn, fl->code, body_assigned);
+          _cg_note_block(fn, fl->steps, body_assigned);
+          free(body_assigned);
+        }
+        break;
+      case NODE_KIND_FOR_EACH_LOOP:
+        {
+          ForEachLoop* fel = (ForEachLoop*) line;
+          _cg_note_reads(fn, fel->list_expr, assigned);
+          if (fn->local_names[fel->variable_index] == NULL) fn->local_names[fel->variable_index] = fel->variable->value;
+          char* body_assigned = _cg_copy_assigned(fn, assigned);
+          body_assigned[fel->variable_index] = 1;
+          _cg_note_block(fn, fel->code, body_assigned);
+          free(body_assigned);
+        }
+        break;
+      case NODE_KIND_RETURN:
+        if (((ReturnStatement*) line)->value != NULL) _cg_note_reads(fn, ((ReturnStatement*) line)->value, assigned);
+        exits = 1;
+        break;
+      case NODE_KIND_BREAK:
+      case NODE_KIND_CONTINUE:
+        exits = 1;
+        break;
+      default:
+        break;
+    }
+  }
+  return exits;
+}
+
+// Makes a local boxed if any of its uses isn't known to be an integer.
+void _cg_box_locals_in(CGen* g, Node* expr) {
+  switch (node_kind(expr)) {
+    case NODE_KIND_VARIABLE:
+      {
+        Variable* v = (Variable*) expr;
+        if (v->scope == VARIABLE_SCOPE_LOCAL && v->value_type != VALUE_TYPE_INTEGER) g->local_types[v->index] = CGEN_ANY;
+      }
+      break;
+    case NODE_KIND_INLINE_DICTIONARY:
+      {
+        InlineDictionary* dict = (InlineDictionary*) expr;
+        for (int i = 0; i < dict->values->length; ++i) {
+          _cg_box_locals_in(g, (Node*) list_get(dict->values, i));
+        }
+      }
+      break;
+    case NODE_KIND_DOT_FIELD:
+      _cg_box_locals_in(g, ((DotField*) expr)->root);
+      break;
+    case NODE_KIND_BRACKET_INDEX:
+      _cg_box_locals_in(g, ((BracketIndex*) expr)->root);
+      _cg_box_locals_in(g, ((BracketIndex*) expr)->index);
+      break;
+    case NODE_KIND_OP_CHAIN:
+      {
+        OpChain* oc = (OpChain*) expr;
+        for (int i = 0; i < oc->expressions->length; ++i) {
+          _cg_box_locals_in(g, (Node*) list_get(oc->expressions, i));
+        }
+      }
+      break;
+    case NODE_KIND_TERNARY:
+      _cg_box_locals_in(g, ((Ternary*) expr)->condition);
+      _cg_box_locals_in(g, ((Ternary*) expr)->true_expr);
+      _cg_box_locals_in(g, ((Ternary*) expr)->false_expr);
+      break;
+    case NODE_KIND_FUNCTION_INVOCATION:
+      {
+        FunctionInvocation* fi = (FunctionInvocation*) expr;
+        _cg_box_locals_in(g, fi->root);
+        for (int i = 0; i < fi->args->length; ++i) {
+          _cg_box_locals_in(g, (Node*) list_get(fi->args, i));
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void _cg_box_locals(CGen* g, List* code) {
+  for (int i = 0; i < code->length; ++i) {
+    Node* line = (Node*) list_get(code, i);
+    switch (node_kind(line)) {
+      case NODE_KIND_ASSIGNMENT:
+        {
+          // The target of = has the type it's assigned, and the target of x += y the type it's read as.
+          Assignment* asgn = (Assignment*) line;
+          _cg_box_locals_in(g, asgn->target);
+          _cg_box_locals_in(g, asgn->value);
+          String* op = asgn->assignment_op->value;
+          if (node_kind(asgn->target) == NODE_KIND_VARIABLE && !string_equals_chars(op, "=") &&
+              value_type_of_assignment(op, VALUE_TYPE_INTEGER, value_type_of(asgn->value)) != VALUE_TYPE_INTEGER) {
+            g->local_types[((Variable*) asgn->target)->index] = CGEN_ANY;
+          }
+        }
+        break;
+      case NODE_KIND_EXPR_EXEC:
+        _cg_box_locals_in(g, ((ExpressionAsExecutable*) line)->expression);
+        break;
+      case NODE_KIND_IF_STATEMENT:
+        _cg_box_locals_in(g, ((IfStatement*) line)->condition);
+        _cg_box_locals(g, ((IfStatement*) line)->true_code);
+        _cg_box_locals(g, ((IfStatement*) line)->false_code);
+        break;
+      case NODE_KIND_WHILE_LOOP:
+        _cg_box_locals_in(g, ((WhileLoop*) line)->condition);
+        _cg_box_locals(g, ((WhileLoop*) line)->code);
+        break;
+      case NODE_KIND_FOR_LOOP:
+        {
+          ForLoop* fl = (ForLoop*) line;
+          _cg_box_locals(g, fl->inits);
+          if (fl->condition != NULL) _cg_box_locals_in(g, fl->condition);
+          _cg_box_locals(g, fl->steps);
+          _cg_box_locals(g, fl->code);
+        }
+        break;
+      case NODE_KIND_FOR_EACH_LOOP:
+        {
+          ForEachLoop* fel = (ForEachLoop*) line;
+          g->local_types[fel->variable_index] = CGEN_ANY;
+          _cg_box_locals_in(g, fel->list_expr);
+          _cg_box_locals(g, fel->code);
+        }
+        break;
+      case NODE_KIND_RETURN:
+        if (((ReturnStatement*) line)->value != NULL) _cg_box_locals_in(g, ((ReturnStatement*) line)->value);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+int _cg_arg_slot_count(CGenCallable* fn) {
+  return fn->is_method + fn->arg_tokens->length;
+}
+
+void _cg_set_function(CGen* g, CGenCallable* fn, int is_int_version) {
+  g->fn = fn;
+  g->is_int_version = is_int_version;
+  if (!is_int_version) {
+    g->local_types = fn->local_types;
+    return;
+  }
+  g->local_types = g->int_local_types;
+  for (int i = 0; i < fn->local_count; ++i) {
+    g->local_types[i] = CGEN_INT;
+  }
+}
+
+// Whether a module function can have an int version, given the ones that have one so far.
+int _cg_can_have_int_version(CGen* g, CGenCallable* fn) {
+  if (fn->required_arg_count != fn->arg_tokens->length) return 0;
+  for (int i = 0; i < fn->local_count; ++i) {
+    if (fn->maybe_unassigned[i]) return 0;
+  }
+  _cg_set_function(g, fn, 1);
+  return _cg_is_unboxed_block(g, fn->code) && _cg_block_returns(fn->code);
+}
+
+// Works out what is known about each function before any code is generated.
+void _cg_analyze(CGen* g) {
+  int max_locals = 1;
+  for (int i = 0; i < g->callable_count; ++i) {
+    CGenCallable* fn = &g->callables[i];
+    fn->local_names = (String**) malloc_ptr_array(fn->local_count + 1);
+    fn->maybe_unassigned = (char*) malloc_clean(fn->local_count + 1);
+    char* assigned = (char*) malloc_clean(fn->local_count + 1);
+    if (fn->is_method) fn->local_names[0] = new_string("this");
+    for (int j = 0; j < _cg_arg_slot_count(fn); ++j) {
+      if (j >= fn->is_method) fn->local_names[j] = ((Token*) list_get(fn->arg_tokens, j - fn->is_method))->value;
+      assigned[j] = 1;
+    }
+    for (int j = fn->required_arg_count; j < fn->arg_tokens->length; ++j) {
+      _cg_note_reads(fn, (Node*) list_get(fn->arg_default_values, j), assigned);
+    }
+    _cg_note_block(fn, fn->code, assigned);
+    free(assigned);
+    if (fn->local_count > max_locals) max_locals = fn->local_count;
+    fn->has_int_version = !fn->is_method;
+  }
+  g->int_local_types = (int*) malloc(sizeof(int) * (max_locals + 1));
+
+  // Start from every module function having an int version and drop the ones that can't until none change.
+  int changed = 1;
+  while (changed) {
+    changed = 0;
+    for (int i = 0; i < g->callable_count; ++i) {
+      CGenCallable* fn = &g->callables[i];
+      if (fn->has_int_version && !_cg_can_have_int_version(g, fn)) {
+        fn->has_int_version = 0;
+        changed = 1;
+      }
+    }
+  }
+
+  // The regular versions have boxed arguments. Another local is an integer if it's one everywhere it's used.
+  for (int i = 0; i < g->callable_count; ++i) {
+    CGenCallable* fn = &g->callables[i];
+    fn->local_types = (int*) malloc(sizeof(int) * (fn->local_count + 1));
+    for (int j = 0; j < fn->local_count; ++j) {
+      fn->local_types[j] = j < _cg_arg_slot_count(fn) ? CGEN_ANY : CGEN_INT;
+    }
+    _cg_set_function(g, fn, 0);
+    _cg_box_locals(g, fn->code);
+  }
+}
+
+CGenValue _cg_expression(CGen* g, Node* expr, int slot);
+void _cg_block(CGen* g, List* code, int slot);
+
+CGenValue _cg_binary(CGen* g, int op, CGenValue left, CGenValue right, int slot, Token* token) {
+  String* a = left.code;
+  String* b = right.code;
+  g->operation_count++;
+  if (op == BC_EQ || op == BC_NE) {
+    const char* c_op = op == BC_EQ ? " == " : " != ";
+    if (left.type != CGEN_ANY && right.type != CGEN_ANY) g->specialized_count++;
+    if (left.type != CGEN_ANY && left.type == right.type) {
+      return _cg_to_temp(g, CGEN_BOOL, string_concat5("(", a->cstring, c_op, b->cstring, ")"));
+    }
+    // An integer is never equal to a boolean.
+    if (left.type != CGEN_ANY && right.type != CGEN_ANY) return _cg_value(new_string(op == BC_EQ ? "0" : "1"), CGEN_BOOL);
+    String* equals = string_concat5("crt_equals(", _cg_boxed(left)->cstring, ", ", _cg_boxed(right)->cstring, ")");
+    return _cg_to_temp(g, CGEN_BOOL, op == BC_EQ ? equals : string_concat("!", equals->cstring));
+  }
+
+  String* site = _cg_site(g, token);
+  String* crt_op = string_concat("CRT_", bytecode_op_name(op));
+  if (left.type != CGEN_INT || right.type != CGEN_INT) {
+    if (!_cg_is_arithmetic(op)) {
+      return _cg_to_temp(g, CGEN_BOOL, string_concat6("crt_compare(", crt_op->cstring, ", ", _cg_boxed(left)->cstring, ", ",
+        string_concat4(_cg_boxed(right)->cstring, ", ", site->cstring, ")")->cstring));
+    }
+    return _cg_to_slot(g, slot, string_concat6("crt_binary(", crt_op->cstring, ", ", _cg_boxed(left)->cstring, ", ",
+      string_concat4(_cg_boxed(right)->cstring, ", ", site->cstring, ")")->cstring));
+  }
+
+  g->specialized_count++;
+  const char* checked = NULL; // a runtime function that takes the operands and the site
+  const char* c_op = NULL; // or a C operator that can't overflow
+  switch (op) {
+    case BC_ADD: c_op = " + "; break;
+    case BC_SUB: c_op = " - "; break;
+    case BC_MUL: c_op = " * "; break;
+    case BC_DIV: checked = "crt_idiv("; break;
+    case BC_MOD: checked = "crt_imod("; break;
+    case BC_POW: checked = "crt_ipow("; break;
+    case BC_BIT_AND: c_op = " & "; break;
+    case BC_BIT_OR: c_op = " | "; break;
+    case BC_BIT_XOR: c_op = " ^ "; break;
+    case BC_SHL: checked = "crt_ishl("; break;
+    case BC_SHR: checked = "crt_ishr("; break;
+    case BC_LT: c_op = " < "; break;
+    case BC_GT: c_op = " > "; break;
+    case BC_LE: c_op = " <= "; break;
+    default: c_op = " >= "; break;
+  }
+  if (checked != NULL) {
+    return _cg_to_temp(g, CGEN_INT, string_concat6(checked, a->cstring, ", ", b->cstring, ", ", string_concat(site->cstring, ")")->cstring));
+  }
+  String* code = string_concat5("(", a->cstring, c_op, b->cstring, ")");
+  if (!_cg_is_arithmetic(op)) return _cg_to_temp(g, CGEN_BOOL, code);
+  if (op == BC_ADD || op == BC_SUB || op == BC_MUL) code = string_concat5("crt_i32(", code->cstring, ", ", site->cstring, ")");
+  return _cg_to_temp(g, CGEN_INT, code);
+}
+
+// A boxed value as an int64_t or an int, for a value that is known to be one.
+String* _cg_unboxed(String* code, int type) {
+  if (type == CGEN_INT) return string_concat3("crt_int_value(", code->cstring, ")");
+  return string_concat3("(", code->cstring, " == CRT_TRUE)");
+}
+
+// Converts a value to the type of an expression it is one of the possible values of.
+String* _cg_convert(CGenValue value, int type) {
+  if (type == CGEN_ANY) return _cg_boxed(value);
+  return value.type == CGEN_ANY ? _cg_unboxed(value.code, type) : value.code;
+}
+
+// a && b && c is the first falsy operand, or c if there is none. Evaluates the operands into one result.
+CGenValue _cg_logical_chain(CGen* g, OpChain* oc, int slot) {
+  int type = _cg_value_type(g, (Node*) oc);
+  int is_and = ((Token*) list_get(oc->ops, 0))->value->cstring[0] == '&';
+  CGenValue first = _cg_expression(g, (Node*) list_get(oc->expressions, 0), slot);
+  CGenValue result;
+  if (type == CGEN_ANY) {
+    result = _cg_to_slot(g, slot, _cg_boxed(first));
+  } else {
+    result = _cg_to_temp(g, type, _cg_convert(first, type));
+  }
+  for (int i = 1; i < oc->expressions->length; ++i) {
+    String* truthy = _cg_truthy(result);
+    _cg_line(g, string_concat3(is_and ? "if (" : "if (!", truthy->cstring, ") {"));
+    g->indent++;
+    CGenValue next = _cg_expression(g, (Node*) list_get(oc->expressions, i), slot);
+    if (!string_equals(result.code, _cg_convert(next, type))) {
+      _cg_line(g, string_concat4(result.code->cstring, " = ", _cg_convert(next, type)->cstring, ";"));
+    }
+  }
+  for (int i = 1; i < oc->expressions->length; ++i) {
+    g->indent--;
+    _cg_line_chars(g, "}");
+  }
+  return result;
+}
+
+CGenValue _cg_invocation(CGen* g, FunctionInvocation* fi, int slot) {
+  Node* root = fi->root;
+  int argc = fi->args->length;
+  String* argc_code = _cg_int_string(argc);
+
+  int int_target = _cg_int_call_target(g, fi);
+  if (int_target != -1) {
+    StringBuilder* sb = new_string_builder();
+    string_builder_append_chars(sb, g->callables[int_target].c_name->cstring);
+    string_builder_append_chars(sb, "_int(");
+    String* site = _cg_site(g, fi->open_paren);
+    for (int i = 0; i < argc; ++i) {
+      CGenValue arg = _cg_expression(g, (Node*) list_get(fi->args, i), slot + i);
+      string_builder_append_chars(sb, arg.code->cstring);
+      string_builder_append_chars(sb, ", ");
+    }
+    string_builder_append_chars(sb, site->cstring);
+    string_builder_append_char(sb, ')');
+    return _cg_to_temp(g, CGEN_INT, string_builder_to_string_and_free(sb));
+  }
+
+  if (node_kind(root) == NODE_KIND_VARIABLE && ((Variable*) root)->scope == VARIABLE_SCOPE_FUNCTION) {
+    // The module's own functions are called directly, with the arguments where the callee's frame starts.
+    int index = ((Variable*) root)->index;
+    CGenCallable* target = &g->callables[index];
+    for (int i = 0; i < argc; ++i) {
+      _cg_to_slot(g, slot + i, _cg_boxed(_cg_expression(g, (Node*) list_get(fi->args, i), slot + i)));
+    }
+    String* site = _cg_site(g, fi->open_paren);
+    if (argc < target->required_arg_count || argc > target->arg_tokens->length) {
+      _cg_line(g, string_concat5("crt_fail(", site->cstring, ", crt_arg_count_error(crt_functions[", _cg_int_string(index)->cstring,
+        string_concat3("], ", argc_code->cstring, "));")->cstring));
+      return _cg_value(new_string("CRT_NULL"), CGEN_ANY);
+    }
+    String* slot_name = _cg_slot_name(g, slot);
+    return _cg_to_slot(g, slot, string_concat6(target->c_name->cstring, "(&", slot_name->cstring, ", ", argc_code->cstring,
+      string_concat3(", ", site->cstring, ")")->cstring));
+  }
+
+  // Anything else has the function or the root of the method call in the slot before the arguments.
+  String* name = NULL;
+  if (node_kind(root) == NODE_KIND_DOT_FIELD) {
+    _cg_to_slot(g, slot, _cg_boxed(_cg_expression(g, ((DotField*) root)->root, slot)));
+    name = _cg_string_constant(g, ((DotField*) root)->field_token->value);
+  } else {
+    _cg_to_slot(g, slot, _cg_boxed(_cg_expression(g, root, slot)));
+  }
+  for (int i = 0; i < argc; ++i) {
+    _cg_to_slot(g, slot + 1 + i, _cg_boxed(_cg_expression(g, (Node*) list_get(fi->args, i), slot + 1 + i)));
+  }
+  String* site = _cg_site(g, fi->open_paren);
+  String* slot_name = _cg_slot_name(g, slot);
+  if (name != NULL) {
+    return _cg_to_slot(g, slot, string_concat6("crt_call_method(&", slot_name->cstring, ", ", argc_code->cstring, ", ",
+      string_concat4(name->cstring, ", ", site->cstring, ")")->cstring));
+  }
+  return _cg_to_slot(g, slot, string_concat6("crt_call(&", slot_name->cstring, ", ", argc_code->cstring, ", ", string_concat(site->cstring, ")")->cstring));
+}
+
+// The index of a dictionary constant, built once in wax_init.
+int _cg_dictionary_constant(CGen* g, InlineDictionary* dict);
+
+// The C expression for the value of a constant node.
+String* _cg_constant(CGen* g, Node* node) {
+  switch (node_kind(node)) {
+    case NODE_KIND_BOOLEAN_CONSTANT: return new_string(((BooleanConstant*) node)->value ? "CRT_TRUE" : "CRT_FALSE");
+    case NODE_KIND_INTEGER_CONSTANT: return string_concat3("crt_int(", _cg_int_string(((IntegerConstant*) node)->value)->cstring, ")");
+    case NODE_KIND_STRING_CONSTANT: return _cg_string_constant(g, ((StringConstant*) node)->value);
+    case NODE_KIND_INLINE_DICTIONARY:
+      return string_concat3("wax_dictionaries[", _cg_int_string(_cg_dictionary_constant(g, (InlineDictionary*) node))->cstring, "]");
+    default: return new_string("CRT_NULL");
+  }
+}
+
+int _cg_dictionary_constant(CGen* g, InlineDictionary* dict) {
+  List* values = new_list();
+  for (int i = 0; i < dict->values->length; ++i) {
+    list_add(values, _cg_constant(g, (Node*) list_get(dict->values, i)));
+  }
+  int index = g->dictionary_count++;
+  String* name = string_concat3("wax_dictionaries[", _cg_int_string(index)->cstring, "]");
+  StringBuilder* sb = g->dictionaries;
+  string_builder_append_chars(sb, "  ");
+  string_builder_append_chars(sb, name->cstring);
+  string_builder_append_chars(sb, " = new_dictionary();\n  gc_save_item(");
+  string_builder_append_chars(sb, name->cstring);
+  string_builder_append_chars(sb, ");\n");
+  for (int i = 0; i < dict->keys->length; ++i) {
+    string_builder_append_chars(sb, "  dictionary_set(");
+    string_builder_append_chars(sb, name->cstring);
+    string_builder_append_chars(sb, ", ");
+    string_builder_append_chars(sb, _cg_string_constant(g, ((StringConstant*) list_get(dict->keys, i))->value)->cstring);
+    string_builder_append_chars(sb, ", ");
+    string_builder_append_chars(sb, list_get_string(values, i)->cstring);
+    string_builder_append_chars(sb, ");\n");
+  }
+  return index;
+}
+
+String* _cg_field_of_this(CGenValue root, int field_index) {
+  return string_concat5("((CrtObject*) ", root.code->cstring, ")->fields[", _cg_int_string(field_index)->cstring, "]");
+}
+
+CGenValue _cg_computed_expression(CGen* g, Node* expr, int slot) {
+  switch (node_kind(expr)) {
+    case NODE_KIND_NULL_CONSTANT:
+      return _cg_value(new_string("CRT_NULL"), CGEN_ANY);
+    case NODE_KIND_BOOLEAN_CONSTANT:
+      return _cg_value(new_string(((BooleanConstant*) expr)->value ? "1" : "0"), CGEN_BOOL);
+    case NODE_KIND_INTEGER_CONSTANT:
+      {
+        // As an int64_t, so arithmetic on constants can't overflow in C and crt_i32 sees the result.
+        String* code = _cg_int_string(((IntegerConstant*) expr)->value);
+        return _cg_value(string_concat3("INT64_C(", code->cstring, ")"), CGEN_INT);
+      }
+    case NODE_KIND_STRING_CONSTANT:
+      return _cg_value(_cg_string_constant(g, ((StringConstant*) expr)->value), CGEN_ANY);
+    case NODE_KIND_VARIABLE:
+      {
+        // Locals can only change in statements, so reading one where the value is used is the same
+        // as reading it here.
+        Variable* v = (Variable*) expr;
+        String* index = _cg_int_string(v->index);
+        switch (v->scope) {
+          case VARIABLE_SCOPE_LOCAL:
+            if (g->local_types[v->index] == CGEN_INT) return _cg_value(_cg_local_name(g, v->index), CGEN_INT);
+            return _cg_value(string_concat3("L[", index->cstring, "]"), CGEN_ANY);
+          case VARIABLE_SCOPE_FUNCTION:
+            return _cg_value(string_concat3("(CrtValue) crt_functions[", index->cstring, "]"), CGEN_ANY);
+          case VARIABLE_SCOPE_CLASS:
+            return _cg_value(string_concat3("(CrtValue) crt_classes[", index->cstring, "]"), CGEN_ANY);
+          default:
+            return _cg_to_slot(g, slot, string_concat5("crt_global(", _cg_c_string(v->name->cstring)->cstring, ", ",
+              _cg_site(g, expr->first_token)->cstring, ")"));
+        }
+      }
+    case NODE_KIND_INLINE_DICTIONARY:
+      {
+        InlineDictionary* dict = (InlineDictionary*) expr;
+        if (dict->is_constant) {
+          return _cg_to_slot(g, slot, string_concat3("(CrtValue) crt_clone_dictionary(", _cg_constant(g, expr)->cstring, ")"));
+        }
+        int count = dict->keys->length;
+        for (int i = 0; i < count; ++i) {
+          _cg_to_slot(g, slot + 1 + i, _cg_boxed(_cg_expression(g, (Node*) list_get(dict->values, i), slot + 1 + i)));
+        }
+        CGenValue result = _cg_to_slot(g, slot, new_string("(CrtValue) crt_new_dictionary()"));
+        for (int i = 0; i < count; ++i) {
+          String* key = _cg_string_constant(g, ((StringConstant*) list_get(dict->keys, i))->value);
+          _cg_line(g, string_concat6("dictionary_set((Dictionary*) ", result.code->cstring, ", ", key->cstring, ", ",
+            string_concat(_cg_slot_name(g, slot + 1 + i)->cstring, ");")->cstring));
+        }
+        return result;
+      }
+    case NODE_KIND_DOT_FIELD:
+      {
+        DotField* df = (DotField*) expr;
+        CGenValue root = _cg_expression(g, df->root, slot);
+        // A field can change before the value is used, so it is read into a slot.
+        if (df->field_index != -1) return _cg_to_slot(g, slot, _cg_field_of_this(root, df->field_index));
+        return _cg_to_slot(g, slot, string_concat6("crt_dot_get(", _cg_boxed(root)->cstring, ", ",
+          _cg_string_constant(g, df->field_token->value)->cstring, ", ", string_concat(_cg_site(g, df->dot_token)->cstring, ")")->cstring));
+      }
+    case NODE_KIND_BRACKET_INDEX:
+      {
+        BracketIndex* bi = (BracketIndex*) expr;
+        CGenValue root = _cg_expression(g, bi->root, slot);
+        CGenValue index = _cg_expression(g, bi->index, slot + 1);
+        return _cg_to_slot(g, slot, string_concat6("crt_index_get(", _cg_boxed(root)->cstring, ", ", _cg_boxed(index)->cstring, ", ",
+          string_concat(_cg_site(g, bi->bracket_token)->cstring, ")")->cstring));
+      }
+    case NODE_KIND_OP_CHAIN:
+      {
+        OpChain* oc = (OpChain*) expr;
+        if (_cg_is_logical_chain(oc)) return _cg_logical_chain(g, oc, slot);
+        CGenValue value = _cg_expression(g, (Node*) list_get(oc->expressions, 0), slot);
+        for (int i = 0; i < oc->ops->length; ++i) {
+          Token* op = (Token*) list_get(oc->ops, i);
+          CGenValue right = _cg_expression(g, (Node*) list_get(oc->expressions, i + 1), slot + 1);
+          value = _cg_binary(g, _bcg_binary_op(op->value->cstring), value, right, slot, op);
+        }
+        return value;
+      }
+    case NODE_KIND_TERNARY:
+      {
+        Ternary* ter = (Ternary*) expr;
+        int type = _cg_value_type(g, expr);
+        String* condition = _cg_truthy(_cg_expression(g, ter->condition, slot));
+        String* result;
+        if (type == CGEN_ANY) {
+          result = _cg_slot_name(g, slot);
+        } else {
+          result = string_concat("t", _cg_int_string(g->temp_count++)->cstring);
+          _cg_line(g, string_concat3(type == CGEN_INT ? "int64_t " : "int ", result->cstring, ";"));
+        }
+        _cg_line(g, string_concat3("if (", condition->cstring, ") {"));
+        for (int branch = 0; branch < 2; ++branch) {
+          g->indent++;
+          CGenValue value = _cg_expression(g, branch == 0 ? ter->true_expr : ter->false_expr, slot);
+          if (!string_equals(result, _cg_convert(value, type))) {
+            _cg_line(g, string_concat4(result->cstring, " = ", _cg_convert(value, type)->cstring, ";"));
+          }
+          g->indent--;
+          _cg_line_chars(g, branch == 0 ? "} else {" : "}");
+        }
+        return _cg_value(result, type);
+      }
+    case NODE_KIND_FUNCTION_INVOCATION:
+      return _cg_invocation(g, (FunctionInvocation*) expr, slot);
+    default:
+      return _cg_value(new_string("CRT_NULL"), CGEN_ANY);
+  }
+}
+
+// Generates an expression and returns its value with the type _cg_value_type says it has.
+CGenValue _cg_expression(CGen* g, Node* expr, int slot) {
+  CGenValue value = _cg_computed_expression(g, expr, slot);
+  int type = _cg_value_type(g, expr);
+  if (value.type != CGEN_ANY || type == CGEN_ANY) return value;
+  return _cg_to_temp(g, type, _cg_unboxed(value.code, type));
+}
+
+void _cg_store_local(CGen* g, int index, CGenValue value) {
+  if (g->local_types[index] == CGEN_INT) {
+    _cg_line(g, string_concat4(_cg_local_name(g, index)->cstring, " = ", _cg_convert(value, CGEN_INT)->cstring, ";"));
+  } else {
+    _cg_line(g, string_concat5("L[", _cg_int_string(index)->cstring, "] = ", _cg_boxed(value)->cstring, ";"));
+  }
+}
+
+void _cg_assignment(CGen* g, Assignment* asgn, int slot) {
+  Node* target = asgn->target;
+  int compound_op = string_equals_chars(asgn->assignment_op->value, "=") ? -1 : _bcg_assignment_op(asgn->assignment_op->value);
+  switch (node_kind(target)) {
+    case NODE_KIND_VARIABLE:
+      {
+        int index = ((Variable*) target)->index;
+        CGenValue value = _cg_expression(g, asgn->value, slot);
+        if (compound_op != -1) value = _cg_binary(g, compound_op, _cg_expression(g, target, slot), value, slot, asgn->assignment_op);
+        _cg_store_local(g, index, value);
+      }
+      break;
+    case NODE_KIND_DOT_FIELD:
+      {
+        DotField* df = (DotField*) target;
+        CGenValue root = _cg_to_slot(g, slot, _cg_boxed(_cg_expression(g, df->root, slot)));
+        CGenValue value;
+        if (compound_op == -1) {
+          value = _cg_expression(g, asgn->value, slot + 1);
+        } else {
+          CGenValue current = df->field_index != -1
+            ? _cg_to_slot(g, slot + 1, _cg_field_of_this(root, df->field_index))
+            : _cg_to_slot(g, slot + 1, string_concat6("crt_dot_get(", root.code->cstring, ", ", _cg_string_constant(g, df->field_token->value)->cstring,
+                ", ", string_concat(_cg_site(g, df->dot_token)->cstring, ")")->cstring));
+          value = _cg_binary(g, compound_op, current, _cg_expression(g, asgn->value, slot + 2), slot + 1, asgn->assignment_op);
+        }
+        if (df->field_index != -1) {
+          _cg_line(g, string_concat4(_cg_field_of_this(root, df->field_index)->cstring, " = ", _cg_boxed(value)->cstring, ";"));
+        } else {
+          _cg_line(g, string_concat6("crt_dot_set(", root.code->cstring, ", ", _cg_string_constant(g, df->field_token->value)->cstring, ", ",
+            string_concat4(_cg_boxed(value)->cstring, ", ", _cg_site(g, asgn->assignment_op)->cstring, ");")->cstring));
+        }
+      }
+      break;
+    case NODE_KIND_BRACKET_INDEX:
+      {
+        BracketIndex* bi = (BracketIndex*) target;
+        String* root = _cg_to_slot(g, slot, _cg_boxed(_cg_expression(g, bi->root, slot))).code;
+        String* index = _cg_to_slot(g, slot + 1, _cg_boxed(_cg_expression(g, bi->index, slot + 1))).code;
+        CGenValue value;
+        if (compound_op == -1) {
+          value = _cg_expression(g, asgn->value, slot + 2);
+        } else {
+          CGenValue current = _cg_to_slot(g, slot + 2, string_concat6("crt_index_get(", root->cstring, ", ", index->cstring, ", ",
+            string_concat(_cg_site(g, bi->bracket_token)->cstring, ")")->cstring));
+          value = _cg_binary(g, compound_op, current, _cg_expression(g, asgn->value, slot + 3), slot + 2, asgn->assignment_op);
+        }
+        _cg_line(g, string_concat6("crt_index_set(", root->cstring, ", ", index->cstring, ", ",
+          string_concat4(_cg_boxed(value)->cstring, ", ", _cg_site(g, asgn->assignment_op)->cstring, ");")->cstring));
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// The start of a loop iteration in the regular version, where the GC may run.
+void _cg_safepoint(CGen* g) {
+  if (!g->is_int_version) _cg_line_chars(g, "if (crt_allocations >= CRT_GC_INTERVAL) crt_safepoint();");
+}
+
+// Generates a loop body, with break and continue going to the loop being generated.
+void _cg_loop_body(CGen* g, List* code, int slot, int label) {
+  int outer_label = g->loop_label;
+  int outer_used = g->loop_label_used;
+  g->loop_label = label;
+  g->loop_label_used = 0;
+  _cg_block(g, code, slot);
+  if (label != -1 && g->loop_label_used) _cg_line(g, string_concat3("continue_", _cg_int_string(label)->cstring, ":;"));
+  g->loop_label = outer_label;
+  g->loop_label_used = outer_used;
+}
+
+String* _cg_return(CGen* g, String* value) {
+  if (g->is_int_version) return string_concat3("return crt_leave_int(", value->cstring, ");");
+  return string_concat3("return crt_leave(caller_end, ", value->cstring, ");");
+}
+
+void _cg_statement(CGen* g, Node* line, int slot) {
+  switch (node_kind(line)) {
+    case NODE_KIND_ASSIGNMENT:
+      _cg_assignment(g, (Assignment*) line, slot);
+      break;
+    case NODE_KIND_EXPR_EXEC:
+      _cg_expression(g, ((ExpressionAsExecutable*) line)->expression, slot);
+      break;
+    case NODE_KIND_IF_STATEMENT:
+      {
+        IfStatement* _if = (IfStatement*) line;
+        String* condition = _cg_truthy(_cg_expression(g, _if->condition, slot));
+        _cg_line(g, string_concat3("if (", condition->cstring, ") {"));
+        g->indent++;
+        _cg_block(g, _if->true_code, slot);
+        g->indent--;
+        if (_if->false_code->length > 0) {
+          _cg_line_chars(g, "} else {");
+          g->indent++;
+          _cg_block(g, _if->false_code, slot);
+          g->indent--;
+        }
+        _cg_line_chars(g, "}");
+      }
+      break;
+    case NODE_KIND_WHILE_LOOP:
+      {
+        WhileLoop* wl = (WhileLoop*) line;
+        _cg_line_chars(g, "for (;;) {");
+        g->indent++;
+        _cg_safepoint(g);
+        _cg_line(g, string_concat3("if (!", _cg_truthy(_cg_expression(g, wl->condition, slot))->cstring, ") break;"));
+        _cg_loop_body(g, wl->code, slot, -1);
+        g->indent--;
+        _cg_line_chars(g, "}");
+      }
+      break;
+    case NODE_KIND_FOR_LOOP:
+      {
+        // continue has to run the steps, so it jumps to a label before them.
+        ForLoop* fl = (ForLoop*) line;
+        _cg_block(g, fl->inits, slot);
+        _cg_line_chars(g, "for (;;) {");
+        g->indent++;
+        _cg_safepoint(g);
+        if (fl->condition != NULL) {
+          _cg_line(g, string_concat3("if (!", _cg_truthy(_cg_expression(g, fl->condition, slot))->cstring, ") break;"));
+        }
+        _cg_loop_body(g, fl->code, slot, g->label_count++);
+        _cg_block(g, fl->steps, slot);
+        g->indent--;
+        _cg_line_chars(g, "}");
+      }
+      break;
+    case NODE_KIND_FOR_EACH_LOOP:
+      {
+        // The list stays in its slot while the loop runs, and the loop reads its length every time
+        // around since the body can add to it.
+        ForEachLoop* fel = (ForEachLoop*) line;
+        String* list = _cg_to_slot(g, slot, _cg_boxed(_cg_expression(g, fel->list_expr, slot))).code;
+        _cg_line(g, string_concat5("crt_iterate(", list->cstring, ", ", _cg_site(g, line->first_token)->cstring, ");"));
+        String* position = string_concat("p", _cg_int_string(g->temp_count++)->cstring);
+        _cg_line(g, string_concat6("for (int ", position->cstring, " = 0; ", position->cstring, " < ((List*) ",
+          string_concat4(list->cstring, ")->length; ++", position->cstring, ") {")->cstring));
+        g->indent++;
+        _cg_safepoint(g);
+        _cg_line(g, string_concat6("L[", _cg_int_string(fel->variable_index)->cstring, "] = ((List*) ", list->cstring, ")->items[",
+          string_concat(position->cstring, "];")->cstring));
+        _cg_loop_body(g, fel->code, slot + 1, -1);
+        g->indent--;
+        _cg_line_chars(g, "}");
+      }
+      break;
+    case NODE_KIND_RETURN:
+      {
+        Node* value = ((ReturnStatement*) line)->value;
+        if (value == NULL) {
+          _cg_line(g, _cg_return(g, new_string(g->fn->is_constructor ? "L[0]" : "CRT_NULL")));
+        } else {
+          CGenValue result = _cg_expression(g, value, slot);
+          _cg_line(g, _cg_return(g, g->is_int_version ? result.code : _cg_boxed(result)));
+        }
+      }
+      break;
+    case NODE_KIND_BREAK:
+      _cg_line_chars(g, "break;");
+      break;
+    case NODE_KIND_CONTINUE:
+      if (g->loop_label == -1) {
+        _cg_line_chars(g, "continue;");
+      } else {
+        _cg_line(g, string_concat3("goto continue_", _cg_int_string(g->loop_label)->cstring, ";"));
+        g->loop_label_used = 1;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void _cg_block(CGen* g, List* code, int slot) {
+  for (int i = 0; i < code->length; ++i) {
+    _cg_statement(g, (Node*) list_get(code, i), slot);
+  }
+}
+
+// The int version's signature, or the regular version's if is_int_version is 0.
+String* _cg_signature(CGen* g, CGenCallable* fn, int is_int_version) {
+  if (!is_int_version) return string_concat3("CrtValue ", fn->c_name->cstring, "(CrtValue* L, int argc, int site)");
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, "int64_t ");
+  string_builder_append_chars(sb, fn->c_name->cstring);
+  string_builder_append_chars(sb, "_int(");
+  for (int i = 0; i < fn->arg_tokens->length; ++i) {
+    g->fn = fn;
+    string_builder_append_chars(sb, "int64_t ");
+    string_builder_append_chars(sb, _cg_local_name(g, i)->cstring);
+    string_builder_append_chars(sb, ", ");
+  }
+  string_builder_append_chars(sb, "int site)");
+  return string_builder_to_string_and_free(sb);
+}
+
+// Generates one version of a function and appends it to output.
+void _cg_function(CGen* g, CGenCallable* fn, int is_int_version, StringBuilder* output) {
+  _cg_set_function(g, fn, is_int_version);
+  g->out = new_string_builder();
+  g->indent = 1;
+  g->max_slot = 0;
+  g->temp_count = 0;
+  g->label_count = 0;
+  g->loop_label = -1;
+  g->loop_label_used = 0;
+
+  // Optional arguments that weren't passed get their default values first.
+  int first_arg = fn->is_method;
+  for (int i = fn->required_arg_count; i < fn->arg_tokens->length; ++i) {
+    _cg_line(g, string_concat3("if (argc < ", _cg_int_string(first_arg + i + 1)->cstring, ") {"));
+    g->indent++;
+    _cg_store_local(g, first_arg + i, _cg_expression(g, (Node*) list_get(fn->arg_default_values, i), 0));
+    g->indent--;
+    _cg_line_chars(g, "}");
+  }
+  _cg_block(g, fn->code, 0);
+  if (!is_int_version && !_cg_block_returns(fn->code)) _cg_line(g, _cg_return(g, new_string(fn->is_constructor ? "L[0]" : "CRT_NULL")));
+
+  string_builder_append_chars(output, _cg_signature(g, fn, is_int_version)->cstring);
+  string_builder_append_chars(output, " {\n");
+  if (is_int_version) {
+    string_builder_append_chars(output, "  crt_enter_int(site);\n");
+  } else {
+    if (fn->has_int_version) {
+      // The int version takes over whenever the arguments are integers.
+      int arg_count = fn->arg_tokens->length;
+      string_builder_append_chars(output, "  if (argc == ");
+      string_builder_append_int(output, arg_count);
+      for (int i = 0; i < arg_count; ++i) {
+        string_builder_append_chars(output, " && crt_is_int(L[");
+        string_builder_append_int(output, i);
+        string_builder_append_chars(output, "])");
+      }
+      string_builder_append_chars(output, ") {\n    return crt_int(");
+      string_builder_append_chars(output, fn->c_name->cstring);
+      string_builder_append_chars(output, "_int(");
+      for (int i = 0; i < arg_count; ++i) {
+        string_builder_append_chars(output, "crt_int_value(L[");
+        string_builder_append_int(output, i);
+        string_builder_append_chars(output, "]), ");
+      }
+      string_builder_append_chars(output, "site));\n  }\n");
+    }
+    string_builder_append_chars(output, "  CrtValue* caller_end = crt_enter(L, argc, ");
+    string_builder_append_int(output, fn->local_count + g->max_slot);
+    string_builder_append_chars(output, ", site);\n");
+    if (g->max_slot > 0) {
+      string_builder_append_chars(output, "  CrtValue* S = L + ");
+      string_builder_append_int(output, fn->local_count);
+      string_builder_append_chars(output, ";\n");
+    }
+  }
+  int first_local = is_int_version ? fn->arg_tokens->length : 0;
+  for (int i = first_local; i < fn->local_count; ++i) {
+    if (g->local_types[i] != CGEN_INT) continue;
+    string_builder_append_chars(output, "  int64_t ");
+    string_builder_append_chars(output, _cg_local_name(g, i)->cstring);
+    string_builder_append_chars(output, " = 0;\n");
+  }
+  string_builder_append_chars(output, string_builder_to_string_and_free(g->out)->cstring);
+  string_builder_append_chars(output, "}\n\n");
+}
+
+void _cg_add_callable(CGen* g, String* name, Node* node, Token* first_token, int is_method, List* arg_tokens, List* arg_default_values, List* code, int local_count) {
+  CGenCallable* fn = &g->callables[g->callable_count];
+  memset(fn, 0, sizeof(CGenCallable));
+  fn->name = name;
+  fn->c_name = _cg_identifier(string_concat3("wax_", _cg_int_string(g->callable_count)->cstring, "_")->cstring, name);
+  fn->first_token = first_token;
+  fn->code = code;
+  fn->arg_tokens = arg_tokens;
+  fn->arg_default_values = arg_default_values;
+  fn->local_count = local_count;
+  fn->is_method = is_method;
+  fn->is_constructor = node_kind(node) == NODE_KIND_CONSTRUCTOR_DEFINITION;
+  while (fn->required_arg_count < arg_tokens->length && list_get(arg_default_values, fn->required_arg_count) == NULL) {
+    fn->required_arg_count++;
+  }
+  g->callable_count++;
+}
+
+// The statements of wax_init that create the functions and classes.
+void _cg_init_entities(CGen* g, StringBuilder* sb) {
+  for (int i = 0; i < g->callable_count; ++i) {
+    CGenCallable* fn = &g->callables[i];
+    string_builder_append_chars(sb, "  crt_functions[");
+    string_builder_append_int(sb, i);
+    string_builder_append_chars(sb, "] = crt_new_function(new_string(");
+    string_builder_append_chars(sb, _cg_c_string(fn->name->cstring)->cstring);
+    string_builder_append_chars(sb, "), ");
+    string_builder_append_chars(sb, fn->c_name->cstring);
+    string_builder_append_chars(sb, ", ");
+    string_builder_append_int(sb, fn->arg_tokens->length);
+    string_builder_append_chars(sb, ", ");
+    string_builder_append_int(sb, fn->required_arg_count);
+    string_builder_append_chars(sb, ", ");
+    string_builder_append_int(sb, fn->is_method);
+    string_builder_append_chars(sb, ");\n");
+  }
+
+  // Methods are numbered in class and member order after the module's functions, like the bytecode's.
+  List* classes = g->ctx->class_definitions;
+  int* first_method = (int*) malloc(sizeof(int) * (classes->length + 1));
+  int* constructors = (int*) malloc(sizeof(int) * (classes->length + 1));
+  int function_index = g->ctx->function_definitions->length;
+  for (int i = 0; i < classes->length; ++i) {
+    ClassDefinition* cd = (ClassDefinition*) list_get(classes, i);
+    first_method[i] = function_index;
+    constructors[i] = -1;
+    for (int j = 0; j < cd->member_order->length; ++j) {
+      Node* member = (Node*) dictionary_get(cd->members, list_get_string(cd->member_order, j));
+      if (node_kind(member) == NODE_KIND_CONSTRUCTOR_DEFINITION) constructors[i] = function_index;
+      if (node_kind(member) != NODE_KIND_FIELD_DEFINITION) function_index++;
+    }
+  }
+
+  for (int i = 0; i < classes->length; ++i) {
+    ClassDefinition* cd = (ClassDefinition*) list_get(classes, i);
+    String* cls = string_concat3("crt_classes[", _cg_int_string(i)->cstring, "]");
+    string_builder_append_chars(sb, "  ");
+    string_builder_append_chars(sb, cls->cstring);
+    string_builder_append_chars(sb, " = crt_new_class(new_string(");
+    string_builder_append_chars(sb, _cg_c_string(cd->class_name->value->cstring)->cstring);
+    string_builder_append_chars(sb, "), ");
+    string_builder_append_int(sb, cd->field_count);
+    string_builder_append_chars(sb, ");\n");
+  }
+  for (int i = 0; i < classes->length; ++i) {
+    ClassDefinition* cd = (ClassDefinition*) list_get(classes, i);
+    String* cls = string_concat3("crt_classes[", _cg_int_string(i)->cstring, "]");
+    if (cd->base_class_definition != NULL) {
+      string_builder_append_chars(sb, "  ");
+      string_builder_append_chars(sb, cls->cstring);
+      string_builder_append_chars(sb, "->base = crt_classes[");
+      string_builder_append_int(sb, cd->base_class_definition->index);
+      string_builder_append_chars(sb, "];\n");
+    }
+    for (ClassDefinition* walker = cd; walker != NULL; walker = walker->base_class_definition) {
+      if (constructors[walker->index] == -1) continue;
+      string_builder_append_chars(sb, "  ");
+      string_builder_append_chars(sb, cls->cstring);
+      string_builder_append_chars(sb, "->constructor = crt_functions[");
+      string_builder_append_int(sb, constructors[walker->index]);
+      string_builder_append_chars(sb, "];\n");
+      break;
+    }
+
+    // Inherited members go in first so the class's own replace the ones they override.
+    List* chain = new_list();
+    for (ClassDefinition* walker = cd; walker != NULL; walker = walker->base_class_definition) {
+      list_add(chain, walker);
+    }
+    for (int j = chain->length - 1; j >= 0; --j) {
+      ClassDefinition* ancestor = (ClassDefinition*) list_get(chain, j);
+      int method_index = first_method[ancestor->index];
+      for (int k = 0; k < ancestor->member_order->length; ++k) {
+        String* member_name = list_get_string(ancestor->member_order, k);
+        Node* member = (Node*) dictionary_get(ancestor->members, member_name);
+        int kind = node_kind(member);
+        if (kind == NODE_KIND_FIELD_DEFINITION) {
+          FieldDefinition* fd = (FieldDefinition*) member;
+          string_builder_append_chars(sb, "  dictionary_set(");
+          string_builder_append_chars(sb, cls->cstring);
+          string_builder_append_chars(sb, "->field_slots, new_string(");
+          string_builder_append_chars(sb, _cg_c_string(member_name->cstring)->cstring);
+          string_builder_append_chars(sb, "), crt_int(");
+          string_builder_append_int(sb, fd->index);
+          string_builder_append_chars(sb, "));\n");
+          if (fd->default_value != NULL && node_kind(fd->default_value) != NODE_KIND_NULL_CONSTANT) {
+            string_builder_append_chars(sb, "  ");
+            string_builder_append_chars(sb, cls->cstring);
+            string_builder_append_chars(sb, "->field_defaults[");
+            string_builder_append_int(sb, fd->index);
+            string_builder_append_chars(sb, "] = ");
+            string_builder_append_chars(sb, _cg_constant(g, fd->default_value)->cstring);
+            string_builder_append_chars(sb, ";\n");
+          }
+          continue;
+        }
+        if (kind == NODE_KIND_FUNCTION_DEFINITION) {
+          string_builder_append_chars(sb, "  dictionary_set(");
+          string_builder_append_chars(sb, cls->cstring);
+          string_builder_append_chars(sb, "->methods, new_string(");
+          string_builder_append_chars(sb, _cg_c_string(member_name->cstring)->cstring);
+          string_builder_append_chars(sb, "), crt_functions[");
+          string_builder_append_int(sb, method_index);
+          string_builder_append_chars(sb, "]);\n");
+        }
+        method_index++;
+      }
+    }
+  }
+  free(first_method);
+  free(constructors);
+}
+
+// Generates the C source of a resolved module, after wax_infer_types has annotated it. The code
+// includes "wax/cruntime.h", so it compiles with the src directory of the compiler on the include path.
+// Sets *operation_count to the number of binary operations in the C, counting each version of a
+// function, and *specialized_count to how many of those work on unboxed values.
+String* wax_c_generate(CompilerContext* ctx, String* module_name, int* operation_count, int* specialized_count) {
+  CGen g;
+  memset(&g, 0, sizeof(CGen));
+  g.ctx = ctx;
+  g.strings = new_list();
+  g.string_ids = new_dictionary();
+  g.dictionaries = new_string_builder();
+  g.sites = new_string_builder();
+  g.site_ids = new_dictionary();
+
+  int capacity = ctx->function_definitions->length;
+  for (int i = 0; i < ctx->class_definitions->length; ++i) {
+    capacity += ((ClassDefinition*) list_get(ctx->class_definitions, i))->member_order->length;
+  }
+  g.callables = (CGenCallable*) malloc(sizeof(CGenCallable) * (capacity + 1));
+  for (int i = 0; i < ctx->function_definitions->length; ++i) {
+    FunctionDefinition* fd = (FunctionDefinition*) list_get(ctx->function_definitions, i);
+    _cg_add_callable(&g, fd->function_name->value, (Node*) fd, fd->function_name, 0, fd->arg_tokens, fd->arg_default_values, fd->code, fd->local_count);
+  }
+  for (int i = 0; i < ctx->class_definitions->length; ++i) {
+    ClassDefinition* cd = (ClassDefinition*) list_get(ctx->class_definitions, i);
+    for (int j = 0; j < cd->member_order->length; ++j) {
+      String* member_name = list_get_string(cd->member_order, j);
+      Node* member = (Node*) dictionary_get(cd->members, member_name);
+      if (node_kind(member) == NODE_KIND_FUNCTION_DEFINITION) {
+        FunctionDefinition* fd = (FunctionDefinition*) member;
+        _cg_add_callable(&g, string_concat3(cd->class_name->value->cstring, ".", member_name->cstring), member, fd->function_name, 1,
+          fd->arg_tokens, fd->arg_default_values, fd->code, fd->local_count);
+      } else if (node_kind(member) == NODE_KIND_CONSTRUCTOR_DEFINITION) {
+        ConstructorDefinition* ctor = (ConstructorDefinition*) member;
+        _cg_add_callable(&g, string_concat(cd->class_name->value->cstring, ".constructor"), member, member->first_token, 1,
+          ctor->arg_tokens, ctor->arg_default_values, ctor->code, ctor->local_count);
+      }
+    }
+  }
+  _cg_analyze(&g);
+
+  StringBuilder* prototypes = new_string_builder();
+  StringBuilder* functions = new_string_builder();
+  for (int i = 0; i < g.callable_count; ++i) {
+    CGenCallable* fn = &g.callables[i];
+    for (int is_int_version = 0; is_int_version <= fn->has_int_version; ++is_int_version) {
+      string_builder_append_chars(prototypes, _cg_signature(&g, fn, is_int_version)->cstring);
+      string_builder_append_chars(prototypes, ";\n");
+      _cg_function(&g, fn, is_int_version, functions);
+    }
+  }
+  StringBuilder* entities = new_string_builder();
+  _cg_init_entities(&g, entities);
+
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, "// Generated by waxcli from the Wax module ");
+  string_builder_append_chars(sb, module_name->cstring);
+  string_builder_append_chars(sb, ".\n#include \"wax/cruntime.h\"\n\nconst CrtSite wax_sites[] = {\n");
+  string_builder_append_chars(sb, string_builder_to_string_and_free(g.sites)->cstring);
+  string_builder_append_chars(sb, "  { NULL, NULL, 0 },\n};\n\nString* wax_strings[");
+  string_builder_append_int(sb, g.strings->length + 1);
+  string_builder_append_chars(sb, "];\nDictionary* wax_dictionaries[");
+  string_builder_append_int(sb, g.dictionary_count + 1);
+  string_builder_append_chars(sb, "];\n\n");
+  string_builder_append_chars(sb, string_builder_to_string_and_free(prototypes)->cstring);
+  string_builder_append_char(sb, '\n');
+  string_builder_append_chars(sb, string_builder_to_string_and_free(functions)->cstring);
+
+  string_builder_append_chars(sb, "void wax_init() {\n");
+  for (int i = 0; i < g.strings->length; ++i) {
+    string_builder_append_chars(sb, "  wax_strings[");
+    string_builder_append_int(sb, i);
+    string_builder_append_chars(sb, "] = new_common_string(");
+    string_builder_append_chars(sb, _cg_c_string(list_get_string(g.strings, i)->cstring)->cstring);
+    string_builder_append_chars(sb, ");\n");
+  }
+  string_builder_append_chars(sb, string_builder_to_string_and_free(g.dictionaries)->cstring);
+  string_builder_append_chars(sb, string_builder_to_string_and_free(entities)->cstring);
+  string_builder_append_chars(sb, "}\n\nint main(int argc, char** argv) {\n  crt_init(wax_sites, ");
+  string_builder_append_int(sb, g.callable_count);
+  string_builder_append_chars(sb, ", ");
+  string_builder_append_int(sb, ctx->class_definitions->length);
+  string_builder_append_chars(sb, ");\n  wax_init();\n  return crt_run(argc, argv);\n}\n");
+
+  for (int i = 0; i < g.callable_count; ++i) {
+    free(g.callables[i].local_names);
+    free(g.callables[i].maybe_unassigned);
+    free(g.callables[i].local_types);
+  }
+  free(g.callables);
+  free(g.int_local_types);
+  *operation_count = g.operation_count;
+  *specialized_count = g.specialized_count;
+  return string_builder_to_string_and_free(sb);
+}
+
+#endif
@@ -5,15 +5,64 @@
 #include "../util/lists.h"
 #include "../util/dictionaries.h"
 #include "../util/strings.h"
+#include "../util/profiler.h"
+#include "../util/subprocess.h"
+#include "../util/threads.h"
 #include "manifest.h"
 #include "tokens.h"
 #include "compilercontext.h"
 #include "parser.h"
 #include "resolver.h"
+#include "serializer.h"
+#include "bytecodegen.h"
+#include "typeinfer.h"
+#include "cgen.h"
+
+// The C compiler and the include path native builds use. The generated C includes wax/cruntime.h.
+// WAX_NATIVE_CC is one program, which is run without a shell.
+#ifndef WAX_NATIVE_CC
+#define WAX_NATIVE_CC "cc"
+#endif
+#ifndef WAX_SOURCE_DIR
+#define WAX_SOURCE_DIR "src"
+#endif
+
+typedef struct _CompileOptions {
+  const char* ast_output_dir; // if set, the resolved AST of each module is saved here as <module>.waxast
+  const char* bytecode_output_dir; // if set, the bytecode of each module is saved here as <module>.waxbc
+  const char* native_output_dir; // if set, each module is compiled to C and built as PATH/<module>, with the C in PATH/<module>.c
+  int jobs; // number of threads used to tokenize and parse the files of a module
+} CompileOptions;
+
+void compile_options_init(CompileOptions* options) {
+  options->ast_output_dir = NULL;
+  options->bytecode_output_dir = NULL;
+  options->native_output_dir = NULL;
+  options->jobs = 1;
+}
+
+// Several functions build static lookup tables the first time they are called. Run the
+// tokenizer, parser, resolver and serializer once on the current thread so that worker threads
+// never race to initialize them.
+void wax_compiler_prime_static_caches() {
+  static int primed = 0;
+  if (primed) return;
+  primed = 1;
+  CompilerContext* ctx = new_compiler_context();
+  ctx->tokens = tokenize(new_string("<prime>"), new_string("function f(a) { b = { 'k': a }; }"));
+  parse_first_pass(ctx);
+  ctx->tokens = NULL;
+  wax_resolve_module(ctx, 1);
+  string_builder_free(wax_ast_serialize(ctx));
+}
 
 Dictionary* wax_compiler_get_files(const char* path) {
+  int span = profiler_begin("wax_compiler_get_files", path);
   List* files = directory_gather_files_recursive(path);
-  if (files == NULL) return NULL;
+  if (files == NULL) {
+    profiler_end(span);
+    return NULL;
+  }
 
   String* dot_wax = new_string(".wax");
   Dictionary* src_files = new_dictionary();
@@ -24,55 +73,318 @@ Dictionary* wax_compiler_get_files(const char* path) {
       dictionary_set(src_files, file, full_path);
     }
   }
+  profiler_end(span);
   return src_files;
 }
 
-void wax_compile(ProjectManifest* manifest, ModuleMetadata* module) {
-  Dictionary* src_files = wax_compiler_get_files(module->src->cstring);
-  if (src_files == NULL || src_files->size == 0) {
-    printf("Module is empty!\n");
-    return;
+typedef struct _ParallelParseState {
+  List* paths;
+  List* contents;
+  TokenStream** tokens;
+  int keep_tokens;
+  CompilerContext** file_contexts;
+} ParallelParseState;
+
+void _wax_compiler_parse_file_task(void* arg, int index) {
+  ParallelParseState* state = (ParallelParseState*) arg;
+  CompilerContext* file_ctx = new_compiler_context();
+  gc_save_item(file_ctx);
+  String* full_path = list_get_string(state->paths, index);
+  int file_span = profiler_begin("compile file", full_path->cstring);
+  TokenStream* tokens = state->tokens == NULL ? NULL : state->tokens[index];
+  if (tokens == NULL) {
+    String* content;
+    if (state->contents == NULL) {
+      int span = profiler_begin("file_read_text", full_path->cstring);
+      content = file_read_text(full_path->cstring);
+      profiler_end(span);
+    } else {
+      content = list_get_string(state->contents, index);
+    }
+    if (state->keep_tokens) {
+      int span = profiler_begin("tokenize", full_path->cstring);
+      tokens = tokenize(full_path, content);
+      profiler_end(span);
+    } else {
+      // Tokens that are not kept are only scanned as the parser needs them, one at a time, which is
+      // too fine grained for a span of its own. The time goes in the parse span below instead.
+      tokens = tokenize_incremental(full_path, content);
+    }
+    profiler_count("source bytes tokenized", content->length);
+  } else {
+    tokens->index = 0;
   }
+  file_ctx->tokens = tokens;
+  // Tokens and nodes go in an arena owned by the file's context. The nodes refer to the token
+  // values and source file, which are GC objects, so the arena holds on to those.
+  file_ctx->arena = new_arena();
+  Arena* previous_arena = arena_set_current(file_ctx->arena);
+  arena_keep(tokens->symbols);
+  arena_keep(tokens->source);
+  const char* phase = tokens->scanner == NULL ? "parse_first_pass" : "tokenize + parse_first_pass";
+  int span = profiler_begin(phase, full_path->cstring);
+  parse_first_pass(file_ctx);
+  profiler_end(span);
+  token_stream_close(tokens);
+  arena_set_current(previous_arena);
+  profiler_count("tokens", tokens->length);
+  profiler_count("files parsed", 1);
+  if (!state->keep_tokens) file_ctx->tokens = NULL;
+  state->file_contexts[index] = file_ctx;
+  gc_perform_pass();
+  profiler_end(file_span);
+}
 
-  gc_save_item(src_files);
-  List* src_file_names = dictionary_get_keys(src_files);
-  gc_save_item(src_file_names);
+/*
+  Tokenizes and parses each file on its own context, across jobs worker threads if there is more
+  than one file. Returns a malloc'd array of contexts in the same order as paths. Each context is
+  gc_save'd and owns the arena its nodes are in. The caller is responsible for releasing the
+  contexts and freeing their arenas with compiler_context_free_arena once the nodes are not needed.
 
-  CompilerContext* ctx = new_compiler_context();
-  gc_save_item(ctx);
+  contents may be NULL, in which case the files are read from disk. tokens may be NULL or hold
+  previously tokenized files to parse again instead of tokenizing, with NULL entries for files
+  that need tokenizing. The token streams are left on the contexts if keep_tokens is set.
+*/
+CompilerContext** wax_compiler_parse_files(List* paths, List* contents, TokenStream** tokens, int keep_tokens, int jobs) {
+  if (jobs > 1 && paths->length > 1) wax_compiler_prime_static_caches();
 
-  for (int i = 0; i < src_file_names->length; ++i) {
-    String* name = list_get_string(src_file_names, i);
-    String* full_path = (String*) dictionary_get(src_files, name);
-    String* content = file_read_text(full_path->cstring);
-    ctx->tokens = tokenize(full_path, content);
-    parse_first_pass(ctx);
-    ctx->tokens = NULL;
-    gc_perform_pass();
-  }
+  ParallelParseState state;
+  state.paths = paths;
+  state.contents = contents;
+  state.tokens = tokens;
+  state.keep_tokens = keep_tokens;
+  state.file_contexts = (CompilerContext**) malloc_ptr_array(paths->length);
+  parallel_for(paths->length, jobs, _wax_compiler_parse_file_task, &state);
+  return state.file_contexts;
+}
 
+void wax_compiler_merge_file_context(CompilerContext* ctx, CompilerContext* file_ctx) {
+  list_push_all(ctx->class_definitions, file_ctx->class_definitions);
+  list_push_all(ctx->function_definitions, file_ctx->function_definitions);
+  list_push_all(ctx->error_messages, file_ctx->error_messages);
+  list_push_all(ctx->error_tokens, file_ctx->error_tokens);
+  if (file_ctx->has_error) ctx->has_error = 1;
+}
+
+// Resolves a parsed module and appends the report for it to output. Returns 1 if there were no errors.
+int wax_compiler_finish_module(CompilerContext* ctx, ModuleMetadata* module, CompileOptions* options, StringBuilder* output) {
   if (ctx->error_messages->length == 0) {
-    wax_resolve_module(ctx);
+    int span = profiler_begin("wax_resolve_module", module->name->cstring);
+    wax_resolve_module(ctx, options->jobs);
+    profiler_end(span);
+  }
+  // Only the C backend uses the inferred types so far, so the pass only runs for native builds.
+  if (ctx->error_messages->length == 0 && options->native_output_dir != NULL) {
+    int span = profiler_begin("wax_infer_types", module->name->cstring);
+    wax_infer_types(ctx);
+    profiler_end(span);
+  }
+  // The interpreter only runs modules loaded from a saved file with waxcli --run, never during a
+  // compile, so the bytecode is only generated when it is saved.
+  BytecodeModule* bytecode = NULL;
+  if (ctx->error_messages->length == 0 && options->bytecode_output_dir != NULL) {
+    int span = profiler_begin("wax_bytecode_generate", module->name->cstring);
+    bytecode = wax_bytecode_generate(ctx, module->name);
+    profiler_end(span);
+  }
+  String* native_code = NULL;
+  if (ctx->error_messages->length == 0 && options->native_output_dir != NULL) {
+    int span = profiler_begin("wax_c_generate", module->name->cstring);
+    int operations;
+    int specialized;
+    native_code = wax_c_generate(ctx, module->name, &operations, &specialized);
+    profiler_end(span);
+    profiler_count("binary operations in native code", operations);
+    profiler_count("binary operations on unboxed values", specialized);
   }
 
   List* errors = ctx->error_messages;
   List* error_tokens = ctx->error_tokens;
-  if (errors->length > 0) {
-    printf("The following errors were countered:\n");
+  int ok = errors->length == 0;
+  if (!ok) {
+    string_builder_append_chars(output, "The following errors were countered:\n");
     for (int i = 0; i < errors->length; ++i) {
-      printf("  ");
+      string_builder_append_chars(output, "  ");
       Token* token = (Token*) list_get(error_tokens, i);
       if (token != NULL) {
-        printf("%s Line %d Col %d: ", token->file->cstring, token->line, token->col);
+        string_builder_append_chars(output, token->source->path->cstring);
+        string_builder_append_chars(output, " Line ");
+        string_builder_append_int(output, token_get_line(token));
+        string_builder_append_chars(output, " Col ");
+        string_builder_append_int(output, token_get_col(token));
+        string_builder_append_chars(output, ": ");
       }
-      printf("%s\n", list_get_string(errors, i)->cstring);
+      string_builder_append_chars(output, list_get_string(errors, i)->cstring);
+      string_builder_append_char(output, '\n');
     }
   } else {
-    printf("Success!\n");
+    if (options->ast_output_dir != NULL) {
+      String* ast_path = string_concat4(options->ast_output_dir, "/", module->name->cstring, ".waxast");
+      int span = profiler_begin("wax_ast_save", ast_path->cstring);
+      int saved = wax_ast_save(ctx, ast_path->cstring);
+      profiler_end(span);
+      if (!saved) {
+        string_builder_append_chars(output, "Could not write AST file: ");
+        string_builder_append_chars(output, ast_path->cstring);
+        string_builder_append_char(output, '\n');
+      }
+    }
+    if (options->bytecode_output_dir != NULL) {
+      String* bytecode_path = string_concat4(options->bytecode_output_dir, "/", module->name->cstring, ".waxbc");
+      int span = profiler_begin("bytecode_module_save", bytecode_path->cstring);
+      int saved = bytecode_module_save(bytecode, bytecode_path->cstring);
+      profiler_end(span);
+      if (!saved) {
+        string_builder_append_chars(output, "Could not write bytecode file: ");
+        string_builder_append_chars(output, bytecode_path->cstring);
+        string_builder_append_char(output, '\n');
+      }
+    }
+    if (options->native_output_dir != NULL) {
+      String* native_path = string_concat3(options->native_output_dir, "/", module->name->cstring);
+      String* c_path = string_concat(native_path->cstring, ".c");
+      int span = profiler_begin("wax_native_build", native_path->cstring);
+      int saved = file_write_bytes(c_path->cstring, native_code->cstring, native_code->length);
+      const char* cc_args[] = { WAX_NATIVE_CC, "-O2", "-I" WAX_SOURCE_DIR, c_path->cstring, "-o", native_path->cstring, "-lm", "-lpthread", NULL };
+      int built = saved && subprocess_run(cc_args) == 0;
+      profiler_end(span);
+      if (!saved) {
+        string_builder_append_chars(output, "Could not write native file: ");
+        string_builder_append_chars(output, c_path->cstring);
+        string_builder_append_char(output, '\n');
+      } else if (!built) {
+        string_builder_append_chars(output, "Could not build native file: ");
+        string_builder_append_chars(output, c_path->cstring);
+        string_builder_append_char(output, '\n');
+      }
+    }
+    string_builder_append_chars(output, "Success!\n");
   }
+  return ok;
+}
+
+// Compiles one Wax module and appends its report to output. Returns 1 if there were no errors.
+int wax_compile(ProjectManifest* manifest, ModuleMetadata* module, CompileOptions* options, StringBuilder* output) {
+  int module_span = profiler_begin("wax_compile", module->name->cstring);
+  Dictionary* src_files = wax_compiler_get_files(module->src->cstring);
+  if (src_files == NULL || src_files->size == 0) {
+    string_builder_append_chars(output, "Module is empty!\n");
+    profiler_end(module_span);
+    return 0;
+  }
+
+  gc_save_item(src_files);
+  List* paths = dictionary_get_values(src_files);
+  gc_save_item(paths);
+
+  CompilerContext* ctx = new_compiler_context();
+  gc_save_item(ctx);
+
+  // Each file is parsed on its own context and the results are merged in file order, so the
+  // output is the same no matter how many threads did the parsing.
+  CompilerContext** file_contexts = wax_compiler_parse_files(paths, NULL, NULL, 0, options->jobs);
+  for (int i = 0; i < paths->length; ++i) {
+    wax_compiler_merge_file_context(ctx, file_contexts[i]);
+  }
+  gc_perform_pass();
+
+  int ok = wax_compiler_finish_module(ctx, module, options, output);
+
+  // The whole AST goes at once, without the GC having to trace or sweep any of it.
+  for (int i = 0; i < paths->length; ++i) {
+    compiler_context_free_arena(file_contexts[i]);
+    gc_release_item(file_contexts[i]);
+  }
+  free(file_contexts);
 
   gc_release_item(src_files);
-  gc_release_item(src_file_names);
+  gc_release_item(paths);
+  gc_release_item(ctx);
   gc_perform_pass();
+  profiler_end(module_span);
+  return ok;
+}
+
+/*
+  Loads a module saved with --emit-ast and lowers it to bytecode, without parsing or resolving it
+  again. The module is named after the file. Returns NULL if the file can't be read or is malformed.
+*/
+BytecodeModule* wax_compiler_load_ast(const char* path) {
+  AstReader* reader = ast_reader_open(path);
+  if (reader == NULL) return NULL;
+  CompilerContext* ctx = new_compiler_context();
+  gc_save_item(ctx);
+  BytecodeModule* module = NULL;
+  if (ast_reader_load_into(reader, ctx)) {
+    const char* name = strrchr(path, '/') == NULL ? path : strrchr(path, '/') + 1;
+    const char* extension = strrchr(name, '.');
+    module = wax_bytecode_generate(ctx, new_string_from_range(name, 0, extension == NULL ? (int) strlen(name) : (int) (extension - name)));
+  }
+  ast_reader_close(reader);
+  gc_release_item(ctx);
+  return module;
+}
+
+void wax_compiler_append_module_intro(StringBuilder* output, ModuleMetadata* module) {
+  string_builder_append_chars(output, "Transpiling wax project '");
+  string_builder_append_chars(output, module->name->cstring);
+  string_builder_append_chars(output, "'...\n");
+}
+
+void wax_compiler_append_foreign_module(StringBuilder* output, ModuleMetadata* module) {
+  string_builder_append_chars(output, "TODO: wrap project ");
+  string_builder_append_chars(output, module->name->cstring);
+  string_builder_append_chars(output, " from ");
+  string_builder_append_chars(output, module->src->cstring);
+  string_builder_append_char(output, '\n');
+}
+
+typedef struct _ProjectCompileState {
+  ProjectManifest* manifest;
+  CompileOptions* options;
+  StringBuilder** reports;
+} ProjectCompileState;
+
+void _wax_compiler_module_task(void* arg, int index) {
+  ProjectCompileState* state = (ProjectCompileState*) arg;
+  ModuleMetadata* mm = (ModuleMetadata*) list_get(state->manifest->modules, index);
+  StringBuilder* report = new_string_builder();
+  if (mm->lang == LANG_WAX) {
+    wax_compiler_append_module_intro(report, mm);
+    wax_compile(state->manifest, mm, state->options, report);
+    string_builder_append_char(report, '\n');
+  } else {
+    wax_compiler_append_foreign_module(report, mm);
+  }
+  state->reports[index] = report;
+}
+
+// Compiles every module of the manifest and prints their reports in manifest order. Modules are
+// independent until bundling, so up to options->jobs of them are compiled at once and whatever
+// threads are left over are given to each module for parsing its files.
+void wax_compile_project(ProjectManifest* manifest, CompileOptions* options) {
+  List* modules = manifest->modules;
+  int module_jobs = options->jobs < modules->length ? options->jobs : modules->length;
+  if (module_jobs < 1) module_jobs = 1;
+
+  CompileOptions module_options = *options;
+  module_options.jobs = options->jobs / module_jobs;
+  if (module_options.jobs < 1) module_options.jobs = 1;
+
+  if (module_jobs > 1) wax_compiler_prime_static_caches();
+
+  ProjectCompileState state;
+  state.manifest = manifest;
+  state.options = &module_options;
+  state.reports = (StringBuilder**) malloc_ptr_array(modules->length);
+  parallel_for(modules->length, module_jobs, _wax_compiler_module_task, &state);
+
+  for (int i = 0; i < modules->length; ++i) {
+    StringBuilder* report = state.reports[i];
+    string_builder_append_char(report, '\0');
+    printf("%s", report->chars);
+    string_builder_free(report);
+  }
+  free(state.reports);
 }
 #endif
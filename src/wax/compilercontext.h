@@ -2,6 +2,7 @@
 #define _WAX_COMPILERCONTEXT_H
 
 #include <string.h>
+#include "../util/arena.h"
 #include "../util/gcbase.h"
 #include "../util/lists.h"
 #include "tokens.h"
@@ -12,10 +13,12 @@ typedef struct _CompilerContext {
   TokenStream* tokens;
   List* class_definitions;
   List* function_definitions;
+  List* global_names; // names the module's code uses but does not define, by VARIABLE_SCOPE_GLOBAL index
   int has_error;
+  Arena* arena; // the tokens and nodes parsed on this context, if it owns an arena
 } CompilerContext;
 
-#define COMPILER_CONTEXT_GC_FIELD_COUNT 5
+#define COMPILER_CONTEXT_GC_FIELD_COUNT 6
 #define COMPILER_CONTEXT_NAME "CompilerContext"
 
 CompilerContext* new_compiler_context() {
@@ -26,9 +29,18 @@ CompilerContext* new_compiler_context() {
   ctx->tokens = NULL;
   ctx->class_definitions = new_list();
   ctx->function_definitions = new_list();
+  ctx->global_names = new_list();
+  ctx->arena = NULL;
   return ctx;
 }
 
+// Frees the arena of the context and with it every token and node parsed on it.
+void compiler_context_free_arena(CompilerContext* ctx) {
+  if (ctx->arena == NULL) return;
+  arena_free(ctx->arena);
+  ctx->arena = NULL;
+}
+
 int parser_error(CompilerContext* ctx, Token* token, String* msg) {
   list_add(ctx->error_messages, msg);
   list_add(ctx->error_tokens, token);
@@ -41,13 +53,20 @@ int parser_error_chars(CompilerContext* ctx, Token* token, const char* msg) {
 }
 
 int tokens_has_more(CompilerContext* ctx) {
-  if (ctx->tokens->index < ctx->tokens->length) return 1;
-  return 0;
+  return token_stream_has(ctx->tokens, ctx->tokens->index);
+}
+
+// Reports running out of tokens. If the tokenizer stopped early because of an error, that error is
+// the real cause and is reported instead.
+int tokens_eof_error(CompilerContext* ctx, String* msg) {
+  if (ctx->tokens->error != NULL) return parser_error(ctx, ctx->tokens->error_token, ctx->tokens->error);
+  return parser_error(ctx, NULL, msg);
 }
 
+// Creates a Token for the next token, for the parser to keep in the AST or report an error at.
 Token* tokens_peek_next(CompilerContext* ctx) {
-  if (ctx->tokens->index < ctx->tokens->length) {
-    return (Token*) list_get(ctx->tokens->tokens, ctx->tokens->index);
+  if (tokens_has_more(ctx)) {
+    return token_stream_get_token(ctx->tokens, ctx->tokens->index);
   }
   return NULL;
 }
@@ -56,34 +75,72 @@ int parser_error_next_chars(CompilerContext* ctx, const char* msg) {
   return parser_error_chars(ctx, tokens_has_more(ctx) ? tokens_peek_next(ctx) : NULL, msg);
 }
 
+// Returns the value of the token distance tokens past the next one, or NULL past the end.
+String* tokens_peek_ahead_value(CompilerContext* ctx, int distance) {
+  int index = ctx->tokens->index + distance;
+  if (token_stream_has(ctx->tokens, index)) return token_stream_get_value(ctx->tokens, index);
+  return NULL;
+}
+
+// Returns the type of the token distance tokens past the next one, or -1 past the end.
+int tokens_peek_ahead_type(CompilerContext* ctx, int distance) {
+  int index = ctx->tokens->index + distance;
+  if (token_stream_has(ctx->tokens, index)) return token_stream_get_type(ctx->tokens, index);
+  return -1;
+}
+
+// Returns the symbol id of the token distance tokens past the next one, or -1 past the end.
+int tokens_peek_ahead_symbol(CompilerContext* ctx, int distance) {
+  int index = ctx->tokens->index + distance;
+  if (token_stream_has(ctx->tokens, index)) return token_stream_get_symbol_id(ctx->tokens, index);
+  return -1;
+}
+
 String* tokens_peek_next_value(CompilerContext* ctx) {
-  Token* t = tokens_peek_next(ctx);
-  if (t == NULL) return NULL;
-  return t->value;
+  return tokens_peek_ahead_value(ctx, 0);
 }
 
 Token* tokens_pop(CompilerContext* ctx) {
   if (tokens_has_more(ctx)) {
-    return (Token*) list_get(ctx->tokens->tokens, ctx->tokens->index++);
+    return token_stream_get_token(ctx->tokens, ctx->tokens->index++);
   } else {
-    parser_error_chars(ctx, NULL, "Unexpected EOF");
+    tokens_eof_error(ctx, new_string("Unexpected EOF"));
     return NULL;
   }
 }
 
-Token* tokens_pop_expected(CompilerContext* ctx, const char* value) {
-  Token* token = tokens_pop(ctx);
-  if (token == NULL) {
-    list_pop(ctx->error_messages);
-    list_pop(ctx->error_tokens);
-    parser_error(ctx, NULL, string_concat3("Expected '", value, "' but found End of File instead"));
-    return NULL;
+// Like tokens_pop, for when the token itself is not needed. Returns 0 at the end of the file.
+int tokens_skip(CompilerContext* ctx) {
+  if (tokens_has_more(ctx)) {
+    ctx->tokens->index++;
+    return 1;
   }
-  if (string_equals_chars(token->value, value)) {
-    return token;
+  tokens_eof_error(ctx, new_string("Unexpected EOF"));
+  return 0;
+}
+
+int _tokens_expect(CompilerContext* ctx, const char* value) {
+  if (!tokens_has_more(ctx)) {
+    tokens_eof_error(ctx, string_concat3("Expected '", value, "' but found End of File instead"));
+    return 0;
   }
-  parser_error(ctx, token, string_concat5("Expected '", value, "' but found '", token->value->cstring, "' instead."));
-  return NULL;
+  String* next = tokens_peek_next_value(ctx);
+  if (strcmp(next->cstring, value) == 0) return 1;
+  parser_error(ctx, tokens_peek_next(ctx), string_concat5("Expected '", value, "' but found '", next->cstring, "' instead."));
+  ctx->tokens->index++;
+  return 0;
+}
+
+Token* tokens_pop_expected(CompilerContext* ctx, const char* value) {
+  if (!_tokens_expect(ctx, value)) return NULL;
+  return tokens_pop(ctx);
+}
+
+// Like tokens_pop_expected, for when the token itself is not needed.
+int tokens_skip_expected(CompilerContext* ctx, const char* value) {
+  if (!_tokens_expect(ctx, value)) return 0;
+  ctx->tokens->index++;
+  return 1;
 }
 
 int tokens_ensure_not_eof(CompilerContext* ctx) {
@@ -106,7 +163,7 @@ Token* tokens_peek_next_no_eof(CompilerContext* ctx) {
 
 int tokens_pop_if_next(CompilerContext* ctx, const char* token) {
   String* next = tokens_peek_next_value(ctx);
-  if (next != NULL && string_equals_chars(next, token)) {
+  if (next != NULL && strcmp(token, next->cstring) == 0) {
     ctx->tokens->index++;
     return 1;
   }
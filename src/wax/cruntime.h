@@ -0,0 +1,704 @@
+#ifndef _WAX_CRUNTIME_H
+#define _WAX_CRUNTIME_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../util/dictionaries.h"
+#include "../util/gc.h"
+#include "../util/lists.h"
+#include "../util/strings.h"
+#include "../util/util.h"
+
+/*
+  The runtime of Wax modules compiled to C by cgen.h. A generated program includes this header and
+  nothing of the compiler or the VM. Values behave exactly as they do in the VM (see vm.h): integers,
+  booleans and null are tagged words, everything else is a GC object, and the operations fail with
+  the same messages.
+
+  Every value the GC must see lives on the shadow stack. A compiled function's frame holds its
+  locals and then the slots its expressions leave values in, and a call's arguments are the first
+  locals of the callee, so a frame starts inside its caller's. Integers the generated code has proven
+  to be integers are unboxed C variables instead, which the GC has no reason to see. The GC only runs
+  at safepoints, on entering a function or going around a loop, where every other value is dead.
+
+  An error prints where it happened, like the VM's, and ends the program.
+*/
+
+#define CRT_STACK_SIZE (1024 * 1024)
+#define CRT_MAX_DEPTH 10000
+#define CRT_GC_INTERVAL 100000
+
+typedef void* CrtValue;
+
+#define CRT_NULL ((CrtValue) NULL)
+#define CRT_FALSE ((CrtValue) (intptr_t) 3)
+#define CRT_TRUE ((CrtValue) (intptr_t) 7)
+
+// The binary operators, for crt_binary and crt_compare.
+enum CrtOp {
+  CRT_ADD,
+  CRT_SUB,
+  CRT_MUL,
+  CRT_DIV,
+  CRT_MOD,
+  CRT_POW,
+  CRT_BIT_AND,
+  CRT_BIT_OR,
+  CRT_BIT_XOR,
+  CRT_SHL,
+  CRT_SHR,
+  CRT_LT,
+  CRT_GT,
+  CRT_LE,
+  CRT_GE,
+};
+
+// Where an operation that can fail is in the source, for its error message.
+typedef struct _CrtSite {
+  const char* path;
+  const char* function;
+  int line;
+} CrtSite;
+
+// A compiled function's entry point. args are the first locals of its frame, on the shadow stack, and
+// site is where the call is, for the errors that belong to the caller.
+typedef CrtValue (*CrtEntry)(CrtValue* args, int argc, int site);
+
+typedef struct _CrtFunction {
+  String* name;
+  CrtEntry entry;
+  int arg_count;
+  int required_arg_count;
+  int is_method; // takes this as an extra first argument
+  int is_native; // takes any number of arguments
+} CrtFunction;
+#define CRT_FUNCTION_GC_FIELD_COUNT 1
+#define CRT_FUNCTION_NAME "CrtFunction"
+
+typedef struct _CrtClass {
+  String* name;
+  struct _CrtClass* base; // NULL if the class has no base class
+  CrtFunction* constructor; // the class's own or the nearest base class's, NULL if there is none
+  Dictionary* methods; // name to CrtFunction, including the inherited methods that aren't overridden
+  Dictionary* field_slots; // name to slot, as an integer value
+  CrtValue* field_defaults; // by slot
+  int field_count;
+} CrtClass;
+#define CRT_CLASS_GC_FIELD_COUNT 6
+#define CRT_CLASS_NAME "CrtClass"
+
+typedef struct _CrtObject {
+  CrtClass* class_def;
+  CrtValue fields[]; // by slot
+} CrtObject;
+#define CRT_OBJECT_NAME "CrtObject"
+
+const CrtSite* crt_sites = NULL;
+CrtValue* crt_stack = NULL;
+CrtValue* crt_stack_end = NULL;
+CrtValue* crt_sp = NULL; // end of the innermost frame
+int crt_depth = 0;
+int crt_allocations = 0; // since the last GC pass
+CrtFunction** crt_functions = NULL; // by function index, methods and constructors after the module's functions
+int crt_function_count = 0;
+CrtClass** crt_classes = NULL;
+CrtFunction* crt_print_function = NULL;
+
+CrtValue crt_int(int64_t value) {
+  return (CrtValue) (intptr_t) (((uintptr_t) (intptr_t) value << 2) | 1);
+}
+
+int crt_is_int(CrtValue value) {
+  return (((intptr_t) value) & 3) == 1;
+}
+
+int64_t crt_int_value(CrtValue value) {
+  return (int64_t) (((intptr_t) value) >> 2);
+}
+
+CrtValue crt_bool(int value) {
+  return value ? CRT_TRUE : CRT_FALSE;
+}
+
+int crt_is_object(CrtValue value) {
+  return value != NULL && (((intptr_t) value) & 1) == 0;
+}
+
+int crt_is_struct(CrtValue value, const char* name) {
+  if (!crt_is_object(value)) return 0;
+  GCValue* gc_value = ((GCValue*) value) - 1;
+  return gc_value->type == 'C' && (gc_value->name == name || strcmp(gc_value->name, name) == 0);
+}
+
+int crt_type_is(CrtValue value, char type) {
+  return crt_is_object(value) && gc_get_type(value) == type;
+}
+
+const char* crt_type_name(CrtValue value) {
+  if (value == CRT_NULL) return "null";
+  if (crt_is_int(value)) return "integer";
+  if (value == CRT_TRUE || value == CRT_FALSE) return "boolean";
+  switch (gc_get_type(value)) {
+    case 'S': return "string";
+    case 'L': return "list";
+    case 'D': return "dictionary";
+  }
+  if (crt_is_struct(value, CRT_OBJECT_NAME)) return ((CrtObject*) value)->class_def->name->cstring;
+  if (crt_is_struct(value, CRT_CLASS_NAME)) return "class";
+  return "function";
+}
+
+// Prints the error and ends the program. A site of -1 is the call crt_run makes, which has no place in the source.
+void crt_fail(int site, String* message) {
+  if (site == -1) {
+    printf("%s\n", message->cstring);
+  } else {
+    const CrtSite* at = &crt_sites[site];
+    printf("%s Line %d in %s: %s\n", at->path, at->line, at->function, message->cstring);
+  }
+  exit(1);
+}
+
+void crt_fail_chars(int site, const char* message) {
+  crt_fail(site, new_string(message));
+}
+
+// Runs the GC if the program has allocated enough since the last pass. Only call this when every
+// live value is on the shadow stack.
+void crt_safepoint() {
+  if (crt_allocations < CRT_GC_INTERVAL) return;
+  gc_init_pass();
+  for (CrtValue* value = crt_stack; value < crt_sp; ++value) {
+    if (crt_is_object(*value)) gc_tag_item(*value);
+  }
+  gc_run();
+  crt_allocations = 0;
+}
+
+/*
+  Starts the frame of a compiled function at locals, with argc arguments already there, and returns
+  the end of the caller's frame for crt_leave. frame_size counts the locals and the expression slots.
+*/
+CrtValue* crt_enter(CrtValue* locals, int argc, int frame_size, int site) {
+  CrtValue* caller_end = crt_sp;
+  if (++crt_depth > CRT_MAX_DEPTH) crt_fail_chars(site, "Maximum recursion depth exceeded.");
+  if (locals + frame_size > crt_stack_end) crt_fail_chars(site, "Stack overflow.");
+  for (int i = argc; i < frame_size; ++i) {
+    locals[i] = CRT_NULL;
+  }
+  crt_sp = locals + frame_size;
+  crt_safepoint();
+  return caller_end;
+}
+
+CrtValue crt_leave(CrtValue* caller_end, CrtValue result) {
+  crt_sp = caller_end;
+  crt_depth--;
+  return result;
+}
+
+// For the integer versions of functions, which have no frame on the shadow stack.
+void crt_enter_int(int site) {
+  if (++crt_depth > CRT_MAX_DEPTH) crt_fail_chars(site, "Maximum recursion depth exceeded.");
+}
+
+int64_t crt_leave_int(int64_t result) {
+  crt_depth--;
+  return result;
+}
+
+void _crt_append_value(StringBuilder* sb, CrtValue value, int depth) {
+  if (value == CRT_NULL) {
+    string_builder_append_chars(sb, "null");
+  } else if (crt_is_int(value)) {
+    string_builder_append_int(sb, (int) crt_int_value(value));
+  } else if (value == CRT_TRUE || value == CRT_FALSE) {
+    string_builder_append_chars(sb, value == CRT_TRUE ? "true" : "false");
+  } else if (depth > 16) {
+    string_builder_append_chars(sb, "...");
+  } else {
+    switch (gc_get_type(value)) {
+      case 'S':
+        string_builder_append_chars(sb, ((String*) value)->cstring);
+        break;
+      case 'L':
+        {
+          List* list = (List*) value;
+          string_builder_append_char(sb, '[');
+          for (int i = 0; i < list->length; ++i) {
+            if (i > 0) string_builder_append_chars(sb, ", ");
+            _crt_append_value(sb, list->items[i], depth + 1);
+          }
+          string_builder_append_char(sb, ']');
+        }
+        break;
+      case 'D':
+        {
+          Dictionary* dict = (Dictionary*) value;
+          string_builder_append_char(sb, '{');
+          for (int i = 0; i < dict->size; ++i) {
+            if (i > 0) string_builder_append_chars(sb, ", ");
+            string_builder_append_chars(sb, dict->keys[i]->cstring);
+            string_builder_append_chars(sb, ": ");
+            _crt_append_value(sb, dict->values[i], depth + 1);
+          }
+          string_builder_append_char(sb, '}');
+        }
+        break;
+      default:
+        if (crt_is_struct(value, CRT_OBJECT_NAME)) {
+          string_builder_append_chars(sb, "<instance of ");
+          string_builder_append_chars(sb, ((CrtObject*) value)->class_def->name->cstring);
+        } else if (crt_is_struct(value, CRT_CLASS_NAME)) {
+          string_builder_append_chars(sb, "<class ");
+          string_builder_append_chars(sb, ((CrtClass*) value)->name->cstring);
+        } else {
+          string_builder_append_chars(sb, "<function ");
+          string_builder_append_chars(sb, ((CrtFunction*) value)->name->cstring);
+        }
+        string_builder_append_char(sb, '>');
+        break;
+    }
+  }
+}
+
+String* crt_to_string(CrtValue value) {
+  if (crt_type_is(value, 'S')) return (String*) value;
+  StringBuilder* sb = new_string_builder();
+  _crt_append_value(sb, value, 0);
+  return string_builder_to_string_and_free(sb);
+}
+
+int crt_truthy(CrtValue value) {
+  if (value == CRT_TRUE) return 1;
+  if (value == CRT_FALSE || value == CRT_NULL) return 0;
+  if (crt_is_int(value)) return crt_int_value(value) != 0;
+  if (gc_get_type(value) == 'S') return ((String*) value)->length > 0;
+  return 1;
+}
+
+int crt_equals(CrtValue a, CrtValue b) {
+  if (a == b) return 1;
+  return crt_type_is(a, 'S') && crt_type_is(b, 'S') && string_equals((String*) a, (String*) b);
+}
+
+// Checks that the result of an integer operation is still a 32 bit integer, like every Wax integer.
+int64_t crt_i32(int64_t value, int site) {
+  if (value < -2147483647LL - 1 || value > 2147483647LL) crt_fail_chars(site, "Integer overflow.");
+  return value;
+}
+
+// Integer division and remainder round toward negative infinity.
+int64_t crt_idiv(int64_t x, int64_t y, int site) {
+  if (y == 0) crt_fail_chars(site, "Division by zero.");
+  int64_t quotient = x / y;
+  if (x % y != 0 && ((x % y) < 0) != (y < 0)) quotient--;
+  return crt_i32(quotient, site);
+}
+
+int64_t crt_imod(int64_t x, int64_t y, int site) {
+  if (y == 0) crt_fail_chars(site, "Division by zero.");
+  int64_t remainder = x % y;
+  if (remainder != 0 && (remainder < 0) != (y < 0)) remainder += y;
+  return remainder;
+}
+
+int64_t crt_ipow(int64_t x, int64_t y, int site) {
+  if (y < 0) crt_fail_chars(site, "Negative exponents are not supported for integers.");
+  if (x == 0 || x == 1) return y == 0 ? 1 : x;
+  if (x == -1) return (y & 1) == 0 ? 1 : -1;
+  // Any other base overflows within 32 multiplications.
+  int64_t result = 1;
+  for (int64_t i = 0; i < y; ++i) {
+    result *= x;
+    if (result < -2147483647LL - 1 || result > 2147483647LL) break;
+  }
+  return crt_i32(result, site);
+}
+
+int64_t crt_ishl(int64_t x, int64_t y, int site) {
+  if (y < 0) crt_fail_chars(site, "Negative shift count.");
+  if (x == 0) return 0;
+  return crt_i32(y > 31 ? 1LL << 32 : x * (1LL << y), site);
+}
+
+int64_t crt_ishr(int64_t x, int64_t y, int site) {
+  if (y < 0) crt_fail_chars(site, "Negative shift count.");
+  return x >> (y > 63 ? 63 : y);
+}
+
+const char* _crt_operator_symbol(int op) {
+  switch (op) {
+    case CRT_ADD: return "+";
+    case CRT_SUB: return "-";
+    case CRT_MUL: return "*";
+    case CRT_DIV: return "/";
+    case CRT_MOD: return "%";
+    case CRT_POW: return "**";
+    case CRT_BIT_AND: return "&";
+    case CRT_BIT_OR: return "|";
+    case CRT_BIT_XOR: return "^";
+    case CRT_SHL: return "<<";
+    default: return ">>";
+  }
+}
+
+// The binary operators other than the comparisons, on values of any type.
+CrtValue crt_binary(int op, CrtValue a, CrtValue b, int site) {
+  if (crt_is_int(a) && crt_is_int(b)) {
+    int64_t x = crt_int_value(a);
+    int64_t y = crt_int_value(b);
+    switch (op) {
+      case CRT_ADD: return crt_int(crt_i32(x + y, site));
+      case CRT_SUB: return crt_int(crt_i32(x - y, site));
+      case CRT_MUL: return crt_int(crt_i32(x * y, site));
+      case CRT_DIV: return crt_int(crt_idiv(x, y, site));
+      case CRT_MOD: return crt_int(crt_imod(x, y, site));
+      case CRT_POW: return crt_int(crt_ipow(x, y, site));
+      case CRT_BIT_AND: return crt_int(x & y);
+      case CRT_BIT_OR: return crt_int(x | y);
+      case CRT_BIT_XOR: return crt_int(x ^ y);
+      case CRT_SHL: return crt_int(crt_ishl(x, y, site));
+      case CRT_SHR: return crt_int(crt_ishr(x, y, site));
+    }
+  }
+
+  if (op == CRT_ADD && (crt_type_is(a, 'S') || crt_type_is(b, 'S')) &&
+      (crt_type_is(a, 'S') || crt_is_int(a)) && (crt_type_is(b, 'S') || crt_is_int(b))) {
+    StringBuilder* sb = new_string_builder();
+    _crt_append_value(sb, a, 0);
+    _crt_append_value(sb, b, 0);
+    crt_allocations++;
+    return string_builder_to_string_and_free(sb);
+  }
+
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, "The operator ");
+  string_builder_append_chars(sb, _crt_operator_symbol(op));
+  string_builder_append_chars(sb, " can't be used on a ");
+  string_builder_append_chars(sb, crt_type_name(a));
+  string_builder_append_chars(sb, " and a ");
+  string_builder_append_chars(sb, crt_type_name(b));
+  string_builder_append_char(sb, '.');
+  crt_fail(site, string_builder_to_string_and_free(sb));
+  return CRT_NULL;
+}
+
+// <, >, <= and >= on two integers or two strings.
+int crt_compare(int op, CrtValue a, CrtValue b, int site) {
+  int order;
+  if (crt_is_int(a) && crt_is_int(b)) {
+    order = crt_int_value(a) < crt_int_value(b) ? -1 : crt_int_value(a) > crt_int_value(b) ? 1 : 0;
+  } else if (crt_type_is(a, 'S') && crt_type_is(b, 'S')) {
+    order = strcmp(((String*) a)->cstring, ((String*) b)->cstring);
+  } else {
+    crt_fail(site, string_concat5("Cannot compare ", crt_type_name(a), " and ", crt_type_name(b), "."));
+    return 0;
+  }
+  switch (op) {
+    case CRT_LT: return order < 0;
+    case CRT_GT: return order > 0;
+    case CRT_LE: return order <= 0;
+    default: return order >= 0;
+  }
+}
+
+Dictionary* crt_new_dictionary() {
+  crt_allocations++;
+  return new_dictionary();
+}
+
+// A copy of a dictionary constant, with the dictionaries in it copied too.
+Dictionary* crt_clone_dictionary(Dictionary* original) {
+  Dictionary* dict = crt_new_dictionary();
+  for (int i = 0; i < original->size; ++i) {
+    CrtValue value = original->values[i];
+    if (crt_type_is(value, 'D')) value = crt_clone_dictionary((Dictionary*) value);
+    dictionary_set(dict, original->keys[i], value);
+  }
+  return dict;
+}
+
+// The slot of a field of an instance. Fails if the class has no such field.
+int _crt_field_slot(CrtObject* object, String* name, int site) {
+  CrtValue slot = dictionary_get(object->class_def->field_slots, name);
+  if (slot == NULL) {
+    crt_fail(site, string_concat5("The class '", object->class_def->name->cstring, "' has no field named '", name->cstring, "'."));
+  }
+  return (int) crt_int_value(slot);
+}
+
+CrtValue crt_dot_get(CrtValue root, String* name, int site) {
+  if (crt_type_is(root, 'D')) return dictionary_get((Dictionary*) root, name); // missing fields are null
+  if (crt_is_struct(root, CRT_OBJECT_NAME)) return ((CrtObject*) root)->fields[_crt_field_slot((CrtObject*) root, name, site)];
+  if (string_equals_chars(name, "length") && crt_type_is(root, 'L')) return crt_int(((List*) root)->length);
+  if (string_equals_chars(name, "length") && crt_type_is(root, 'S')) return crt_int(((String*) root)->length);
+  crt_fail(site, string_concat5("A ", crt_type_name(root), " has no field named '", name->cstring, "'."));
+  return CRT_NULL;
+}
+
+void crt_dot_set(CrtValue root, String* name, CrtValue value, int site) {
+  if (crt_type_is(root, 'D')) {
+    dictionary_set((Dictionary*) root, name, value);
+  } else if (crt_is_struct(root, CRT_OBJECT_NAME)) {
+    ((CrtObject*) root)->fields[_crt_field_slot((CrtObject*) root, name, site)] = value;
+  } else {
+    crt_fail(site, string_concat5("Cannot set the field '", name->cstring, "' of a ", crt_type_name(root), "."));
+  }
+}
+
+// The position an index stands for in a list or string of the given length. Fails if it isn't one.
+int _crt_position(CrtValue index, int length, int site) {
+  if (!crt_is_int(index)) {
+    crt_fail(site, string_concat3("A list or string index must be an integer, not a ", crt_type_name(index), "."));
+  }
+  int64_t i = crt_int_value(index);
+  if (i < 0 || i >= length) {
+    StringBuilder* sb = new_string_builder();
+    string_builder_append_chars(sb, "Index ");
+    string_builder_append_int(sb, (int) i);
+    string_builder_append_chars(sb, " is out of range for a length of ");
+    string_builder_append_int(sb, length);
+    string_builder_append_char(sb, '.');
+    crt_fail(site, string_builder_to_string_and_free(sb));
+  }
+  return (int) i;
+}
+
+String* _crt_key(CrtValue key, int site) {
+  if (!crt_type_is(key, 'S')) crt_fail(site, string_concat3("A dictionary key must be a string, not a ", crt_type_name(key), "."));
+  return (String*) key;
+}
+
+CrtValue crt_index_get(CrtValue root, CrtValue index, int site) {
+  if (crt_type_is(root, 'L')) return ((List*) root)->items[_crt_position(index, ((List*) root)->length, site)];
+  if (crt_type_is(root, 'D')) return dictionary_get((Dictionary*) root, _crt_key(index, site));
+  if (crt_type_is(root, 'S')) {
+    String* str = (String*) root;
+    int i = _crt_position(index, str->length, site);
+    crt_allocations++;
+    return new_string_from_range(str->cstring, i, i + 1);
+  }
+  crt_fail(site, string_concat3("A ", crt_type_name(root), " can't be indexed."));
+  return CRT_NULL;
+}
+
+void crt_index_set(CrtValue root, CrtValue index, CrtValue value, int site) {
+  if (crt_type_is(root, 'L')) {
+    ((List*) root)->items[_crt_position(index, ((List*) root)->length, site)] = value;
+  } else if (crt_type_is(root, 'D')) {
+    dictionary_set((Dictionary*) root, _crt_key(index, site), value);
+  } else {
+    crt_fail(site, string_concat3("Cannot set an index of a ", crt_type_name(root), "."));
+  }
+}
+
+// The list a for each loop iterates over. Fails if the value isn't a list.
+List* crt_iterate(CrtValue value, int site) {
+  if (!crt_type_is(value, 'L')) crt_fail(site, string_concat3("Only a list can be iterated over, not a ", crt_type_name(value), "."));
+  return (List*) value;
+}
+
+String* crt_arg_count_error(CrtFunction* fn, int given) {
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, "The function '");
+  string_builder_append_chars(sb, fn->name->cstring);
+  string_builder_append_chars(sb, "' takes ");
+  if (fn->required_arg_count != fn->arg_count) {
+    string_builder_append_int(sb, fn->required_arg_count);
+    string_builder_append_chars(sb, " to ");
+  }
+  string_builder_append_int(sb, fn->arg_count);
+  string_builder_append_chars(sb, fn->arg_count == 1 ? " argument but was given " : " arguments but was given ");
+  string_builder_append_int(sb, given);
+  string_builder_append_char(sb, '.');
+  return string_builder_to_string_and_free(sb);
+}
+
+// Calls a function with argc arguments at args, which start a frame. For a method the first argument is this, and argc counts it.
+CrtValue _crt_call_function(CrtFunction* fn, CrtValue* args, int argc, int site) {
+  if (!fn->is_native) {
+    int given = argc - fn->is_method;
+    if (given < fn->required_arg_count || given > fn->arg_count) crt_fail(site, crt_arg_count_error(fn, given));
+  }
+  return fn->entry(args, argc, site);
+}
+
+// A new instance with the field defaults of its class. Dictionary defaults are copied for each instance.
+CrtObject* _crt_new_object(CrtClass* cls) {
+  CrtObject* object = (CrtObject*) gc_create_struct(sizeof(CrtObject) + sizeof(CrtValue) * cls->field_count, CRT_OBJECT_NAME, 1 + cls->field_count);
+  crt_allocations++;
+  object->class_def = cls;
+  for (int i = 0; i < cls->field_count; ++i) {
+    CrtValue value = cls->field_defaults[i];
+    object->fields[i] = crt_type_is(value, 'D') ? crt_clone_dictionary((Dictionary*) value) : value;
+  }
+  return object;
+}
+
+// Calls the value at callee with the argc arguments after it. A class is called by making an instance
+// in the callee's place, which is this for the constructor.
+CrtValue crt_call(CrtValue* callee, int argc, int site) {
+  if (crt_is_struct(*callee, CRT_FUNCTION_NAME)) return _crt_call_function((CrtFunction*) *callee, callee + 1, argc, site);
+  if (crt_is_struct(*callee, CRT_CLASS_NAME)) {
+    CrtClass* cls = (CrtClass*) *callee;
+    *callee = _crt_new_object(cls);
+    if (cls->constructor != NULL) return _crt_call_function(cls->constructor, callee, argc + 1, site);
+    if (argc != 0) crt_fail(site, string_concat3("The class '", cls->name->cstring, "' has no constructor and takes no arguments."));
+    return *callee;
+  }
+  crt_fail(site, string_concat3("A ", crt_type_name(*callee), " can't be called."));
+  return CRT_NULL;
+}
+
+void _crt_check_arg_count(String* name, int argc, int expected, int site) {
+  if (argc == expected) return;
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, "The method '");
+  string_builder_append_chars(sb, name->cstring);
+  string_builder_append_chars(sb, "' takes ");
+  string_builder_append_int(sb, expected);
+  string_builder_append_chars(sb, expected == 1 ? " argument." : " arguments.");
+  crt_fail(site, string_builder_to_string_and_free(sb));
+}
+
+/*
+  Calls the method name of the value at root with the argc arguments after it. That is a method of
+  an instance, a function in a field of a dictionary, or one of the methods of the built in types.
+*/
+CrtValue crt_call_method(CrtValue* root, int argc, String* name, int site) {
+  if (crt_is_struct(*root, CRT_OBJECT_NAME)) {
+    CrtObject* object = (CrtObject*) *root;
+    CrtFunction* method = (CrtFunction*) dictionary_get(object->class_def->methods, name);
+    if (method == NULL) {
+      crt_fail(site, string_concat5("The class '", object->class_def->name->cstring, "' has no method named '", name->cstring, "'."));
+    }
+    return _crt_call_function(method, root, argc + 1, site);
+  }
+  if (crt_type_is(*root, 'D')) {
+    // A dictionary field that holds a function is called like a method, without the dictionary.
+    CrtValue field = dictionary_get((Dictionary*) *root, name);
+    if (crt_is_struct(field, CRT_FUNCTION_NAME)) {
+      *root = field;
+      return _crt_call_function((CrtFunction*) field, root + 1, argc, site);
+    }
+    Dictionary* dict = (Dictionary*) *root;
+    if (string_equals_chars(name, "keys") || string_equals_chars(name, "values")) {
+      _crt_check_arg_count(name, argc, 0, site);
+      crt_allocations++;
+      return name->cstring[0] == 'k' ? dictionary_get_keys(dict) : dictionary_get_values(dict);
+    }
+    if (string_equals_chars(name, "contains")) {
+      _crt_check_arg_count(name, argc, 1, site);
+      return crt_bool(dictionary_has_key(dict, _crt_key(root[1], site)));
+    }
+  } else if (crt_type_is(*root, 'L')) {
+    List* list = (List*) *root;
+    if (string_equals_chars(name, "add")) {
+      _crt_check_arg_count(name, argc, 1, site);
+      list_add(list, root[1]);
+      return CRT_NULL;
+    }
+    if (string_equals_chars(name, "pop")) {
+      _crt_check_arg_count(name, argc, 0, site);
+      if (list->length == 0) crt_fail_chars(site, "Cannot pop from an empty list.");
+      return list_pop(list);
+    }
+  }
+  crt_fail(site, string_concat5("A ", crt_type_name(*root), " has no method named '", name->cstring, "'."));
+  return CRT_NULL;
+}
+
+CrtValue _crt_native_print(CrtValue* args, int argc, int site) {
+  for (int i = 0; i < argc; ++i) {
+    if (i > 0) fputc(' ', stdout);
+    fputs(crt_to_string(args[i])->cstring, stdout);
+  }
+  fputc('\n', stdout);
+  return CRT_NULL;
+}
+
+// The value of a name the module uses but doesn't define. Only print is defined.
+CrtValue crt_global(const char* name, int site) {
+  if (strcmp(name, "print") == 0) return crt_print_function;
+  crt_fail(site, string_concat3("'", name, "' is not defined."));
+  return CRT_NULL;
+}
+
+CrtFunction* crt_new_function(String* name, CrtEntry entry, int arg_count, int required_arg_count, int is_method) {
+  CrtFunction* fn = (CrtFunction*) gc_create_struct(sizeof(CrtFunction), CRT_FUNCTION_NAME, CRT_FUNCTION_GC_FIELD_COUNT);
+  gc_save_item(fn);
+  fn->name = name;
+  fn->entry = entry;
+  fn->arg_count = arg_count;
+  fn->required_arg_count = required_arg_count;
+  fn->is_method = is_method;
+  fn->is_native = 0;
+  return fn;
+}
+
+// A class with every field null and no methods, for the generated code to fill in.
+CrtClass* crt_new_class(String* name, int field_count) {
+  CrtClass* cls = (CrtClass*) gc_create_struct(sizeof(CrtClass), CRT_CLASS_NAME, CRT_CLASS_GC_FIELD_COUNT);
+  gc_save_item(cls);
+  cls->name = name;
+  cls->base = NULL;
+  cls->constructor = NULL;
+  cls->methods = new_dictionary();
+  cls->field_slots = new_dictionary();
+  cls->field_count = field_count;
+  cls->field_defaults = (CrtValue*) gc_create_buffer(sizeof(CrtValue) * (field_count + 1));
+  return cls;
+}
+
+// Sets up the runtime for a module with the given sites, function count and class count.
+void crt_init(const CrtSite* sites, int function_count, int class_count) {
+  crt_sites = sites;
+  crt_stack = (CrtValue*) malloc_clean(sizeof(CrtValue) * CRT_STACK_SIZE);
+  crt_stack_end = crt_stack + CRT_STACK_SIZE;
+  crt_sp = crt_stack;
+  crt_function_count = function_count;
+  crt_functions = (CrtFunction**) malloc_ptr_array(function_count + 1);
+  crt_classes = (CrtClass**) malloc_ptr_array(class_count + 1);
+  crt_print_function = crt_new_function(new_string("print"), _crt_native_print, 0, 0, 0);
+  crt_print_function->is_native = 1;
+}
+
+/*
+  The main function of a compiled module. Calls the function named by the first command line argument
+  with the rest as its arguments, which are passed as integers if they look like one and as strings
+  otherwise, and prints the result unless it is null. Returns the exit code. This is the compiled
+  counterpart of waxcli --run.
+*/
+int crt_run(int argc, char** argv) {
+  if (argc < 2) {
+    printf("Usage: %s function [arguments...]\n", argv[0]);
+    return 0;
+  }
+  CrtFunction* fn = NULL;
+  for (int i = 0; i < crt_function_count && fn == NULL; ++i) {
+    if (!crt_functions[i]->is_method && string_equals_chars(crt_functions[i]->name, argv[1])) fn = crt_functions[i];
+  }
+  if (fn == NULL) {
+    printf("There is no function named '%s' in %s\n", argv[1], argv[0]);
+    return 1;
+  }
+  int given = argc - 2;
+  if (given < fn->required_arg_count || given > fn->arg_count) {
+    printf("%s\n", crt_arg_count_error(fn, given)->cstring);
+    return 1;
+  }
+  CrtValue* args = crt_sp;
+  for (int i = 0; i < given; ++i) {
+    int value;
+    args[i] = try_parse_int(argv[i + 2], &value) ? crt_int(value) : (CrtValue) new_string(argv[i + 2]);
+  }
+  crt_sp = args + given;
+  CrtValue result = fn->entry(args, given, -1);
+  if (result != CRT_NULL) printf("%s\n", crt_to_string(result)->cstring);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef _WAX_FOLDING_H
+#define _WAX_FOLDING_H
+
+#include <string.h>
+#include "../util/lists.h"
+#include "../util/strings.h"
+#include "nodes.h"
+
+/*
+  Constant folding, run by the resolver on each op chain, ternary and inline dictionary once its
+  children are resolved (and folded), so folding works bottom up through nested expressions.
+
+  Only what gives the same result in every language the compiler targets is folded:
+    - integer + - * & | ^ << >> and comparisons, as long as the result fits in an int
+    - integer / only when it divides exactly, and % only on non-negative operands
+    - == and != on two integers, two strings, two booleans or two nulls
+    - + of two strings, or of a string and an integer, as concatenation
+    - && and || with a boolean constant operand, keeping the short circuit behavior
+    - ternaries with a boolean constant condition
+  Anything else, like 1 + null or a division by zero, is left for the backend to report at runtime.
+
+  New constant nodes are created in the current arena. The resolver sets that to the arena of the
+  function being resolved, so the nodes live exactly as long as the rest of the tree.
+*/
+
+int _fold_is_constant(Node* node) {
+  switch (node_kind(node)) {
+    case NODE_KIND_NULL_CONSTANT:
+    case NODE_KIND_BOOLEAN_CONSTANT:
+    case NODE_KIND_INTEGER_CONSTANT:
+    case NODE_KIND_STRING_CONSTANT:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+int _fold_is_boolean(Node* node, int value) {
+  return node_kind(node) == NODE_KIND_BOOLEAN_CONSTANT && ((BooleanConstant*) node)->value == value;
+}
+
+Node* _fold_int_result(Token* token, long long value) {
+  if (value < -2147483647LL - 1 || value > 2147483647LL) return NULL;
+  return (Node*) new_integer_constant(token, (int) value);
+}
+
+Node* _fold_concat(Token* token, Node* left, Node* right) {
+  StringBuilder* sb = new_string_builder();
+  Node* parts[2] = { left, right };
+  for (int i = 0; i < 2; ++i) {
+    if (node_kind(parts[i]) == NODE_KIND_STRING_CONSTANT) {
+      string_builder_append_chars(sb, ((StringConstant*) parts[i])->value->cstring);
+    } else {
+      string_builder_append_int(sb, ((IntegerConstant*) parts[i])->value);
+    }
+  }
+  return (Node*) new_string_constant(token, string_builder_to_string_and_free(sb));
+}
+
+// Returns the constant that left op right evaluates to, or NULL if it can't be folded.
+Node* _fold_binary(Node* left, Token* op_token, Node* right) {
+  Token* token = left->first_token;
+  const char* op = op_token->value->cstring;
+  int left_kind = node_kind(left);
+  int right_kind = node_kind(right);
+
+  if (left_kind == NODE_KIND_INTEGER_CONSTANT && right_kind == NODE_KIND_INTEGER_CONSTANT) {
+    long long a = ((IntegerConstant*) left)->value;
+    long long b = ((IntegerConstant*) right)->value;
+    switch (op[0]) {
+      case '+': return _fold_int_result(token, a + b);
+      case '-': return _fold_int_result(token, a - b);
+      case '*': return _fold_int_result(token, a * b);
+      case '/': return b != 0 && a % b == 0 ? _fold_int_result(token, a / b) : NULL;
+      case '%': return a >= 0 && b > 0 ? _fold_int_result(token, a % b) : NULL;
+      case '^': return _fold_int_result(token, a ^ b);
+      case '&': return op[1] == '\0' ? _fold_int_result(token, a & b) : NULL;
+      case '|': return op[1] == '\0' ? _fold_int_result(token, a | b) : NULL;
+      case '=': return (Node*) new_boolean_constant(token, a == b);
+      case '!': return (Node*) new_boolean_constant(token, a != b);
+      case '<':
+        if (op[1] == '<') return a >= 0 && b >= 0 && b < 31 ? _fold_int_result(token, a << b) : NULL;
+        return (Node*) new_boolean_constant(token, op[1] == '=' ? a <= b : a < b);
+      case '>':
+        if (op[1] == '>') return b >= 0 && b < 31 ? _fold_int_result(token, a >> b) : NULL;
+        return (Node*) new_boolean_constant(token, op[1] == '=' ? a >= b : a > b);
+      default: return NULL;
+    }
+  }
+
+  if (op[0] == '+' &&
+      (left_kind == NODE_KIND_STRING_CONSTANT || right_kind == NODE_KIND_STRING_CONSTANT) &&
+      (left_kind == NODE_KIND_STRING_CONSTANT || left_kind == NODE_KIND_INTEGER_CONSTANT) &&
+      (right_kind == NODE_KIND_STRING_CONSTANT || right_kind == NODE_KIND_INTEGER_CONSTANT)) {
+    return _fold_concat(token, left, right);
+  }
+
+  int is_equals = strcmp(op, "==") == 0;
+  if ((is_equals || strcmp(op, "!=") == 0) && left_kind == right_kind) {
+    int equal;
+    switch (left_kind) {
+      case NODE_KIND_STRING_CONSTANT: equal = string_equals(((StringConstant*) left)->value, ((StringConstant*) right)->value); break;
+      case NODE_KIND_BOOLEAN_CONSTANT: equal = ((BooleanConstant*) left)->value == ((BooleanConstant*) right)->value; break;
+      case NODE_KIND_NULL_CONSTANT: equal = 1; break;
+      default: return NULL;
+    }
+    return (Node*) new_boolean_constant(token, is_equals ? equal : !equal);
+  }
+
+  return NULL;
+}
+
+/*
+  In a && chain a true operand that is not the last one can be dropped, and a false operand ends the
+  chain since nothing after it is evaluated. The same goes for false and true in a || chain. The
+  last operand is never dropped since its value, not just its truthiness, is the chain's result.
+*/
+void _fold_logical_chain(OpChain* oc, int is_and) {
+  List* expressions = oc->expressions;
+  List* ops = oc->ops;
+  int length = 0;
+  for (int i = 0; i < expressions->length; ++i) {
+    Node* ex = (Node*) list_get(expressions, i);
+    int is_last = i == expressions->length - 1;
+    if (!is_last && _fold_is_boolean(ex, is_and)) continue;
+    if (length > 0) list_set(ops, length - 1, list_get(ops, i - 1));
+    list_set(expressions, length++, ex);
+    if (_fold_is_boolean(ex, !is_and)) break;
+  }
+  expressions->length = length;
+  ops->length = length - 1;
+}
+
+/*
+  Once the first operand of a chain of +'s is a string, every + in it is a concatenation, which is
+  associative. So neighboring string and integer constants anywhere in the chain can be joined,
+  even when something that isn't constant comes before them.
+*/
+void _fold_concat_chain(OpChain* oc) {
+  List* expressions = oc->expressions;
+  for (int i = 0; i < oc->ops->length; ++i) {
+    if (!string_equals_chars(((Token*) list_get(oc->ops, i))->value, "+")) return;
+  }
+  int length = 1;
+  for (int i = 1; i < expressions->length; ++i) {
+    Node* previous = (Node*) list_get(expressions, length - 1);
+    Node* ex = (Node*) list_get(expressions, i);
+    int previous_kind = node_kind(previous);
+    int kind = node_kind(ex);
+    if ((previous_kind == NODE_KIND_STRING_CONSTANT || previous_kind == NODE_KIND_INTEGER_CONSTANT) &&
+        (kind == NODE_KIND_STRING_CONSTANT || kind == NODE_KIND_INTEGER_CONSTANT)) {
+      list_set(expressions, length - 1, _fold_concat(previous->first_token, previous, ex));
+    } else {
+      list_set(expressions, length++, ex);
+    }
+  }
+  expressions->length = length;
+  oc->ops->length = length - 1;
+}
+
+// Folds what it can of an op chain whose operands are resolved. Returns the constant the chain
+// evaluates to, or the chain itself with fewer operands.
+Node* wax_fold_op_chain(OpChain* oc) {
+  List* expressions = oc->expressions;
+  List* ops = oc->ops;
+  String* first_op = ((Token*) list_get(ops, 0))->value;
+  if (string_equals_chars(first_op, "&&") || string_equals_chars(first_op, "||")) {
+    _fold_logical_chain(oc, first_op->cstring[0] == '&');
+  } else {
+    // Operators of the same precedence evaluate left to right, so only a constant prefix folds.
+    int folded = 0;
+    while (folded < ops->length) {
+      Node* left = (Node*) list_get(expressions, folded);
+      Node* right = (Node*) list_get(expressions, folded + 1);
+      if (!_fold_is_constant(left) || !_fold_is_constant(right)) break;
+      Node* result = _fold_binary(left, (Token*) list_get(ops, folded), right);
+      if (result == NULL) break;
+      list_set(expressions, ++folded, result);
+    }
+    if (folded > 0) {
+      for (int i = folded; i < expressions->length; ++i) {
+        list_set(expressions, i - folded, list_get(expressions, i));
+      }
+      for (int i = folded; i < ops->length; ++i) {
+        list_set(ops, i - folded, list_get(ops, i));
+      }
+      expressions->length -= folded;
+      ops->length -= folded;
+    }
+    if (expressions->length > 1 && node_kind((Node*) list_get(expressions, 0)) == NODE_KIND_STRING_CONSTANT) {
+      _fold_concat_chain(oc);
+    }
+  }
+
+  if (expressions->length == 1) return (Node*) list_get(expressions, 0);
+  return (Node*) oc;
+}
+
+Node* wax_fold_ternary(Ternary* ter) {
+  if (node_kind(ter->condition) != NODE_KIND_BOOLEAN_CONSTANT) return (Node*) ter;
+  return ((BooleanConstant*) ter->condition)->value ? ter->true_expr : ter->false_expr;
+}
+
+// A dictionary is constant if all of its values are constants or constant dictionaries.
+void wax_fold_inline_dictionary(InlineDictionary* dict) {
+  dict->is_constant = 1;
+  for (int i = 0; i < dict->values->length; ++i) {
+    Node* value = (Node*) list_get(dict->values, i);
+    if (_fold_is_constant(value)) continue;
+    if (node_kind(value) == NODE_KIND_INLINE_DICTIONARY && ((InlineDictionary*) value)->is_constant) continue;
+    dict->is_constant = 0;
+    return;
+  }
+}
+
+#endif
@@ -1,16 +1,58 @@
 #ifndef _WAX_NODES_H
 #define _WAX_NODES_H
 
+#include "../util/arena.h"
 #include "../util/gcbase.h"
 #include "../util/strings.h"
 #include "./tokens.h"
 
+enum NodeKind {
+  NODE_KIND_CLASS_DEFINITION,
+  NODE_KIND_FUNCTION_DEFINITION,
+  NODE_KIND_CONSTRUCTOR_DEFINITION,
+  NODE_KIND_FIELD_DEFINITION,
+  NODE_KIND_ASSIGNMENT,
+  NODE_KIND_IF_STATEMENT,
+  NODE_KIND_FOR_LOOP,
+  NODE_KIND_FOR_EACH_LOOP,
+  NODE_KIND_EXPR_EXEC,
+  NODE_KIND_WHILE_LOOP,
+  NODE_KIND_RETURN,
+  NODE_KIND_BREAK,
+  NODE_KIND_CONTINUE,
+  NODE_KIND_NULL_CONSTANT,
+  NODE_KIND_BOOLEAN_CONSTANT,
+  NODE_KIND_INTEGER_CONSTANT,
+  NODE_KIND_STRING_CONSTANT,
+  NODE_KIND_VARIABLE,
+  NODE_KIND_INLINE_DICTIONARY,
+  NODE_KIND_DOT_FIELD,
+  NODE_KIND_BRACKET_INDEX,
+  NODE_KIND_OP_CHAIN,
+  NODE_KIND_TERNARY,
+  NODE_KIND_FUNCTION_INVOCATION,
+  NODE_KIND_COUNT,
+};
+
+/*
+  Nodes and their lists are created in the current arena if there is one (see arena.h), which is
+  the case while the compiler parses a file. Other GC objects that a node holds must be kept with
+  arena_keep. Token values don't need to be, since the symbol list of their token stream is kept for
+  the whole file.
+
+  kind is an enum NodeKind. It is stored with gc_tag_int so it can sit among the GC fields at the
+  start of every node without being traced. Read it with node_kind().
+*/
 typedef struct _Node {
   Token* first_token;
-  String* type;
+  intptr_t kind;
 } Node;
 #define NODE_GC_FIELD_COUNT 2
 
+int node_kind(Node* node) {
+  return gc_untag_int(node->kind);
+}
+
 typedef struct _ClassDefinition {
   Node node;
   Token* class_name;
@@ -18,18 +60,25 @@ typedef struct _ClassDefinition {
   List* member_order;
   Token* base_class_token;
   struct _ClassDefinition* base_class_definition;
+  int index; // position in the module's class definitions, set by the resolver
+  int field_count; // fields of the class and its base classes, set by the resolver
+  Arena* arena; // the arena the class was parsed into, for nodes the resolver adds. Not traced.
 } ClassDefinition;
 #define CLASS_DEFINITION_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 5)
 #define CLASS_DEFINITION_NAME "ClassDefinition"
 
 ClassDefinition* new_class_definition(Token* first_token, Token* name_token) {
-  ClassDefinition* cd = (ClassDefinition*) gc_create_struct(sizeof(ClassDefinition), CLASS_DEFINITION_NAME, CLASS_DEFINITION_GC_FIELD_COUNT);
+  ClassDefinition* cd = (ClassDefinition*) arena_create_struct(sizeof(ClassDefinition), CLASS_DEFINITION_NAME, CLASS_DEFINITION_GC_FIELD_COUNT);
   cd->node.first_token = first_token;
-  cd->node.type = new_string(CLASS_DEFINITION_NAME);
+  cd->node.kind = gc_tag_int(NODE_KIND_CLASS_DEFINITION);
   cd->class_name = name_token;
-  cd->members = new_dictionary();
-  cd->member_order = new_list();
+  cd->members = (Dictionary*) arena_keep(new_dictionary());
+  cd->member_order = arena_new_list();
   cd->base_class_token = NULL;
+  cd->base_class_definition = NULL;
+  cd->index = -1;
+  cd->field_count = -1;
+  cd->arena = arena_get_current();
   return cd;
 }
 
@@ -39,17 +88,24 @@ typedef struct _FunctionDefinition {
   List* code;
   List* arg_tokens;
   List* arg_default_values;
+  int index; // position in the module's function definitions, set by the resolver
+  int local_count; // number of local slots, arguments first (after this, in a method), set by the resolver
+  Arena* arena; // the arena the function was parsed into, for nodes the resolver adds. Not traced.
 } FunctionDefinition;
 #define FUNCTION_DEFINITION_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 4)
 #define FUNCTION_DEFINITION_NAME "FunctionDefinition"
 
 FunctionDefinition* new_function_definition(Token* first_token, Token* function_name) {
-  FunctionDefinition* fd = (FunctionDefinition*) gc_create_struct(sizeof(FunctionDefinition), FUNCTION_DEFINITION_NAME, FUNCTION_DEFINITION_GC_FIELD_COUNT);
+  FunctionDefinition* fd = (FunctionDefinition*) arena_create_struct(sizeof(FunctionDefinition), FUNCTION_DEFINITION_NAME, FUNCTION_DEFINITION_GC_FIELD_COUNT);
   fd->node.first_token = first_token;
-  fd->node.type = new_string(FUNCTION_DEFINITION_NAME);
-  fd->code = new_list();
-  fd->arg_tokens = new_list();
-  fd->arg_default_values = new_list();
+  fd->node.kind = gc_tag_int(NODE_KIND_FUNCTION_DEFINITION);
+  fd->function_name = function_name;
+  fd->code = arena_new_list();
+  fd->arg_tokens = arena_new_list();
+  fd->arg_default_values = arena_new_list();
+  fd->index = -1;
+  fd->local_count = 0;
+  fd->arena = arena_get_current();
   return fd;
 }
 
@@ -58,18 +114,43 @@ typedef struct _ConstructorDefinition {
   List* code;
   List* arg_tokens;
   List* arg_default_values;
+  int local_count; // number of local slots, this and then the arguments first, set by the resolver
+  Arena* arena; // the arena the constructor was parsed into. Not traced.
 } ConstructorDefinition;
 #define CONSTRUCTOR_DEFINITION_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 3)
 #define CONSTRUCTOR_DEFINITION_NAME "ConstructorDefinition"
 
+ConstructorDefinition* new_constructor_definition(Token* first_token) {
+  ConstructorDefinition* cd = (ConstructorDefinition*) arena_create_struct(sizeof(ConstructorDefinition), CONSTRUCTOR_DEFINITION_NAME, CONSTRUCTOR_DEFINITION_GC_FIELD_COUNT);
+  cd->node.first_token = first_token;
+  cd->node.kind = gc_tag_int(NODE_KIND_CONSTRUCTOR_DEFINITION);
+  cd->code = arena_new_list();
+  cd->arg_tokens = arena_new_list();
+  cd->arg_default_values = arena_new_list();
+  cd->local_count = 0;
+  cd->arena = arena_get_current();
+  return cd;
+}
+
 typedef struct _FieldDefinition {
   Node node;
   Token* field_name;
   Node* default_value;
+  int index; // slot in the instances of the class, after the fields of the base classes, set by the resolver
 } FieldDefinition;
 #define FIELD_DEFINITION_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 2)
 #define FIELD_DEFINITION_NAME "FieldDefinition"
 
+FieldDefinition* new_field_definition(Token* first_token, Token* field_name, Node* default_value) {
+  FieldDefinition* fd = (FieldDefinition*) arena_create_struct(sizeof(FieldDefinition), FIELD_DEFINITION_NAME, FIELD_DEFINITION_GC_FIELD_COUNT);
+  fd->node.first_token = first_token;
+  fd->node.kind = gc_tag_int(NODE_KIND_FIELD_DEFINITION);
+  fd->field_name = field_name;
+  fd->default_value = default_value;
+  fd->index = -1;
+  return fd;
+}
+
 typedef struct _Assignment {
   Node node;
   Node* target;
@@ -80,9 +161,9 @@ typedef struct _Assignment {
 #define NODE_ASSIGNMENT_NAME "Assignment"
 
 Assignment* new_assignment(Node* target, Token* op, Node* value) {
-  Assignment* asgn = (Assignment*) gc_create_struct(sizeof(Assignment), NODE_ASSIGNMENT_NAME, NODE_ASSIGNMENT_GC_FIELD_COUNT);
+  Assignment* asgn = (Assignment*) arena_create_struct(sizeof(Assignment), NODE_ASSIGNMENT_NAME, NODE_ASSIGNMENT_GC_FIELD_COUNT);
   asgn->node.first_token = target->first_token;
-  asgn->node.type = new_string(NODE_ASSIGNMENT_NAME);
+  asgn->node.kind = gc_tag_int(NODE_KIND_ASSIGNMENT);
   asgn->target = target;
   asgn->assignment_op = op;
   asgn->value = value;
@@ -99,9 +180,9 @@ typedef struct _IfStatement {
 #define NODE_IF_STATEMENT_NAME "IfStatement"
 
 IfStatement* new_if_statement(Token* if_token, Node* condition, List* true_code, List* false_code) {
-  IfStatement* ifstat = (IfStatement*) gc_create_struct(sizeof(IfStatement), NODE_IF_STATEMENT_NAME, NODE_IF_STATEMENT_GC_FIELD_COUNT);
+  IfStatement* ifstat = (IfStatement*) arena_create_struct(sizeof(IfStatement), NODE_IF_STATEMENT_NAME, NODE_IF_STATEMENT_GC_FIELD_COUNT);
   ifstat->node.first_token = if_token;
-  ifstat->node.type = new_string(NODE_IF_STATEMENT_NAME);
+  ifstat->node.kind = gc_tag_int(NODE_KIND_IF_STATEMENT);
   ifstat->condition = condition;
   ifstat->true_code = true_code;
   ifstat->false_code = false_code;
@@ -119,9 +200,9 @@ typedef struct _ForLoop {
 #define NODE_FOR_LOOP_NAME "ForLoop"
 
 ForLoop* new_for_loop(Token* for_token, List* inits, Node* condition, List* steps, List* code) {
-  ForLoop* fl = (ForLoop*) gc_create_struct(sizeof(ForLoop), NODE_FOR_LOOP_NAME, NODE_FOR_LOOP_GC_FIELD_COUNT);
+  ForLoop* fl = (ForLoop*) arena_create_struct(sizeof(ForLoop), NODE_FOR_LOOP_NAME, NODE_FOR_LOOP_GC_FIELD_COUNT);
   fl->node.first_token = for_token;
-  fl->node.type = new_string(NODE_FOR_LOOP_NAME);
+  fl->node.kind = gc_tag_int(NODE_KIND_FOR_LOOP);
   fl->inits = inits;
   fl->condition = condition;
   fl->steps = steps;
@@ -134,17 +215,19 @@ typedef struct _ForEachLoop {
   Token* variable;
   Node* list_expr;
   List* code;
+  int variable_index; // local slot of the iteration variable, set by the resolver
 } ForEachLoop;
 #define NODE_FOR_EACH_LOOP_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 3)
 #define NODE_FOR_EACH_LOOP_NAME "ForEachLoop"
 
 ForEachLoop* new_for_each_loop(Token* for_token, Token* iterator_variable, Node* list_expr, List* code) {
-  ForEachLoop* fl = (ForEachLoop*) gc_create_struct(sizeof(ForEachLoop), NODE_FOR_EACH_LOOP_NAME, NODE_FOR_EACH_LOOP_GC_FIELD_COUNT);
+  ForEachLoop* fl = (ForEachLoop*) arena_create_struct(sizeof(ForEachLoop), NODE_FOR_EACH_LOOP_NAME, NODE_FOR_EACH_LOOP_GC_FIELD_COUNT);
   fl->node.first_token = for_token;
-  fl->node.type = new_string(NODE_FOR_EACH_LOOP_NAME);
+  fl->node.kind = gc_tag_int(NODE_KIND_FOR_EACH_LOOP);
   fl->variable = iterator_variable;
   fl->list_expr = list_expr;
   fl->code = code;
+  fl->variable_index = -1;
   return fl;
 }
 
@@ -156,13 +239,60 @@ typedef struct _ExpressionAsExecutable {
 #define NODE_EXPR_EXEC_NAME "ExpressionAsExecutable"
 
 ExpressionAsExecutable* new_expression_as_executable(Node* expr) {
-  ExpressionAsExecutable* ee = (ExpressionAsExecutable*) gc_create_struct(sizeof(ExpressionAsExecutable), NODE_EXPR_EXEC_NAME, NODE_EXPR_EXEC_GC_FIELD_COUNT);
+  ExpressionAsExecutable* ee = (ExpressionAsExecutable*) arena_create_struct(sizeof(ExpressionAsExecutable), NODE_EXPR_EXEC_NAME, NODE_EXPR_EXEC_GC_FIELD_COUNT);
   ee->node.first_token = expr->first_token;
-  ee->node.type = new_string(NODE_EXPR_EXEC_NAME);
+  ee->node.kind = gc_tag_int(NODE_KIND_EXPR_EXEC);
   ee->expression = expr;
   return ee;
 }
 
+typedef struct _WhileLoop {
+  Node node;
+  Node* condition;
+  List* code;
+} WhileLoop;
+#define NODE_WHILE_LOOP_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 2)
+#define NODE_WHILE_LOOP_NAME "WhileLoop"
+
+WhileLoop* new_while_loop(Token* while_token, Node* condition, List* code) {
+  WhileLoop* wl = (WhileLoop*) arena_create_struct(sizeof(WhileLoop), NODE_WHILE_LOOP_NAME, NODE_WHILE_LOOP_GC_FIELD_COUNT);
+  wl->node.first_token = while_token;
+  wl->node.kind = gc_tag_int(NODE_KIND_WHILE_LOOP);
+  wl->condition = condition;
+  wl->code = code;
+  return wl;
+}
+
+typedef struct _ReturnStatement {
+  Node node;
+  Node* value; // NULL for a bare return
+} ReturnStatement;
+#define NODE_RETURN_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 1)
+#define NODE_RETURN_NAME "ReturnStatement"
+
+ReturnStatement* new_return_statement(Token* return_token, Node* value) {
+  ReturnStatement* rs = (ReturnStatement*) arena_create_struct(sizeof(ReturnStatement), NODE_RETURN_NAME, NODE_RETURN_GC_FIELD_COUNT);
+  rs->node.first_token = return_token;
+  rs->node.kind = gc_tag_int(NODE_KIND_RETURN);
+  rs->value = value;
+  return rs;
+}
+
+// break and continue have nothing but their token, so they share a struct and differ by kind.
+typedef struct _LoopJump {
+  Node node;
+} LoopJump;
+#define NODE_LOOP_JUMP_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 0)
+#define NODE_BREAK_NAME "BreakStatement"
+#define NODE_CONTINUE_NAME "ContinueStatement"
+
+LoopJump* new_loop_jump(Token* token, int is_break) {
+  LoopJump* lj = (LoopJump*) arena_create_struct(sizeof(LoopJump), is_break ? NODE_BREAK_NAME : NODE_CONTINUE_NAME, NODE_LOOP_JUMP_GC_FIELD_COUNT);
+  lj->node.first_token = token;
+  lj->node.kind = gc_tag_int(is_break ? NODE_KIND_BREAK : NODE_KIND_CONTINUE);
+  return lj;
+}
+
 typedef struct _NullConstant {
   Node node;
 } NullConstant;
@@ -170,9 +300,9 @@ typedef struct _NullConstant {
 #define NODE_NULL_CONSTANT_NAME "NullConstant"
 
 NullConstant* new_null_constant(Token* token) {
-  NullConstant* nc = (NullConstant*) gc_create_struct(sizeof(NullConstant), NODE_NULL_CONSTANT_NAME, NODE_NULL_CONSTANT_GC_FIELD_COUNT);
+  NullConstant* nc = (NullConstant*) arena_create_struct(sizeof(NullConstant), NODE_NULL_CONSTANT_NAME, NODE_NULL_CONSTANT_GC_FIELD_COUNT);
   nc->node.first_token = token;
-  nc->node.type = new_string(NODE_NULL_CONSTANT_NAME);
+  nc->node.kind = gc_tag_int(NODE_KIND_NULL_CONSTANT);
   return nc;
 }
 
@@ -184,9 +314,9 @@ typedef struct _BooleanConstant {
 #define NODE_BOOLEAN_CONSTANT_NAME "BooleanConstant"
 
 BooleanConstant* new_boolean_constant(Token* token, int value) {
-  BooleanConstant* bo = (BooleanConstant*) gc_create_struct(sizeof(BooleanConstant), NODE_BOOLEAN_CONSTANT_NAME, NODE_BOOLEAN_CONSTANT_GC_FIELD_COUNT);
+  BooleanConstant* bo = (BooleanConstant*) arena_create_struct(sizeof(BooleanConstant), NODE_BOOLEAN_CONSTANT_NAME, NODE_BOOLEAN_CONSTANT_GC_FIELD_COUNT);
   bo->node.first_token = token;
-  bo->node.type = new_string(NODE_BOOLEAN_CONSTANT_NAME);
+  bo->node.kind = gc_tag_int(NODE_KIND_BOOLEAN_CONSTANT);
   bo->value = value;
   return bo;
 }
@@ -199,9 +329,9 @@ typedef struct _IntegerConstant {
 #define NODE_INTEGER_CONSTANT_NAME "IntegerConstant"
 
 IntegerConstant* new_integer_constant(Token* token, int value) {
-  IntegerConstant* str = (IntegerConstant*) gc_create_struct(sizeof(IntegerConstant), NODE_INTEGER_CONSTANT_NAME, NODE_INTEGER_CONSTANT_GC_FIELD_COUNT);
+  IntegerConstant* str = (IntegerConstant*) arena_create_struct(sizeof(IntegerConstant), NODE_INTEGER_CONSTANT_NAME, NODE_INTEGER_CONSTANT_GC_FIELD_COUNT);
   str->node.first_token = token;
-  str->node.type = new_string(NODE_INTEGER_CONSTANT_NAME);
+  str->node.kind = gc_tag_int(NODE_KIND_INTEGER_CONSTANT);
   str->value = value;
   return str;
 }
@@ -214,25 +344,57 @@ typedef struct _StringConstant {
 #define NODE_STRING_CONSTANT_NAME "StringConstant"
 
 StringConstant* new_string_constant(Token* token, String* value) {
-  StringConstant* str = (StringConstant*) gc_create_struct(sizeof(StringConstant), NODE_STRING_CONSTANT_NAME, NODE_STRING_CONSTANT_GC_FIELD_COUNT);
+  StringConstant* str = (StringConstant*) arena_create_struct(sizeof(StringConstant), NODE_STRING_CONSTANT_NAME, NODE_STRING_CONSTANT_GC_FIELD_COUNT);
   str->node.first_token = token;
-  str->node.type = new_string(NODE_STRING_CONSTANT_NAME);
-  str->value = value;
+  str->node.kind = gc_tag_int(NODE_KIND_STRING_CONSTANT);
+  str->value = (String*) arena_keep(value);
   return str;
 }
 
+/*
+  The resolver decides once what each variable name refers to, so that a backend never has to look
+  a name up while the code runs. scope says which table index is a position in.
+*/
+enum VariableScope {
+  VARIABLE_SCOPE_UNRESOLVED,
+  VARIABLE_SCOPE_LOCAL, // slot in the frame of the enclosing function, arguments first
+  VARIABLE_SCOPE_FUNCTION, // index into the module's function definitions
+  VARIABLE_SCOPE_CLASS, // index into the module's class definitions
+  VARIABLE_SCOPE_GLOBAL, // index into the module's global names, for names it does not define
+};
+
+/*
+  What the type inference pass (see typeinfer.h) found a value can be at runtime. A value type is an
+  or of these flags, and 0 for code that can't run or that the pass hasn't seen. A backend can use a
+  native representation for a value whose type is a single flag.
+*/
+enum ValueType {
+  VALUE_TYPE_NULL = 1,
+  VALUE_TYPE_BOOLEAN = 2,
+  VALUE_TYPE_INTEGER = 4,
+  VALUE_TYPE_STRING = 8,
+  VALUE_TYPE_OTHER = 16, // dictionaries, lists, functions, classes and instances
+  VALUE_TYPE_ANY = 31,
+};
+
 typedef struct _Variable {
   Node node;
   String* name;
+  int scope; // an enum VariableScope
+  int index;
+  int value_type; // of a local where it is read, or what it's assigned if it's the target of =. Set by the type inference pass.
 } Variable;
 #define NODE_VARIABLE_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 1)
 #define NODE_VARIABLE_NAME "Variable"
 
 Variable* new_variable(Token* token, String* name) {
-  Variable* v = (Variable*) gc_create_struct(sizeof(Variable), NODE_VARIABLE_NAME, NODE_VARIABLE_GC_FIELD_COUNT);
+  Variable* v = (Variable*) arena_create_struct(sizeof(Variable), NODE_VARIABLE_NAME, NODE_VARIABLE_GC_FIELD_COUNT);
   v->node.first_token = token;
-  v->node.type = new_string(NODE_VARIABLE_NAME);
+  v->node.kind = gc_tag_int(NODE_KIND_VARIABLE);
   v->name = name;
+  v->scope = VARIABLE_SCOPE_UNRESOLVED;
+  v->index = -1;
+  v->value_type = 0;
   return v;
 }
 
@@ -240,16 +402,18 @@ typedef struct _InlineDictionary {
   Node node;
   List* keys;
   List* values;
+  int is_constant; // every value is a constant, so a backend can build it once. Set by the resolver.
 } InlineDictionary;
 #define NODE_INLINE_DICTIONARY_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 2)
 #define NODE_INLINE_DICTIONARY_NAME "InlineDictionary"
 
 InlineDictionary* new_inline_dictionary(Token* first_token, List* keys, List* values) {
-  InlineDictionary* d = (InlineDictionary*) gc_create_struct(sizeof(InlineDictionary), NODE_INLINE_DICTIONARY_NAME, NODE_INLINE_DICTIONARY_GC_FIELD_COUNT);
+  InlineDictionary* d = (InlineDictionary*) arena_create_struct(sizeof(InlineDictionary), NODE_INLINE_DICTIONARY_NAME, NODE_INLINE_DICTIONARY_GC_FIELD_COUNT);
   d->node.first_token = first_token;
-  d->node.type = new_string(NODE_INLINE_DICTIONARY_NAME);
+  d->node.kind = gc_tag_int(NODE_KIND_INLINE_DICTIONARY);
   d->keys = keys;
   d->values = values;
+  d->is_constant = 0;
   return d;
 }
 
@@ -258,17 +422,19 @@ typedef struct _DotField {
   Node* root;
   Token* dot_token;
   Token* field_token;
+  int field_index; // the field's slot if the root is this and the name is a field, else -1. Set by the resolver.
 } DotField;
 #define NODE_DOT_FIELD_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 3)
 #define NODE_DOT_FIELD_NAME "DotField"
 
 DotField* new_dot_field(Node* root_expression, Token* dot_token, Token* field_token) {
-  DotField* df = (DotField*) gc_create_struct(sizeof(DotField), NODE_DOT_FIELD_NAME, NODE_DOT_FIELD_GC_FIELD_COUNT);
+  DotField* df = (DotField*) arena_create_struct(sizeof(DotField), NODE_DOT_FIELD_NAME, NODE_DOT_FIELD_GC_FIELD_COUNT);
   df->node.first_token = root_expression->first_token;
-  df->node.type = new_string(NODE_DOT_FIELD_NAME);
+  df->node.kind = gc_tag_int(NODE_KIND_DOT_FIELD);
   df->root = root_expression;
   df->dot_token = dot_token;
   df->field_token = field_token;
+  df->field_index = -1;
   return df;
 }
 
@@ -282,9 +448,9 @@ typedef struct _BracketIndex {
 #define NODE_BRACKET_INDEX_NAME "BracketIndex"
 
 BracketIndex* new_bracket_index(Node* root_expression, Token* bracket_token, Node* index_expr) {
-  BracketIndex* bi = (BracketIndex*) gc_create_struct(sizeof(BracketIndex), NODE_BRACKET_INDEX_NAME, NODE_BRACKET_INDEX_GC_FIELD_COUNT);
+  BracketIndex* bi = (BracketIndex*) arena_create_struct(sizeof(BracketIndex), NODE_BRACKET_INDEX_NAME, NODE_BRACKET_INDEX_GC_FIELD_COUNT);
   bi->node.first_token = root_expression->first_token;
-  bi->node.type = new_string(NODE_BRACKET_INDEX_NAME);
+  bi->node.kind = gc_tag_int(NODE_KIND_BRACKET_INDEX);
   bi->root = root_expression;
   bi->bracket_token = bracket_token;
   bi->index = index_expr;
@@ -295,16 +461,18 @@ typedef struct _OpChain {
   Node node;
   List* expressions;
   List* ops;
+  int value_type; // set by the type inference pass
 } OpChain;
 #define NODE_OP_CHAIN_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 2)
 #define NODE_OP_CHAIN_NAME "OpChain"
 
 OpChain* new_op_chain(List* expressions, List* ops) {
-  OpChain* oc = (OpChain*) gc_create_struct(sizeof(OpChain), NODE_OP_CHAIN_NAME, NODE_OP_CHAIN_GC_FIELD_COUNT);
+  OpChain* oc = (OpChain*) arena_create_struct(sizeof(OpChain), NODE_OP_CHAIN_NAME, NODE_OP_CHAIN_GC_FIELD_COUNT);
   oc->node.first_token = ((Node*) list_get(expressions, 0))->first_token;
-  oc->node.type = new_string(NODE_OP_CHAIN_NAME);
-  oc->expressions = list_clone(expressions);
-  oc->ops = list_clone(ops);
+  oc->node.kind = gc_tag_int(NODE_KIND_OP_CHAIN);
+  oc->expressions = expressions;
+  oc->ops = ops;
+  oc->value_type = 0;
   return oc;
 }
 
@@ -314,18 +482,20 @@ typedef struct _Ternary {
   Token* question_mark;
   Node* true_expr;
   Node* false_expr;
+  int value_type; // set by the type inference pass
 } Ternary;
 #define NODE_TERNARY_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 4)
 #define NODE_TERNARY_NAME "Ternary"
 
 Ternary* new_ternary(Node* condition, Token* question_mark_token, Node* true_expr, Node* false_expr) {
-  Ternary* ter = (Ternary*) gc_create_struct(sizeof(Ternary), NODE_TERNARY_NAME, NODE_TERNARY_GC_FIELD_COUNT);
+  Ternary* ter = (Ternary*) arena_create_struct(sizeof(Ternary), NODE_TERNARY_NAME, NODE_TERNARY_GC_FIELD_COUNT);
   ter->node.first_token = condition->first_token;
-  ter->node.type = new_string(NODE_TERNARY_NAME);
+  ter->node.kind = gc_tag_int(NODE_KIND_TERNARY);
   ter->condition = condition;
   ter->question_mark = question_mark_token;
   ter->true_expr = true_expr;
   ter->false_expr = false_expr;
+  ter->value_type = 0;
   return ter;
 }
 
@@ -334,19 +504,52 @@ typedef struct _FunctionInvocation {
   Node* root;
   Token* open_paren;
   List* args;
+  int value_type; // of the result, set by the type inference pass
 } FunctionInvocation;
 #define NODE_FUNCTION_INVOCATION_GC_FIELD_COUNT (NODE_GC_FIELD_COUNT + 3)
 #define NODE_FUNCTION_INVOCATION_NAME "FunctionInvocation"
 
 FunctionInvocation* new_function_invocation(Node* root_expression, Token* open_paren, List* args) {
-  FunctionInvocation* fi = (FunctionInvocation*) gc_create_struct(sizeof(FunctionInvocation), NODE_FUNCTION_INVOCATION_NAME, NODE_FUNCTION_INVOCATION_GC_FIELD_COUNT);
+  FunctionInvocation* fi = (FunctionInvocation*) arena_create_struct(sizeof(FunctionInvocation), NODE_FUNCTION_INVOCATION_NAME, NODE_FUNCTION_INVOCATION_GC_FIELD_COUNT);
   fi->node.first_token = root_expression->first_token;
-  fi->node.type = new_string(NODE_FUNCTION_INVOCATION_NAME);
+  fi->node.kind = gc_tag_int(NODE_KIND_FUNCTION_INVOCATION);
   fi->root = root_expression;
   fi->open_paren = open_paren;
   fi->args = args;
+  fi->value_type = 0;
   return fi;
 }
 
+// The type name of each kind, for diagnostics.
+const char* node_kind_name(int kind) {
+  static const char* names[NODE_KIND_COUNT] = {
+    CLASS_DEFINITION_NAME,
+    FUNCTION_DEFINITION_NAME,
+    CONSTRUCTOR_DEFINITION_NAME,
+    FIELD_DEFINITION_NAME,
+    NODE_ASSIGNMENT_NAME,
+    NODE_IF_STATEMENT_NAME,
+    NODE_FOR_LOOP_NAME,
+    NODE_FOR_EACH_LOOP_NAME,
+    NODE_EXPR_EXEC_NAME,
+    NODE_WHILE_LOOP_NAME,
+    NODE_RETURN_NAME,
+    NODE_BREAK_NAME,
+    NODE_CONTINUE_NAME,
+    NODE_NULL_CONSTANT_NAME,
+    NODE_BOOLEAN_CONSTANT_NAME,
+    NODE_INTEGER_CONSTANT_NAME,
+    NODE_STRING_CONSTANT_NAME,
+    NODE_VARIABLE_NAME,
+    NODE_INLINE_DICTIONARY_NAME,
+    NODE_DOT_FIELD_NAME,
+    NODE_BRACKET_INDEX_NAME,
+    NODE_OP_CHAIN_NAME,
+    NODE_TERNARY_NAME,
+    NODE_FUNCTION_INVOCATION_NAME,
+  };
+  if (kind < 0 || kind >= NODE_KIND_COUNT) return "Unknown";
+  return names[kind];
+}
 
 #endif
@@ -27,22 +27,26 @@ void parse_first_pass(CompilerContext* ctx) {
       return;
     }
   }
+  // The tokens may have run out at a top level boundary because the tokenizer stopped at an error.
+  if (ctx->tokens->error != NULL) {
+    parser_error(ctx, ctx->tokens->error_token, ctx->tokens->error);
+  }
 }
 
 int parse_top_level_entity(CompilerContext* ctx) {
   String* next = tokens_peek_next_value(ctx);
-  if (string_equals_chars(next, "class")) {
+  if (strcmp(next->cstring, "class") == 0) {
     return parse_class(ctx);
   }
 
-  if (string_equals_chars(next, "function")) {
+  if (strcmp(next->cstring, "function") == 0) {
     FunctionDefinition* fd = parse_function(ctx);
     if (fd == NULL) return 0;
     list_add(ctx->function_definitions, fd);
     return 1;
   }
 
-  tokens_pop_expected(ctx, "function"); // throws
+  tokens_skip_expected(ctx, "function"); // throws
   return 0;
 }
 
@@ -60,7 +64,17 @@ int parse_class(CompilerContext* ctx) {
 
   ClassDefinition* class_def = new_class_definition(first_token, name_token);
 
-  if (tokens_pop_expected(ctx, "{") == NULL) return 0;
+  if (tokens_pop_if_next(ctx, ":")) {
+    Token* base_class_token = tokens_pop(ctx);
+    if (base_class_token == NULL) return 0;
+    if (!token_is_name(base_class_token)) {
+      return parser_error(ctx, base_class_token, string_concat3(
+        "Expected a base class name but found '", base_class_token->value->cstring, "' instead."));
+    }
+    class_def->base_class_token = base_class_token;
+  }
+
+  if (!tokens_skip_expected(ctx, "{")) return 0;
 
   String* str_function = new_string("function");
   String* str_constructor = new_string("constructor");
@@ -180,7 +194,7 @@ Node* parse_executable(CompilerContext* ctx, int allow_complex, int with_semicol
   }
 
   if (with_semicolon) {
-    if (tokens_pop_expected(ctx, ";") == NULL) return NULL;
+    if (!tokens_skip_expected(ctx, ";")) return NULL;
   }
 
   return ex;
@@ -189,14 +203,14 @@ Node* parse_executable(CompilerContext* ctx, int allow_complex, int with_semicol
 Node* parse_if(CompilerContext* ctx) {
   Token* if_token = tokens_pop_expected(ctx, "if");
   if (if_token == NULL) return NULL;
-  if (tokens_pop_expected(ctx, "(") == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, "(")) return NULL;
   Node* condition = parse_expression(ctx);
   if (condition == NULL) return NULL;
-  if (tokens_pop_expected(ctx, ")") == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, ")")) return NULL;
 
-  List* true_code = new_list();
+  List* true_code = arena_new_list();
   if (!parse_code_block(ctx, true_code, 0)) return NULL;
-  List* false_code = new_list();
+  List* false_code = arena_new_list();
   if (tokens_pop_if_next(ctx, "else")) {
     if (!parse_code_block(ctx, false_code, 0)) return NULL;
   }
@@ -205,31 +219,26 @@ Node* parse_if(CompilerContext* ctx) {
 Node* parse_for_loop(CompilerContext* ctx) {
   Token* for_token = tokens_pop_expected(ctx, "for");
   if (for_token == NULL) return NULL;
-  if (tokens_pop_expected(ctx, "(") == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, "(")) return NULL;
 
-  List* token_list = ctx->tokens->tokens;
-  int token_index = ctx->tokens->index;
-  int token_len = ctx->tokens->length;
-  if (token_index + 2 >= token_len) {
-    while (tokens_has_more(ctx)) tokens_pop(ctx);
+  if (tokens_peek_ahead_value(ctx, 2) == NULL) {
+    while (tokens_has_more(ctx)) tokens_skip(ctx);
     tokens_ensure_not_eof(ctx);
     return NULL;
   }
-  Token* t1 = (Token*) list_get(token_list, token_index);
-  Token* t2 = (Token*) list_get(token_list, token_index + 1);
-  int is_for_each = t1->type == TOKEN_TYPE_WORD && string_equals_chars(t2->value, ":");
-  List* code_block = new_list();
+  int is_for_each = tokens_peek_ahead_type(ctx, 0) == TOKEN_TYPE_WORD && strcmp(tokens_peek_ahead_value(ctx, 1)->cstring, ":") == 0;
+  List* code_block = arena_new_list();
   if (is_for_each) {
     Token* iterator_variable = tokens_pop(ctx);
-    if (tokens_pop_expected(ctx, ":") == NULL) return NULL;
+    if (!tokens_skip_expected(ctx, ":")) return NULL;
     Node* list_expression = parse_expression(ctx);
     if (list_expression == NULL) return NULL;
-    if (tokens_pop_expected(ctx, ")") == NULL) return NULL;
+    if (!tokens_skip_expected(ctx, ")")) return NULL;
     if (!parse_code_block(ctx, code_block, 0)) return NULL;
     return new_for_each_loop(for_token, iterator_variable, list_expression, code_block);
   }
 
-  List* inits = new_list();
+  List* inits = arena_new_list();
   if (!tokens_is_next(ctx, ";")) {
     Node* init = parse_executable(ctx, 0, 0);
     if (init == NULL) return NULL;
@@ -240,15 +249,15 @@ Node* parse_for_loop(CompilerContext* ctx) {
       list_add(inits, init);
     }
   }
-  if (tokens_pop_expected(ctx, ";") == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, ";")) return NULL;
   Node* condition = NULL;
   if (!tokens_is_next(ctx, ";")) {
     condition = parse_expression(ctx);
     if (condition == NULL) return NULL;
   }
-  if (tokens_pop_expected(ctx, ";") == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, ";")) return NULL;
 
-  List* steps = new_list();
+  List* steps = arena_new_list();
   if (!tokens_is_next(ctx, ")")) {
     Node* step = parse_executable(ctx, 0, 0);
     if (step == NULL) return NULL;
@@ -259,24 +268,53 @@ Node* parse_for_loop(CompilerContext* ctx) {
       list_add(steps, step);
     }
   }
-  if (tokens_pop_expected(ctx, ")") == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, ")")) return NULL;
   if (!parse_code_block(ctx, code_block, 0)) return NULL;
   return new_for_loop(for_token, inits, condition, steps, code_block);
 }
 
-Node* parse_break(CompilerContext* ctx) { parser_error_next_chars(ctx, "NOT IMPLEMENTED: parse_break"); return NULL; }
-Node* parse_continue(CompilerContext* ctx) { parser_error_next_chars(ctx, "NOT IMPLEMENTED: parse_continue"); return NULL; }
+Node* parse_while_loop(CompilerContext* ctx) {
+  Token* while_token = tokens_pop_expected(ctx, "while");
+  if (while_token == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, "(")) return NULL;
+  Node* condition = parse_expression(ctx);
+  if (condition == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, ")")) return NULL;
+  List* code = arena_new_list();
+  if (!parse_code_block(ctx, code, 0)) return NULL;
+  return (Node*) new_while_loop(while_token, condition, code);
+}
+
+Node* parse_return(CompilerContext* ctx) {
+  Token* return_token = tokens_pop_expected(ctx, "return");
+  if (return_token == NULL) return NULL;
+  Node* value = NULL;
+  if (!tokens_is_next(ctx, ";")) {
+    value = parse_expression(ctx);
+    if (value == NULL) return NULL;
+  }
+  if (!tokens_skip_expected(ctx, ";")) return NULL;
+  return (Node*) new_return_statement(return_token, value);
+}
+
+Node* parse_loop_jump(CompilerContext* ctx, const char* keyword) {
+  Token* token = tokens_pop_expected(ctx, keyword);
+  if (token == NULL) return NULL;
+  if (!tokens_skip_expected(ctx, ";")) return NULL;
+  return (Node*) new_loop_jump(token, keyword[0] == 'b');
+}
+
+Node* parse_break(CompilerContext* ctx) { return parse_loop_jump(ctx, "break"); }
+Node* parse_continue(CompilerContext* ctx) { return parse_loop_jump(ctx, "continue"); }
 Node* parse_do_while_loop(CompilerContext* ctx) { parser_error_next_chars(ctx, "NOT IMPLEMENTED: parse_do_while_loop"); return NULL; }
-Node* parse_return(CompilerContext* ctx) { parser_error_next_chars(ctx, "NOT IMPLEMENTED: parse_return"); return NULL; }
 Node* parse_switch(CompilerContext* ctx) { parser_error_next_chars(ctx, "NOT IMPLEMENTED: parse_switch"); return NULL; }
 Node* parse_try(CompilerContext* ctx) { parser_error_next_chars(ctx, "NOT IMPLEMENTED: parse_try"); return NULL; }
-Node* parse_while_loop(CompilerContext* ctx) { parser_error_next_chars(ctx, "NOT IMPLEMENTED: parse_while_loop"); return NULL; }
 
 int parse_arg_list(CompilerContext* ctx, List* arg_names_out, List* arg_default_values_out) {
-  if (tokens_pop_expected(ctx, "(") == NULL) return 0;
+  if (!tokens_skip_expected(ctx, "(")) return 0;
   while (!tokens_pop_if_next(ctx, ")")) {
     if (arg_names_out->length > 0) {
-      if (!tokens_pop_expected(ctx, ",")) return 0;
+      if (!tokens_skip_expected(ctx, ",")) return 0;
     }
     Token* arg_name = tokens_pop(ctx);
     if (!token_is_name(arg_name)) {
@@ -295,7 +333,7 @@ int parse_arg_list(CompilerContext* ctx, List* arg_names_out, List* arg_default_
 
 int parse_code_block(CompilerContext* ctx, List* code, int require_curly_brace) {
   if (require_curly_brace || tokens_is_next(ctx, "{")) {
-    if (tokens_pop_expected(ctx, "{") == NULL) return 0;
+    if (!tokens_skip_expected(ctx, "{")) return 0;
     while (!tokens_pop_if_next(ctx, "}")) {
       Node* exec = parse_executable(ctx, 1, 1);
       if (exec == NULL) return 0;
@@ -330,39 +368,103 @@ FunctionDefinition* parse_function(CompilerContext* ctx) {
 }
 
 FieldDefinition* parse_field(CompilerContext* ctx) {
-  parser_error_chars(ctx, tokens_peek_next(ctx), "parse_field NOT IMPLEMENTED");
-  return NULL;
+  Token* field_token = tokens_pop_expected(ctx, "field");
+  if (field_token == NULL) return NULL;
+
+  Token* field_name = tokens_pop(ctx);
+  if (field_name == NULL) return NULL;
+  if (!token_is_name(field_name)) {
+    parser_error(ctx, field_name, string_concat3("Expected a field name but found '", field_name->value->cstring, "' instead."));
+    return NULL;
+  }
+
+  Node* default_value = NULL;
+  if (tokens_pop_if_next(ctx, "=")) {
+    default_value = parse_expression(ctx);
+    if (default_value == NULL) return NULL;
+  }
+  if (!tokens_skip_expected(ctx, ";")) return NULL;
+
+  return new_field_definition(field_token, field_name, default_value);
 }
 
 ConstructorDefinition* parse_constructor(CompilerContext* ctx) {
-  parser_error_chars(ctx, tokens_peek_next(ctx), "parse_constructor NOT IMPLEMENTED");
-  return NULL;
+  Token* constructor_token = tokens_pop_expected(ctx, "constructor");
+  if (constructor_token == NULL) return NULL;
+
+  ConstructorDefinition* ctor = new_constructor_definition(constructor_token);
+
+  if (!parse_arg_list(ctx, ctor->arg_tokens, ctor->arg_default_values)) return NULL;
+
+  if (!parse_code_block(ctx, ctor->code, 1)) return NULL;
+
+  return ctor;
 }
 
 Node* parse_expr_ternary(CompilerContext* ctx);
-Node* parse_expr_boolean_combination(CompilerContext* ctx);
-Node* parse_expr_bitwise(CompilerContext* ctx);
-Node* parse_expr_equality(CompilerContext* ctx);
-Node* parse_expr_inequality(CompilerContext* ctx);
-Node* parse_expr_bitshift(CompilerContext* ctx);
-Node* parse_expr_addition(CompilerContext* ctx);
-Node* parse_expr_multiplication(CompilerContext* ctx);
+Node* parse_expr_binary(CompilerContext* ctx, int min_precedence);
 Node* parse_expr_postprefix(CompilerContext* ctx);
 Node* parse_expr_entity_with_suffix(CompilerContext* ctx);
 Node* parse_expr_entity(CompilerContext* ctx);
 
+/*
+  Binary operators are parsed by precedence climbing over this table, which is indexed by the shared
+  symbol id of the operator token so finding the precedence of the next token is one array read. A run
+  of operators with the same precedence becomes a single OpChain, evaluated left to right. Higher
+  numbers bind tighter and 0 means the token is not a binary operator.
+*/
+#define PARSER_BINARY_OPERATORS "|| 1 && 2 | 3 ^ 4 & 5 == 6 != 6 < 7 > 7 <= 7 >= 7 << 8 >> 8 + 9 - 9 * 10 / 10 % 10"
+#define PARSER_OP_PREFIX 1
+#define PARSER_OP_SUFFIX 2
+
+typedef struct _ParserOperatorTable {
+  unsigned char binary_precedence[TOKENIZER_MAX_SHARED_SYMBOLS];
+  unsigned char unary[TOKENIZER_MAX_SHARED_SYMBOLS]; // PARSER_OP_PREFIX and PARSER_OP_SUFFIX flags
+} ParserOperatorTable;
+
+ParserOperatorTable* _parser_get_operator_table() {
+  static ParserOperatorTable* table = NULL;
+  if (table != NULL) return table;
+
+  ParserOperatorTable* t = (ParserOperatorTable*) malloc_clean(sizeof(ParserOperatorTable));
+  List* pairs = string_split(PARSER_BINARY_OPERATORS, " ");
+  for (int i = 0; i + 1 < pairs->length; i += 2) {
+    int id = tokenizer_find_shared_symbol(list_get_string(pairs, i)->cstring);
+    int precedence;
+    try_parse_int(list_get_string(pairs, i + 1)->cstring, &precedence);
+    t->binary_precedence[id] = (unsigned char) precedence;
+  }
+  t->unary[tokenizer_find_shared_symbol("++")] = PARSER_OP_PREFIX | PARSER_OP_SUFFIX;
+  t->unary[tokenizer_find_shared_symbol("--")] = PARSER_OP_PREFIX | PARSER_OP_SUFFIX;
+  t->unary[tokenizer_find_shared_symbol("-")] = PARSER_OP_PREFIX;
+  t->unary[tokenizer_find_shared_symbol("!")] = PARSER_OP_PREFIX;
+
+  table = t;
+  return table;
+}
+
+int _parser_binary_precedence(ParserOperatorTable* table, int symbol_id) {
+  if (symbol_id < 0 || symbol_id >= TOKENIZER_MAX_SHARED_SYMBOLS) return 0;
+  return table->binary_precedence[symbol_id];
+}
+
+int _parser_is_unary(ParserOperatorTable* table, int symbol_id, int flag) {
+  if (symbol_id < 0 || symbol_id >= TOKENIZER_MAX_SHARED_SYMBOLS) return 0;
+  return (table->unary[symbol_id] & flag) != 0;
+}
+
 Node* parse_expression(CompilerContext* ctx) {
   return parse_expr_ternary(ctx);
 }
 
 Node* parse_expr_ternary(CompilerContext* ctx) {
-  Node* expr = parse_expr_boolean_combination(ctx);
+  Node* expr = parse_expr_binary(ctx, 1);
   if (expr == NULL) return NULL;
   if (tokens_is_next(ctx, "?")) {
     Token* question_mark = tokens_pop(ctx);
     Node* true_value = parse_expr_ternary(ctx);
     if (true_value == NULL) return NULL;
-    if (tokens_pop_expected(ctx, ":") == NULL) return NULL;
+    if (!tokens_skip_expected(ctx, ":")) return NULL;
     Node* false_value = parse_expr_ternary(ctx);
     if (false_value == NULL) return NULL;
     return new_ternary(expr, question_mark, true_value, false_value);
@@ -370,176 +472,44 @@ Node* parse_expr_ternary(CompilerContext* ctx) {
   return expr;
 }
 
-Node* parse_expr_boolean_combination(CompilerContext* ctx) {
-  static String* op_and = NULL;
-  static String* op_or = NULL;
-  if (op_and == NULL) {
-    op_and = new_common_string("&&");
-    op_or = new_common_string("||");
-  }
-
-  Node* expr = parse_expr_bitwise(ctx);
-  if (expr == NULL) return NULL;
-  if (tokens_is_next_str(ctx, op_and) || tokens_is_next_str(ctx, op_or)) {
-    parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: && and ||");
-    return NULL;
-  }
-  return expr;
-}
-
-Node* parse_expr_bitwise(CompilerContext* ctx) {
-  static String* op_and = NULL;
-  static String* op_or = NULL;
-  static String* op_xor = NULL;
-  if (op_and == NULL) {
-    op_and = new_common_string("&");
-    op_or = new_common_string("|");
-    op_xor = new_common_string("^");
-  }
-  Node* expr = parse_expr_equality(ctx);
-  if (expr == NULL) return NULL;
-  if (tokens_is_next_str(ctx, op_and) || tokens_is_next_str(ctx, op_or) || tokens_is_next_str(ctx, op_xor)) {
-    parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: & and | and ^");
-    return NULL;
-  }
-  return expr;
-}
-
-Node* parse_expr_equality(CompilerContext* ctx) {
-  static String* op_equals = NULL;
-  static String* op_neq = NULL;
-  if (op_equals == NULL) {
-    op_equals = new_common_string("==");
-    op_neq = new_common_string("!=");
-  }
-  Node* expr = parse_expr_inequality(ctx);
-  if (expr == NULL) return NULL;
-  if (tokens_is_next_str(ctx, op_equals) || tokens_is_next_str(ctx, op_neq)) {
-    List* ops = new_list();
-    list_add(ops, tokens_pop(ctx));
-    Node* right = parse_expr_inequality(ctx);
-    if (right == NULL) return NULL;
-    List* expressions = new_list();
-    list_add(expressions, expr);
-    list_add(expressions, right);
-    return new_op_chain(expressions, ops);
-  }
-  return expr;
-}
-
-Node* parse_expr_inequality(CompilerContext* ctx) {
-  static String* op_lt = NULL;
-  static String* op_gt = NULL;
-  static String* op_lteq = NULL;
-  static String* op_gteq = NULL;
-  if (op_lt == NULL) {
-    op_lt = new_common_string("<");
-    op_gt = new_common_string(">");
-    op_lteq = new_common_string("<=");
-    op_gteq = new_common_string(">=");
-  }
-  Node* expr = parse_expr_bitshift(ctx);
-  if (expr == NULL) return NULL;
-  if (tokens_is_next_str(ctx, op_lt) ||
-      tokens_is_next_str(ctx, op_gt) ||
-      tokens_is_next_str(ctx, op_lteq) ||
-      tokens_is_next_str(ctx, op_gteq)) {
-    parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: < > <= and >=");
-    return NULL;
-  }
-  return expr;
-}
-
-Node* parse_expr_bitshift(CompilerContext* ctx) {
-  static String* op_left = NULL;
-  static String* op_right = NULL;
-  if (op_left == NULL) {
-    op_left = new_common_string("<<");
-    op_right = new_common_string(">>");
-  }
-  Node* expr = parse_expr_addition(ctx);
-  if (expr == NULL) return NULL;
-  if (tokens_is_next_str(ctx, op_left) || tokens_is_next_str(ctx, op_right)) {
-    parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: << and >>");
-    return NULL;
-  }
-  return expr;
-}
-
-Node* parse_expr_addition(CompilerContext* ctx) {
-  static String* op_add = NULL;
-  static String* op_sub = NULL;
-  if (op_add == NULL) {
-    op_add = new_common_string("+");
-    op_sub = new_common_string("-");
-  }
-  Node* expr = parse_expr_multiplication(ctx);
+// Parses an expression that only contains binary operators with at least the given precedence.
+Node* parse_expr_binary(CompilerContext* ctx, int min_precedence) {
+  ParserOperatorTable* table = _parser_get_operator_table();
+  Node* expr = parse_expr_postprefix(ctx);
   if (expr == NULL) return NULL;
-  if (tokens_is_next_str(ctx, op_add) || tokens_is_next_str(ctx, op_sub)) {
-    List* expressions = new_list();
+  int precedence = _parser_binary_precedence(table, tokens_peek_ahead_symbol(ctx, 0));
+  while (precedence >= min_precedence) {
+    List* expressions = arena_new_list();
+    List* ops = arena_new_list();
     list_add(expressions, expr);
-    List* ops = new_list();
-    while (tokens_is_next_str(ctx, op_add) || tokens_is_next_str(ctx, op_sub)) {
+    int next_precedence = precedence;
+    while (next_precedence == precedence) {
       list_add(ops, tokens_pop(ctx));
-      Node* next_expr = parse_expr_multiplication(ctx);
-      if (next_expr == NULL) return NULL;
-      list_add(expressions, next_expr);
+      Node* right = parse_expr_binary(ctx, precedence + 1);
+      if (right == NULL) return NULL;
+      list_add(expressions, right);
+      next_precedence = _parser_binary_precedence(table, tokens_peek_ahead_symbol(ctx, 0));
     }
-    return new_op_chain(expressions, ops);
-  }
-  return expr;
-}
-
-Node* parse_expr_multiplication(CompilerContext* ctx) {
-  static String* op_mul = NULL;
-  static String* op_div = NULL;
-  static String* op_mod = NULL;
-  if (op_mul == NULL) {
-    op_mul = new_common_string("*");
-    op_div = new_common_string("/");
-    op_mod = new_common_string("%");
-  }
-  Node* expr = parse_expr_postprefix(ctx);
-  if (expr == NULL) return NULL;
-  if (tokens_is_next_str(ctx, op_mul) ||
-      tokens_is_next_str(ctx, op_div) ||
-      tokens_is_next_str(ctx, op_mod)) {
-    parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: * / and %");
-    return NULL;
+    expr = (Node*) new_op_chain(expressions, ops);
+    precedence = next_precedence;
   }
   return expr;
 }
 
 Node* parse_expr_postprefix(CompilerContext* ctx) {
-  static String* op_pp = NULL;
-  static String* op_mm = NULL;
-  static String* op_neg = NULL;
-  static String* op_not = NULL;
-  if (op_pp == NULL) {
-    op_pp = new_common_string("++");
-    op_mm = new_common_string("--");
-    op_neg = new_common_string("-");
-    op_not = new_common_string("!");
-  }
-
-  if (tokens_is_next_str(ctx, op_pp) || tokens_is_next_str(ctx, op_mm)) {
-    parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: ++ and -- prefix");
-    return NULL;
-  }
-
-  if (tokens_is_next_str(ctx, op_neg)) {
-    parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: negative sign");
-    return NULL;
-  }
-
-  if (tokens_is_next_str(ctx, op_not)) {
-    parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: boolean not");
+  ParserOperatorTable* table = _parser_get_operator_table();
+  if (_parser_is_unary(table, tokens_peek_ahead_symbol(ctx, 0), PARSER_OP_PREFIX)) {
+    String* op = tokens_peek_next_value(ctx);
+    const char* msg = "NOT IMPLEMENTED: ++ and -- prefix";
+    if (op->cstring[0] == '-' && op->length == 1) msg = "NOT IMPLEMENTED: negative sign";
+    if (op->cstring[0] == '!') msg = "NOT IMPLEMENTED: boolean not";
+    parser_error_chars(ctx, tokens_peek_next(ctx), msg);
     return NULL;
   }
 
   Node* expr = parse_expr_entity_with_suffix(ctx);
   if (expr == NULL) return NULL;
-  while (tokens_is_next_str(ctx, op_pp) || tokens_is_next_str(ctx, op_mm)) {
+  if (_parser_is_unary(table, tokens_peek_ahead_symbol(ctx, 0), PARSER_OP_SUFFIX)) {
     parser_error_chars(ctx, tokens_peek_next(ctx), "NOT IMPLEMENTED: ++ and -- suffix");
     return NULL;
   }
@@ -571,7 +541,7 @@ Node* parse_expr_entity_with_suffix(CompilerContext* ctx) {
           Token* open_bracket = tokens_pop(ctx);
           Node* index_expression = parse_expression(ctx);
           if (index_expression == NULL) return NULL;
-          if (tokens_pop_expected(ctx, "]") == NULL) return NULL;
+          if (!tokens_skip_expected(ctx, "]")) return NULL;
 
           expr = (Node*) new_bracket_index(expr, open_bracket, index_expression);
         }
@@ -579,10 +549,10 @@ Node* parse_expr_entity_with_suffix(CompilerContext* ctx) {
       case '(':
         {
           Token* open_paren = tokens_pop(ctx);
-          List* args = new_list();
+          List* args = arena_new_list();
           while (!tokens_pop_if_next(ctx, ")")) {
             if (args->length > 0) {
-              if (tokens_pop_expected(ctx, ",") == NULL) return NULL;
+              if (!tokens_skip_expected(ctx, ",")) return NULL;
             }
             Node* arg = parse_expression(ctx);
             if (arg == NULL) return NULL;
@@ -614,9 +584,9 @@ Node* parse_expr_entity(CompilerContext* ctx) {
   }
 
   if (tokens_is_next(ctx, "(")) {
-    tokens_pop(ctx);
+    tokens_skip(ctx);
     Node* expr = parse_expression(ctx);
-    if (tokens_pop_expected(ctx, ")") == NULL) return NULL;
+    if (!tokens_skip_expected(ctx, ")")) return NULL;
     return expr;
   }
 
@@ -627,13 +597,13 @@ Node* parse_expr_entity(CompilerContext* ctx) {
   switch (next->cstring[0]) {
     case 't':
       if (string_equals(next, str_true)) {
-        tokens_pop(ctx);
+        tokens_skip(ctx);
         return new_boolean_constant(next_token, 1);
       }
       break;
     case 'f':
       if (string_equals(next, str_false)) {
-        tokens_pop(ctx);
+        tokens_skip(ctx);
         return new_boolean_constant(next_token, 0);
       }
       break;
@@ -647,19 +617,19 @@ Node* parse_expr_entity(CompilerContext* ctx) {
       return NULL;
     case '{': {
         Token* open_curly_brace = tokens_pop(ctx);
-        List* keys = new_list();
-        List* values = new_list();
+        List* keys = arena_new_list();
+        List* values = arena_new_list();
         int allow_next = 1;
         while (!tokens_pop_if_next(ctx, "}")) {
           if (!allow_next) {
-            tokens_pop_expected(ctx, "}"); // pushes error
+            tokens_skip_expected(ctx, "}"); // pushes error
             return NULL;
           }
           if (!tokens_ensure_not_eof(ctx)) return NULL;
           Node* key = parse_expr_entity(ctx);
           if (key == NULL) return NULL;
           list_add(keys, key);
-          if (tokens_pop_expected(ctx, ":") == NULL) return NULL;
+          if (!tokens_skip_expected(ctx, ":")) return NULL;
           Node* value = parse_expression(ctx);
           if (value == NULL) return NULL;
           list_add(values, value);
@@ -676,20 +646,20 @@ Node* parse_expr_entity(CompilerContext* ctx) {
   }
 
   if (next_token->type == TOKEN_TYPE_INTEGER) {
-    tokens_pop(ctx);
+    tokens_skip(ctx);
     int value;
     if (!parse_integer_value(ctx, next_token, next_token->value, &value)) return NULL;
     return new_integer_constant(next_token, value);
   }
 
   if (next_token->type == TOKEN_TYPE_STRING) {
-    tokens_pop(ctx);
+    tokens_skip(ctx);
     String* str_value = parse_string_value(ctx, next_token, next);
     return new_string_constant(next_token, str_value);
   }
 
   if (next_token->type == TOKEN_TYPE_WORD) {
-    tokens_pop(ctx);
+    tokens_skip(ctx);
     return (Node*) new_variable(next_token, next);
   }
 
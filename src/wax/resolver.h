@@ -4,38 +4,142 @@
 #include <stdio.h>
 #include "../util/dictionaries.h"
 #include "../util/lists.h"
+#include "../util/threads.h"
 #include "compilercontext.h"
+#include "folding.h"
 #include "nodes.h"
 
 typedef struct _ResolverContext {
   Dictionary* classes_by_name;
   Dictionary* functions_by_name;
+  Dictionary* locals; // name -> slot (Integer) in the function being resolved, NULL outside of one
+  int local_count; // slots given out so far in the function being resolved
+  int loop_depth; // how many loops the code being resolved is in, for checking break and continue
+  List* global_refs; // variables with VARIABLE_SCOPE_GLOBAL, numbered once every function is resolved
+  ClassDefinition* class_def; // the class of the method or constructor being resolved, NULL in a function
+  int in_constructor;
   CompilerContext* ctx;
 } ResolverContext;
 
+int _wax_resolve_class_layout(ResolverContext* rctx, ClassDefinition* cd);
 int wax_resolve_class(ResolverContext* rctx, ClassDefinition* cd);
 int wax_resolve_function(ResolverContext* rctx, FunctionDefinition* cd);
 int wax_resolve_executable(ResolverContext* rctx, Node* line, List* code_out);
 Node* wax_resolve_expression(ResolverContext* rctx, Node* expression);
 
-void wax_resolve_module(CompilerContext* ctx) {
+/*
+  Function bodies only read the module's lookup tables, which are complete before the first body is
+  resolved and are not changed afterwards, and each body is only touched by the task resolving it.
+  So with more than one job the functions are split into batches of about RESOLVER_FUNCTIONS_PER_TASK
+  and the batches are resolved across worker threads, each reporting errors to its own context.
+  Resolving can add nodes to the arena of a function's file and arenas are not thread safe, so a
+  batch only ends where the next function belongs to another arena. Like the
+  serial loop, a batch stops at the first function with an error, and only the errors of the first
+  batch that has any are reported, so the output does not depend on the number of threads.
+*/
+#define RESOLVER_FUNCTIONS_PER_TASK 32
+
+typedef struct _ParallelResolveState {
+  ResolverContext* rctx;
+  int* batch_starts; // batch i is functions batch_starts[i] to batch_starts[i + 1] - 1
+  CompilerContext** batch_contexts;
+  List** batch_global_refs;
+} ParallelResolveState;
+
+void _wax_resolve_functions_task(void* arg, int index) {
+  ParallelResolveState* state = (ParallelResolveState*) arg;
+  List* functions = state->rctx->ctx->function_definitions;
+  ResolverContext rctx = *state->rctx;
+  rctx.ctx = new_compiler_context();
+  rctx.global_refs = new_list();
+  for (int i = state->batch_starts[index]; i < state->batch_starts[index + 1]; ++i) {
+    wax_resolve_function(&rctx, (FunctionDefinition*) list_get(functions, i));
+    if (rctx.ctx->has_error) break;
+  }
+  state->batch_contexts[index] = rctx.ctx;
+  state->batch_global_refs[index] = rctx.global_refs;
+}
+
+void _wax_resolve_functions_parallel(ResolverContext* rctx, int jobs) {
+  CompilerContext* ctx = rctx->ctx;
+  List* functions = ctx->function_definitions;
+  ParallelResolveState state;
+  state.rctx = rctx;
+  state.batch_starts = (int*) malloc(sizeof(int) * (functions->length + 1));
+  int batch_count = 0;
+  Arena* previous_arena = NULL;
+  for (int i = 0; i < functions->length; ++i) {
+    Arena* arena = ((FunctionDefinition*) list_get(functions, i))->arena;
+    if (i == 0 || (i - state.batch_starts[batch_count - 1] >= RESOLVER_FUNCTIONS_PER_TASK && (arena == NULL || arena != previous_arena))) {
+      state.batch_starts[batch_count++] = i;
+    }
+    previous_arena = arena;
+  }
+  state.batch_starts[batch_count] = functions->length;
+
+  state.batch_contexts = (CompilerContext**) malloc_ptr_array(batch_count);
+  state.batch_global_refs = (List**) malloc_ptr_array(batch_count);
+  parallel_for(batch_count, jobs, _wax_resolve_functions_task, &state);
+
+  for (int i = 0; i < batch_count; ++i) {
+    CompilerContext* batch_ctx = state.batch_contexts[i];
+    if (batch_ctx->has_error) {
+      list_push_all(ctx->error_messages, batch_ctx->error_messages);
+      list_push_all(ctx->error_tokens, batch_ctx->error_tokens);
+      ctx->has_error = 1;
+      break;
+    }
+    // Batches cover the functions in order, so this is the order a serial resolve would find them in.
+    list_push_all(rctx->global_refs, state.batch_global_refs[i]);
+  }
+  free(state.batch_starts);
+  free(state.batch_contexts);
+  free(state.batch_global_refs);
+}
+
+// Gives each name in global_refs an index in the module's global names, in order of first use.
+void _wax_resolve_global_names(CompilerContext* ctx, List* global_refs) {
+  Dictionary* global_ids = new_dictionary();
+  ctx->global_names = new_list();
+  for (int i = 0; i < global_refs->length; ++i) {
+    Variable* v = (Variable*) list_get(global_refs, i);
+    Integer* id = (Integer*) dictionary_get(global_ids, v->name);
+    if (id == NULL) {
+      id = wrap_int(ctx->global_names->length);
+      dictionary_set(global_ids, v->name, id);
+      list_add(ctx->global_names, v->name);
+    }
+    v->index = id->value;
+  }
+}
+
+// Resolves the classes and functions of a module. Function bodies are resolved on up to jobs threads.
+void wax_resolve_module(CompilerContext* ctx, int jobs) {
 
   ResolverContext rctx;
   rctx.ctx = ctx;
   rctx.classes_by_name = new_dictionary();
   rctx.functions_by_name = new_dictionary();
+  rctx.locals = NULL;
+  rctx.local_count = 0;
+  rctx.loop_depth = 0;
+  rctx.global_refs = new_list();
+  rctx.class_def = NULL;
+  rctx.in_constructor = 0;
 
   // Create lookups for classes and functions
   for (int i = 0; i < ctx->class_definitions->length; ++i) {
     ClassDefinition* class_def = (ClassDefinition*) list_get(ctx->class_definitions, i);
+    class_def->index = i;
     String* name = class_def->class_name->value;
     if (dictionary_has_key(rctx.classes_by_name, name)) {
       parser_error(ctx, class_def->class_name, string_concat3("There are multiple classes named '", name->cstring, "'."));
     }
     dictionary_set(rctx.classes_by_name, name, class_def);
   }
-  for (int i = 0; i < ctx->class_definitions->length; ++i) {
+  for (int i = 0; i < ctx->function_definitions->length; ++i) {
     FunctionDefinition* func_def = (FunctionDefinition*) list_get(ctx->function_definitions, i);
+    func_def->index = i;
     String* name = func_def->function_name->value;
     if (dictionary_has_key(rctx.functions_by_name, name)) {
       parser_error(ctx, func_def->function_name, string_concat3("There are multiple functions named '", name->cstring, "'."));
@@ -52,39 +156,225 @@ void wax_resolve_module(CompilerContext* ctx) {
       if (base_class == NULL) {
         parser_error(ctx, class_def->base_class_token, string_concat3("There is no class named '", name->cstring, "'."));
       }
+      class_def->base_class_definition = base_class;
+    }
+  }
+  for (int i = 0; i < ctx->class_definitions->length; ++i) {
+    ClassDefinition* class_def = (ClassDefinition*) list_get(ctx->class_definitions, i);
+    ClassDefinition* walker = class_def->base_class_definition;
+    for (int depth = 0; walker != NULL && depth < ctx->class_definitions->length; ++depth) {
+      if (walker == class_def) {
+        parser_error(ctx, class_def->class_name, string_concat3("The class '", class_def->class_name->value->cstring, "' inherits from itself."));
+        break;
+      }
+      walker = walker->base_class_definition;
     }
   }
 
   // If the metadata names are fundamentally wrong, then don't move on.
   if (ctx->has_error) return;
 
+  // Every class is laid out before any code is resolved, since code can use the fields of any class.
+  // A cached tree keeps the layout of the last compile, which is stale if a base class changed.
+  for (int i = 0; i < ctx->class_definitions->length; ++i) {
+    ((ClassDefinition*) list_get(ctx->class_definitions, i))->field_count = -1;
+  }
+  for (int i = 0; i < ctx->class_definitions->length; ++i) {
+    if (!_wax_resolve_class_layout(&rctx, (ClassDefinition*) list_get(ctx->class_definitions, i))) return;
+  }
   for (int i = 0; i < ctx->class_definitions->length; ++i) {
     wax_resolve_class(&rctx, (ClassDefinition*) list_get(ctx->class_definitions, i));
     if (ctx->has_error) return;
   }
 
-  for (int i = 0; i < ctx->function_definitions->length; ++i) {
-    wax_resolve_function(&rctx, (FunctionDefinition*) list_get(ctx->function_definitions, i));
-    if (ctx->has_error) return;
+  int function_count = ctx->function_definitions->length;
+  if (jobs > 1 && function_count >= 2 * RESOLVER_FUNCTIONS_PER_TASK) {
+    _wax_resolve_functions_parallel(&rctx, jobs);
+  } else {
+    for (int i = 0; i < function_count; ++i) {
+      wax_resolve_function(&rctx, (FunctionDefinition*) list_get(ctx->function_definitions, i));
+      if (ctx->has_error) break;
+    }
   }
+  if (ctx->has_error) return;
+
+  _wax_resolve_global_names(ctx, rctx.global_refs);
+}
+
+// Returns the member named name of cd or of the nearest of its base classes that has one, or NULL.
+Node* wax_resolver_find_member(ClassDefinition* cd, String* name) {
+  for (; cd != NULL; cd = cd->base_class_definition) {
+    Node* member = (Node*) dictionary_get(cd->members, name);
+    if (member != NULL) return member;
+  }
+  return NULL;
+}
+
+/*
+  Instances are a fixed array of fields. A class's fields come after those of its base classes, so a
+  field has the same slot in the instances of every subclass and this.field can be compiled to a
+  load from a known slot. A method can override a method of a base class, but no other member can
+  share a name with a member of a base class. Lays out the base classes first.
+*/
+int _wax_resolve_class_layout(ResolverContext* rctx, ClassDefinition* cd) {
+  if (cd->field_count != -1) return 1;
+  ClassDefinition* base = cd->base_class_definition;
+  if (base != NULL && !_wax_resolve_class_layout(rctx, base)) return 0;
+  int field_count = base == NULL ? 0 : base->field_count;
+  for (int i = 0; i < cd->member_order->length; ++i) {
+    String* name = list_get_string(cd->member_order, i);
+    Node* member = (Node*) dictionary_get(cd->members, name);
+    int kind = node_kind(member);
+    Node* inherited = base == NULL || kind == NODE_KIND_CONSTRUCTOR_DEFINITION ? NULL : wax_resolver_find_member(base, name);
+    if (inherited != NULL && (kind != NODE_KIND_FUNCTION_DEFINITION || node_kind(inherited) != NODE_KIND_FUNCTION_DEFINITION)) {
+      parser_error(rctx->ctx, member->first_token, string_concat5(
+        "The ", kind == NODE_KIND_FIELD_DEFINITION ? "field" : "method", " '", name->cstring, "' has the same name as a member of a base class."));
+      return 0;
+    }
+    if (kind == NODE_KIND_FIELD_DEFINITION) ((FieldDefinition*) member)->index = field_count++;
+  }
+  cd->field_count = field_count;
+  return 1;
+}
+
+int _wax_resolve_callable(ResolverContext* rctx, Arena* arena, List* arg_tokens, List* arg_default_values, List* code, int* local_count_out);
+
+// Field defaults are copied into each new instance, so they have to be constants.
+int _wax_resolve_field(ResolverContext* rctx, FieldDefinition* fd) {
+  if (fd->default_value == NULL) return 1;
+  Node* value = wax_resolve_expression(rctx, fd->default_value);
+  if (value == NULL) return 0;
+  int kind = node_kind(value);
+  if (!_fold_is_constant(value) && !(kind == NODE_KIND_INLINE_DICTIONARY && ((InlineDictionary*) value)->is_constant)) {
+    parser_error_chars(rctx->ctx, value->first_token, "The default value of a field must be a constant.");
+    return 0;
+  }
+  fd->default_value = value;
+  return 1;
 }
 
 int wax_resolve_class(ResolverContext* rctx, ClassDefinition* cd) {
-  parser_error_chars(rctx->ctx, cd->node.first_token, "TODO: class resolver");
-  return 0;
+  Arena* previous_arena = arena_set_current(cd->arena);
+  int ok = 1;
+  for (int i = 0; i < cd->member_order->length && ok; ++i) {
+    Node* member = (Node*) dictionary_get(cd->members, list_get_string(cd->member_order, i));
+    rctx->locals = NULL;
+    rctx->class_def = cd;
+    switch (node_kind(member)) {
+      case NODE_KIND_FIELD_DEFINITION:
+        rctx->class_def = NULL; // field defaults are outside of any instance
+        ok = _wax_resolve_field(rctx, (FieldDefinition*) member);
+        break;
+      case NODE_KIND_FUNCTION_DEFINITION:
+        {
+          FunctionDefinition* fd = (FunctionDefinition*) member;
+          ok = _wax_resolve_callable(rctx, fd->arena, fd->arg_tokens, fd->arg_default_values, fd->code, &fd->local_count);
+        }
+        break;
+      case NODE_KIND_CONSTRUCTOR_DEFINITION:
+        {
+          ConstructorDefinition* ctor = (ConstructorDefinition*) member;
+          rctx->in_constructor = 1;
+          ok = _wax_resolve_callable(rctx, ctor->arena, ctor->arg_tokens, ctor->arg_default_values, ctor->code, &ctor->local_count);
+          rctx->in_constructor = 0;
+        }
+        break;
+    }
+  }
+  rctx->class_def = NULL;
+  arena_set_current(previous_arena);
+  return ok;
 }
 
 List* wax_resolve_code_block(ResolverContext* rctx, List* code, int* ok);
 
+// Gives name the next local slot of the function being resolved, unless it already has one.
+void _wax_resolver_declare_local(ResolverContext* rctx, Token* token, String* name) {
+  if (string_equals_chars(name, "this")) {
+    parser_error_chars(rctx->ctx, token, "Cannot assign to 'this'.");
+    return;
+  }
+  if (dictionary_has_key(rctx->locals, name)) return;
+  if (dictionary_has_key(rctx->classes_by_name, name)) {
+    parser_error(rctx->ctx, token, string_concat3("The variable name '", name->cstring, "' collides with a class definition name."));
+  } else if (dictionary_has_key(rctx->functions_by_name, name)) {
+    parser_error(rctx->ctx, token, string_concat3("The variable name '", name->cstring, "' collides with a function definition name."));
+  }
+  dictionary_set(rctx->locals, name, wrap_int(rctx->local_count++));
+}
+
+/*
+  A name is local to the whole function if the function assigns to it or iterates with it anywhere,
+  even in a nested block or after the place it is read, the same way Python decides it. So the code
+  is scanned for those names before any of it is resolved. Slots are given out in the order the
+  names first appear, after the arguments.
+*/
+void _wax_resolver_declare_locals(ResolverContext* rctx, List* code) {
+  for (int i = 0; i < code->length; ++i) {
+    Node* line = (Node*) list_get(code, i);
+    switch (node_kind(line)) {
+      case NODE_KIND_ASSIGNMENT:
+        {
+          Node* target = ((Assignment*) line)->target;
+          if (node_kind(target) == NODE_KIND_VARIABLE) {
+            _wax_resolver_declare_local(rctx, target->first_token, ((Variable*) target)->name);
+          }
+        }
+        break;
+      case NODE_KIND_FOR_EACH_LOOP:
+        {
+          ForEachLoop* fel = (ForEachLoop*) line;
+          _wax_resolver_declare_local(rctx, fel->variable, fel->variable->value);
+          _wax_resolver_declare_locals(rctx, fel->code);
+        }
+        break;
+      case NODE_KIND_IF_STATEMENT:
+        _wax_resolver_declare_locals(rctx, ((IfStatement*) line)->true_code);
+        _wax_resolver_declare_locals(rctx, ((IfStatement*) line)->false_code);
+        break;
+      case NODE_KIND_FOR_LOOP:
+        _wax_resolver_declare_locals(rctx, ((ForLoop*) line)->inits);
+        _wax_resolver_declare_locals(rctx, ((ForLoop*) line)->steps);
+        _wax_resolver_declare_locals(rctx, ((ForLoop*) line)->code);
+        break;
+      case NODE_KIND_WHILE_LOOP:
+        _wax_resolver_declare_locals(rctx, ((WhileLoop*) line)->code);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
 int wax_resolve_function(ResolverContext* rctx, FunctionDefinition* func_def) {
-  // resolve argument names and default values
-  int arg_count = func_def->arg_tokens->length;
-  Dictionary* arg_lookup = new_dictionary(); // name collision check
+  return _wax_resolve_callable(rctx, func_def->arena, func_def->arg_tokens, func_def->arg_default_values, func_def->code, &func_def->local_count);
+}
+
+// Resolves the arguments and code of a function, or of a method or constructor of rctx->class_def,
+// where this is local 0 and the arguments come after it. Sets *local_count_out to the slot count.
+int _wax_resolve_callable(ResolverContext* rctx, Arena* arena, List* arg_tokens, List* arg_default_values, List* code, int* local_count_out) {
+  // Nodes made while resolving, like folded constants, go with the rest of the function's nodes.
+  Arena* previous_arena = arena_set_current(arena);
+
+  // resolve argument names and default values. Default values can't see the arguments.
+  int arg_count = arg_tokens->length;
+  int first_arg = rctx->class_def == NULL ? 0 : 1;
+  Dictionary* locals = new_dictionary();
+  if (first_arg == 1) dictionary_set(locals, new_string("this"), wrap_int(0));
+  rctx->locals = NULL;
+  int has_default = 0;
   for (int i = 0; i < arg_count; ++i) {
-    Token* name_token = (Token*) list_get(func_def->arg_tokens, i);
+    Token* name_token = (Token*) list_get(arg_tokens, i);
     String* name = name_token->value;
-    Node* default_value = (Node*) list_get(func_def->arg_default_values, i);
-    if (dictionary_has_key(arg_lookup, name)) {
+    Node* default_value = (Node*) list_get(arg_default_values, i);
+    if (default_value == NULL && has_default) {
+      // Callers can only leave out arguments at the end, so there would be no way to skip this one.
+      parser_error(rctx->ctx, name_token, string_concat3("The argument '", name->cstring, "' needs a default value since an argument before it has one."));
+    }
+    if (default_value != NULL) has_default = 1;
+    if (string_equals_chars(name, "this")) {
+      parser_error_chars(rctx->ctx, name_token, "'this' can't be used as an argument name.");
+    } else if (dictionary_has_key(locals, name)) {
       parser_error(rctx->ctx, name_token, string_concat3("There are multiple arguments for this function named '", name->cstring, "'."));
     } else if (dictionary_has_key(rctx->classes_by_name, name)) {
       parser_error(rctx->ctx, name_token, string_concat3("The argument name '", name->cstring, "' collides with a class definition name."));
@@ -92,79 +382,77 @@ int wax_resolve_function(ResolverContext* rctx, FunctionDefinition* func_def) {
       parser_error(rctx->ctx, name_token, string_concat3("The argument name '", name->cstring, "' collides with a function definition name."));
     }
 
+    // Arguments always get the slots after this, even if one of them is reported above.
+    dictionary_set(locals, name, wrap_int(first_arg + i));
+
     if (default_value != NULL) {
-      list_set(func_def->arg_default_values, i, wax_resolve_expression(rctx, default_value));
+      list_set(arg_default_values, i, wax_resolve_expression(rctx, default_value));
     }
   }
 
+  rctx->locals = locals;
+  rctx->local_count = first_arg + arg_count;
+  rctx->loop_depth = 0;
+  _wax_resolver_declare_locals(rctx, code);
+  *local_count_out = rctx->local_count;
+
   int ok;
-  func_def->code = wax_resolve_code_block(rctx, func_def->code, &ok);
+  wax_resolve_code_block(rctx, code, &ok);
+  rctx->locals = NULL;
+  arena_set_current(previous_arena);
   return ok;
 }
 
+// Resolves the lines of code in place and returns the same list. Lines that are dropped during
+// resolution are removed from it. The list can belong to an arena, so no new one is made.
 List* wax_resolve_code_block(ResolverContext* rctx, List* code, int* ok) {
   *ok = 1;
-  List* new_code = new_list();
-  for (int i = 0; i < code->length; ++i) {
+  int length = code->length;
+  code->length = 0;
+  // wax_resolve_executable appends the lines it keeps, which never overwrites a line not yet read.
+  for (int i = 0; i < length; ++i) {
     Node* line = (Node*) list_get(code, i);
-    if (wax_resolve_executable(rctx, line, new_code) == 0) {
+    if (wax_resolve_executable(rctx, line, code) == 0) {
       *ok = 0;
     }
   }
-  return new_code;
+  return code;
 }
 
 int wax_resolver_is_assignable(Node* expr) {
-  static String* expr_dot_field = NULL;
-  static String* expr_variable = NULL;
-  static String* expr_bracket_index = NULL;
-  if (expr_dot_field == NULL) {
-    expr_dot_field = new_common_string(NODE_DOT_FIELD_NAME);
-    expr_variable = new_common_string(NODE_VARIABLE_NAME);
-    expr_bracket_index = new_common_string(NODE_BRACKET_INDEX_NAME);
+  switch (node_kind(expr)) {
+    case NODE_KIND_DOT_FIELD:
+    case NODE_KIND_VARIABLE:
+    case NODE_KIND_BRACKET_INDEX:
+      return 1;
+    default:
+      return 0;
   }
-  if (string_equals(expr->type, expr_dot_field)) return 1;
-  if (string_equals(expr->type, expr_variable)) return 1;
-  if (string_equals(expr->type, expr_bracket_index)) return 1;
-  return 0;
 }
 
 int wax_resolve_executable(ResolverContext* rctx, Node* line, List* code_out) {
-  static String* str_assignment = NULL;
-  static String* str_exec_expr = NULL;
-  static String* str_foreach_loop = NULL;
-  static String* str_if = NULL;
-  if (str_if == NULL) {
-    str_assignment = new_common_string(NODE_ASSIGNMENT_NAME);
-    str_exec_expr = new_common_string(NODE_EXPR_EXEC_NAME);
-    str_foreach_loop = new_common_string(NODE_FOR_EACH_LOOP_NAME);
-    str_if = new_common_string(NODE_IF_STATEMENT_NAME);
-  }
-  String* type = line->type;
-  Node* expr = NULL;
   int keep = 0;
   int found = 0;
-  switch (type->cstring[0]) {
-    case 'A':
-      // Assignment
-      if (string_equals(type, str_assignment)) {
+  switch (node_kind(line)) {
+    case NODE_KIND_ASSIGNMENT:
+      {
         found = 1;
         Assignment* asgn = (Assignment*) line;
         asgn->target = wax_resolve_expression(rctx, asgn->target);
-        if (asgn->target == NULL) return NULL;
+        if (asgn->target == NULL) return 0;
 
         asgn->value = wax_resolve_expression(rctx, asgn->value);
-        if (asgn->value == NULL) return NULL;
+        if (asgn->value == NULL) return 0;
 
         if (!wax_resolver_is_assignable(asgn->target)) {
           parser_error_chars(rctx->ctx, asgn->target->first_token, "Cannot assign to this type of expression.");
-          return NULL;
+          return 0;
         }
         keep = 1;
       }
       break;
-    case 'E':
-      if (string_equals(type, str_exec_expr)) {
+    case NODE_KIND_EXPR_EXEC:
+      {
         // Expression as Executable
         found = 1;
         ExpressionAsExecutable* ee = (ExpressionAsExecutable*) line;
@@ -173,22 +461,81 @@ int wax_resolve_executable(ResolverContext* rctx, Node* line, List* code_out) {
         keep = 1;
       }
       break;
-    case 'F':
-      if (string_equals(type, str_foreach_loop)) {
-        // Foreach Loop
+    case NODE_KIND_FOR_EACH_LOOP:
+      {
         found = 1;
         ForEachLoop* fel = (ForEachLoop*) line;
+        fel->variable_index = ((Integer*) dictionary_get(rctx->locals, fel->variable->value))->value;
         fel->list_expr = wax_resolve_expression(rctx, fel->list_expr);
         if (fel->list_expr == NULL) return 0;
         int ok;
+        rctx->loop_depth++;
         fel->code = wax_resolve_code_block(rctx, fel->code, &ok);
+        rctx->loop_depth--;
         if (!ok) return 0;
         keep = 1;
       }
       break;
-    case 'I':
-      if (string_equals(type, str_if)) {
-        // If Statement
+    case NODE_KIND_FOR_LOOP:
+      {
+        found = 1;
+        ForLoop* fl = (ForLoop*) line;
+        int ok;
+        fl->inits = wax_resolve_code_block(rctx, fl->inits, &ok);
+        if (!ok) return 0;
+        if (fl->condition != NULL) {
+          fl->condition = wax_resolve_expression(rctx, fl->condition);
+          if (fl->condition == NULL) return 0;
+        }
+        fl->steps = wax_resolve_code_block(rctx, fl->steps, &ok);
+        if (!ok) return 0;
+        rctx->loop_depth++;
+        fl->code = wax_resolve_code_block(rctx, fl->code, &ok);
+        rctx->loop_depth--;
+        if (!ok) return 0;
+        keep = 1;
+      }
+      break;
+    case NODE_KIND_WHILE_LOOP:
+      {
+        found = 1;
+        WhileLoop* wl = (WhileLoop*) line;
+        wl->condition = wax_resolve_expression(rctx, wl->condition);
+        if (wl->condition == NULL) return 0;
+        int ok;
+        rctx->loop_depth++;
+        wl->code = wax_resolve_code_block(rctx, wl->code, &ok);
+        rctx->loop_depth--;
+        if (!ok) return 0;
+        keep = 1;
+      }
+      break;
+    case NODE_KIND_RETURN:
+      {
+        found = 1;
+        ReturnStatement* rs = (ReturnStatement*) line;
+        if (rs->value != NULL && rctx->in_constructor) {
+          parser_error_chars(rctx->ctx, rs->value->first_token, "A constructor can't return a value.");
+          return 0;
+        }
+        if (rs->value != NULL) {
+          rs->value = wax_resolve_expression(rctx, rs->value);
+          if (rs->value == NULL) return 0;
+        }
+        keep = 1;
+      }
+      break;
+    case NODE_KIND_BREAK:
+    case NODE_KIND_CONTINUE:
+      found = 1;
+      if (rctx->loop_depth == 0) {
+        parser_error(rctx->ctx, line->first_token, string_concat3("'", line->first_token->value->cstring, "' can only be used inside a loop."));
+        return 0;
+      }
+      keep = 1;
+      break;
+    case NODE_KIND_IF_STATEMENT:
+      {
         found = 1;
         IfStatement* _if = (IfStatement*) line;
         _if->condition = wax_resolve_expression(rctx, _if->condition);
@@ -199,15 +546,16 @@ int wax_resolve_executable(ResolverContext* rctx, Node* line, List* code_out) {
         _if->false_code = wax_resolve_code_block(rctx, _if->false_code, &ok);
         if (!ok) return 0;
         keep = 1;
-        break;
       }
       break;
+    default:
+      break;
   }
 
   if (keep) list_add(code_out, line);
 
   if (!found) {
-    parser_error(rctx->ctx, line->first_token, string_concat("No executable resolver for: ", type->cstring));
+    parser_error(rctx->ctx, line->first_token, string_concat("No executable resolver for: ", node_kind_name(node_kind(line))));
     return 0;
   }
 
@@ -220,65 +568,25 @@ Node* wax_resolve_function_invocation(ResolverContext* rctx, FunctionInvocation*
 Node* wax_resolve_inline_dictionary(ResolverContext* rctx, InlineDictionary* dict);
 Node* wax_resolve_op_chain(ResolverContext* rctx, OpChain* oc);
 Node* wax_resolve_ternary(ResolverContext* rctx, Ternary* ter);
+Node* wax_resolve_variable(ResolverContext* rctx, Variable* v);
 
 Node* wax_resolve_expression(ResolverContext* rctx, Node* expression) {
-  static String* str_boolean_constant = NULL;
-  static String* str_bracket_index = NULL;
-  static String* str_dot_field = NULL;
-  static String* str_inline_dictionary = NULL;
-  static String* str_integer_constant = NULL;
-  static String* str_function_invocation = NULL;
-  static String* str_null_constant = NULL;
-  static String* str_op_chain = NULL;
-  static String* str_string_constant = NULL;
-  static String* str_ternary = NULL;
-  static String* str_variable = NULL;
-  if (str_boolean_constant == NULL) {
-    str_boolean_constant = new_common_string(NODE_BOOLEAN_CONSTANT_NAME);
-    str_bracket_index = new_common_string(NODE_BRACKET_INDEX_NAME);
-    str_dot_field = new_common_string(NODE_DOT_FIELD_NAME);
-    str_inline_dictionary = new_common_string(NODE_INLINE_DICTIONARY_NAME);
-    str_integer_constant = new_common_string(NODE_INTEGER_CONSTANT_NAME);
-    str_function_invocation = new_common_string(NODE_FUNCTION_INVOCATION_NAME);
-    str_null_constant = new_common_string(NODE_NULL_CONSTANT_NAME);
-    str_op_chain = new_common_string(NODE_OP_CHAIN_NAME);
-    str_string_constant = new_common_string(NODE_STRING_CONSTANT_NAME);
-    str_ternary = new_common_string(NODE_TERNARY_NAME);
-    str_variable = new_common_string(NODE_VARIABLE_NAME);
-  }
-  String* type = expression->type;
-  switch (type->cstring[0]) {
-    case 'B':
-      if (string_equals(type, str_boolean_constant)) return expression; // nothing to resolve
-      if (string_equals(type, str_bracket_index)) return wax_resolve_bracket_index(rctx, (BracketIndex*) expression);
-      break;
-    case 'D':
-      if (string_equals(type, str_dot_field)) return wax_resolve_dot_token(rctx, (DotField*) expression);
-      break;
-    case 'F':
-      if (string_equals(type, str_function_invocation)) return wax_resolve_function_invocation(rctx, (FunctionInvocation*) expression);
-      break;
-    case 'I':
-      if (string_equals(type, str_integer_constant)) return expression; // nothing to resolve
-      if (string_equals(type, str_inline_dictionary)) return wax_resolve_inline_dictionary(rctx, (InlineDictionary*) expression); // nothing to resolve
-      break;
-    case 'N':
-      if (string_equals(type, str_null_constant)) return expression; // nothing to resolve
-      break;
-    case 'O':
-      if (string_equals(type, str_op_chain)) return wax_resolve_op_chain(rctx, (OpChain*) expression);
-      break;
-    case 'S':
-      if (string_equals(type, str_string_constant)) return expression; // nothing to resolve
-      break;
-    case 'T':
-      if (string_equals(type, str_ternary)) return wax_resolve_ternary(rctx, (Ternary*) expression);
-      break;
-    case 'V':
-      if (string_equals(type, str_variable)) return expression; // nothing to resolve...yet
-      break;
+  int kind = node_kind(expression);
+  switch (kind) {
+    case NODE_KIND_BOOLEAN_CONSTANT: return expression; // nothing to resolve
+    case NODE_KIND_BRACKET_INDEX: return wax_resolve_bracket_index(rctx, (BracketIndex*) expression);
+    case NODE_KIND_DOT_FIELD: return wax_resolve_dot_token(rctx, (DotField*) expression);
+    case NODE_KIND_FUNCTION_INVOCATION: return wax_resolve_function_invocation(rctx, (FunctionInvocation*) expression);
+    case NODE_KIND_INTEGER_CONSTANT: return expression; // nothing to resolve
+    case NODE_KIND_INLINE_DICTIONARY: return wax_resolve_inline_dictionary(rctx, (InlineDictionary*) expression);
+    case NODE_KIND_NULL_CONSTANT: return expression; // nothing to resolve
+    case NODE_KIND_OP_CHAIN: return wax_resolve_op_chain(rctx, (OpChain*) expression);
+    case NODE_KIND_STRING_CONSTANT: return expression; // nothing to resolve
+    case NODE_KIND_TERNARY: return wax_resolve_ternary(rctx, (Ternary*) expression);
+    case NODE_KIND_VARIABLE: return wax_resolve_variable(rctx, (Variable*) expression);
+    default: break;
   }
-  parser_error(rctx->ctx, expression->first_token, string_concat("No expression resolver for: ", type->cstring));
+  parser_error(rctx->ctx, expression->first_token, string_concat("No expression resolver for: ", node_kind_name(kind)));
   return NULL;
 }
 
@@ -290,6 +598,17 @@ Node* wax_resolve_bracket_index(ResolverContext* rctx, BracketIndex* bi) {
 
 Node* wax_resolve_dot_token(ResolverContext* rctx, DotField* df) {
   if ((df->root = wax_resolve_expression(rctx, df->root)) == NULL) return NULL;
+  // The members of this are known, and its fields have a fixed slot.
+  if (node_kind(df->root) == NODE_KIND_VARIABLE && string_equals_chars(((Variable*) df->root)->name, "this")) {
+    String* name = df->field_token->value;
+    Node* member = wax_resolver_find_member(rctx->class_def, name);
+    if (member == NULL || node_kind(member) == NODE_KIND_CONSTRUCTOR_DEFINITION) {
+      parser_error(rctx->ctx, df->field_token, string_concat5(
+        "The class '", rctx->class_def->class_name->value->cstring, "' has no field or method named '", name->cstring, "'."));
+      return NULL;
+    }
+    if (node_kind(member) == NODE_KIND_FIELD_DEFINITION) df->field_index = ((FieldDefinition*) member)->index;
+  }
   return (Node*) df;
 }
 
@@ -304,33 +623,31 @@ Node* wax_resolve_function_invocation(ResolverContext* rctx, FunctionInvocation*
 }
 
 Node* wax_resolve_inline_dictionary(ResolverContext* rctx, InlineDictionary* dict) {
-  static String* str_string_constant = NULL;
-  if (str_string_constant == NULL) {
-    str_string_constant = new_common_string(NODE_STRING_CONSTANT_NAME);
-  }
   int kcount = dict->keys->length;
   Dictionary* collisions = new_dictionary();
   for (int i = 0; i < kcount; ++i) {
     Node* key = list_get(dict->keys, i);
     key = wax_resolve_expression(rctx, key);
     if (key == NULL) return NULL;
-    if (!string_equals(key->type, str_string_constant)) {
+    if (node_kind(key) != NODE_KIND_STRING_CONSTANT) {
       parser_error_chars(rctx->ctx, key->first_token, "Only a string can be used as the key of a dictionary.");
       return NULL;
     }
     list_set(dict->keys, i, key);
 
-    if (dictionary_has_key(collisions, key)) {
+    String* key_value = ((StringConstant*) key)->value;
+    if (dictionary_has_key(collisions, key_value)) {
       parser_error_chars(rctx->ctx, key->first_token, "This dictionary contains a key collisions here.");
       return NULL;
     }
-    dictionary_set(collisions, key, key);
+    dictionary_set(collisions, key_value, key);
 
     Node* value = list_get(dict->values, i);
     value = wax_resolve_expression(rctx, value);
     if (value == NULL) return NULL;
     list_set(dict->values, i, value);
   }
+  wax_fold_inline_dictionary(dict);
   return (Node*) dict;
 }
 
@@ -341,7 +658,7 @@ Node* wax_resolve_op_chain(ResolverContext* rctx, OpChain* oc) {
     if (ex == NULL) return NULL;
     list_set(oc->expressions, i, ex);
   }
-  return (Node*) oc;
+  return wax_fold_op_chain(oc);
 }
 
 Node* wax_resolve_ternary(ResolverContext* rctx, Ternary* ter) {
@@ -351,7 +668,34 @@ Node* wax_resolve_ternary(ResolverContext* rctx, Ternary* ter) {
   if (ter->true_expr == NULL) return NULL;
   ter->false_expr = wax_resolve_expression(rctx, ter->false_expr);
   if (ter->false_expr == NULL) return NULL;
-  return (Node*) ter;
+  return wax_fold_ternary(ter);
+}
+
+// Locals shadow the module's functions and classes. Any other name is a global the module does not
+// define itself, like print, and gets its index in _wax_resolve_global_names.
+Node* wax_resolve_variable(ResolverContext* rctx, Variable* v) {
+  if ((rctx->class_def == NULL || rctx->locals == NULL) && string_equals_chars(v->name, "this")) {
+    parser_error_chars(rctx->ctx, v->node.first_token, "'this' can only be used in a method or constructor.");
+    return NULL;
+  }
+  Integer* slot = rctx->locals == NULL ? NULL : (Integer*) dictionary_get(rctx->locals, v->name);
+  FunctionDefinition* func_def;
+  ClassDefinition* class_def;
+  if (slot != NULL) {
+    v->scope = VARIABLE_SCOPE_LOCAL;
+    v->index = slot->value;
+  } else if ((func_def = (FunctionDefinition*) dictionary_get(rctx->functions_by_name, v->name)) != NULL) {
+    v->scope = VARIABLE_SCOPE_FUNCTION;
+    v->index = func_def->index;
+  } else if ((class_def = (ClassDefinition*) dictionary_get(rctx->classes_by_name, v->name)) != NULL) {
+    v->scope = VARIABLE_SCOPE_CLASS;
+    v->index = class_def->index;
+  } else {
+    v->scope = VARIABLE_SCOPE_GLOBAL;
+    v->index = -1;
+    list_add(rctx->global_refs, v);
+  }
+  return (Node*) v;
 }
 
 #endif
@@ -0,0 +1,1185 @@
+#ifndef _WAX_SERIALIZER_H
+#define _WAX_SERIALIZER_H
+
+#include "../util/dictionaries.h"
+#include "../util/fileio.h"
+#include "../util/gc.h"
+#include "../util/lists.h"
+#include "../util/primitives.h"
+#include "../util/strings.h"
+#include "compilercontext.h"
+#include "nodes.h"
+#include "tokens.h"
+
+/*
+  Binary AST format (.waxast)
+
+  Header (fixed size so that a mapped file can be read without scanning):
+    [0..3]   magic "WAXA"
+    [4..7]   format version (u32, little endian)
+    [8..11]  offset of the string table (u32)
+    [12..15] offset of the entity index (u32)
+    [16..19] offset of the source file table (u32)
+    [20..23] offset of the global names table (u32)
+
+  Node records follow the header. Children are always written before their parent, so a child is
+  referenced by the distance back from the start of the parent's record (varint). 0 means NULL.
+  Strings are referenced by their varint id in the string table. All other integers are varints.
+
+  Token: type + 1 (byte, 0 for NULL), source file id, byte offset, value string id
+
+  Source file table: count, then (path string id, line count, line start deltas) for each file, so
+  that line and column numbers can still be computed for tokens without the source text.
+  String table: count, then (length, bytes) for each string.
+  Entity index: class count, function count, then the absolute offset of each class and function.
+  Global names table: count, then the string id of each name, by VARIABLE_SCOPE_GLOBAL index.
+
+  The resolver's scope information is kept: a variable record has its scope and index, a function
+  or constructor record ends with its local slot count and a for-each record has the slot of its
+  variable. A class record ends with its field count including inherited fields, a field record
+  with its slot and a dot field record with the slot of the field of this it reads, or -1. Classes
+  and functions are numbered by their position in the entity index. An inline dictionary record
+  starts with a byte that is 1 if the resolver found it to be constant.
+
+  Entities are materialized lazily: opening a file only reads the header and the two tables and
+  each class or function is decoded the first time it is requested. Nothing in a file is trusted:
+  every count, offset and index is checked before it is used, and each record can only be referred
+  to once, so a malformed file is rejected rather than crashing the reader or what runs the result.
+*/
+
+#define AST_FORMAT_MAGIC "WAXA"
+#define AST_FORMAT_VERSION 6
+#define AST_HEADER_SIZE 24
+
+enum AstRecordKind {
+  AST_RECORD_CLASS_DEFINITION = 1,
+  AST_RECORD_FUNCTION_DEFINITION,
+  AST_RECORD_CONSTRUCTOR_DEFINITION,
+  AST_RECORD_FIELD_DEFINITION,
+  AST_RECORD_ASSIGNMENT,
+  AST_RECORD_IF_STATEMENT,
+  AST_RECORD_FOR_LOOP,
+  AST_RECORD_FOR_EACH_LOOP,
+  AST_RECORD_EXPR_EXEC,
+  AST_RECORD_NULL_CONSTANT,
+  AST_RECORD_BOOLEAN_CONSTANT,
+  AST_RECORD_INTEGER_CONSTANT,
+  AST_RECORD_STRING_CONSTANT,
+  AST_RECORD_VARIABLE,
+  AST_RECORD_INLINE_DICTIONARY,
+  AST_RECORD_DOT_FIELD,
+  AST_RECORD_BRACKET_INDEX,
+  AST_RECORD_OP_CHAIN,
+  AST_RECORD_TERNARY,
+  AST_RECORD_FUNCTION_INVOCATION,
+  AST_RECORD_WHILE_LOOP,
+  AST_RECORD_RETURN,
+  AST_RECORD_BREAK,
+  AST_RECORD_CONTINUE,
+};
+
+typedef struct _AstWriter {
+  StringBuilder* bytes;
+  Dictionary* string_ids;
+  List* strings;
+  Dictionary* source_ids; // by path
+  List* sources;
+} AstWriter;
+
+void _ast_write_byte(AstWriter* writer, int value) {
+  string_builder_append_char(writer->bytes, (char) value);
+}
+
+void _ast_write_varint(StringBuilder* sb, unsigned int value) {
+  while (value >= 0x80) {
+    string_builder_append_char(sb, (char) ((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  string_builder_append_char(sb, (char) value);
+}
+
+void _ast_write_signed_varint(AstWriter* writer, int value) {
+  // zig-zag so that small negative numbers stay small
+  _ast_write_varint(writer->bytes, (((unsigned int) value) << 1) ^ (unsigned int) (value >> 31));
+}
+
+void _ast_write_u32_at(StringBuilder* sb, int index, unsigned int value) {
+  for (int i = 0; i < 4; ++i) {
+    sb->chars[index + i] = (char) ((value >> (i * 8)) & 0xFF);
+  }
+}
+
+void _ast_write_string(AstWriter* writer, String* str) {
+  Integer* id = (Integer*) dictionary_get(writer->string_ids, str);
+  if (id == NULL) {
+    id = wrap_int(writer->strings->length);
+    dictionary_set(writer->string_ids, str, id);
+    list_add(writer->strings, str);
+  }
+  _ast_write_varint(writer->bytes, id->value);
+}
+
+void _ast_write_token(AstWriter* writer, Token* token) {
+  if (token == NULL) {
+    _ast_write_byte(writer, 0);
+    return;
+  }
+  SourceFile* source = token->source;
+  Integer* source_id = (Integer*) dictionary_get(writer->source_ids, source->path);
+  if (source_id == NULL) {
+    source_id = wrap_int(writer->sources->length);
+    dictionary_set(writer->source_ids, source->path, source_id);
+    list_add(writer->sources, source);
+  }
+  _ast_write_byte(writer, token->type + 1);
+  _ast_write_varint(writer->bytes, source_id->value);
+  _ast_write_varint(writer->bytes, token->offset);
+  _ast_write_string(writer, token->value);
+}
+
+void _ast_write_token_list(AstWriter* writer, List* tokens) {
+  _ast_write_varint(writer->bytes, tokens->length);
+  for (int i = 0; i < tokens->length; ++i) {
+    _ast_write_token(writer, (Token*) list_get(tokens, i));
+  }
+}
+
+void _ast_write_child(AstWriter* writer, int record_start, int child_offset) {
+  _ast_write_varint(writer->bytes, child_offset < 0 ? 0 : record_start - child_offset);
+}
+
+int _ast_write_node(AstWriter* writer, Node* node);
+
+// Writes each node of the list and returns a malloc'd array of their record offsets.
+int* _ast_write_node_list_children(AstWriter* writer, List* nodes) {
+  int* offsets = (int*) malloc(sizeof(int) * (nodes->length + 1));
+  for (int i = 0; i < nodes->length; ++i) {
+    offsets[i] = _ast_write_node(writer, (Node*) list_get(nodes, i));
+  }
+  return offsets;
+}
+
+void _ast_write_node_list_refs(AstWriter* writer, int record_start, List* nodes, int* offsets) {
+  _ast_write_varint(writer->bytes, nodes->length);
+  for (int i = 0; i < nodes->length; ++i) {
+    _ast_write_child(writer, record_start, offsets[i]);
+  }
+  free(offsets);
+}
+
+int _ast_begin_record(AstWriter* writer, enum AstRecordKind kind, Node* node) {
+  int record_start = writer->bytes->length;
+  _ast_write_byte(writer, kind);
+  _ast_write_token(writer, node->first_token);
+  return record_start;
+}
+
+// Returns the offset of the node's record or -1 for NULL.
+int _ast_write_node(AstWriter* writer, Node* node) {
+  if (node == NULL) return -1;
+
+  int kind = node_kind(node);
+  int start;
+
+  if (kind == NODE_KIND_CLASS_DEFINITION) {
+    ClassDefinition* cd = (ClassDefinition*) node;
+    int* member_offsets = (int*) malloc(sizeof(int) * (cd->member_order->length + 1));
+    for (int i = 0; i < cd->member_order->length; ++i) {
+      member_offsets[i] = _ast_write_node(writer, (Node*) dictionary_get(cd->members, list_get_string(cd->member_order, i)));
+    }
+    start = _ast_begin_record(writer, AST_RECORD_CLASS_DEFINITION, node);
+    _ast_write_token(writer, cd->class_name);
+    _ast_write_token(writer, cd->base_class_token);
+    _ast_write_varint(writer->bytes, cd->member_order->length);
+    for (int i = 0; i < cd->member_order->length; ++i) {
+      _ast_write_string(writer, list_get_string(cd->member_order, i));
+      _ast_write_child(writer, start, member_offsets[i]);
+    }
+    _ast_write_signed_varint(writer, cd->field_count);
+    free(member_offsets);
+  } else if (kind == NODE_KIND_FUNCTION_DEFINITION || kind == NODE_KIND_CONSTRUCTOR_DEFINITION) {
+    int is_function = kind == NODE_KIND_FUNCTION_DEFINITION;
+    List* code = is_function ? ((FunctionDefinition*) node)->code : ((ConstructorDefinition*) node)->code;
+    List* arg_tokens = is_function ? ((FunctionDefinition*) node)->arg_tokens : ((ConstructorDefinition*) node)->arg_tokens;
+    List* arg_default_values = is_function ? ((FunctionDefinition*) node)->arg_default_values : ((ConstructorDefinition*) node)->arg_default_values;
+    int* default_offsets = _ast_write_node_list_children(writer, arg_default_values);
+    int* code_offsets = _ast_write_node_list_children(writer, code);
+    start = _ast_begin_record(writer, is_function ? AST_RECORD_FUNCTION_DEFINITION : AST_RECORD_CONSTRUCTOR_DEFINITION, node);
+    if (is_function) _ast_write_token(writer, ((FunctionDefinition*) node)->function_name);
+    _ast_write_token_list(writer, arg_tokens);
+    _ast_write_node_list_refs(writer, start, arg_default_values, default_offsets);
+    _ast_write_node_list_refs(writer, start, code, code_offsets);
+    _ast_write_varint(writer->bytes, is_function ? ((FunctionDefinition*) node)->local_count : ((ConstructorDefinition*) node)->local_count);
+  } else if (kind == NODE_KIND_FIELD_DEFINITION) {
+    FieldDefinition* fd = (FieldDefinition*) node;
+    int value_offset = _ast_write_node(writer, fd->default_value);
+    start = _ast_begin_record(writer, AST_RECORD_FIELD_DEFINITION, node);
+    _ast_write_token(writer, fd->field_name);
+    _ast_write_child(writer, start, value_offset);
+    _ast_write_signed_varint(writer, fd->index);
+  } else if (kind == NODE_KIND_ASSIGNMENT) {
+    Assignment* asgn = (Assignment*) node;
+    int target_offset = _ast_write_node(writer, asgn->target);
+    int value_offset = _ast_write_node(writer, asgn->value);
+    start = _ast_begin_record(writer, AST_RECORD_ASSIGNMENT, node);
+    _ast_write_token(writer, asgn->assignment_op);
+    _ast_write_child(writer, start, target_offset);
+    _ast_write_child(writer, start, value_offset);
+  } else if (kind == NODE_KIND_IF_STATEMENT) {
+    IfStatement* ifstat = (IfStatement*) node;
+    int condition_offset = _ast_write_node(writer, ifstat->condition);
+    int* true_offsets = _ast_write_node_list_children(writer, ifstat->true_code);
+    int* false_offsets = _ast_write_node_list_children(writer, ifstat->false_code);
+    start = _ast_begin_record(writer, AST_RECORD_IF_STATEMENT, node);
+    _ast_write_child(writer, start, condition_offset);
+    _ast_write_node_list_refs(writer, start, ifstat->true_code, true_offsets);
+    _ast_write_node_list_refs(writer, start, ifstat->false_code, false_offsets);
+  } else if (kind == NODE_KIND_FOR_LOOP) {
+    ForLoop* fl = (ForLoop*) node;
+    int* init_offsets = _ast_write_node_list_children(writer, fl->inits);
+    int condition_offset = _ast_write_node(writer, fl->condition);
+    int* step_offsets = _ast_write_node_list_children(writer, fl->steps);
+    int* code_offsets = _ast_write_node_list_children(writer, fl->code);
+    start = _ast_begin_record(writer, AST_RECORD_FOR_LOOP, node);
+    _ast_write_node_list_refs(writer, start, fl->inits, init_offsets);
+    _ast_write_child(writer, start, condition_offset);
+    _ast_write_node_list_refs(writer, start, fl->steps, step_offsets);
+    _ast_write_node_list_refs(writer, start, fl->code, code_offsets);
+  } else if (kind == NODE_KIND_FOR_EACH_LOOP) {
+    ForEachLoop* fel = (ForEachLoop*) node;
+    int list_offset = _ast_write_node(writer, fel->list_expr);
+    int* code_offsets = _ast_write_node_list_children(writer, fel->code);
+    start = _ast_begin_record(writer, AST_RECORD_FOR_EACH_LOOP, node);
+    _ast_write_token(writer, fel->variable);
+    _ast_write_signed_varint(writer, fel->variable_index);
+    _ast_write_child(writer, start, list_offset);
+    _ast_write_node_list_refs(writer, start, fel->code, code_offsets);
+  } else if (kind == NODE_KIND_WHILE_LOOP) {
+    WhileLoop* wl = (WhileLoop*) node;
+    int condition_offset = _ast_write_node(writer, wl->condition);
+    int* code_offsets = _ast_write_node_list_children(writer, wl->code);
+    start = _ast_begin_record(writer, AST_RECORD_WHILE_LOOP, node);
+    _ast_write_child(writer, start, condition_offset);
+    _ast_write_node_list_refs(writer, start, wl->code, code_offsets);
+  } else if (kind == NODE_KIND_RETURN) {
+    int value_offset = _ast_write_node(writer, ((ReturnStatement*) node)->value);
+    start = _ast_begin_record(writer, AST_RECORD_RETURN, node);
+    _ast_write_child(writer, start, value_offset);
+  } else if (kind == NODE_KIND_BREAK) {
+    start = _ast_begin_record(writer, AST_RECORD_BREAK, node);
+  } else if (kind == NODE_KIND_CONTINUE) {
+    start = _ast_begin_record(writer, AST_RECORD_CONTINUE, node);
+  } else if (kind == NODE_KIND_EXPR_EXEC) {
+    int expr_offset = _ast_write_node(writer, ((ExpressionAsExecutable*) node)->expression);
+    start = _ast_begin_record(writer, AST_RECORD_EXPR_EXEC, node);
+    _ast_write_child(writer, start, expr_offset);
+  } else if (kind == NODE_KIND_NULL_CONSTANT) {
+    start = _ast_begin_record(writer, AST_RECORD_NULL_CONSTANT, node);
+  } else if (kind == NODE_KIND_BOOLEAN_CONSTANT) {
+    start = _ast_begin_record(writer, AST_RECORD_BOOLEAN_CONSTANT, node);
+    _ast_write_byte(writer, ((BooleanConstant*) node)->value ? 1 : 0);
+  } else if (kind == NODE_KIND_INTEGER_CONSTANT) {
+    start = _ast_begin_record(writer, AST_RECORD_INTEGER_CONSTANT, node);
+    _ast_write_signed_varint(writer, ((IntegerConstant*) node)->value);
+  } else if (kind == NODE_KIND_STRING_CONSTANT) {
+    start = _ast_begin_record(writer, AST_RECORD_STRING_CONSTANT, node);
+    _ast_write_string(writer, ((StringConstant*) node)->value);
+  } else if (kind == NODE_KIND_VARIABLE) {
+    Variable* v = (Variable*) node;
+    start = _ast_begin_record(writer, AST_RECORD_VARIABLE, node);
+    _ast_write_string(writer, v->name);
+    _ast_write_byte(writer, v->scope);
+    _ast_write_signed_varint(writer, v->index);
+  } else if (kind == NODE_KIND_INLINE_DICTIONARY) {
+    InlineDictionary* dict = (InlineDictionary*) node;
+    int* key_offsets = _ast_write_node_list_children(writer, dict->keys);
+    int* value_offsets = _ast_write_node_list_children(writer, dict->values);
+    start = _ast_begin_record(writer, AST_RECORD_INLINE_DICTIONARY, node);
+    _ast_write_byte(writer, dict->is_constant ? 1 : 0);
+    _ast_write_node_list_refs(writer, start, dict->keys, key_offsets);
+    _ast_write_node_list_refs(writer, start, dict->values, value_offsets);
+  } else if (kind == NODE_KIND_DOT_FIELD) {
+    DotField* df = (DotField*) node;
+    int root_offset = _ast_write_node(writer, df->root);
+    start = _ast_begin_record(writer, AST_RECORD_DOT_FIELD, node);
+    _ast_write_token(writer, df->dot_token);
+    _ast_write_token(writer, df->field_token);
+    _ast_write_child(writer, start, root_offset);
+    _ast_write_signed_varint(writer, df->field_index);
+  } else if (kind == NODE_KIND_BRACKET_INDEX) {
+    BracketIndex* bi = (BracketIndex*) node;
+    int root_offset = _ast_write_node(writer, bi->root);
+    int index_offset = _ast_write_node(writer, bi->index);
+    start = _ast_begin_record(writer, AST_RECORD_BRACKET_INDEX, node);
+    _ast_write_token(writer, bi->bracket_token);
+    _ast_write_child(writer, start, root_offset);
+    _ast_write_child(writer, start, index_offset);
+  } else if (kind == NODE_KIND_OP_CHAIN) {
+    OpChain* oc = (OpChain*) node;
+    int* expr_offsets = _ast_write_node_list_children(writer, oc->expressions);
+    start = _ast_begin_record(writer, AST_RECORD_OP_CHAIN, node);
+    _ast_write_token_list(writer, oc->ops);
+    _ast_write_node_list_refs(writer, start, oc->expressions, expr_offsets);
+  } else if (kind == NODE_KIND_TERNARY) {
+    Ternary* ter = (Ternary*) node;
+    int condition_offset = _ast_write_node(writer, ter->condition);
+    int true_offset = _ast_write_node(writer, ter->true_expr);
+    int false_offset = _ast_write_node(writer, ter->false_expr);
+    start = _ast_begin_record(writer, AST_RECORD_TERNARY, node);
+    _ast_write_token(writer, ter->question_mark);
+    _ast_write_child(writer, start, condition_offset);
+    _ast_write_child(writer, start, true_offset);
+    _ast_write_child(writer, start, false_offset);
+  } else if (kind == NODE_KIND_FUNCTION_INVOCATION) {
+    FunctionInvocation* fi = (FunctionInvocation*) node;
+    int root_offset = _ast_write_node(writer, fi->root);
+    int* arg_offsets = _ast_write_node_list_children(writer, fi->args);
+    start = _ast_begin_record(writer, AST_RECORD_FUNCTION_INVOCATION, node);
+    _ast_write_token(writer, fi->open_paren);
+    _ast_write_child(writer, start, root_offset);
+    _ast_write_node_list_refs(writer, start, fi->args, arg_offsets);
+  } else {
+    printf("Warning: no AST serializer for: %s\n", node_kind_name(kind));
+    return -1;
+  }
+  return start;
+}
+
+// Returns the serialized bytes of the context's classes and functions. The caller frees them.
+StringBuilder* wax_ast_serialize(CompilerContext* ctx) {
+  AstWriter writer;
+  writer.bytes = new_string_builder();
+  writer.string_ids = new_dictionary();
+  writer.strings = new_list();
+  writer.source_ids = new_dictionary();
+  writer.sources = new_list();
+  gc_save_item(writer.string_ids);
+  gc_save_item(writer.strings);
+  gc_save_item(writer.source_ids);
+  gc_save_item(writer.sources);
+
+  for (int i = 0; i < AST_HEADER_SIZE; ++i) _ast_write_byte(&writer, 0);
+  memcpy(writer.bytes->chars, AST_FORMAT_MAGIC, 4);
+
+  int class_count = ctx->class_definitions->length;
+  int function_count = ctx->function_definitions->length;
+  int* entity_offsets = (int*) malloc(sizeof(int) * (class_count + function_count + 1));
+  for (int i = 0; i < class_count; ++i) {
+    entity_offsets[i] = _ast_write_node(&writer, (Node*) list_get(ctx->class_definitions, i));
+  }
+  for (int i = 0; i < function_count; ++i) {
+    entity_offsets[class_count + i] = _ast_write_node(&writer, (Node*) list_get(ctx->function_definitions, i));
+  }
+
+  // Written before the string table since these add names and paths to it.
+  int global_table_offset = writer.bytes->length;
+  _ast_write_varint(writer.bytes, ctx->global_names->length);
+  for (int i = 0; i < ctx->global_names->length; ++i) {
+    _ast_write_string(&writer, list_get_string(ctx->global_names, i));
+  }
+
+  int source_table_offset = writer.bytes->length;
+  _ast_write_varint(writer.bytes, writer.sources->length);
+  for (int i = 0; i < writer.sources->length; ++i) {
+    SourceFile* source = (SourceFile*) list_get(writer.sources, i);
+    _ast_write_string(&writer, source->path);
+    _ast_write_varint(writer.bytes, source->line_count);
+    for (int j = 0; j < source->line_count; ++j) {
+      _ast_write_varint(writer.bytes, source->line_starts[j] - (j == 0 ? 0 : source->line_starts[j - 1]));
+    }
+  }
+
+  int string_table_offset = writer.bytes->length;
+  _ast_write_varint(writer.bytes, writer.strings->length);
+  for (int i = 0; i < writer.strings->length; ++i) {
+    String* str = list_get_string(writer.strings, i);
+    _ast_write_varint(writer.bytes, str->length);
+    for (int j = 0; j < str->length; ++j) {
+      string_builder_append_char(writer.bytes, str->cstring[j]);
+    }
+  }
+
+  int entity_index_offset = writer.bytes->length;
+  _ast_write_varint(writer.bytes, class_count);
+  _ast_write_varint(writer.bytes, function_count);
+  for (int i = 0; i < class_count + function_count; ++i) {
+    _ast_write_varint(writer.bytes, entity_offsets[i]);
+  }
+  free(entity_offsets);
+
+  _ast_write_u32_at(writer.bytes, 4, AST_FORMAT_VERSION);
+  _ast_write_u32_at(writer.bytes, 8, string_table_offset);
+  _ast_write_u32_at(writer.bytes, 12, entity_index_offset);
+  _ast_write_u32_at(writer.bytes, 16, source_table_offset);
+  _ast_write_u32_at(writer.bytes, 20, global_table_offset);
+
+  gc_release_item(writer.string_ids);
+  gc_release_item(writer.strings);
+  gc_release_item(writer.source_ids);
+  gc_release_item(writer.sources);
+  return writer.bytes;
+}
+
+int wax_ast_save(CompilerContext* ctx, const char* path) {
+  StringBuilder* bytes = wax_ast_serialize(ctx);
+  int ok = file_write_bytes(path, bytes->chars, bytes->length);
+  string_builder_free(bytes);
+  return ok;
+}
+
+// Records can't nest deeper than this, so that a malformed file can't run the reader out of stack.
+#define AST_MAX_NESTING 1000
+
+typedef struct _AstReader {
+  unsigned char* data;
+  int length;
+  int ok; // cleared when the file turns out to be malformed
+  char* claimed; // by offset, set for each record once it is decoded, so that no record is used twice
+  int string_count;
+  int* string_offsets;
+  List* strings; // materialized on first use, NULL until then
+  int source_count;
+  int* source_offsets;
+  List* sources; // materialized on first use, NULL until then
+  int class_count;
+  int function_count;
+  int* entity_offsets;
+  List* entities; // materialized on first use, NULL until then
+  List* global_names;
+
+  // Where the record being decoded is, to check the resolver's indices against.
+  int depth;
+  int in_class;
+  int in_function;
+  int loop_depth;
+  int local_slot_end; // one more than the highest local slot the current function uses
+  int field_slot_end; // one more than the highest field slot the current class uses
+} AstReader;
+
+int _ast_read_byte(AstReader* reader, int* index) {
+  if (*index >= reader->length) {
+    reader->ok = 0;
+    return 0;
+  }
+  return reader->data[(*index)++];
+}
+
+unsigned int _ast_read_varint(AstReader* reader, int* index) {
+  unsigned int value = 0;
+  int shift = 0;
+  unsigned char b;
+  do {
+    if (*index >= reader->length) {
+      reader->ok = 0;
+      return 0;
+    }
+    b = reader->data[(*index)++];
+    value |= ((unsigned int) (b & 0x7F)) << shift;
+    shift += 7;
+  } while ((b & 0x80) != 0 && shift < 35);
+  return value;
+}
+
+int _ast_read_signed_varint(AstReader* reader, int* index) {
+  unsigned int raw = _ast_read_varint(reader, index);
+  return (int) (raw >> 1) ^ -((int) (raw & 1));
+}
+
+// Reads a count of things that each take up at least a byte after it, so a corrupt one can't ask for too much.
+int _ast_read_count(AstReader* reader, int* index) {
+  unsigned int count = _ast_read_varint(reader, index);
+  if (count > (unsigned int) (reader->length - *index)) {
+    reader->ok = 0;
+    return 0;
+  }
+  return (int) count;
+}
+
+unsigned int _ast_read_u32(AstReader* reader, int index) {
+  unsigned int value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= ((unsigned int) reader->data[index + i]) << (i * 8);
+  }
+  return value;
+}
+
+// Reads the offset of one of the tables from the header.
+int _ast_read_table_offset(AstReader* reader, int header_index) {
+  unsigned int offset = _ast_read_u32(reader, header_index);
+  if (offset < AST_HEADER_SIZE || offset > (unsigned int) reader->length) {
+    reader->ok = 0;
+    return reader->length;
+  }
+  return (int) offset;
+}
+
+void ast_reader_close(AstReader* reader) {
+  gc_release_item(reader->strings);
+  gc_release_item(reader->sources);
+  gc_release_item(reader->entities);
+  gc_release_item(reader->global_names);
+  file_unmap_bytes(reader->data, reader->length);
+  free(reader->claimed);
+  free(reader->string_offsets);
+  free(reader->source_offsets);
+  free(reader->entity_offsets);
+  free(reader);
+}
+
+String* _ast_read_string(AstReader* reader, int* index);
+
+/*
+  Returns NULL if the file does not exist, is not a compatible .waxast file or its tables don't fit
+  in it. The records are only checked as they are decoded, so any of the reader's getters can
+  still find the file to be malformed.
+*/
+AstReader* ast_reader_open(const char* path) {
+  int length = 0;
+  unsigned char* data = file_map_bytes(path, &length);
+  if (data == NULL) return NULL;
+
+  AstReader* reader = (AstReader*) malloc_clean(sizeof(AstReader));
+  reader->data = data;
+  reader->length = length;
+  reader->ok = 1;
+  reader->claimed = (char*) malloc_clean(length + 1);
+  reader->strings = new_list();
+  reader->sources = new_list();
+  reader->entities = new_list();
+  reader->global_names = new_list();
+  gc_save_item(reader->strings);
+  gc_save_item(reader->sources);
+  gc_save_item(reader->entities);
+  gc_save_item(reader->global_names);
+
+  if (length < AST_HEADER_SIZE ||
+      memcmp(data, AST_FORMAT_MAGIC, 4) != 0 ||
+      _ast_read_u32(reader, 4) != AST_FORMAT_VERSION) {
+    ast_reader_close(reader);
+    return NULL;
+  }
+
+  int index = _ast_read_table_offset(reader, 8);
+  reader->string_count = _ast_read_count(reader, &index);
+  reader->string_offsets = (int*) malloc(sizeof(int) * (reader->string_count + 1));
+  for (int i = 0; i < reader->string_count && reader->ok; ++i) {
+    reader->string_offsets[i] = index;
+    index += _ast_read_count(reader, &index);
+    list_add(reader->strings, NULL);
+  }
+
+  index = _ast_read_table_offset(reader, 16);
+  reader->source_count = _ast_read_count(reader, &index);
+  reader->source_offsets = (int*) malloc(sizeof(int) * (reader->source_count + 1));
+  for (int i = 0; i < reader->source_count && reader->ok; ++i) {
+    reader->source_offsets[i] = index;
+    if (_ast_read_varint(reader, &index) >= (unsigned int) reader->string_count) reader->ok = 0;
+    int line_count = _ast_read_count(reader, &index);
+    for (int j = 0; j < line_count && reader->ok; ++j) {
+      _ast_read_varint(reader, &index);
+    }
+    list_add(reader->sources, NULL);
+  }
+
+  index = _ast_read_table_offset(reader, 12);
+  reader->class_count = _ast_read_count(reader, &index);
+  reader->function_count = _ast_read_count(reader, &index);
+  int entity_count = reader->class_count + reader->function_count;
+  if (entity_count > reader->length - index) reader->ok = 0;
+  reader->entity_offsets = (int*) malloc(sizeof(int) * (reader->ok ? entity_count + 1 : 1));
+  for (int i = 0; i < entity_count && reader->ok; ++i) {
+    unsigned int offset = _ast_read_varint(reader, &index);
+    if (offset < AST_HEADER_SIZE || offset >= (unsigned int) length) reader->ok = 0;
+    reader->entity_offsets[i] = (int) offset;
+    list_add(reader->entities, NULL);
+  }
+
+  index = _ast_read_table_offset(reader, 20);
+  int global_count = _ast_read_count(reader, &index);
+  for (int i = 0; i < global_count && reader->ok; ++i) {
+    list_add(reader->global_names, _ast_read_string(reader, &index));
+  }
+
+  if (!reader->ok) {
+    ast_reader_close(reader);
+    return NULL;
+  }
+  return reader;
+}
+
+String* _ast_read_string(AstReader* reader, int* index) {
+  unsigned int id = _ast_read_varint(reader, index);
+  if (id >= (unsigned int) reader->string_count) {
+    reader->ok = 0;
+    return new_string("");
+  }
+  String* str = list_get_string(reader->strings, id);
+  if (str == NULL) {
+    // The table was checked when the file was opened.
+    int str_index = reader->string_offsets[id];
+    int len = _ast_read_count(reader, &str_index);
+    str = new_string_from_range((const char*) reader->data, str_index, str_index + len);
+    list_set(reader->strings, id, str);
+  }
+  return str;
+}
+
+SourceFile* _ast_read_source(AstReader* reader, int* index) {
+  unsigned int id = _ast_read_varint(reader, index);
+  if (id >= (unsigned int) reader->source_count) {
+    reader->ok = 0;
+    return new_source_file(new_string(""), NULL, NULL, 0);
+  }
+  SourceFile* source = (SourceFile*) list_get(reader->sources, id);
+  if (source == NULL) {
+    int source_index = reader->source_offsets[id];
+    String* path = _ast_read_string(reader, &source_index);
+    int line_count = _ast_read_count(reader, &source_index);
+    int* line_starts = (int*) gc_create_buffer(sizeof(int) * (line_count + 1));
+    int line_start = 0;
+    for (int i = 0; i < line_count; ++i) {
+      line_start += _ast_read_varint(reader, &source_index);
+      line_starts[i] = line_start;
+    }
+    source = new_source_file(path, NULL, line_starts, line_count);
+    list_set(reader->sources, id, source);
+  }
+  return source;
+}
+
+Token* _ast_read_token(AstReader* reader, int* index) {
+  int type = _ast_read_byte(reader, index);
+  if (type == 0) return NULL;
+  if (type - 1 > TOKEN_TYPE_KEYWORD) reader->ok = 0;
+  SourceFile* source = _ast_read_source(reader, index);
+  int offset = _ast_read_varint(reader, index);
+  String* value = _ast_read_string(reader, index);
+  return new_token(source, value, offset, (enum TokenType) (type - 1));
+}
+
+// Reads a token that the node it belongs to can't do without.
+Token* _ast_read_required_token(AstReader* reader, int* index) {
+  Token* token = _ast_read_token(reader, index);
+  if (token == NULL) reader->ok = 0;
+  return token;
+}
+
+List* _ast_read_token_list(AstReader* reader, int* index) {
+  int count = _ast_read_count(reader, index);
+  List* tokens = new_list();
+  for (int i = 0; i < count && reader->ok; ++i) {
+    list_add(tokens, _ast_read_required_token(reader, index));
+  }
+  return tokens;
+}
+
+// The kinds of node a record can refer to as a child.
+enum AstChildKind {
+  AST_CHILD_EXPRESSION,
+  AST_CHILD_STATEMENT,
+  AST_CHILD_MEMBER,
+  AST_CHILD_ASSIGNABLE,
+};
+
+int _ast_child_fits(int kind, enum AstChildKind expected) {
+  switch (expected) {
+    case AST_CHILD_EXPRESSION:
+      return kind >= NODE_KIND_NULL_CONSTANT && kind <= NODE_KIND_FUNCTION_INVOCATION;
+    case AST_CHILD_STATEMENT:
+      return kind >= NODE_KIND_ASSIGNMENT && kind <= NODE_KIND_CONTINUE;
+    case AST_CHILD_MEMBER:
+      return kind == NODE_KIND_FIELD_DEFINITION || kind == NODE_KIND_FUNCTION_DEFINITION || kind == NODE_KIND_CONSTRUCTOR_DEFINITION;
+    case AST_CHILD_ASSIGNABLE:
+      return kind == NODE_KIND_VARIABLE || kind == NODE_KIND_DOT_FIELD || kind == NODE_KIND_BRACKET_INDEX;
+  }
+  return 0;
+}
+
+Node* _ast_read_node(AstReader* reader, int offset);
+
+// Reads a reference to a child record, which must be one of the expected kind of node. It can only
+// be NULL if optional is set.
+Node* _ast_read_child(AstReader* reader, int record_start, int* index, enum AstChildKind expected, int optional) {
+  unsigned int distance = _ast_read_varint(reader, index);
+  if (distance == 0 && optional) return NULL;
+  if (!reader->ok || distance == 0 || distance > (unsigned int) (record_start - AST_HEADER_SIZE)) {
+    reader->ok = 0;
+    return NULL;
+  }
+  Node* child = _ast_read_node(reader, record_start - (int) distance);
+  if (child != NULL && !_ast_child_fits(node_kind(child), expected)) reader->ok = 0;
+  return reader->ok ? child : NULL;
+}
+
+void _ast_read_node_list(AstReader* reader, int record_start, int* index, List* output, enum AstChildKind expected, int optional) {
+  int count = _ast_read_count(reader, index);
+  for (int i = 0; i < count && reader->ok; ++i) {
+    list_add(output, _ast_read_child(reader, record_start, index, expected, optional));
+  }
+}
+
+void _ast_use_local_slot(AstReader* reader, int slot) {
+  if (!reader->in_function || slot < 0) {
+    reader->ok = 0;
+  } else if (slot >= reader->local_slot_end) {
+    reader->local_slot_end = slot + 1;
+  }
+}
+
+void _ast_use_field_slot(AstReader* reader, int slot) {
+  if (!reader->in_class || slot < 0) {
+    reader->ok = 0;
+  } else if (slot >= reader->field_slot_end) {
+    reader->field_slot_end = slot + 1;
+  }
+}
+
+void _ast_check_variable(AstReader* reader, int scope, int index) {
+  switch (scope) {
+    case VARIABLE_SCOPE_LOCAL:
+      _ast_use_local_slot(reader, index);
+      break;
+    case VARIABLE_SCOPE_FUNCTION:
+      if (index < 0 || index >= reader->function_count) reader->ok = 0;
+      break;
+    case VARIABLE_SCOPE_CLASS:
+      if (index < 0 || index >= reader->class_count) reader->ok = 0;
+      break;
+    case VARIABLE_SCOPE_GLOBAL:
+      if (index < 0 || index >= reader->global_names->length) reader->ok = 0;
+      break;
+    default:
+      reader->ok = 0;
+      break;
+  }
+}
+
+int _ast_is_one_of(String* op, const char** ops) {
+  for (int i = 0; ops[i] != NULL; ++i) {
+    if (string_equals_chars(op, ops[i])) return 1;
+  }
+  return 0;
+}
+
+// The operators the parser accepts.
+int _ast_is_binary_op(String* op) {
+  static const char* ops[] = { "||", "&&", "|", "^", "&", "==", "!=", "<", ">", "<=", ">=", "<<", ">>", "+", "-", "*", "/", "%", NULL };
+  return _ast_is_one_of(op, ops);
+}
+
+int _ast_is_assignment_op(String* op) {
+  static const char* ops[] = { "=", "+=", "-=", "*=", "/=", "&=", "|=", "^=", "**=", ">>=", "<<=", NULL };
+  return _ast_is_one_of(op, ops);
+}
+
+int _ast_is_logical_op(String* op) {
+  return string_equals_chars(op, "&&") || string_equals_chars(op, "||");
+}
+
+// Whether a node is a value the bytecode can have as a constant, which is what a constant dictionary holds.
+int _ast_is_constant_value(Node* node) {
+  switch (node_kind(node)) {
+    case NODE_KIND_NULL_CONSTANT:
+    case NODE_KIND_BOOLEAN_CONSTANT:
+    case NODE_KIND_INTEGER_CONSTANT:
+    case NODE_KIND_STRING_CONSTANT:
+      return 1;
+    case NODE_KIND_INLINE_DICTIONARY:
+      return ((InlineDictionary*) node)->is_constant;
+    default:
+      return 0;
+  }
+}
+
+// Reads the arguments, code and slot count of a function or constructor record into the node.
+void _ast_read_callable(AstReader* reader, int offset, int* index, List* arg_tokens, List* arg_default_values, List* code, int* local_count) {
+  int was_in_function = reader->in_function;
+  int outer_loop_depth = reader->loop_depth;
+  int outer_local_slot_end = reader->local_slot_end;
+  reader->in_function = 1;
+  reader->loop_depth = 0;
+  // A method has this in slot 0, before the arguments.
+  reader->local_slot_end = arg_tokens->length + (reader->in_class ? 1 : 0);
+  _ast_read_node_list(reader, offset, index, arg_default_values, AST_CHILD_EXPRESSION, 1);
+  _ast_read_node_list(reader, offset, index, code, AST_CHILD_STATEMENT, 0);
+  *local_count = _ast_read_count(reader, index);
+  if (arg_default_values->length != arg_tokens->length || *local_count < reader->local_slot_end) reader->ok = 0;
+  reader->in_function = was_in_function;
+  reader->loop_depth = outer_loop_depth;
+  reader->local_slot_end = outer_local_slot_end;
+}
+
+void _ast_read_loop_body(AstReader* reader, int offset, int* index, List* code) {
+  reader->loop_depth++;
+  _ast_read_node_list(reader, offset, index, code, AST_CHILD_STATEMENT, 0);
+  reader->loop_depth--;
+}
+
+// Decodes the record at offset. Returns NULL and clears ok if it is malformed.
+Node* _ast_decode_record(AstReader* reader, int offset) {
+  int index = offset;
+  enum AstRecordKind kind = (enum AstRecordKind) _ast_read_byte(reader, &index);
+  Token* first_token = _ast_read_required_token(reader, &index);
+  if (!reader->ok) return NULL;
+
+  Node* node = NULL;
+  switch (kind) {
+    case AST_RECORD_CLASS_DEFINITION:
+      {
+        Token* class_name = _ast_read_required_token(reader, &index);
+        Token* base_class_token = _ast_read_token(reader, &index);
+        if (!reader->ok) return NULL;
+        ClassDefinition* cd = new_class_definition(first_token, class_name);
+        cd->base_class_token = base_class_token;
+        int was_in_class = reader->in_class;
+        int outer_field_slot_end = reader->field_slot_end;
+        reader->in_class = 1;
+        reader->field_slot_end = 0;
+        int member_count = _ast_read_count(reader, &index);
+        for (int i = 0; i < member_count && reader->ok; ++i) {
+          String* member_name = _ast_read_string(reader, &index);
+          dictionary_set(cd->members, member_name, _ast_read_child(reader, offset, &index, AST_CHILD_MEMBER, 0));
+          list_add(cd->member_order, member_name);
+        }
+        cd->field_count = _ast_read_signed_varint(reader, &index);
+        if (cd->field_count < reader->field_slot_end) reader->ok = 0;
+        reader->in_class = was_in_class;
+        reader->field_slot_end = outer_field_slot_end;
+        node = (Node*) cd;
+      }
+      break;
+
+    case AST_RECORD_FUNCTION_DEFINITION:
+      {
+        Token* function_name = _ast_read_required_token(reader, &index);
+        if (!reader->ok) return NULL;
+        FunctionDefinition* fd = new_function_definition(first_token, function_name);
+        fd->arg_tokens = _ast_read_token_list(reader, &index);
+        _ast_read_callable(reader, offset, &index, fd->arg_tokens, fd->arg_default_values, fd->code, &fd->local_count);
+        node = (Node*) fd;
+      }
+      break;
+
+    case AST_RECORD_CONSTRUCTOR_DEFINITION:
+      {
+        if (!reader->in_class) return NULL;
+        ConstructorDefinition* cd = new_constructor_definition(first_token);
+        cd->arg_tokens = _ast_read_token_list(reader, &index);
+        _ast_read_callable(reader, offset, &index, cd->arg_tokens, cd->arg_default_values, cd->code, &cd->local_count);
+        node = (Node*) cd;
+      }
+      break;
+
+    case AST_RECORD_FIELD_DEFINITION:
+      {
+        Token* field_name = _ast_read_required_token(reader, &index);
+        Node* default_value = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 1);
+        int field_index = _ast_read_signed_varint(reader, &index);
+        _ast_use_field_slot(reader, field_index);
+        if (!reader->ok) return NULL;
+        FieldDefinition* fd = new_field_definition(first_token, field_name, default_value);
+        fd->index = field_index;
+        node = (Node*) fd;
+      }
+      break;
+
+    case AST_RECORD_ASSIGNMENT:
+      {
+        Token* op = _ast_read_required_token(reader, &index);
+        Node* target = _ast_read_child(reader, offset, &index, AST_CHILD_ASSIGNABLE, 0);
+        Node* value = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        if (!reader->ok || !_ast_is_assignment_op(op->value)) return NULL;
+        node = (Node*) new_assignment(target, op, value);
+      }
+      break;
+
+    case AST_RECORD_IF_STATEMENT:
+      {
+        Node* condition = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        List* true_code = new_list();
+        List* false_code = new_list();
+        _ast_read_node_list(reader, offset, &index, true_code, AST_CHILD_STATEMENT, 0);
+        _ast_read_node_list(reader, offset, &index, false_code, AST_CHILD_STATEMENT, 0);
+        node = (Node*) new_if_statement(first_token, condition, true_code, false_code);
+      }
+      break;
+
+    case AST_RECORD_FOR_LOOP:
+      {
+        List* inits = new_list();
+        List* steps = new_list();
+        List* code = new_list();
+        _ast_read_node_list(reader, offset, &index, inits, AST_CHILD_STATEMENT, 0);
+        Node* condition = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 1);
+        _ast_read_node_list(reader, offset, &index, steps, AST_CHILD_STATEMENT, 0);
+        _ast_read_loop_body(reader, offset, &index, code);
+        node = (Node*) new_for_loop(first_token, inits, condition, steps, code);
+      }
+      break;
+
+    case AST_RECORD_FOR_EACH_LOOP:
+      {
+        Token* variable = _ast_read_required_token(reader, &index);
+        int variable_index = _ast_read_signed_varint(reader, &index);
+        _ast_use_local_slot(reader, variable_index);
+        Node* list_expr = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        List* code = new_list();
+        _ast_read_loop_body(reader, offset, &index, code);
+        ForEachLoop* fel = new_for_each_loop(first_token, variable, list_expr, code);
+        fel->variable_index = variable_index;
+        node = (Node*) fel;
+      }
+      break;
+
+    case AST_RECORD_EXPR_EXEC:
+      {
+        Node* expression = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        if (!reader->ok) return NULL;
+        node = (Node*) new_expression_as_executable(expression);
+      }
+      break;
+
+    case AST_RECORD_WHILE_LOOP:
+      {
+        Node* condition = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        List* code = new_list();
+        _ast_read_loop_body(reader, offset, &index, code);
+        node = (Node*) new_while_loop(first_token, condition, code);
+      }
+      break;
+
+    case AST_RECORD_RETURN:
+      node = (Node*) new_return_statement(first_token, _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 1));
+      break;
+
+    case AST_RECORD_BREAK:
+    case AST_RECORD_CONTINUE:
+      if (reader->loop_depth == 0) return NULL;
+      node = (Node*) new_loop_jump(first_token, kind == AST_RECORD_BREAK);
+      break;
+
+    case AST_RECORD_NULL_CONSTANT:
+      node = (Node*) new_null_constant(first_token);
+      break;
+
+    case AST_RECORD_BOOLEAN_CONSTANT:
+      node = (Node*) new_boolean_constant(first_token, _ast_read_byte(reader, &index) != 0);
+      break;
+
+    case AST_RECORD_INTEGER_CONSTANT:
+      node = (Node*) new_integer_constant(first_token, _ast_read_signed_varint(reader, &index));
+      break;
+
+    case AST_RECORD_STRING_CONSTANT:
+      node = (Node*) new_string_constant(first_token, _ast_read_string(reader, &index));
+      break;
+
+    case AST_RECORD_VARIABLE:
+      {
+        Variable* v = new_variable(first_token, _ast_read_string(reader, &index));
+        v->scope = _ast_read_byte(reader, &index);
+        v->index = _ast_read_signed_varint(reader, &index);
+        _ast_check_variable(reader, v->scope, v->index);
+        node = (Node*) v;
+      }
+      break;
+
+    case AST_RECORD_INLINE_DICTIONARY:
+      {
+        int is_constant = _ast_read_byte(reader, &index);
+        List* keys = new_list();
+        List* values = new_list();
+        _ast_read_node_list(reader, offset, &index, keys, AST_CHILD_EXPRESSION, 0);
+        _ast_read_node_list(reader, offset, &index, values, AST_CHILD_EXPRESSION, 0);
+        if (!reader->ok || keys->length != values->length) return NULL;
+        for (int i = 0; i < keys->length && is_constant; ++i) {
+          if (node_kind((Node*) list_get(keys, i)) != NODE_KIND_STRING_CONSTANT || !_ast_is_constant_value((Node*) list_get(values, i))) return NULL;
+        }
+        InlineDictionary* dict = new_inline_dictionary(first_token, keys, values);
+        dict->is_constant = is_constant;
+        node = (Node*) dict;
+      }
+      break;
+
+    case AST_RECORD_DOT_FIELD:
+      {
+        Token* dot_token = _ast_read_required_token(reader, &index);
+        Token* field_token = _ast_read_required_token(reader, &index);
+        Node* root = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        int field_index = _ast_read_signed_varint(reader, &index);
+        if (!reader->ok) return NULL;
+        // A field is only read by its slot on this, which the interpreter doesn't check.
+        if (field_index != -1) {
+          Variable* v = (Variable*) root;
+          if (!reader->in_function || node_kind(root) != NODE_KIND_VARIABLE || v->scope != VARIABLE_SCOPE_LOCAL || v->index != 0 ||
+              !string_equals_chars(v->name, "this")) {
+            return NULL;
+          }
+          _ast_use_field_slot(reader, field_index);
+        }
+        DotField* df = new_dot_field(root, dot_token, field_token);
+        df->field_index = field_index;
+        node = (Node*) df;
+      }
+      break;
+
+    case AST_RECORD_BRACKET_INDEX:
+      {
+        Token* bracket_token = _ast_read_required_token(reader, &index);
+        Node* root = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        Node* index_expr = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        if (!reader->ok) return NULL;
+        node = (Node*) new_bracket_index(root, bracket_token, index_expr);
+      }
+      break;
+
+    case AST_RECORD_OP_CHAIN:
+      {
+        List* ops = _ast_read_token_list(reader, &index);
+        List* expressions = new_list();
+        _ast_read_node_list(reader, offset, &index, expressions, AST_CHILD_EXPRESSION, 0);
+        if (!reader->ok || ops->length == 0 || expressions->length != ops->length + 1) return NULL;
+        // && and || chains are lowered to jumps as a whole, so they can't be mixed with anything else.
+        String* first_op = ((Token*) list_get(ops, 0))->value;
+        for (int i = 0; i < ops->length; ++i) {
+          String* op = ((Token*) list_get(ops, i))->value;
+          if (!_ast_is_binary_op(op) || (_ast_is_logical_op(first_op) ? !string_equals(op, first_op) : _ast_is_logical_op(op))) return NULL;
+        }
+        node = (Node*) new_op_chain(expressions, ops);
+      }
+      break;
+
+    case AST_RECORD_TERNARY:
+      {
+        Token* question_mark = _ast_read_required_token(reader, &index);
+        Node* condition = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        Node* true_expr = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        Node* false_expr = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        if (!reader->ok) return NULL;
+        node = (Node*) new_ternary(condition, question_mark, true_expr, false_expr);
+      }
+      break;
+
+    case AST_RECORD_FUNCTION_INVOCATION:
+      {
+        Token* open_paren = _ast_read_required_token(reader, &index);
+        Node* root = _ast_read_child(reader, offset, &index, AST_CHILD_EXPRESSION, 0);
+        List* args = new_list();
+        _ast_read_node_list(reader, offset, &index, args, AST_CHILD_EXPRESSION, 0);
+        if (!reader->ok) return NULL;
+        node = (Node*) new_function_invocation(root, open_paren, args);
+      }
+      break;
+  }
+
+  if (node == NULL || !reader->ok) return NULL;
+  // Constructors like new_op_chain take the first token of a child, which isn't always the one the
+  // node had, for example once the folder has replaced the child.
+  node->first_token = first_token;
+  return node;
+}
+
+Node* _ast_read_node(AstReader* reader, int offset) {
+  // Each record is referred to once, so a malformed file can't make a record its own ancestor or
+  // have a record decoded over and over.
+  if (!reader->ok || reader->claimed[offset] || reader->depth >= AST_MAX_NESTING) {
+    reader->ok = 0;
+    return NULL;
+  }
+  reader->claimed[offset] = 1;
+  reader->depth++;
+  Node* node = _ast_decode_record(reader, offset);
+  reader->depth--;
+  if (node == NULL) reader->ok = 0;
+  return node;
+}
+
+Node* _ast_reader_get_entity(AstReader* reader, int entity_index, int expected_kind) {
+  if (!reader->ok) return NULL;
+  Node* entity = (Node*) list_get(reader->entities, entity_index);
+  if (entity == NULL) {
+    entity = _ast_read_node(reader, reader->entity_offsets[entity_index]);
+    if (entity != NULL && node_kind(entity) != expected_kind) reader->ok = 0;
+    if (!reader->ok) return NULL;
+    list_set(reader->entities, entity_index, entity);
+  }
+  return entity;
+}
+
+// Returns NULL if the class's record is malformed.
+ClassDefinition* ast_reader_get_class(AstReader* reader, int index) {
+  ClassDefinition* cd = (ClassDefinition*) _ast_reader_get_entity(reader, index, NODE_KIND_CLASS_DEFINITION);
+  if (cd != NULL) cd->index = index;
+  return cd;
+}
+
+// Returns NULL if the function's record is malformed.
+FunctionDefinition* ast_reader_get_function(AstReader* reader, int index) {
+  FunctionDefinition* fd = (FunctionDefinition*) _ast_reader_get_entity(reader, reader->class_count + index, NODE_KIND_FUNCTION_DEFINITION);
+  if (fd != NULL) fd->index = index;
+  return fd;
+}
+
+// Whether a class's fields, and those of its base classes, fill its field slots exactly once each.
+int _ast_class_fields_fit(ClassDefinition* cd) {
+  char* filled = (char*) malloc_clean(cd->field_count + 1);
+  int ok = 1;
+  for (ClassDefinition* walker = cd; walker != NULL && ok; walker = walker->base_class_definition) {
+    if (walker->field_count > cd->field_count) ok = 0;
+    for (int i = 0; i < walker->member_order->length && ok; ++i) {
+      Node* member = (Node*) dictionary_get(walker->members, list_get_string(walker->member_order, i));
+      if (node_kind(member) != NODE_KIND_FIELD_DEFINITION) continue;
+      int slot = ((FieldDefinition*) member)->index;
+      if (slot >= cd->field_count || filled[slot]) ok = 0;
+      else filled[slot] = 1;
+    }
+  }
+  for (int i = 0; i < cd->field_count && ok; ++i) {
+    if (!filled[i]) ok = 0;
+  }
+  free(filled);
+  return ok;
+}
+
+/*
+  Materializes every entity in the file and appends them to the context's definition lists. Base
+  classes are linked up by name, as the resolver did. Returns 0 and leaves the context as it was if
+  the file is malformed.
+*/
+int ast_reader_load_into(AstReader* reader, CompilerContext* ctx) {
+  Dictionary* classes_by_name = new_dictionary();
+  for (int i = 0; i < reader->class_count; ++i) {
+    ClassDefinition* cd = ast_reader_get_class(reader, i);
+    if (cd == NULL) return 0;
+    dictionary_set(classes_by_name, cd->class_name->value, cd);
+  }
+  for (int i = 0; i < reader->class_count; ++i) {
+    ClassDefinition* cd = ast_reader_get_class(reader, i);
+    if (cd->base_class_token == NULL) continue;
+    cd->base_class_definition = (ClassDefinition*) dictionary_get(classes_by_name, cd->base_class_token->value);
+    if (cd->base_class_definition == NULL) return 0;
+  }
+  for (int i = 0; i < reader->class_count; ++i) {
+    // Everything after the resolver follows base classes up to the root, so there can't be a cycle.
+    ClassDefinition* walker = ast_reader_get_class(reader, i);
+    for (int depth = 0; walker != NULL; ++depth) {
+      if (depth > reader->class_count) return 0;
+      walker = walker->base_class_definition;
+    }
+    if (!_ast_class_fields_fit(ast_reader_get_class(reader, i))) return 0;
+  }
+  for (int i = 0; i < reader->function_count; ++i) {
+    if (ast_reader_get_function(reader, i) == NULL) return 0;
+  }
+
+  for (int i = 0; i < reader->class_count; ++i) {
+    list_add(ctx->class_definitions, ast_reader_get_class(reader, i));
+  }
+  for (int i = 0; i < reader->function_count; ++i) {
+    list_add(ctx->function_definitions, ast_reader_get_function(reader, i));
+  }
+  list_push_all(ctx->global_names, reader->global_names);
+  return 1;
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef _WAX_SESSION_H
+#define _WAX_SESSION_H
+
+#include "../util/dictionaries.h"
+#include "../util/fileio.h"
+#include "../util/gcbase.h"
+#include "../util/gc.h"
+#include "../util/lists.h"
+#include "../util/profiler.h"
+#include "../util/strings.h"
+#include "compiler.h"
+#include "compilercontext.h"
+#include "manifest.h"
+
+/*
+  A compile session keeps the manifest and the tokens and parse tree of every source file resident
+  between compiles, so a long running process (--watch or --serve) only has to tokenize and parse the
+  files whose content changed. The whole module is still resolved every time since a change in one
+  file can break references in another.
+
+  Cached parse trees get resolved again on every compile, so resolution must leave an already
+  resolved tree as it was. A resolver error can leave a tree half resolved, so when resolution fails
+  the files of that module are parsed again from their cached tokens next time.
+*/
+
+#define CACHED_FILE_GC_FIELD_COUNT 2
+#define CACHED_FILE_NAME "CachedFile"
+typedef struct _CachedFile {
+  String* content;
+  CompilerContext* parse_result; // tokens, definitions and parse errors of this file alone
+  int needs_reparse;
+} CachedFile;
+
+CachedFile* new_cached_file(String* content, CompilerContext* parse_result) {
+  CachedFile* file = (CachedFile*) gc_create_struct(sizeof(CachedFile), CACHED_FILE_NAME, CACHED_FILE_GC_FIELD_COUNT);
+  file->content = content;
+  file->parse_result = parse_result;
+  file->needs_reparse = 0;
+  return file;
+}
+
+#define COMPILE_SESSION_GC_FIELD_COUNT 3
+#define COMPILE_SESSION_NAME "CompileSession"
+typedef struct _CompileSession {
+  ProjectManifest* manifest;
+  List* file_caches; // per module, a Dictionary of full file path -> CachedFile
+  List* reports; // per module, the String report of the last compile or NULL if there hasn't been one
+  CompileOptions options;
+} CompileSession;
+
+CompileSession* new_compile_session(ProjectManifest* manifest, CompileOptions* options) {
+  CompileSession* session = (CompileSession*) gc_create_struct(sizeof(CompileSession), COMPILE_SESSION_NAME, COMPILE_SESSION_GC_FIELD_COUNT);
+  session->manifest = manifest;
+  session->file_caches = new_list();
+  session->reports = new_list();
+  session->options = *options;
+  for (int i = 0; i < manifest->modules->length; ++i) {
+    list_add(session->file_caches, new_dictionary());
+    list_add(session->reports, NULL);
+  }
+  return session;
+}
+
+// Brings the report of one Wax module up to date. Returns 1 if anything had to be compiled.
+int _compile_session_update_module(CompileSession* session, int module_index) {
+  ModuleMetadata* module = (ModuleMetadata*) list_get(session->manifest->modules, module_index);
+  Dictionary* old_cache = (Dictionary*) list_get(session->file_caches, module_index);
+
+  Dictionary* src_files = wax_compiler_get_files(module->src->cstring);
+  List* paths = src_files == NULL ? new_list() : dictionary_get_values(src_files);
+  gc_save_item(paths);
+  List* contents = new_list();
+  gc_save_item(contents);
+
+  int changed = list_get(session->reports, module_index) == NULL;
+  List* dirty_paths = new_list();
+  gc_save_item(dirty_paths);
+  List* dirty_contents = new_list();
+  gc_save_item(dirty_contents);
+  List* dirty_tokens = new_list();
+  gc_save_item(dirty_tokens);
+  for (int i = 0; i < paths->length; ++i) {
+    String* path = list_get_string(paths, i);
+    int span = profiler_begin("file_read_text", path->cstring);
+    String* content = file_read_text(path->cstring);
+    profiler_end(span);
+    if (content == NULL) content = new_string(""); // deleted since the directory was listed
+    list_add(contents, content);
+    CachedFile* cached = (CachedFile*) dictionary_get(old_cache, path);
+    if (cached == NULL || !string_equals(cached->content, content)) {
+      list_add(dirty_paths, path);
+      list_add(dirty_contents, content);
+      list_add(dirty_tokens, NULL);
+    } else if (cached->needs_reparse) {
+      list_add(dirty_paths, path);
+      list_add(dirty_contents, content);
+      list_add(dirty_tokens, cached->parse_result->tokens);
+    }
+  }
+  // Every current file was found in the old cache, so a size difference means files were removed.
+  if (dirty_paths->length > 0 || paths->length != old_cache->size) changed = 1;
+
+  if (changed) {
+    int module_span = profiler_begin("wax_compile", module->name->cstring);
+    CompilerContext** parsed = wax_compiler_parse_files(
+      dirty_paths, dirty_contents, (TokenStream**) dirty_tokens->items, 1, session->options.jobs);
+
+    Dictionary* new_cache = new_dictionary();
+    list_set(session->file_caches, module_index, new_cache);
+    CompilerContext* ctx = new_compiler_context();
+    gc_save_item(ctx);
+    int dirty_index = 0;
+    for (int i = 0; i < paths->length; ++i) {
+      String* path = list_get_string(paths, i);
+      CachedFile* cached = (CachedFile*) dictionary_get(old_cache, path);
+      if (dirty_index < dirty_paths->length && list_get(dirty_paths, dirty_index) == path) {
+        cached = new_cached_file(list_get_string(contents, i), parsed[dirty_index]);
+        gc_release_item(parsed[dirty_index]);
+        ++dirty_index;
+      }
+      dictionary_set(new_cache, path, cached);
+      wax_compiler_merge_file_context(ctx, cached->parse_result);
+    }
+    free(parsed);
+
+    // A cached file that was parsed again or removed takes its tokens and nodes with it.
+    for (int i = 0; i < old_cache->size; ++i) {
+      CachedFile* cached = (CachedFile*) old_cache->values[i];
+      if (dictionary_get(new_cache, old_cache->keys[i]) != cached) {
+        compiler_context_free_arena(cached->parse_result);
+      }
+    }
+
+    StringBuilder* report = new_string_builder();
+    wax_compiler_append_module_intro(report, module);
+    if (paths->length == 0) {
+      string_builder_append_chars(report, "Module is empty!\n");
+    } else {
+      int parsed_ok = ctx->error_messages->length == 0;
+      if (!wax_compiler_finish_module(ctx, module, &session->options, report) && parsed_ok) {
+        for (int i = 0; i < paths->length; ++i) {
+          ((CachedFile*) dictionary_get(new_cache, list_get_string(paths, i)))->needs_reparse = 1;
+        }
+      }
+    }
+    string_builder_append_char(report, '\n');
+    list_set(session->reports, module_index, string_builder_to_string_and_free(report));
+    gc_release_item(ctx);
+    profiler_end(module_span);
+  }
+
+  gc_release_item(paths);
+  gc_release_item(contents);
+  gc_release_item(dirty_paths);
+  gc_release_item(dirty_contents);
+  gc_release_item(dirty_tokens);
+  // A pass walks every resident object, so only pay for one when there is new garbage of note.
+  if (changed) gc_perform_pass();
+  return changed;
+}
+
+/*
+  Recompiles whatever changed since the last call and appends the report of every module to output,
+  in manifest order. Returns the number of modules that had to be compiled again. Modules are
+  compiled one at a time here and the options' jobs are all used for parsing the changed files.
+*/
+int compile_session_update(CompileSession* session, StringBuilder* output) {
+  int span = profiler_begin("compile_session_update", NULL);
+  int rebuilt = 0;
+  for (int i = 0; i < session->manifest->modules->length; ++i) {
+    ModuleMetadata* module = (ModuleMetadata*) list_get(session->manifest->modules, i);
+    if (module->lang == LANG_WAX) {
+      rebuilt += _compile_session_update_module(session, i);
+    } else if (list_get(session->reports, i) == NULL) {
+      StringBuilder* report = new_string_builder();
+      wax_compiler_append_foreign_module(report, module);
+      list_set(session->reports, i, string_builder_to_string_and_free(report));
+      ++rebuilt;
+    }
+    string_builder_append_chars(output, list_get_string(session->reports, i)->cstring);
+  }
+  profiler_end(span);
+  return rebuilt;
+}
+
+#endif
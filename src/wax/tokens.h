@@ -1,6 +1,8 @@
 #ifndef _WAX_TOKENS_H
 #define _WAX_TOKENS_H
 
+#include "../util/arena.h"
+#include "../util/scan.h"
 #include "../util/strings.h"
 #include "../util/lists.h"
 #include "../util/valueutil.h"
@@ -14,187 +16,604 @@ enum TokenType {
   TOKEN_TYPE_KEYWORD
 };
 
+/*
+  A tokenized file. Tokens only store their byte offset into the file, and the line and column are
+  looked up in line_starts when they are actually needed, which is only for error messages.
+  line_starts holds the offset of the first character of each line and is filled in by the tokenizer
+  (or the AST reader) since it has to look at every newline anyway. content is NULL for files that
+  were loaded from a serialized AST.
+*/
+#define SOURCE_FILE_GC_FIELD_COUNT 3
+#define SOURCE_FILE_NAME "SourceFile"
+typedef struct _SourceFile {
+  String* path;
+  String* content;
+  int* line_starts; // gc_create_buffer'd
+  int line_count;
+} SourceFile;
+
+SourceFile* new_source_file(String* path, String* content, int* line_starts, int line_count) {
+  SourceFile* source = (SourceFile*) gc_create_struct(sizeof(SourceFile), SOURCE_FILE_NAME, SOURCE_FILE_GC_FIELD_COUNT);
+  source->path = path;
+  source->content = content;
+  source->line_starts = line_starts;
+  source->line_count = line_count;
+  return source;
+}
+
+// Returns the 1-based line that contains the byte at offset.
+int source_file_get_line(SourceFile* source, int offset) {
+  int low = 0;
+  int high = source->line_count - 1;
+  while (low < high) {
+    int mid = (low + high + 1) / 2;
+    if (source->line_starts[mid] <= offset) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return low + 1;
+}
+
+// Returns the 1-based column of the byte at offset.
+int source_file_get_col(SourceFile* source, int offset) {
+  if (source->line_count == 0) return offset + 1;
+  return offset - source->line_starts[source_file_get_line(source, offset) - 1] + 1;
+}
+
 #define TOKEN_GC_FIELD_COUNT 2
 #define TOKEN_NAME "Token"
 typedef struct _Token {
-  String* file;
+  SourceFile* source;
   String* value;
-  int line;
-  int col;
+  int offset;
   enum TokenType type;
 } Token;
 
-Token* new_token(String* file, String* value, int line, int col, enum TokenType type) {
-  Token* token = (Token*) gc_create_struct(sizeof(Token), TOKEN_NAME, TOKEN_GC_FIELD_COUNT);
-  token->file = file;
+// Tokens are created in the current arena if there is one, since the parser creates one per token.
+Token* new_token(SourceFile* source, String* value, int offset, enum TokenType type) {
+  Token* token = (Token*) arena_create_struct(sizeof(Token), TOKEN_NAME, TOKEN_GC_FIELD_COUNT);
+  token->source = source;
   token->value = value;
-  token->line = line;
-  token->col = col;
+  token->offset = offset;
   token->type = type;
   return token;
 }
 
+int token_get_line(Token* token) {
+  return source_file_get_line(token->source, token->offset);
+}
+
+int token_get_col(Token* token) {
+  return source_file_get_col(token->source, token->offset);
+}
+
 int token_is_name(Token* token) {
   return token->type == TOKEN_TYPE_WORD;
 }
 
-#define TOKEN_STREAM_GC_FIELD_COUNT 4
+// The tokenizer is table driven. Every byte is mapped to a character class, and punctuation is matched
+// by walking a small DFA over the operator set so the longest operator wins. Every prefix of an
+// operator is an operator itself, so the DFA can stop at the first missing transition. Keywords and
+// operators are interned once, so recognizing them does not allocate. Whitespace runs, comments and
+// string literals are skipped with the vectorized helpers in scan.h. The tables are built on first
+// use, which wax_compiler_prime_static_caches() does before any worker threads start.
+
+#define TOKENIZER_CLASS_END 0
+#define TOKENIZER_CLASS_SPACE 1
+#define TOKENIZER_CLASS_NEWLINE 2
+#define TOKENIZER_CLASS_WORD 3
+#define TOKENIZER_CLASS_DIGIT 4
+#define TOKENIZER_CLASS_QUOTE 5
+#define TOKENIZER_CLASS_SLASH 6
+#define TOKENIZER_CLASS_PUNC 7
+#define TOKENIZER_CLASS_OTHER 8
+
+#define TOKENIZER_KEYWORDS "if else function for while do try catch except class constructor field return continue break switch case default"
+#define TOKENIZER_OPERATORS "++ -- << >> || && == != <= >= => += -= *= /= &= |= ^= ** ?? **= <<= >>="
+#define TOKENIZER_MAX_OP_STATES 96
+#define TOKENIZER_MAX_SHARED_SYMBOLS 128
+#define TOKENIZER_KEYWORD_SLOTS 64
+
+/*
+  Symbol ids below shared_symbol_count are the operators and keywords and mean the same thing in every
+  token stream. Higher ids are local to one stream and index its symbols list.
+*/
+typedef struct _TokenizerTables {
+  unsigned char char_class[256];
+  unsigned char op_next[TOKENIZER_MAX_OP_STATES][128]; // 0 means no transition, state 0 is the start state
+  short op_symbol[TOKENIZER_MAX_OP_STATES]; // the symbol accepted in each state
+  int op_state_count;
+  short keywords[TOKENIZER_KEYWORD_SLOTS]; // symbol ids by hash with open addressing, -1 for an empty slot
+  String* shared_symbols[TOKENIZER_MAX_SHARED_SYMBOLS];
+  int shared_symbol_count;
+} TokenizerTables;
+
+int _tokenizer_add_shared_symbol(TokenizerTables* tables, const char* value) {
+  tables->shared_symbols[tables->shared_symbol_count] = new_common_string(value);
+  return tables->shared_symbol_count++;
+}
+
+void _tokenizer_add_operator(TokenizerTables* tables, const char* op) {
+  int state = 0;
+  for (int i = 0; op[i] != '\0'; ++i) {
+    int c = op[i];
+    if (tables->op_next[state][c] == 0) {
+      tables->op_next[state][c] = (unsigned char) tables->op_state_count++;
+    }
+    state = tables->op_next[state][c];
+  }
+  tables->op_symbol[state] = (short) _tokenizer_add_shared_symbol(tables, op);
+}
+
+TokenizerTables* _tokenizer_get_tables() {
+  static TokenizerTables* tables = NULL;
+  if (tables != NULL) return tables;
+
+  TokenizerTables* t = (TokenizerTables*) malloc_clean(sizeof(TokenizerTables));
+  for (int c = 1; c < 256; ++c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+      t->char_class[c] = TOKENIZER_CLASS_WORD;
+    } else if (c >= '0' && c <= '9') {
+      t->char_class[c] = TOKENIZER_CLASS_DIGIT;
+    } else if (c == ' ' || c == '\t' || c == '\r') {
+      t->char_class[c] = TOKENIZER_CLASS_SPACE;
+    } else if (c == '\n') {
+      t->char_class[c] = TOKENIZER_CLASS_NEWLINE;
+    } else if (c == '"' || c == '\'') {
+      t->char_class[c] = TOKENIZER_CLASS_QUOTE;
+    } else if (c == '/') {
+      t->char_class[c] = TOKENIZER_CLASS_SLASH;
+    } else if (c < 128) {
+      t->char_class[c] = TOKENIZER_CLASS_PUNC;
+    } else {
+      t->char_class[c] = TOKENIZER_CLASS_OTHER;
+    }
+  }
+
+  // Every single ASCII punctuation character is a token on its own, so the operators extend those states.
+  t->op_state_count = 1;
+  char single[2];
+  single[1] = '\0';
+  for (int c = 1; c < 128; ++c) {
+    int cc = t->char_class[c];
+    if (cc == TOKENIZER_CLASS_PUNC || cc == TOKENIZER_CLASS_SLASH) {
+      single[0] = (char) c;
+      _tokenizer_add_operator(t, single);
+    }
+  }
+  List* ops = string_split(TOKENIZER_OPERATORS, " ");
+  for (int i = 0; i < ops->length; ++i) {
+    _tokenizer_add_operator(t, list_get_string(ops, i)->cstring);
+  }
+
+  for (int i = 0; i < TOKENIZER_KEYWORD_SLOTS; ++i) t->keywords[i] = -1;
+  List* keywords = string_split(TOKENIZER_KEYWORDS, " ");
+  for (int i = 0; i < keywords->length; ++i) {
+    int id = _tokenizer_add_shared_symbol(t, list_get_string(keywords, i)->cstring);
+    int slot = t->shared_symbols[id]->hash & (TOKENIZER_KEYWORD_SLOTS - 1);
+    while (t->keywords[slot] != -1) slot = (slot + 1) & (TOKENIZER_KEYWORD_SLOTS - 1);
+    t->keywords[slot] = (short) id;
+  }
+
+  tables = t;
+  return tables;
+}
+
+// Returns the symbol id of the keyword or -1 if the word is not a keyword.
+int _tokenizer_find_keyword(TokenizerTables* tables, const char* chars, int length, int hash) {
+  int slot = hash & (TOKENIZER_KEYWORD_SLOTS - 1);
+  int id;
+  while ((id = tables->keywords[slot]) != -1) {
+    String* keyword = tables->shared_symbols[id];
+    if (keyword->hash == hash && keyword->length == length && memcmp(keyword->cstring, chars, length) == 0) {
+      return id;
+    }
+    slot = (slot + 1) & (TOKENIZER_KEYWORD_SLOTS - 1);
+  }
+  return -1;
+}
+
+// Returns the shared symbol id of an operator or keyword, or -1 if value is neither.
+int tokenizer_find_shared_symbol(const char* value) {
+  TokenizerTables* tables = _tokenizer_get_tables();
+  for (int id = 0; id < tables->shared_symbol_count; ++id) {
+    if (strcmp(tables->shared_symbols[id]->cstring, value) == 0) return id;
+  }
+  return -1;
+}
+
+/*
+  The tokens of a file, stored as parallel arrays: the type, the byte offset in the source file and the
+  symbol id of each token. The spelling of a token is looked up through its symbol id, so identical
+  tokens share one String and comparing two tokens' spelling only needs their ids. Token structs are
+  only created for the tokens that the parser keeps in the AST (see token_stream_get_token).
+
+  A stream from tokenize holds every token of the file. A stream from tokenize_incremental only
+  scans ahead as far as the parser has looked, and keeps the most recent TOKEN_STREAM_WINDOW tokens in
+  ring buffers, so its memory does not grow with the size of the file. Either way, tokens must only
+  be read through token_stream_has first, which scans up to the requested index.
+*/
+#define TOKEN_STREAM_GC_FIELD_COUNT 8
 #define TOKEN_STREAM_NAME "TokenStream"
+#define TOKEN_STREAM_WINDOW 16
+
+struct _TokenizerState;
 
 typedef struct _TokenStream {
-  List* tokens;
+  List* symbols; // String for each local symbol id, starting at the shared symbol count
+  SourceFile* source;
   String* filename;
   String* error;
   Token* error_token;
+  unsigned char* types; // gc_create_buffer'd, enum TokenType per token
+  int* offsets; // gc_create_buffer'd
+  int* symbol_ids; // gc_create_buffer'd
+  struct _TokenizerState* scanner; // malloc'd, NULL once the whole file has been scanned
   int index;
-  int length;
+  int length; // the number of tokens scanned so far
+  int mask; // maps token indexes to array slots, -1 if the arrays hold every token
 } TokenStream;
 
-Dictionary* _tokenizer_create_string_set(const char* space_sep_values) {
-  List* words = string_split(space_sep_values, " ");
-  Dictionary* lookup = new_dictionary();
-  for (int i = 0; i < words->length; ++i) {
-    String* k = list_get_string(words, i);
-    dictionary_set(lookup, k, wrap_bool(1));
+// Scratch state of the scanner. Nothing in it is owned by the GC.
+typedef struct _TokenizerState {
+  const unsigned char* chars;
+  int length;
+  int position;
+
+  // Identifiers and literals repeat a lot within a file, so each distinct spelling gets one local
+  // symbol. intern_slots maps spellings to symbol id + 1 with open addressing. Long string literals
+  // are rarely repeated and are not worth hashing twice, so they always get a symbol of their own.
+  int* intern_slots;
+  int intern_capacity;
+  List* symbols;
+  int shared_symbol_count;
+
+  // Growable copies of the token arrays when the whole file is tokenized, NULL for a window.
+  unsigned char* types;
+  int* offsets;
+  int* symbol_ids;
+  int token_capacity;
+
+  int* line_starts;
+  int line_count;
+  int line_capacity;
+} TokenizerState;
+
+#define TOKENIZER_MAX_INTERNED_STRING 64
+
+// The same hash a String of these characters gets. It is computed unsigned, since it wraps around
+// for longer symbols, and gives the same bits as String's.
+int _tokenizer_hash_range(const char* chars, int start, int end) {
+  unsigned int hash = 0;
+  for (int i = start; i < end; ++i) {
+    hash = hash * 31 + (unsigned int) chars[i];
   }
-  return lookup;
+  return hash == 0 ? 1319 : (int) hash;
 }
 
-TokenStream* tokenize(String* filename, String* content) {
-  TokenStream* token_stream = (TokenStream*)gc_create_struct(sizeof(TokenStream), TOKEN_STREAM_NAME, TOKEN_STREAM_GC_FIELD_COUNT);
-  token_stream->error = NULL;
-  token_stream->filename = filename;
-  token_stream->index = 0;
-  token_stream->length = 0;
-  token_stream->error_token = NULL;
-  token_stream->tokens = new_list();
-
-  content = string_concat(string_replace(content->cstring, "\r\n", "\n")->cstring, "\n");
-  const char* chars = content->cstring;
-  int len = content->length;
-  int* lines = (int*) malloc(sizeof(int) * len);
-  int* cols = (int*) malloc(sizeof(int) * len);
-  int line = 1;
-  int col = 1;
-  char c;
-  for (int i = 0; i < len; ++i) {
-    lines[i] = line;
-    cols[i] = col;
-    c = chars[i];
-    if (c == '\n') {
-      line++;
-      col = 1;
-    } else {
-      col++;
+int _tokenizer_add_symbol(TokenizerState* state, String* value) {
+  list_add(state->symbols, value);
+  return state->shared_symbol_count + state->symbols->length - 1;
+}
+
+void _tokenizer_intern_grow(TokenizerState* state) {
+  int* old_slots = state->intern_slots;
+  int old_capacity = state->intern_capacity;
+  state->intern_capacity = old_capacity == 0 ? 256 : old_capacity * 2;
+  state->intern_slots = (int*) calloc(state->intern_capacity, sizeof(int));
+  for (int i = 0; i < old_capacity; ++i) {
+    if (old_slots[i] == 0) continue;
+    String* str = (String*) state->symbols->items[old_slots[i] - 1 - state->shared_symbol_count];
+    int slot = str->hash & (state->intern_capacity - 1);
+    while (state->intern_slots[slot] != 0) slot = (slot + 1) & (state->intern_capacity - 1);
+    state->intern_slots[slot] = old_slots[i];
+  }
+  free(old_slots);
+}
+
+int _tokenizer_intern(TokenizerState* state, int start, int end, int hash) {
+  const char* chars = (const char*) state->chars;
+  if (state->symbols->length * 2 >= state->intern_capacity) _tokenizer_intern_grow(state);
+  int length = end - start;
+  int slot = hash & (state->intern_capacity - 1);
+  int entry;
+  while ((entry = state->intern_slots[slot]) != 0) {
+    String* str = (String*) state->symbols->items[entry - 1 - state->shared_symbol_count];
+    if (str->hash == hash && str->length == length && memcmp(str->cstring, chars + start, length) == 0) {
+      return entry - 1;
     }
+    slot = (slot + 1) & (state->intern_capacity - 1);
   }
+  int id = _tokenizer_add_symbol(state, new_string_from_range(chars, start, end));
+  state->intern_slots[slot] = id + 1;
+  return id;
+}
 
-  Dictionary* keywords = _tokenizer_create_string_set("if else function for while do try catch except class constructor field return continue break switch case default");
-  Dictionary* multichar_tokens = _tokenizer_create_string_set("++ -- << >> || && == != <= >= => += -= *= /= &= |= ^= ** ??");
-  String* str_temp = NULL;
-
-  char state = 'N'; // N - Normal, S - String, C - Comment, W - Word
-  char token_type = ' '; // / or * for comments, ' or " for strings
-  int token_start = 0;
-  char c2;
-
-  List* tokens = token_stream->tokens;
-  char single_char_buf[2];
-  char two_char_buf[3];
-  single_char_buf[1] = '\0';
-  two_char_buf[2] = '\0';
-
-  for (int i = 0; i < len; ++i) {
-    c = chars[i];
-    c2 = chars[i + 1];
-    switch (state) {
-      case 'N':
-        if (c == ' ' || c == '\n' || c == '\t') {
-          // do nothing!
-        } else if (c == '"' || c == '\'') {
-          token_start = i;
-          state = 'S';
-          token_type = c;
-        } else if (c == '/' && (c2 == '/' || c2 == '*')) {
-          state = 'C';
-          token_type = c2;
-          i++;
-        } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_') {
-          state = 'W';
-          token_start = i;
-          --i;
-        } else if (c2 != '\0') {
-          two_char_buf[0] = c;
-          two_char_buf[1] = c2;
-          str_temp = new_string(two_char_buf);
-          if (dictionary_has_key(multichar_tokens, str_temp)) {
-            list_add(tokens, new_token(filename, str_temp, lines[i], cols[i], TOKEN_TYPE_PUNC));
-            i++;
-          } else {
-            single_char_buf[0] = c;
-            list_add(tokens, new_token(filename, new_string(single_char_buf), lines[i], cols[i], TOKEN_TYPE_PUNC));
-          }
-        } else {
-          single_char_buf[0] = c;
-          list_add(tokens, new_token(filename, new_string(single_char_buf), lines[i], cols[i], TOKEN_TYPE_PUNC));
-        }
+void _tokenizer_add_token(TokenStream* token_stream, enum TokenType type, int offset, int symbol_id) {
+  TokenizerState* state = token_stream->scanner;
+  if (state->types != NULL && token_stream->length == state->token_capacity) {
+    state->token_capacity *= 2;
+    state->types = (unsigned char*) realloc(state->types, state->token_capacity);
+    state->offsets = (int*) realloc(state->offsets, sizeof(int) * state->token_capacity);
+    state->symbol_ids = (int*) realloc(state->symbol_ids, sizeof(int) * state->token_capacity);
+  }
+  unsigned char* types = state->types != NULL ? state->types : token_stream->types;
+  int* offsets = state->types != NULL ? state->offsets : token_stream->offsets;
+  int* symbol_ids = state->types != NULL ? state->symbol_ids : token_stream->symbol_ids;
+  int slot = token_stream->length & token_stream->mask;
+  types[slot] = (unsigned char) type;
+  offsets[slot] = offset;
+  symbol_ids[slot] = symbol_id;
+  token_stream->length++;
+}
+
+void _tokenizer_add_line(TokenizerState* state, int offset) {
+  if (state->line_count == state->line_capacity) {
+    state->line_capacity *= 2;
+    state->line_starts = (int*) realloc(state->line_starts, sizeof(int) * state->line_capacity);
+  }
+  state->line_starts[state->line_count++] = offset;
+}
+
+/*
+  Called at the end of the file or at a tokenizer error. Moves the line index (and the tokens, when the
+  whole file was tokenized) into exactly sized GC buffers and frees the scanner.
+*/
+void _tokenizer_finish(TokenStream* token_stream) {
+  TokenizerState* state = token_stream->scanner;
+  if (state->types != NULL) {
+    int count = token_stream->length;
+    token_stream->types = (unsigned char*) gc_create_buffer(count + 1);
+    token_stream->offsets = (int*) gc_create_buffer(sizeof(int) * (count + 1));
+    token_stream->symbol_ids = (int*) gc_create_buffer(sizeof(int) * (count + 1));
+    memcpy(token_stream->types, state->types, count);
+    memcpy(token_stream->offsets, state->offsets, sizeof(int) * count);
+    memcpy(token_stream->symbol_ids, state->symbol_ids, sizeof(int) * count);
+    free(state->types);
+    free(state->offsets);
+    free(state->symbol_ids);
+  }
+
+  SourceFile* source = token_stream->source;
+  source->line_starts = (int*) gc_create_buffer(sizeof(int) * state->line_count);
+  memcpy(source->line_starts, state->line_starts, sizeof(int) * state->line_count);
+  source->line_count = state->line_count;
+
+  free(state->intern_slots);
+  free(state->line_starts);
+  free(state);
+  token_stream->scanner = NULL;
+}
+
+void _tokenizer_fail(TokenStream* token_stream, int offset, const char* message) {
+  token_stream->error = new_string(message);
+  token_stream->error_token = new_token(token_stream->source, new_string(""), offset, TOKEN_TYPE_PUNC);
+  _tokenizer_finish(token_stream);
+}
+
+/*
+  Scans the next token. Returns 0 and finishes the stream at the end of the file or at an error. CRLF
+  line endings are handled as they are scanned: '\r' counts as whitespace and string literals that
+  span lines have their "\r\n" turned into "\n".
+*/
+int _tokenizer_scan_next(TokenStream* token_stream) {
+  TokenizerTables* tables = _tokenizer_get_tables();
+  const unsigned char* char_class = tables->char_class;
+  TokenizerState* state = token_stream->scanner;
+  // The scanner relies on the NUL terminator after the last character instead of checking bounds.
+  const unsigned char* chars = state->chars;
+  int len = state->length;
+  int i = state->position;
+
+  while (i < len) {
+    unsigned char c = chars[i];
+    int start = i;
+    switch (char_class[c]) {
+      case TOKENIZER_CLASS_SPACE:
+        // Most runs are a single space between two tokens, which is not worth a vector scan.
+        i++;
+        if (char_class[chars[i]] == TOKENIZER_CLASS_SPACE) i = scan_skip_blanks((const char*) chars, i, len);
         break;
 
-      case 'S':
-        if (c == '\\') {
-          ++i; // worry about if the escape sequence is valid later
-        } else if (c == token_type) {
-          str_temp = new_string_from_range(chars, token_start, i + 1);
-          list_add(tokens, new_token(filename, str_temp, lines[token_start], cols[token_start], TOKEN_TYPE_STRING));
-          state = 'N';
-        }
+      case TOKENIZER_CLASS_NEWLINE:
+        _tokenizer_add_line(state, i + 1);
+        i = scan_skip_blanks((const char*) chars, i + 1, len);
         break;
 
-      case 'C':
-        if (token_type == '/') {
-          if (c == '\n') {
-            state = 'N';
+      case TOKENIZER_CLASS_WORD:
+      case TOKENIZER_CLASS_DIGIT: {
+        // _tokenizer_hash_range, computed as the word is scanned.
+        unsigned int word_hash = 0;
+        while (char_class[chars[i]] == TOKENIZER_CLASS_WORD || char_class[chars[i]] == TOKENIZER_CLASS_DIGIT) {
+          word_hash = word_hash * 31 + chars[i];
+          i++;
+        }
+        int hash = word_hash == 0 ? 1319 : (int) word_hash;
+        int id = _tokenizer_find_keyword(tables, (const char*) chars + start, i - start, hash);
+        if (id != -1) {
+          _tokenizer_add_token(token_stream, TOKEN_TYPE_KEYWORD, start, id);
+        } else {
+          id = _tokenizer_intern(state, start, i, hash);
+          _tokenizer_add_token(token_stream, char_class[c] == TOKENIZER_CLASS_DIGIT ? TOKEN_TYPE_INTEGER : TOKEN_TYPE_WORD, start, id);
+        }
+        state->position = i;
+        return 1;
+      }
+
+      case TOKENIZER_CLASS_QUOTE: {
+        int has_crlf = 0;
+        i++;
+        while (1) {
+          i = scan_find_any3((const char*) chars, i, len, (char) c, '\\', '\n');
+          if (i >= len) {
+            _tokenizer_fail(token_stream, start, "This code contains an unclosed string.");
+            return 0;
+          }
+          if (chars[i] == c) break;
+          if (chars[i] == '\\') {
+            i++; // worry about if the escape sequence is valid later
+            if (i >= len || chars[i] != '\n') {
+              i++;
+              continue;
+            }
           }
+          if (chars[i - 1] == '\r') has_crlf = 1;
+          _tokenizer_add_line(state, i + 1);
+          i++;
+        }
+        i++;
+        int id;
+        if (has_crlf) {
+          String* raw = new_string_from_range((const char*) chars, start, i);
+          id = _tokenizer_add_symbol(state, string_replace(raw->cstring, "\r\n", "\n"));
+        } else if (i - start <= TOKENIZER_MAX_INTERNED_STRING) {
+          id = _tokenizer_intern(state, start, i, _tokenizer_hash_range((const char*) chars, start, i));
         } else {
-          if (c == '*' && c2 == '/') {
-            state = 'N';
+          id = _tokenizer_add_symbol(state, new_string_from_range((const char*) chars, start, i));
+        }
+        _tokenizer_add_token(token_stream, TOKEN_TYPE_STRING, start, id);
+        state->position = i;
+        return 1;
+      }
+
+      case TOKENIZER_CLASS_SLASH:
+        if (chars[i + 1] == '/') {
+          i = scan_find_char((const char*) chars, i, len, '\n');
+          break;
+        }
+        if (chars[i + 1] == '*') {
+          i += 2;
+          while (1) {
+            i = scan_find_either((const char*) chars, i, len, '*', '\n');
+            if (i + 1 >= len) {
+              _tokenizer_fail(token_stream, start, "This code contains an unclosed comment.");
+              return 0;
+            }
+            if (chars[i] == '*' && chars[i + 1] == '/') break;
+            if (chars[i] == '\n') _tokenizer_add_line(state, i + 1);
             i++;
           }
+          i += 2;
+          break;
         }
-        break;
+        // fall through to the operator DFA
 
-      case 'W':
-        if ((c < 'a' || c > 'z') &&
-            (c < 'A' || c > 'Z') &&
-            (c < '0' || c > '9') &&
-            c != '_') {
-
-          str_temp = new_string_from_range(chars, token_start, i);
-          --i;
-          state = 'N';
-          enum TokenType tt = TOKEN_TYPE_WORD;
-          if (dictionary_has_key(keywords, str_temp)) {
-            tt = TOKEN_TYPE_KEYWORD;
-          } else if (str_temp->cstring[0] >= '0' && str_temp->cstring[0] <= '9') {
-            tt = TOKEN_TYPE_INTEGER;
-          }
-          list_add(tokens, new_token(filename, str_temp, lines[token_start], cols[token_start], tt));
+      case TOKENIZER_CLASS_PUNC: {
+        int op_state = tables->op_next[0][c];
+        int next;
+        i++;
+        while (chars[i] < 128 && (next = tables->op_next[op_state][chars[i]]) != 0) {
+          op_state = next;
+          i++;
         }
-        break;
+        _tokenizer_add_token(token_stream, TOKEN_TYPE_PUNC, start, tables->op_symbol[op_state]);
+        state->position = i;
+        return 1;
+      }
+
+      default:
+        i++;
+        _tokenizer_add_token(token_stream, TOKEN_TYPE_PUNC, start, _tokenizer_intern(state, start, i, _tokenizer_hash_range((const char*) chars, start, i)));
+        state->position = i;
+        return 1;
     }
   }
 
-  if (state != 'N') {
-    if (state == 'S') {
-      token_stream->error = new_string("This code contains an unclosed string.");
-    } else if (state == 'C') {
-      token_stream->error = new_string("This code contains an unclosed comment.");
-    }
-    return token_stream;
+  _tokenizer_finish(token_stream);
+  return 0;
+}
+
+TokenStream* _tokenizer_open(String* filename, String* content, int window) {
+  TokenizerTables* tables = _tokenizer_get_tables();
+
+  TokenStream* token_stream = (TokenStream*)gc_create_struct(sizeof(TokenStream), TOKEN_STREAM_NAME, TOKEN_STREAM_GC_FIELD_COUNT);
+  token_stream->error = NULL;
+  token_stream->filename = filename;
+  token_stream->index = 0;
+  token_stream->length = 0;
+  token_stream->error_token = NULL;
+  token_stream->symbols = new_list();
+  token_stream->source = new_source_file(filename, content, NULL, 0);
+  token_stream->types = NULL;
+  token_stream->offsets = NULL;
+  token_stream->symbol_ids = NULL;
+
+  TokenizerState* state = (TokenizerState*) malloc_clean(sizeof(TokenizerState));
+  state->chars = (const unsigned char*) content->cstring;
+  state->length = content->length;
+  state->position = 0;
+  state->symbols = token_stream->symbols;
+  state->shared_symbol_count = tables->shared_symbol_count;
+  state->line_capacity = 64 + content->length / 32;
+  state->line_starts = (int*) malloc(sizeof(int) * state->line_capacity);
+  state->line_count = 1;
+  state->line_starts[0] = 0;
+  if (window) {
+    token_stream->mask = TOKEN_STREAM_WINDOW - 1;
+    token_stream->types = (unsigned char*) gc_create_buffer(TOKEN_STREAM_WINDOW);
+    token_stream->offsets = (int*) gc_create_buffer(sizeof(int) * TOKEN_STREAM_WINDOW);
+    token_stream->symbol_ids = (int*) gc_create_buffer(sizeof(int) * TOKEN_STREAM_WINDOW);
+  } else {
+    token_stream->mask = -1;
+    state->token_capacity = 64 + content->length / 4;
+    state->types = (unsigned char*) malloc(state->token_capacity);
+    state->offsets = (int*) malloc(sizeof(int) * state->token_capacity);
+    state->symbol_ids = (int*) malloc(sizeof(int) * state->token_capacity);
   }
+  token_stream->scanner = state;
+  return token_stream;
+}
 
-  token_stream->length = token_stream->tokens->length;
+// Tokenizes the whole file up front. The tokens can be read any number of times.
+TokenStream* tokenize(String* filename, String* content) {
+  TokenStream* token_stream = _tokenizer_open(filename, content, 0);
+  while (_tokenizer_scan_next(token_stream)) { }
   return token_stream;
 }
 
+/*
+  Returns a stream that tokenizes the file as the parser reads it. Only tokens in the window ending at
+  the furthest token looked at so far can be read, and the stream can only be read once. If it is not
+  read to the end, token_stream_close must be called to free the scanner.
+*/
+TokenStream* tokenize_incremental(String* filename, String* content) {
+  return _tokenizer_open(filename, content, 1);
+}
+
+// Scans up to the token at index if needed. Returns 0 if the file has fewer tokens.
+int token_stream_has(TokenStream* token_stream, int index) {
+  while (index >= token_stream->length && token_stream->scanner != NULL) {
+    _tokenizer_scan_next(token_stream);
+  }
+  return index < token_stream->length;
+}
+
+void token_stream_close(TokenStream* token_stream) {
+  if (token_stream->scanner != NULL) _tokenizer_finish(token_stream);
+}
+
+String* token_stream_get_value(TokenStream* token_stream, int index) {
+  TokenizerTables* tables = _tokenizer_get_tables();
+  int id = token_stream->symbol_ids[index & token_stream->mask];
+  if (id < tables->shared_symbol_count) return tables->shared_symbols[id];
+  return (String*) token_stream->symbols->items[id - tables->shared_symbol_count];
+}
+
+// Symbol ids below TOKENIZER_MAX_SHARED_SYMBOLS that were found with tokenizer_find_shared_symbol
+// identify the same operator or keyword in every stream.
+int token_stream_get_symbol_id(TokenStream* token_stream, int index) {
+  return token_stream->symbol_ids[index & token_stream->mask];
+}
+
+enum TokenType token_stream_get_type(TokenStream* token_stream, int index) {
+  return (enum TokenType) token_stream->types[index & token_stream->mask];
+}
+
+// Creates a Token for the token at index. Each call creates a new one.
+Token* token_stream_get_token(TokenStream* token_stream, int index) {
+  return new_token(token_stream->source, token_stream_get_value(token_stream, index), token_stream->offsets[index & token_stream->mask], token_stream_get_type(token_stream, index));
+}
+
 #endif
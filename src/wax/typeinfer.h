@@ -0,0 +1,388 @@
+#ifndef _WAX_TYPEINFER_H
+#define _WAX_TYPEINFER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "../util/dictionaries.h"
+#include "../util/lists.h"
+#include "../util/strings.h"
+#include "compilercontext.h"
+#include "nodes.h"
+
+/*
+  Works out which types the values in a resolved module can have at runtime, and sets value_type on
+  the local variables, op chains, ternaries and function invocations (see enum ValueType).
+
+  The pass follows the code of each function, method and constructor in order with the type each
+  local slot has at that point, so a local can be a string in one place and an integer in another.
+  Arguments can be anything, since any caller can call a function, and other locals start as null,
+  which is what the VM starts them as. An if statement ends with what either branch leaves, and a
+  loop is followed until the types at its start stop changing, which is how a loop counter like the
+  i of for (i = 0; i < n; i += 1) is found to always be an integer.
+
+  A call to one of the module's functions has the type its return statements have, so the whole
+  module is followed until no function's return type changes. A function is followed both with
+  arguments of any type and with integer arguments, and a call whose arguments are all integers
+  gets the return type of the second.
+
+  An operation can fail instead of producing a value, so the type of a - b is an integer whatever a
+  and b are: if there is a result, it's an integer. The backends still check the operands unless
+  their types say they don't have to.
+*/
+
+typedef struct _TypeInference {
+  int* return_types; // by function index, for arguments of any type
+  int* int_return_types; // by function index, for integer arguments
+  int changed; // a return type changed in this pass over the module
+
+  // The function being followed
+  int* locals; // the type of each slot here, and then 1 if the code here can run or 0 if it can't
+  int local_count;
+  int* break_locals; // what the breaks of the innermost loop leave, NULL outside a loop
+  int* continue_locals;
+  int return_type;
+} TypeInference;
+
+int _ti_is_logical_op(const char* op) {
+  return (op[0] == '&' || op[0] == '|') && op[1] == op[0];
+}
+
+int _ti_is_comparison_op(const char* op) {
+  return op[0] == '=' || op[0] == '!' || ((op[0] == '<' || op[0] == '>') && op[1] != op[0]);
+}
+
+// The type of a binary operation other than && and ||, on values of the given types.
+int value_type_of_binary_op(const char* op, int left, int right) {
+  if (left == 0 || right == 0) return 0;
+  if (_ti_is_comparison_op(op)) return VALUE_TYPE_BOOLEAN;
+  if (op[0] != '+') return VALUE_TYPE_INTEGER;
+  // + adds two integers, or joins a string and a string or an integer.
+  int type = (left & VALUE_TYPE_INTEGER) && (right & VALUE_TYPE_INTEGER) ? VALUE_TYPE_INTEGER : 0;
+  int stringable = VALUE_TYPE_STRING | VALUE_TYPE_INTEGER;
+  if (((left | right) & VALUE_TYPE_STRING) && (left & stringable) && (right & stringable)) type |= VALUE_TYPE_STRING;
+  return type;
+}
+
+// The type a compound assignment like x += y stores, for a target and a value of the given types.
+int value_type_of_assignment(String* op, int target, int value) {
+  // The operator is the assignment operator without its =.
+  char binary_op[4];
+  int length = op->length - 1 < 3 ? op->length - 1 : 3;
+  memcpy(binary_op, op->cstring, length);
+  binary_op[length] = '\0';
+  return value_type_of_binary_op(binary_op, target, value);
+}
+
+// The type of an expression, from its value_type or its kind. Only valid after the pass has run.
+int value_type_of(Node* expr) {
+  switch (node_kind(expr)) {
+    case NODE_KIND_NULL_CONSTANT: return VALUE_TYPE_NULL;
+    case NODE_KIND_BOOLEAN_CONSTANT: return VALUE_TYPE_BOOLEAN;
+    case NODE_KIND_INTEGER_CONSTANT: return VALUE_TYPE_INTEGER;
+    case NODE_KIND_STRING_CONSTANT: return VALUE_TYPE_STRING;
+    case NODE_KIND_INLINE_DICTIONARY: return VALUE_TYPE_OTHER;
+    case NODE_KIND_VARIABLE:
+      {
+        Variable* v = (Variable*) expr;
+        return v->scope == VARIABLE_SCOPE_LOCAL ? v->value_type : VALUE_TYPE_OTHER;
+      }
+    case NODE_KIND_OP_CHAIN: return ((OpChain*) expr)->value_type;
+    case NODE_KIND_TERNARY: return ((Ternary*) expr)->value_type;
+    case NODE_KIND_FUNCTION_INVOCATION: return ((FunctionInvocation*) expr)->value_type;
+    default: return VALUE_TYPE_ANY;
+  }
+}
+
+int _ti_is_unreachable(TypeInference* ti) {
+  return ti->locals[ti->local_count] == 0;
+}
+
+int* _ti_copy_locals(TypeInference* ti, int* locals) {
+  int* copy = (int*) malloc(sizeof(int) * (ti->local_count + 1));
+  memcpy(copy, locals, sizeof(int) * (ti->local_count + 1));
+  return copy;
+}
+
+// Adds the types of other to the types of locals. Returns 1 if any of them changed.
+int _ti_join_locals(TypeInference* ti, int* locals, int* other) {
+  int changed = 0;
+  for (int i = 0; i <= ti->local_count; ++i) {
+    if ((locals[i] | other[i]) != locals[i]) {
+      locals[i] |= other[i];
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+void _ti_set_unreachable(TypeInference* ti) {
+  memset(ti->locals, 0, sizeof(int) * (ti->local_count + 1));
+}
+
+int _ti_expression(TypeInference* ti, Node* expr);
+
+int _ti_invocation(TypeInference* ti, FunctionInvocation* fi) {
+  int all_integers = 1;
+  _ti_expression(ti, fi->root);
+  for (int i = 0; i < fi->args->length; ++i) {
+    if (_ti_expression(ti, (Node*) list_get(fi->args, i)) != VALUE_TYPE_INTEGER) all_integers = 0;
+  }
+  if (_ti_is_unreachable(ti)) return 0;
+  if (node_kind(fi->root) != NODE_KIND_VARIABLE) return VALUE_TYPE_ANY;
+  Variable* v = (Variable*) fi->root;
+  if (v->scope == VARIABLE_SCOPE_CLASS) return VALUE_TYPE_OTHER;
+  if (v->scope != VARIABLE_SCOPE_FUNCTION) return VALUE_TYPE_ANY;
+  return all_integers ? ti->int_return_types[v->index] : ti->return_types[v->index];
+}
+
+// Returns the type of an expression in the current state and sets the value_type of the nodes in it.
+int _ti_expression(TypeInference* ti, Node* expr) {
+  int unreachable = _ti_is_unreachable(ti);
+  switch (node_kind(expr)) {
+    case NODE_KIND_VARIABLE:
+      {
+        Variable* v = (Variable*) expr;
+        if (v->scope != VARIABLE_SCOPE_LOCAL) return unreachable ? 0 : VALUE_TYPE_OTHER;
+        v->value_type = ti->locals[v->index];
+        return v->value_type;
+      }
+    case NODE_KIND_INLINE_DICTIONARY:
+      {
+        InlineDictionary* dict = (InlineDictionary*) expr;
+        for (int i = 0; i < dict->values->length; ++i) {
+          _ti_expression(ti, (Node*) list_get(dict->values, i));
+        }
+        return unreachable ? 0 : VALUE_TYPE_OTHER;
+      }
+    case NODE_KIND_DOT_FIELD:
+      {
+        DotField* df = (DotField*) expr;
+        int root = _ti_expression(ti, df->root);
+        if (unreachable) return 0;
+        return root == VALUE_TYPE_STRING && string_equals_chars(df->field_token->value, "length") ? VALUE_TYPE_INTEGER : VALUE_TYPE_ANY;
+      }
+    case NODE_KIND_BRACKET_INDEX:
+      {
+        BracketIndex* bi = (BracketIndex*) expr;
+        int root = _ti_expression(ti, bi->root);
+        _ti_expression(ti, bi->index);
+        if (unreachable) return 0;
+        return root == VALUE_TYPE_STRING ? VALUE_TYPE_STRING : VALUE_TYPE_ANY;
+      }
+    case NODE_KIND_OP_CHAIN:
+      {
+        // a && b is the first falsy operand or the last one, so it can be any of them.
+        OpChain* oc = (OpChain*) expr;
+        int type = _ti_expression(ti, (Node*) list_get(oc->expressions, 0));
+        int is_logical = _ti_is_logical_op(((Token*) list_get(oc->ops, 0))->value->cstring);
+        for (int i = 0; i < oc->ops->length; ++i) {
+          int right = _ti_expression(ti, (Node*) list_get(oc->expressions, i + 1));
+          type = is_logical ? type | right : value_type_of_binary_op(((Token*) list_get(oc->ops, i))->value->cstring, type, right);
+        }
+        oc->value_type = type;
+        return type;
+      }
+    case NODE_KIND_TERNARY:
+      {
+        Ternary* ter = (Ternary*) expr;
+        _ti_expression(ti, ter->condition);
+        ter->value_type = _ti_expression(ti, ter->true_expr) | _ti_expression(ti, ter->false_expr);
+        return ter->value_type;
+      }
+    case NODE_KIND_FUNCTION_INVOCATION:
+      {
+        FunctionInvocation* fi = (FunctionInvocation*) expr;
+        fi->value_type = _ti_invocation(ti, fi);
+        return fi->value_type;
+      }
+    default:
+      return unreachable ? 0 : value_type_of(expr);
+  }
+}
+
+void _ti_block(TypeInference* ti, List* code);
+
+/*
+  Follows a loop from the current state until the state at its start stops changing, and leaves the
+  state after it. condition is NULL for a loop that only ends with a break, and steps NULL for a
+  loop without them. A for each loop passes the slot of its variable as loop_variable, else -1.
+*/
+void _ti_loop(TypeInference* ti, Node* condition, List* code, List* steps, int loop_variable) {
+  int* outer_break_locals = ti->break_locals;
+  int* outer_continue_locals = ti->continue_locals;
+  int* start = _ti_copy_locals(ti, ti->locals);
+  int* exit = NULL;
+  ti->break_locals = (int*) malloc(sizeof(int) * (ti->local_count + 1));
+  ti->continue_locals = (int*) malloc(sizeof(int) * (ti->local_count + 1));
+  int changed = 1;
+  while (changed) {
+    memcpy(ti->locals, start, sizeof(int) * (ti->local_count + 1));
+    if (condition != NULL) _ti_expression(ti, condition);
+    free(exit);
+    exit = condition != NULL || loop_variable != -1 ? _ti_copy_locals(ti, ti->locals) : (int*) calloc(ti->local_count + 1, sizeof(int));
+    if (loop_variable != -1 && !_ti_is_unreachable(ti)) ti->locals[loop_variable] = VALUE_TYPE_ANY;
+    memset(ti->break_locals, 0, sizeof(int) * (ti->local_count + 1));
+    memset(ti->continue_locals, 0, sizeof(int) * (ti->local_count + 1));
+    _ti_block(ti, code);
+    _ti_join_locals(ti, ti->locals, ti->continue_locals);
+    if (steps != NULL) _ti_block(ti, steps);
+    changed = _ti_join_locals(ti, start, ti->locals);
+  }
+  _ti_join_locals(ti, exit, ti->break_locals);
+  memcpy(ti->locals, exit, sizeof(int) * (ti->local_count + 1));
+  free(start);
+  free(exit);
+  free(ti->break_locals);
+  free(ti->continue_locals);
+  ti->break_locals = outer_break_locals;
+  ti->continue_locals = outer_continue_locals;
+}
+
+void _ti_assignment(TypeInference* ti, Assignment* asgn) {
+  int type = _ti_expression(ti, asgn->value);
+  String* op = asgn->assignment_op->value;
+  if (node_kind(asgn->target) != NODE_KIND_VARIABLE) {
+    _ti_expression(ti, asgn->target);
+    return;
+  }
+  Variable* v = (Variable*) asgn->target;
+  if (!string_equals_chars(op, "=")) {
+    // The target is read first.
+    type = value_type_of_assignment(op, _ti_expression(ti, asgn->target), type);
+  } else {
+    v->value_type = type;
+  }
+  if (!_ti_is_unreachable(ti)) ti->locals[v->index] = type;
+}
+
+void _ti_block(TypeInference* ti, List* code) {
+  for (int i = 0; i < code->length; ++i) {
+    Node* line = (Node*) list_get(code, i);
+    switch (node_kind(line)) {
+      case NODE_KIND_ASSIGNMENT:
+        _ti_assignment(ti, (Assignment*) line);
+        break;
+      case NODE_KIND_EXPR_EXEC:
+        _ti_expression(ti, ((ExpressionAsExecutable*) line)->expression);
+        break;
+      case NODE_KIND_IF_STATEMENT:
+        {
+          IfStatement* _if = (IfStatement*) line;
+          _ti_expression(ti, _if->condition);
+          int* false_locals = _ti_copy_locals(ti, ti->locals);
+          _ti_block(ti, _if->true_code);
+          int* true_locals = ti->locals;
+          ti->locals = false_locals;
+          _ti_block(ti, _if->false_code);
+          _ti_join_locals(ti, ti->locals, true_locals);
+          free(true_locals);
+        }
+        break;
+      case NODE_KIND_WHILE_LOOP:
+        _ti_loop(ti, ((WhileLoop*) line)->condition, ((WhileLoop*) line)->code, NULL, -1);
+        break;
+      case NODE_KIND_FOR_LOOP:
+        {
+          ForLoop* fl = (ForLoop*) line;
+          _ti_block(ti, fl->inits);
+          _ti_loop(ti, fl->condition, fl->code, fl->steps, -1);
+        }
+        break;
+      case NODE_KIND_FOR_EACH_LOOP:
+        {
+          ForEachLoop* fel = (ForEachLoop*) line;
+          _ti_expression(ti, fel->list_expr);
+          _ti_loop(ti, NULL, fel->code, NULL, fel->variable_index);
+        }
+        break;
+      case NODE_KIND_RETURN:
+        {
+          Node* value = ((ReturnStatement*) line)->value;
+          int type = value == NULL ? VALUE_TYPE_NULL : _ti_expression(ti, value);
+          if (!_ti_is_unreachable(ti)) ti->return_type |= type;
+          _ti_set_unreachable(ti);
+        }
+        break;
+      case NODE_KIND_BREAK:
+      case NODE_KIND_CONTINUE:
+        _ti_join_locals(ti, node_kind(line) == NODE_KIND_BREAK ? ti->break_locals : ti->continue_locals, ti->locals);
+        _ti_set_unreachable(ti);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Follows one function with the given type for its arguments and returns its return type.
+int _ti_function(TypeInference* ti, List* code, List* arg_tokens, List* arg_default_values, int local_count, int is_method, int arg_type) {
+  ti->local_count = local_count;
+  ti->locals = (int*) malloc(sizeof(int) * (local_count + 1));
+  for (int i = 0; i < local_count; ++i) {
+    ti->locals[i] = VALUE_TYPE_NULL;
+  }
+  ti->locals[local_count] = 1;
+  if (is_method) ti->locals[0] = VALUE_TYPE_OTHER;
+  for (int i = 0; i < arg_tokens->length; ++i) {
+    Node* default_value = (Node*) list_get(arg_default_values, i);
+    if (default_value != NULL) _ti_expression(ti, default_value);
+    ti->locals[is_method + i] = default_value == NULL ? arg_type : arg_type | value_type_of(default_value);
+  }
+  ti->break_locals = NULL;
+  ti->continue_locals = NULL;
+  ti->return_type = 0;
+  _ti_block(ti, code);
+  // Falling off the end returns null, or this from a constructor.
+  if (!_ti_is_unreachable(ti)) ti->return_type |= is_method ? VALUE_TYPE_OTHER : VALUE_TYPE_NULL;
+  free(ti->locals);
+  return ti->return_type;
+}
+
+void _ti_update_return_type(TypeInference* ti, int* types, int index, int type) {
+  if ((types[index] | type) != types[index]) {
+    types[index] |= type;
+    ti->changed = 1;
+  }
+}
+
+// Runs the pass over a resolved module.
+void wax_infer_types(CompilerContext* ctx) {
+  TypeInference ti;
+  memset(&ti, 0, sizeof(TypeInference));
+  List* functions = ctx->function_definitions;
+  ti.return_types = (int*) malloc_clean(sizeof(int) * (functions->length + 1));
+  ti.int_return_types = (int*) malloc_clean(sizeof(int) * (functions->length + 1));
+
+  // Return types only grow, from nothing, so this ends.
+  ti.changed = 1;
+  while (ti.changed) {
+    ti.changed = 0;
+    for (int i = 0; i < functions->length; ++i) {
+      FunctionDefinition* fd = (FunctionDefinition*) list_get(functions, i);
+      // The pass with any arguments goes last, so the nodes are left with its types.
+      int type = _ti_function(&ti, fd->code, fd->arg_tokens, fd->arg_default_values, fd->local_count, 0, VALUE_TYPE_INTEGER);
+      _ti_update_return_type(&ti, ti.int_return_types, i, type);
+      type = _ti_function(&ti, fd->code, fd->arg_tokens, fd->arg_default_values, fd->local_count, 0, VALUE_TYPE_ANY);
+      _ti_update_return_type(&ti, ti.return_types, i, type);
+    }
+  }
+
+  // Methods and constructors are only called through values, so nothing depends on what they return.
+  for (int i = 0; i < ctx->class_definitions->length; ++i) {
+    ClassDefinition* cd = (ClassDefinition*) list_get(ctx->class_definitions, i);
+    for (int j = 0; j < cd->member_order->length; ++j) {
+      Node* member = (Node*) dictionary_get(cd->members, list_get_string(cd->member_order, j));
+      if (node_kind(member) == NODE_KIND_FUNCTION_DEFINITION) {
+        FunctionDefinition* fd = (FunctionDefinition*) member;
+        _ti_function(&ti, fd->code, fd->arg_tokens, fd->arg_default_values, fd->local_count, 1, VALUE_TYPE_ANY);
+      } else if (node_kind(member) == NODE_KIND_CONSTRUCTOR_DEFINITION) {
+        ConstructorDefinition* ctor = (ConstructorDefinition*) member;
+        _ti_function(&ti, ctor->code, ctor->arg_tokens, ctor->arg_default_values, ctor->local_count, 1, VALUE_TYPE_ANY);
+      }
+    }
+  }
+  free(ti.return_types);
+  free(ti.int_return_types);
+}
+
+#endif
@@ -0,0 +1,1998 @@
+#ifndef _WAX_VM_H
+#define _WAX_VM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "../util/dictionaries.h"
+#include "../util/gc.h"
+#include "../util/lists.h"
+#include "../util/primitives.h"
+#include "../util/strings.h"
+#include "../util/util.h"
+#include "bytecode.h"
+#include "x64.h"
+
+/*
+  An interpreter for Wax bytecode.
+
+  Values are one machine word. Integers and booleans are immediates tagged in the low two bits
+  (01 for an integer, 11 for a boolean) and null is 0, so arithmetic and comparisons never allocate.
+  Every other word is a pointer to a GC object: a String, a List, a Dictionary, a VMFunction, a
+  VMNativeFunction, a VMClass or a VMObject. Lists and dictionaries hold values in the same form; the GC skips words with the
+  low bit set, so the immediates are invisible to it.
+
+  Before a function first runs its bytecode is decoded into an array of VMInstruction, with jump
+  targets turned into instruction indexes and constants into values. With GCC and Clang each
+  instruction also holds the address of its handler in _vm_execute, and every handler ends by
+  jumping straight to the next instruction's handler (direct threading with computed goto). Other
+  compilers, or a build with WAX_VM_NO_THREADING defined, use a switch in a loop instead.
+
+  Integer arithmetic is on 32 bit integers and stops with an error on overflow rather than wrapping.
+  / and % round toward negative infinity, like Python's // and %. false, null, 0 and the empty string
+  are false as conditions, everything else is true.
+
+  Field access and method calls go through an inline cache on their instruction. A dictionary's
+  shape is the order of its keys, which is the same for every dictionary built by the same literal,
+  so a cache entry for a dictionary is the position of the key in the key list, checked by comparing
+  the key at that position with the field name by pointer. The interpreter makes every key that comes
+  from the bytecode the constant pool's instance of that string, so the check holds for dictionaries
+  from literals and DOT_SET. A hit is an indexed load. Lists and strings are cached by type, which
+  turns .length and their methods into a type check. A site holds up to VM_INLINE_CACHE_SIZE entries
+  and stops caching when it sees more shapes than that.
+
+  An instance of a class is a VMObject, its class followed by a fixed array of fields. The slot of
+  every field is known from the bytecode, with the base class's fields first, so this.x in a method
+  is a GET_FIELD with the slot in the instruction. Other field accesses and method calls on instances
+  go through the inline caches, with the class as the shape. Calling a class creates an instance
+  from the class's field defaults and runs the constructor on it, the class's own or the nearest
+  base class's.
+
+  On x86-64 Linux a function that has been called or looped VM_JIT_THRESHOLD times is compiled to
+  machine code (see _vm_jit_compile). The machine code works on the same stack as the interpreter,
+  so control can pass between the two at any instruction without converting anything: the
+  instructions where machine code can start get a handler that enters it, and the machine code
+  returns the index of the instruction the interpreter should run next. It has integer fast paths
+  behind type guards. Anything else, like a call, a string or an integer overflow, goes back to the
+  interpreter for one instruction. A function whose guards fail more than VM_JIT_MAX_DEOPTS times
+  loses its machine code and stays interpreted. Defining WAX_VM_NO_JIT turns the tier off.
+
+  The GC runs every VM_GC_INTERVAL allocations the program makes, with the stack as the roots. Like
+  any GC pass it frees everything on the thread's heap that isn't reachable or gc_save'd, so the
+  host must save whatever it still needs before calling into the VM.
+*/
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(WAX_VM_NO_THREADING)
+#define VM_THREADED
+#endif
+
+// The machine code is entered through instruction handlers, so it needs the threaded dispatch.
+#if defined(VM_THREADED) && defined(X64_SUPPORTED) && !defined(WAX_VM_NO_JIT)
+#define VM_JIT
+#endif
+
+#define VM_STACK_SIZE (1024 * 1024)
+#define VM_MAX_FRAMES 10000
+#define VM_GC_INTERVAL 100000
+#define VM_INLINE_CACHE_SIZE 4
+#define VM_JIT_THRESHOLD 1000
+#define VM_JIT_MAX_DEOPTS 100
+
+typedef void* VMValue;
+
+// The immediates need the integer to fit in a word with two bits to spare.
+typedef char _vm_requires_64_bit_words[sizeof(intptr_t) >= 8 ? 1 : -1];
+
+#define VM_NULL ((VMValue) NULL)
+#define VM_FALSE ((VMValue) (intptr_t) 3)
+#define VM_TRUE ((VMValue) (intptr_t) 7)
+
+VMValue vm_int(int value) {
+  return (VMValue) (intptr_t) (((uintptr_t) (intptr_t) value << 2) | 1);
+}
+
+int vm_is_int(VMValue value) {
+  return (((intptr_t) value) & 3) == 1;
+}
+
+int vm_int_value(VMValue value) {
+  return (int) (((intptr_t) value) >> 2);
+}
+
+VMValue vm_bool(int value) {
+  return value ? VM_TRUE : VM_FALSE;
+}
+
+int vm_is_object(VMValue value) {
+  return value != NULL && (((intptr_t) value) & 1) == 0;
+}
+
+typedef struct _VM VM;
+typedef VMValue (*VMNativeCallback)(VM* vm, VMValue* args, int argc);
+
+// Machine code for a function. Runs from the instruction at index with the given locals and stack
+// pointer, and returns the index of the instruction the interpreter continues at, with *sp_out set.
+typedef int (*VMJitCode)(VMValue* locals, VMValue* sp, int index, VMValue** sp_out);
+
+enum VMBuiltinMethod {
+  VM_METHOD_NONE,
+  VM_METHOD_LIST_ADD,
+  VM_METHOD_LIST_POP,
+  VM_METHOD_DICT_KEYS,
+  VM_METHOD_DICT_VALUES,
+  VM_METHOD_DICT_CONTAINS,
+};
+
+typedef struct _VMCacheEntry {
+  int type; // the GC type of the receivers the entry is for
+  int slot; // the position of the key for a dictionary, the enum VMBuiltinMethod for a list method, a field slot for an instance
+  struct _VMClass* shape; // the class of the instances the entry is for
+  struct _VMFunction* method; // the method called on those instances, for CALL_METHOD
+} VMCacheEntry;
+
+typedef struct _VMInlineCache {
+  VMCacheEntry entries[VM_INLINE_CACHE_SIZE];
+  int count; // -1 once the site has seen too many shapes to cache
+} VMInlineCache;
+
+typedef struct _VMInstruction {
+  const void* handler; // the address of the op's handler in _vm_execute, when threaded
+  VMValue value; // the constant or name an op uses, already in VMValue form
+  VMInlineCache* cache; // for DOT_GET, DOT_SET and CALL_METHOD
+  int op;
+  int arg; // jump targets are instruction indexes
+  int extra; // the argument that follows the instruction word, if the op has one
+  int line;
+} VMInstruction;
+
+typedef struct _VMFunction {
+  BytecodeFunction* bytecode;
+  VMInstruction* code; // NULL until the function first runs
+  int* entry_points; // instruction index to start at for each argument count from required_arg_count up
+  VMInlineCache* caches; // one for each instruction that has one, pointed to by the instructions
+  int local_count;
+  int instruction_count;
+  int hotness; // calls and backward jumps, until the function is compiled
+  int jit_deopts; // guard failures in the machine code
+  VMJitCode jit; // NULL if the function isn't compiled
+  int jit_size; // of the executable memory at jit
+} VMFunction;
+#define VM_FUNCTION_GC_FIELD_COUNT 4
+#define VM_FUNCTION_NAME "VMFunction"
+
+typedef struct _VMNativeFunction {
+  String* name;
+  VMNativeCallback callback;
+} VMNativeFunction;
+#define VM_NATIVE_FUNCTION_GC_FIELD_COUNT 1
+#define VM_NATIVE_FUNCTION_NAME "VMNativeFunction"
+
+typedef struct _VMClass {
+  String* name;
+  struct _VMClass* base; // NULL if the class has no base class
+  VMFunction* constructor; // the class's own or the nearest base class's, NULL if there is none
+  Dictionary* methods; // name to VMFunction, including the inherited methods that aren't overridden
+  Dictionary* field_slots; // name to slot, as an integer VMValue
+  VMValue* field_defaults; // by slot
+  int field_count;
+} VMClass;
+#define VM_CLASS_GC_FIELD_COUNT 6
+#define VM_CLASS_NAME "VMClass"
+
+typedef struct _VMObject {
+  VMClass* class_def;
+  VMValue fields[]; // by slot
+} VMObject;
+#define VM_OBJECT_NAME "VMObject"
+
+typedef struct _VMFrame {
+  VMFunction* function;
+  VMInstruction* ip; // where the function continues once its callee returns
+  VMValue* locals; // arguments, then the other locals, then the operand stack. Also where the result goes.
+} VMFrame;
+
+struct _VM {
+  BytecodeModule* module;
+  List* roots; // gc_save'd. The functions, natives and dictionary templates the instructions refer to.
+  VMFunction** functions;
+  VMClass** classes;
+  VMValue* constants;
+  VMValue* globals;
+  char* globals_defined;
+  VMValue* stack;
+  VMValue* stack_end;
+  VMValue* sp; // top of the stack whenever the VM is not running
+  VMFrame* frames;
+  int frame_count;
+  int allocations; // since the last GC pass
+  VMValue result;
+  String* error; // gc_save'd, NULL if the last call succeeded
+};
+
+const void** _vm_handlers = NULL;
+
+// Whether value is a GC struct with the given name.
+int _vm_is_struct(VMValue value, const char* name) {
+  if (!vm_is_object(value)) return 0;
+  GCValue* gc_value = ((GCValue*) value) - 1;
+  return gc_value->type == 'C' && (gc_value->name == name || strcmp(gc_value->name, name) == 0);
+}
+
+int _vm_type_is(VMValue value, char type) {
+  return vm_is_object(value) && gc_get_type(value) == type;
+}
+
+const char* vm_type_name(VMValue value) {
+  if (value == VM_NULL) return "null";
+  if (vm_is_int(value)) return "integer";
+  if (value == VM_TRUE || value == VM_FALSE) return "boolean";
+  switch (gc_get_type(value)) {
+    case 'S': return "string";
+    case 'L': return "list";
+    case 'D': return "dictionary";
+  }
+  if (_vm_is_struct(value, VM_OBJECT_NAME)) return ((VMObject*) value)->class_def->name->cstring;
+  if (_vm_is_struct(value, VM_CLASS_NAME)) return "class";
+  return "function";
+}
+
+void vm_fail(VM* vm, String* message) {
+  if (vm->error != NULL) gc_release_item(vm->error);
+  vm->error = message;
+  if (message != NULL) gc_save_item(message);
+}
+
+void vm_fail_chars(VM* vm, const char* message) {
+  vm_fail(vm, new_string(message));
+}
+
+// Counts an allocation by the program and runs the GC when there have been enough of them. Only
+// call this when every live value is on the stack below vm->sp.
+void vm_note_allocation(VM* vm) {
+  if (++vm->allocations < VM_GC_INTERVAL) return;
+  gc_init_pass();
+  for (VMValue* value = vm->stack; value < vm->sp; ++value) {
+    if (vm_is_object(*value)) gc_tag_item(*value);
+  }
+  gc_run();
+  vm->allocations = 0;
+}
+
+void _vm_append_value(StringBuilder* sb, VMValue value, int depth) {
+  if (value == VM_NULL) {
+    string_builder_append_chars(sb, "null");
+  } else if (vm_is_int(value)) {
+    string_builder_append_int(sb, vm_int_value(value));
+  } else if (value == VM_TRUE || value == VM_FALSE) {
+    string_builder_append_chars(sb, value == VM_TRUE ? "true" : "false");
+  } else if (depth > 16) {
+    string_builder_append_chars(sb, "...");
+  } else {
+    switch (gc_get_type(value)) {
+      case 'S':
+        string_builder_append_chars(sb, ((String*) value)->cstring);
+        break;
+      case 'L':
+        {
+          List* list = (List*) value;
+          string_builder_append_char(sb, '[');
+          for (int i = 0; i < list->length; ++i) {
+            if (i > 0) string_builder_append_chars(sb, ", ");
+            _vm_append_value(sb, list->items[i], depth + 1);
+          }
+          string_builder_append_char(sb, ']');
+        }
+        break;
+      case 'D':
+        {
+          Dictionary* dict = (Dictionary*) value;
+          string_builder_append_char(sb, '{');
+          for (int i = 0; i < dict->size; ++i) {
+            if (i > 0) string_builder_append_chars(sb, ", ");
+            string_builder_append_chars(sb, dict->keys[i]->cstring);
+            string_builder_append_chars(sb, ": ");
+            _vm_append_value(sb, dict->values[i], depth + 1);
+          }
+          string_builder_append_char(sb, '}');
+        }
+        break;
+      default:
+        if (_vm_is_struct(value, VM_OBJECT_NAME) || _vm_is_struct(value, VM_CLASS_NAME)) {
+          int is_object = _vm_is_struct(value, VM_OBJECT_NAME);
+          string_builder_append_chars(sb, is_object ? "<instance of " : "<class ");
+          string_builder_append_chars(sb, (is_object ? ((VMObject*) value)->class_def : (VMClass*) value)->name->cstring);
+          string_builder_append_char(sb, '>');
+          break;
+        }
+        string_builder_append_chars(sb, "<function ");
+        if (_vm_is_struct(value, VM_FUNCTION_NAME)) {
+          string_builder_append_chars(sb, ((VMFunction*) value)->bytecode->name->cstring);
+        } else {
+          string_builder_append_chars(sb, ((VMNativeFunction*) value)->name->cstring);
+        }
+        string_builder_append_char(sb, '>');
+        break;
+    }
+  }
+}
+
+String* vm_value_to_string(VMValue value) {
+  if (_vm_type_is(value, 'S')) return (String*) value;
+  StringBuilder* sb = new_string_builder();
+  _vm_append_value(sb, value, 0);
+  return string_builder_to_string_and_free(sb);
+}
+
+int vm_is_truthy(VMValue value) {
+  if (value == VM_TRUE) return 1;
+  if (value == VM_FALSE || value == VM_NULL) return 0;
+  if (vm_is_int(value)) return vm_int_value(value) != 0;
+  if (gc_get_type(value) == 'S') return ((String*) value)->length > 0;
+  return 1;
+}
+
+int vm_equals(VMValue a, VMValue b) {
+  if (a == b) return 1;
+  return _vm_type_is(a, 'S') && _vm_type_is(b, 'S') && string_equals((String*) a, (String*) b);
+}
+
+VMValue _vm_int_result(VM* vm, long long value) {
+  if (value < -2147483647LL - 1 || value > 2147483647LL) {
+    vm_fail_chars(vm, "Integer overflow.");
+    return VM_NULL;
+  }
+  return vm_int((int) value);
+}
+
+const char* _vm_operator_symbol(int op) {
+  switch (op) {
+    case BC_ADD: return "+";
+    case BC_SUB: return "-";
+    case BC_MUL: return "*";
+    case BC_DIV: return "/";
+    case BC_MOD: return "%";
+    case BC_POW: return "**";
+    case BC_BIT_AND: return "&";
+    case BC_BIT_OR: return "|";
+    case BC_BIT_XOR: return "^";
+    case BC_SHL: return "<<";
+    default: return ">>";
+  }
+}
+
+// The binary operators other than the comparisons. Sets an error if the operands don't support it.
+VMValue _vm_binary_op(VM* vm, int op, VMValue a, VMValue b) {
+  if (vm_is_int(a) && vm_is_int(b)) {
+    long long x = vm_int_value(a);
+    long long y = vm_int_value(b);
+    switch (op) {
+      case BC_ADD: return _vm_int_result(vm, x + y);
+      case BC_SUB: return _vm_int_result(vm, x - y);
+      case BC_MUL: return _vm_int_result(vm, x * y);
+      case BC_DIV:
+      case BC_MOD:
+        {
+          if (y == 0) {
+            vm_fail_chars(vm, "Division by zero.");
+            return VM_NULL;
+          }
+          long long quotient = x / y;
+          long long remainder = x % y;
+          if (remainder != 0 && (remainder < 0) != (y < 0)) {
+            quotient--;
+            remainder += y;
+          }
+          return _vm_int_result(vm, op == BC_DIV ? quotient : remainder);
+        }
+      case BC_POW:
+        {
+          if (y < 0) {
+            vm_fail_chars(vm, "Negative exponents are not supported for integers.");
+            return VM_NULL;
+          }
+          if (x == 0 || x == 1) return vm_int(y == 0 ? 1 : (int) x);
+          if (x == -1) return vm_int((y & 1) == 0 ? 1 : -1);
+          // Any other base overflows within 32 multiplications.
+          long long result = 1;
+          for (long long i = 0; i < y; ++i) {
+            result *= x;
+            if (result < -2147483647LL - 1 || result > 2147483647LL) break;
+          }
+          return _vm_int_result(vm, result);
+        }
+      case BC_BIT_AND: return vm_int((int) (x & y));
+      case BC_BIT_OR: return vm_int((int) (x | y));
+      case BC_BIT_XOR: return vm_int((int) (x ^ y));
+      case BC_SHL:
+      case BC_SHR:
+        if (y < 0) {
+          vm_fail_chars(vm, "Negative shift count.");
+          return VM_NULL;
+        }
+        if (op == BC_SHR) return vm_int((int) (x >> (y > 63 ? 63 : y)));
+        if (x == 0) return vm_int(0);
+        return y > 31 ? _vm_int_result(vm, 1LL << 32) : _vm_int_result(vm, x * (1LL << y));
+    }
+  }
+
+  if (op == BC_ADD && (_vm_type_is(a, 'S') || _vm_type_is(b, 'S')) &&
+      (_vm_type_is(a, 'S') || vm_is_int(a)) && (_vm_type_is(b, 'S') || vm_is_int(b))) {
+    StringBuilder* sb = new_string_builder();
+    _vm_append_value(sb, a, 0);
+    _vm_append_value(sb, b, 0);
+    return string_builder_to_string_and_free(sb);
+  }
+
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, "The operator ");
+  string_builder_append_chars(sb, _vm_operator_symbol(op));
+  string_builder_append_chars(sb, " can't be used on a ");
+  string_builder_append_chars(sb, vm_type_name(a));
+  string_builder_append_chars(sb, " and a ");
+  string_builder_append_chars(sb, vm_type_name(b));
+  string_builder_append_char(sb, '.');
+  vm_fail(vm, string_builder_to_string_and_free(sb));
+  return VM_NULL;
+}
+
+// <, >, <= and >= on two integers or two strings.
+VMValue _vm_compare(VM* vm, int op, VMValue a, VMValue b) {
+  int order;
+  if (vm_is_int(a) && vm_is_int(b)) {
+    order = vm_int_value(a) < vm_int_value(b) ? -1 : vm_int_value(a) > vm_int_value(b) ? 1 : 0;
+  } else if (_vm_type_is(a, 'S') && _vm_type_is(b, 'S')) {
+    order = strcmp(((String*) a)->cstring, ((String*) b)->cstring);
+  } else {
+    vm_fail(vm, string_concat5("Cannot compare ", vm_type_name(a), " and ", vm_type_name(b), "."));
+    return VM_NULL;
+  }
+  switch (op) {
+    case BC_LT: return vm_bool(order < 0);
+    case BC_GT: return vm_bool(order > 0);
+    case BC_LE: return vm_bool(order <= 0);
+    default: return vm_bool(order >= 0);
+  }
+}
+
+// Returns the entry of the cache for the receiver, or NULL on a miss. name is the instruction's name.
+VMCacheEntry* _vm_cache_find(VMInlineCache* cache, VMValue root, String* name) {
+  if (!vm_is_object(root)) return NULL;
+  int type = gc_get_type(root);
+  for (int i = 0; i < cache->count; ++i) {
+    VMCacheEntry* entry = &cache->entries[i];
+    if (entry->type != type) continue;
+    if (type == 'D') {
+      Dictionary* dict = (Dictionary*) root;
+      if (entry->slot < dict->size && dict->keys[entry->slot] == name) return entry;
+    } else if (type == 'C') {
+      // Only instances are cached among the structs, and no other struct starts with a VMClass.
+      if (entry->shape == ((VMObject*) root)->class_def) return entry;
+    } else {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Returns the new entry, or NULL if the site doesn't cache anymore.
+VMCacheEntry* _vm_cache_add(VMInlineCache* cache, int type, int slot) {
+  if (cache->count == -1) return NULL;
+  if (cache->count == VM_INLINE_CACHE_SIZE) {
+    cache->count = -1;
+    return NULL;
+  }
+  VMCacheEntry* entry = &cache->entries[cache->count++];
+  entry->type = type;
+  entry->slot = slot;
+  entry->shape = NULL;
+  entry->method = NULL;
+  return entry;
+}
+
+// The slot of a field of an instance, or -1 and an error if the class has no such field. Fills in the cache.
+int _vm_field_slot(VM* vm, VMInlineCache* cache, VMObject* object, String* name) {
+  VMValue slot = dictionary_get(object->class_def->field_slots, name);
+  if (slot == NULL) {
+    vm_fail(vm, string_concat5("The class '", object->class_def->name->cstring, "' has no field named '", name->cstring, "'."));
+    return -1;
+  }
+  VMCacheEntry* entry = _vm_cache_add(cache, 'C', vm_int_value(slot));
+  if (entry != NULL) entry->shape = object->class_def;
+  return vm_int_value(slot);
+}
+
+// The method of an instance, or NULL and an error if the class has no such method. Fills in the cache.
+VMFunction* _vm_find_method(VM* vm, VMInlineCache* cache, VMObject* object, String* name) {
+  VMFunction* method = (VMFunction*) dictionary_get(object->class_def->methods, name);
+  if (method == NULL) {
+    vm_fail(vm, string_concat5("The class '", object->class_def->name->cstring, "' has no method named '", name->cstring, "'."));
+    return NULL;
+  }
+  VMCacheEntry* entry = _vm_cache_add(cache, 'C', 0);
+  if (entry != NULL) {
+    entry->shape = object->class_def;
+    entry->method = method;
+  }
+  return method;
+}
+
+// A new instance with the field defaults of its class. Dictionary defaults are copied for each instance.
+VMObject* _vm_new_object(VMClass* cls);
+
+// Adds the position of name in dict to the cache, if the key there is the same instance as name.
+void _vm_cache_add_key(VMInlineCache* cache, Dictionary* dict, String* name) {
+  int slot = _dict_get_index(dict, name, 0);
+  if (slot != -1 && dict->keys[slot] == name) _vm_cache_add(cache, 'D', slot);
+}
+
+// DOT_GET on a cache miss. Fills in the cache for next time.
+VMValue _vm_dot_get(VM* vm, VMInlineCache* cache, VMValue root, String* name) {
+  if (_vm_type_is(root, 'D')) {
+    _vm_cache_add_key(cache, (Dictionary*) root, name);
+    return dictionary_get((Dictionary*) root, name); // missing fields are null
+  }
+  if (_vm_is_struct(root, VM_OBJECT_NAME)) {
+    int slot = _vm_field_slot(vm, cache, (VMObject*) root, name);
+    return slot == -1 ? VM_NULL : ((VMObject*) root)->fields[slot];
+  }
+  if (string_equals_chars(name, "length") && (_vm_type_is(root, 'L') || _vm_type_is(root, 'S'))) {
+    _vm_cache_add(cache, gc_get_type(root), 0);
+    return vm_int(_vm_type_is(root, 'L') ? ((List*) root)->length : ((String*) root)->length);
+  }
+  vm_fail(vm, string_concat5("A ", vm_type_name(root), " has no field named '", name->cstring, "'."));
+  return VM_NULL;
+}
+
+// DOT_SET on a cache miss. Fills in the cache for next time.
+void _vm_dot_set(VM* vm, VMInlineCache* cache, VMValue root, String* name, VMValue value) {
+  if (_vm_type_is(root, 'D')) {
+    dictionary_set((Dictionary*) root, name, value);
+    _vm_cache_add_key(cache, (Dictionary*) root, name);
+    return;
+  }
+  if (_vm_is_struct(root, VM_OBJECT_NAME)) {
+    int slot = _vm_field_slot(vm, cache, (VMObject*) root, name);
+    if (slot != -1) ((VMObject*) root)->fields[slot] = value;
+    return;
+  }
+  vm_fail(vm, string_concat5("Cannot set the field '", name->cstring, "' of a ", vm_type_name(root), "."));
+}
+
+// Checks that index is an integer within the bounds of a list or string of the given length.
+int _vm_check_position(VM* vm, VMValue index, int length) {
+  if (!vm_is_int(index)) {
+    vm_fail(vm, string_concat3("A list or string index must be an integer, not a ", vm_type_name(index), "."));
+    return 0;
+  }
+  int i = vm_int_value(index);
+  if (i < 0 || i >= length) {
+    StringBuilder* sb = new_string_builder();
+    string_builder_append_chars(sb, "Index ");
+    string_builder_append_int(sb, i);
+    string_builder_append_chars(sb, " is out of range for a length of ");
+    string_builder_append_int(sb, length);
+    string_builder_append_char(sb, '.');
+    vm_fail(vm, string_builder_to_string_and_free(sb));
+    return 0;
+  }
+  return 1;
+}
+
+int _vm_check_key(VM* vm, VMValue key) {
+  if (_vm_type_is(key, 'S')) return 1;
+  vm_fail(vm, string_concat3("A dictionary key must be a string, not a ", vm_type_name(key), "."));
+  return 0;
+}
+
+VMValue _vm_index_get(VM* vm, VMValue root, VMValue index) {
+  if (_vm_type_is(root, 'L')) {
+    List* list = (List*) root;
+    return _vm_check_position(vm, index, list->length) ? list->items[vm_int_value(index)] : VM_NULL;
+  }
+  if (_vm_type_is(root, 'D')) {
+    return _vm_check_key(vm, index) ? dictionary_get((Dictionary*) root, (String*) index) : VM_NULL;
+  }
+  if (_vm_type_is(root, 'S')) {
+    String* str = (String*) root;
+    if (!_vm_check_position(vm, index, str->length)) return VM_NULL;
+    int i = vm_int_value(index);
+    return new_string_from_range(str->cstring, i, i + 1);
+  }
+  vm_fail(vm, string_concat3("A ", vm_type_name(root), " can't be indexed."));
+  return VM_NULL;
+}
+
+void _vm_index_set(VM* vm, VMValue root, VMValue index, VMValue value) {
+  if (_vm_type_is(root, 'L')) {
+    List* list = (List*) root;
+    if (_vm_check_position(vm, index, list->length)) list->items[vm_int_value(index)] = value;
+  } else if (_vm_type_is(root, 'D')) {
+    if (_vm_check_key(vm, index)) dictionary_set((Dictionary*) root, (String*) index, value);
+  } else {
+    vm_fail(vm, string_concat3("Cannot set an index of a ", vm_type_name(root), "."));
+  }
+}
+
+Dictionary* _vm_clone_dictionary(Dictionary* original) {
+  Dictionary* dict = new_dictionary();
+  for (int i = 0; i < original->size; ++i) {
+    VMValue value = original->values[i];
+    if (_vm_type_is(value, 'D')) value = _vm_clone_dictionary((Dictionary*) value);
+    dictionary_set(dict, original->keys[i], value);
+  }
+  return dict;
+}
+
+VMObject* _vm_new_object(VMClass* cls) {
+  VMObject* object = (VMObject*) gc_create_struct(sizeof(VMObject) + sizeof(VMValue) * cls->field_count, VM_OBJECT_NAME, 1 + cls->field_count);
+  object->class_def = cls;
+  for (int i = 0; i < cls->field_count; ++i) {
+    VMValue value = cls->field_defaults[i];
+    object->fields[i] = _vm_type_is(value, 'D') ? _vm_clone_dictionary((Dictionary*) value) : value;
+  }
+  return object;
+}
+
+int _vm_check_arg_count(VM* vm, String* name, int argc, int expected) {
+  if (argc == expected) return 1;
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, "The method '");
+  string_builder_append_chars(sb, name->cstring);
+  string_builder_append_chars(sb, "' takes ");
+  string_builder_append_int(sb, expected);
+  string_builder_append_chars(sb, expected == 1 ? " argument." : " arguments.");
+  vm_fail(vm, string_builder_to_string_and_free(sb));
+  return 0;
+}
+
+// The enum VMBuiltinMethod for a method of the built in types, or VM_METHOD_NONE.
+int _vm_find_builtin_method(VMValue root, String* name) {
+  if (_vm_type_is(root, 'L')) {
+    if (string_equals_chars(name, "add")) return VM_METHOD_LIST_ADD;
+    if (string_equals_chars(name, "pop")) return VM_METHOD_LIST_POP;
+  } else if (_vm_type_is(root, 'D')) {
+    if (string_equals_chars(name, "keys")) return VM_METHOD_DICT_KEYS;
+    if (string_equals_chars(name, "values")) return VM_METHOD_DICT_VALUES;
+    if (string_equals_chars(name, "contains")) return VM_METHOD_DICT_CONTAINS;
+  }
+  return VM_METHOD_NONE;
+}
+
+VMValue _vm_call_builtin_method(VM* vm, int method, VMValue root, String* name, VMValue* args, int argc) {
+  switch (method) {
+    case VM_METHOD_LIST_ADD:
+      if (_vm_check_arg_count(vm, name, argc, 1)) list_add((List*) root, args[0]);
+      return VM_NULL;
+    case VM_METHOD_LIST_POP:
+      if (!_vm_check_arg_count(vm, name, argc, 0)) return VM_NULL;
+      if (((List*) root)->length == 0) {
+        vm_fail_chars(vm, "Cannot pop from an empty list.");
+        return VM_NULL;
+      }
+      return list_pop((List*) root);
+    case VM_METHOD_DICT_KEYS:
+    case VM_METHOD_DICT_VALUES:
+      if (!_vm_check_arg_count(vm, name, argc, 0)) return VM_NULL;
+      return method == VM_METHOD_DICT_KEYS ? dictionary_get_keys((Dictionary*) root) : dictionary_get_values((Dictionary*) root);
+    case VM_METHOD_DICT_CONTAINS:
+      if (!_vm_check_arg_count(vm, name, argc, 1) || !_vm_check_key(vm, args[0])) return VM_NULL;
+      return vm_bool(dictionary_has_key((Dictionary*) root, (String*) args[0]));
+  }
+  vm_fail(vm, string_concat5("A ", vm_type_name(root), " has no method named '", name->cstring, "'."));
+  return VM_NULL;
+}
+
+/*
+  CALL on a class. Replaces the class on the stack with a new instance, which is this for the
+  constructor and what it returns. Returns the constructor to call, or NULL if there is none. Call
+  with vm->sp set, since the instance counts as an allocation.
+*/
+VMFunction* _vm_construct(VM* vm, VMValue* callee, int argc) {
+  VMClass* cls = (VMClass*) *callee;
+  *callee = _vm_new_object(cls);
+  vm_note_allocation(vm);
+  if (cls->constructor == NULL && argc != 0) {
+    vm_fail(vm, string_concat3("The class '", cls->name->cstring, "' has no constructor and takes no arguments."));
+  }
+  return cls->constructor;
+}
+
+// Decodes a function's bytecode into instructions the first time it is called.
+void _vm_prepare_function(VM* vm, VMFunction* fn);
+
+#ifdef VM_JIT
+const void* _vm_jit_enter_handler = NULL;
+const void* _vm_jump_back_handler = NULL;
+void _vm_jit_compile(VM* vm, VMFunction* fn);
+void _vm_jit_discard(VMFunction* fn);
+#endif
+
+// Pushes a frame for a call with argc arguments at args. The frame's locals start at args. For a method
+// the first argument is this, and argc counts it.
+int _vm_push_frame(VM* vm, VMFunction* fn, VMValue* args, int argc) {
+  BytecodeFunction* bytecode = fn->bytecode;
+  int given = argc - bytecode->is_method;
+  if (given < bytecode->required_arg_count || given > bytecode->arg_count) {
+    StringBuilder* sb = new_string_builder();
+    string_builder_append_chars(sb, "The function '");
+    string_builder_append_chars(sb, bytecode->name->cstring);
+    string_builder_append_chars(sb, "' takes ");
+    if (bytecode->required_arg_count != bytecode->arg_count) {
+      string_builder_append_int(sb, bytecode->required_arg_count);
+      string_builder_append_chars(sb, " to ");
+    }
+    string_builder_append_int(sb, bytecode->arg_count);
+    string_builder_append_chars(sb, bytecode->arg_count == 1 ? " argument but was given " : " arguments but was given ");
+    string_builder_append_int(sb, given);
+    string_builder_append_char(sb, '.');
+    vm_fail(vm, string_builder_to_string_and_free(sb));
+    return 0;
+  }
+  if (vm->frame_count == VM_MAX_FRAMES) {
+    vm_fail_chars(vm, "Maximum recursion depth exceeded.");
+    return 0;
+  }
+  if (args + bytecode->local_count + bytecode->max_stack > vm->stack_end) {
+    vm_fail_chars(vm, "Stack overflow.");
+    return 0;
+  }
+  if (fn->code == NULL) _vm_prepare_function(vm, fn);
+#ifdef VM_JIT
+  if (++fn->hotness == VM_JIT_THRESHOLD) _vm_jit_compile(vm, fn);
+#endif
+  for (int i = argc; i < bytecode->local_count; ++i) {
+    args[i] = VM_NULL;
+  }
+  VMFrame* frame = &vm->frames[vm->frame_count++];
+  frame->function = fn;
+  frame->locals = args;
+  frame->ip = fn->code + fn->entry_points[given - bytecode->required_arg_count];
+  return 1;
+}
+
+String* _vm_locate_error(String* message, VMFunction* fn, int line) {
+  StringBuilder* sb = new_string_builder();
+  string_builder_append_chars(sb, fn->bytecode->source_path->cstring);
+  string_builder_append_chars(sb, " Line ");
+  string_builder_append_int(sb, line);
+  string_builder_append_chars(sb, " in ");
+  string_builder_append_chars(sb, fn->bytecode->name->cstring);
+  string_builder_append_chars(sb, ": ");
+  string_builder_append_chars(sb, message->cstring);
+  return string_builder_to_string_and_free(sb);
+}
+
+/*
+  Runs the top frame until the frame at index stop_frame_count returns. Returns 1 with its result in
+  vm->result, or 0 with vm->error set. Called with vm NULL only to fill in _vm_handlers.
+*/
+int _vm_execute(VM* vm, int stop_frame_count) {
+#ifdef VM_THREADED
+  static const void* handlers[BC_OP_COUNT] = {
+    [BC_PUSH_NULL] = &&vm_op_PUSH_NULL, [BC_PUSH_TRUE] = &&vm_op_PUSH_TRUE, [BC_PUSH_FALSE] = &&vm_op_PUSH_FALSE,
+    [BC_PUSH_INT] = &&vm_op_PUSH_INT, [BC_PUSH_CONST] = &&vm_op_PUSH_CONST, [BC_CLONE_CONST] = &&vm_op_CLONE_CONST,
+    [BC_LOAD_LOCAL] = &&vm_op_LOAD_LOCAL, [BC_STORE_LOCAL] = &&vm_op_STORE_LOCAL, [BC_LOAD_GLOBAL] = &&vm_op_LOAD_GLOBAL,
+    [BC_LOAD_FUNCTION] = &&vm_op_LOAD_FUNCTION, [BC_LOAD_CLASS] = &&vm_op_LOAD_CLASS,
+    [BC_DOT_GET] = &&vm_op_DOT_GET, [BC_DOT_SET] = &&vm_op_DOT_SET,
+    [BC_GET_FIELD] = &&vm_op_GET_FIELD, [BC_SET_FIELD] = &&vm_op_SET_FIELD, [BC_INDEX_GET] = &&vm_op_INDEX_GET,
+    [BC_INDEX_SET] = &&vm_op_INDEX_SET, [BC_NEW_DICT] = &&vm_op_NEW_DICT,
+    [BC_ADD] = &&vm_op_ADD, [BC_SUB] = &&vm_op_SUB, [BC_MUL] = &&vm_op_MUL, [BC_DIV] = &&vm_op_DIV,
+    [BC_MOD] = &&vm_op_MOD, [BC_POW] = &&vm_op_POW, [BC_BIT_AND] = &&vm_op_BIT_AND, [BC_BIT_OR] = &&vm_op_BIT_OR,
+    [BC_BIT_XOR] = &&vm_op_BIT_XOR, [BC_SHL] = &&vm_op_SHL, [BC_SHR] = &&vm_op_SHR,
+    [BC_EQ] = &&vm_op_EQ, [BC_NE] = &&vm_op_NE, [BC_LT] = &&vm_op_LT, [BC_GT] = &&vm_op_GT,
+    [BC_LE] = &&vm_op_LE, [BC_GE] = &&vm_op_GE,
+    [BC_JUMP] = &&vm_op_JUMP, [BC_JUMP_IF_FALSE] = &&vm_op_JUMP_IF_FALSE,
+    [BC_JUMP_IF_FALSE_OR_POP] = &&vm_op_JUMP_IF_FALSE_OR_POP, [BC_JUMP_IF_TRUE_OR_POP] = &&vm_op_JUMP_IF_TRUE_OR_POP,
+    [BC_ITER_START] = &&vm_op_ITER_START, [BC_ITER_NEXT] = &&vm_op_ITER_NEXT,
+    [BC_CALL] = &&vm_op_CALL, [BC_CALL_FUNCTION] = &&vm_op_CALL_FUNCTION, [BC_CALL_METHOD] = &&vm_op_CALL_METHOD,
+    [BC_POP] = &&vm_op_POP, [BC_DUP] = &&vm_op_DUP, [BC_DUP2] = &&vm_op_DUP2,
+    [BC_RETURN] = &&vm_op_RETURN, [BC_RETURN_NULL] = &&vm_op_RETURN_NULL,
+  };
+  if (vm == NULL) {
+    _vm_handlers = handlers;
+#ifdef VM_JIT
+    _vm_jit_enter_handler = &&vm_jit_enter;
+    _vm_jump_back_handler = &&vm_jump_back;
+#endif
+    return 0;
+  }
+#define VM_CASE(name) vm_op_##name:
+#define VM_DISPATCH() goto *ip->handler
+#else
+  if (vm == NULL) return 0;
+#define VM_CASE(name) case BC_##name:
+#define VM_DISPATCH() goto vm_dispatch
+#endif
+#define VM_NEXT() do { ++ip; VM_DISPATCH(); } while (0)
+#define VM_CHECK_ERROR() if (vm->error != NULL) goto vm_error
+#define VM_ALLOCATED() do { vm->sp = sp; vm_note_allocation(vm); } while (0)
+#define VM_LOAD_FRAME() do { \
+    frame = &vm->frames[vm->frame_count - 1]; \
+    ip = frame->ip; \
+    code = frame->function->code; \
+    locals = frame->locals; \
+  } while (0)
+#define VM_ENTER_FRAME() do { \
+    VM_LOAD_FRAME(); \
+    sp = locals + frame->function->local_count; \
+  } while (0)
+
+  VMFrame* frame;
+  VMInstruction* ip;
+  VMInstruction* code;
+  VMValue* locals;
+  VMValue* sp = vm->sp;
+  VMValue result;
+  VMValue a;
+  VMValue b;
+  VMCacheEntry* entry;
+  VM_LOAD_FRAME();
+
+#ifdef VM_THREADED
+  VM_DISPATCH();
+#else
+vm_dispatch:
+  switch (ip->op) {
+#endif
+
+  VM_CASE(PUSH_NULL)
+  VM_CASE(PUSH_TRUE)
+  VM_CASE(PUSH_FALSE)
+  VM_CASE(PUSH_INT)
+  VM_CASE(PUSH_CONST)
+  VM_CASE(LOAD_CLASS)
+    *sp++ = ip->value;
+    VM_NEXT();
+
+  VM_CASE(CLONE_CONST)
+    *sp++ = _vm_clone_dictionary((Dictionary*) ip->value);
+    VM_ALLOCATED();
+    VM_NEXT();
+
+  VM_CASE(LOAD_LOCAL)
+    *sp++ = locals[ip->arg];
+    VM_NEXT();
+
+  VM_CASE(STORE_LOCAL)
+    locals[ip->arg] = *--sp;
+    VM_NEXT();
+
+  VM_CASE(LOAD_GLOBAL)
+    if (!vm->globals_defined[ip->arg]) {
+      vm_fail(vm, string_concat3("'", list_get_string(vm->module->global_names, ip->arg)->cstring, "' is not defined."));
+      goto vm_error;
+    }
+    *sp++ = vm->globals[ip->arg];
+    VM_NEXT();
+
+  VM_CASE(LOAD_FUNCTION)
+    *sp++ = vm->functions[ip->arg];
+    VM_NEXT();
+
+  VM_CASE(DOT_GET)
+    a = sp[-1];
+    entry = _vm_cache_find(ip->cache, a, (String*) ip->value);
+    if (entry != NULL) {
+      if (entry->type == 'D') {
+        sp[-1] = ((Dictionary*) a)->values[entry->slot];
+      } else if (entry->type == 'C') {
+        sp[-1] = ((VMObject*) a)->fields[entry->slot];
+      } else {
+        sp[-1] = vm_int(entry->type == 'L' ? ((List*) a)->length : ((String*) a)->length);
+      }
+      VM_NEXT();
+    }
+    sp[-1] = _vm_dot_get(vm, ip->cache, a, (String*) ip->value);
+    VM_CHECK_ERROR();
+    VM_NEXT();
+
+  VM_CASE(DOT_SET)
+    a = sp[-2];
+    entry = _vm_cache_find(ip->cache, a, (String*) ip->value);
+    if (entry != NULL && entry->type == 'C') {
+      ((VMObject*) a)->fields[entry->slot] = sp[-1];
+    } else if (entry != NULL) {
+      ((Dictionary*) a)->values[entry->slot] = sp[-1];
+    } else {
+      _vm_dot_set(vm, ip->cache, a, (String*) ip->value, sp[-1]);
+      VM_CHECK_ERROR();
+    }
+    sp -= 2;
+    VM_NEXT();
+
+  // The resolver only emits these with this as the root, which is always an instance of the class.
+  VM_CASE(GET_FIELD)
+    sp[-1] = ((VMObject*) sp[-1])->fields[ip->arg];
+    VM_NEXT();
+
+  VM_CASE(SET_FIELD)
+    ((VMObject*) sp[-2])->fields[ip->arg] = sp[-1];
+    sp -= 2;
+    VM_NEXT();
+
+  VM_CASE(INDEX_GET)
+    sp[-2] = _vm_index_get(vm, sp[-2], sp[-1]);
+    VM_CHECK_ERROR();
+    --sp;
+    if (_vm_type_is(sp[-1], 'S')) VM_ALLOCATED();
+    VM_NEXT();
+
+  VM_CASE(INDEX_SET)
+    _vm_index_set(vm, sp[-3], sp[-2], sp[-1]);
+    VM_CHECK_ERROR();
+    sp -= 3;
+    VM_NEXT();
+
+  VM_CASE(NEW_DICT)
+    {
+      Dictionary* dict = new_dictionary();
+      sp -= 2 * ip->arg;
+      for (int i = 0; i < ip->arg; ++i) {
+        // The resolver only allows string constants as keys.
+        dictionary_set(dict, (String*) sp[2 * i], sp[2 * i + 1]);
+      }
+      *sp++ = dict;
+      VM_ALLOCATED();
+    }
+    VM_NEXT();
+
+  VM_CASE(ADD)
+    a = sp[-2];
+    b = sp[-1];
+    if (vm_is_int(a) && vm_is_int(b)) {
+      long long sum = (long long) vm_int_value(a) + vm_int_value(b);
+      if (sum < -2147483647LL - 1 || sum > 2147483647LL) goto vm_binary_op;
+      sp[-2] = vm_int((int) sum);
+      --sp;
+      VM_NEXT();
+    }
+    goto vm_binary_op;
+
+  VM_CASE(SUB)
+    a = sp[-2];
+    b = sp[-1];
+    if (vm_is_int(a) && vm_is_int(b)) {
+      long long difference = (long long) vm_int_value(a) - vm_int_value(b);
+      if (difference < -2147483647LL - 1 || difference > 2147483647LL) goto vm_binary_op;
+      sp[-2] = vm_int((int) difference);
+      --sp;
+      VM_NEXT();
+    }
+    goto vm_binary_op;
+
+  VM_CASE(MOD)
+    a = sp[-2];
+    b = sp[-1];
+    if (vm_is_int(a) && vm_is_int(b) && vm_int_value(a) >= 0 && vm_int_value(b) > 0) {
+      sp[-2] = vm_int(vm_int_value(a) % vm_int_value(b));
+      --sp;
+      VM_NEXT();
+    }
+    goto vm_binary_op;
+
+  VM_CASE(MUL)
+  VM_CASE(DIV)
+  VM_CASE(POW)
+  VM_CASE(BIT_AND)
+  VM_CASE(BIT_OR)
+  VM_CASE(BIT_XOR)
+  VM_CASE(SHL)
+  VM_CASE(SHR)
+  vm_binary_op:
+    sp[-2] = _vm_binary_op(vm, ip->op, sp[-2], sp[-1]);
+    VM_CHECK_ERROR();
+    --sp;
+    if (!vm_is_int(sp[-1])) VM_ALLOCATED();
+    VM_NEXT();
+
+  VM_CASE(EQ)
+    sp[-2] = vm_bool(sp[-2] == sp[-1] || vm_equals(sp[-2], sp[-1]));
+    --sp;
+    VM_NEXT();
+
+  VM_CASE(NE)
+    sp[-2] = vm_bool(sp[-2] != sp[-1] && !vm_equals(sp[-2], sp[-1]));
+    --sp;
+    VM_NEXT();
+
+  // Integers are ordered the same as their tagged words, so those compare without untagging.
+  VM_CASE(LT)
+    a = sp[-2];
+    b = sp[-1];
+    if (vm_is_int(a) && vm_is_int(b)) {
+      sp[-2] = vm_bool((intptr_t) a < (intptr_t) b);
+      --sp;
+      VM_NEXT();
+    }
+    goto vm_compare;
+
+  VM_CASE(GT)
+    a = sp[-2];
+    b = sp[-1];
+    if (vm_is_int(a) && vm_is_int(b)) {
+      sp[-2] = vm_bool((intptr_t) a > (intptr_t) b);
+      --sp;
+      VM_NEXT();
+    }
+    goto vm_compare;
+
+  VM_CASE(LE)
+  VM_CASE(GE)
+  vm_compare:
+    sp[-2] = _vm_compare(vm, ip->op, sp[-2], sp[-1]);
+    VM_CHECK_ERROR();
+    --sp;
+    VM_NEXT();
+
+  VM_CASE(JUMP)
+    ip = code + ip->arg;
+    VM_DISPATCH();
+
+  VM_CASE(JUMP_IF_FALSE)
+    a = *--sp;
+    if (a == VM_TRUE || (a != VM_FALSE && vm_is_truthy(a))) VM_NEXT();
+    ip = code + ip->arg;
+    VM_DISPATCH();
+
+  VM_CASE(JUMP_IF_FALSE_OR_POP)
+    if (vm_is_truthy(sp[-1])) {
+      --sp;
+      VM_NEXT();
+    }
+    ip = code + ip->arg;
+    VM_DISPATCH();
+
+  VM_CASE(JUMP_IF_TRUE_OR_POP)
+    if (!vm_is_truthy(sp[-1])) {
+      --sp;
+      VM_NEXT();
+    }
+    ip = code + ip->arg;
+    VM_DISPATCH();
+
+  VM_CASE(ITER_START)
+    if (!_vm_type_is(sp[-1], 'L')) {
+      vm_fail(vm, string_concat3("Only a list can be iterated over, not a ", vm_type_name(sp[-1]), "."));
+      goto vm_error;
+    }
+    *sp++ = vm_int(0);
+    VM_NEXT();
+
+  VM_CASE(ITER_NEXT)
+    {
+      List* list = (List*) sp[-2];
+      int position = vm_int_value(sp[-1]);
+      if (position < list->length) {
+        locals[ip->arg] = list->items[position];
+        sp[-1] = vm_int(position + 1);
+        VM_NEXT();
+      }
+      sp -= 2;
+      ip = code + ip->extra;
+    }
+    VM_DISPATCH();
+
+  VM_CASE(CALL)
+    {
+      int argc = ip->arg;
+      VMValue* callee = sp - argc - 1;
+      if (_vm_is_struct(*callee, VM_FUNCTION_NAME)) {
+        VMFunction* fn = (VMFunction*) *callee;
+        memmove(callee, callee + 1, sizeof(VMValue) * argc);
+        --sp;
+        frame->ip = ip + 1;
+        if (!_vm_push_frame(vm, fn, callee, argc)) goto vm_error;
+        VM_ENTER_FRAME();
+        VM_DISPATCH();
+      }
+      if (_vm_is_struct(*callee, VM_NATIVE_FUNCTION_NAME)) {
+        vm->sp = sp;
+        result = ((VMNativeFunction*) *callee)->callback(vm, callee + 1, argc);
+        VM_CHECK_ERROR();
+        sp = callee;
+        *sp++ = result;
+        VM_NEXT();
+      }
+      if (_vm_is_struct(*callee, VM_CLASS_NAME)) {
+        vm->sp = sp;
+        VMFunction* constructor = _vm_construct(vm, callee, argc);
+        VM_CHECK_ERROR();
+        if (constructor == NULL) VM_NEXT();
+        frame->ip = ip + 1;
+        if (!_vm_push_frame(vm, constructor, callee, argc + 1)) goto vm_error;
+        VM_ENTER_FRAME();
+        VM_DISPATCH();
+      }
+      vm_fail(vm, string_concat3("A ", vm_type_name(*callee), " can't be called."));
+      goto vm_error;
+    }
+
+  VM_CASE(CALL_FUNCTION)
+    frame->ip = ip + 1;
+    if (!_vm_push_frame(vm, vm->functions[ip->arg], sp - ip->extra, ip->extra)) goto vm_error;
+    VM_ENTER_FRAME();
+    VM_DISPATCH();
+
+  VM_CASE(CALL_METHOD)
+    {
+      int argc = ip->extra;
+      VMValue* root = sp - argc - 1;
+      String* name = (String*) ip->value;
+      int method = VM_METHOD_NONE;
+      entry = _vm_cache_find(ip->cache, *root, name);
+      if ((entry != NULL && entry->type == 'C') || _vm_is_struct(*root, VM_OBJECT_NAME)) {
+        VMFunction* fn = entry != NULL ? entry->method : _vm_find_method(vm, ip->cache, (VMObject*) *root, name);
+        if (fn == NULL) goto vm_error;
+        frame->ip = ip + 1;
+        if (!_vm_push_frame(vm, fn, root, argc + 1)) goto vm_error;
+        VM_ENTER_FRAME();
+        VM_DISPATCH();
+      }
+      if (entry != NULL && entry->type != 'D') {
+        method = entry->slot;
+      } else if (_vm_type_is(*root, 'D')) {
+        // A dictionary field that holds a function is called like a method, without the dictionary.
+        // Only those are cached for dictionaries, since a built in method is only called when the
+        // dictionary has no field of that name.
+        Dictionary* dict = (Dictionary*) *root;
+        VMValue field;
+        if (entry != NULL) {
+          field = dict->values[entry->slot];
+        } else {
+          field = dictionary_get(dict, name);
+          if (vm_is_object(field) && gc_get_type(field) == 'C') _vm_cache_add_key(ip->cache, dict, name);
+        }
+        if (_vm_is_struct(field, VM_FUNCTION_NAME) || _vm_is_struct(field, VM_NATIVE_FUNCTION_NAME)) {
+          *root = field;
+          if (_vm_is_struct(field, VM_FUNCTION_NAME)) {
+            memmove(root, root + 1, sizeof(VMValue) * argc);
+            --sp;
+            frame->ip = ip + 1;
+            if (!_vm_push_frame(vm, (VMFunction*) field, root, argc)) goto vm_error;
+            VM_ENTER_FRAME();
+            VM_DISPATCH();
+          }
+          vm->sp = sp;
+          result = ((VMNativeFunction*) field)->callback(vm, root + 1, argc);
+          VM_CHECK_ERROR();
+          sp = root;
+          *sp++ = result;
+          VM_NEXT();
+        }
+      }
+      if (method == VM_METHOD_NONE) {
+        method = _vm_find_builtin_method(*root, name);
+        if (method != VM_METHOD_NONE && !_vm_type_is(*root, 'D')) _vm_cache_add(ip->cache, gc_get_type(*root), method);
+      }
+      result = _vm_call_builtin_method(vm, method, *root, name, root + 1, argc);
+      VM_CHECK_ERROR();
+      sp = root;
+      *sp++ = result;
+      if (vm_is_object(result)) VM_ALLOCATED();
+      VM_NEXT();
+    }
+
+  VM_CASE(POP)
+    --sp;
+    VM_NEXT();
+
+  VM_CASE(DUP)
+    sp[0] = sp[-1];
+    ++sp;
+    VM_NEXT();
+
+  VM_CASE(DUP2)
+    sp[0] = sp[-2];
+    sp[1] = sp[-1];
+    sp += 2;
+    VM_NEXT();
+
+  VM_CASE(RETURN)
+    result = sp[-1];
+    goto vm_return;
+
+  VM_CASE(RETURN_NULL)
+    result = VM_NULL;
+  vm_return:
+    sp = frame->locals;
+    if (--vm->frame_count == stop_frame_count) {
+      vm->sp = sp;
+      vm->result = result;
+      return 1;
+    }
+    *sp++ = result;
+    VM_LOAD_FRAME();
+    VM_DISPATCH();
+
+#ifdef VM_JIT
+  // The handler of the instructions of a compiled function where its machine code can start. The
+  // instruction the machine code stops at runs here, with the handler of its op.
+  vm_jit_enter:
+    {
+      // Through a copy, since taking the address of sp would keep it out of a register everywhere.
+      VMFunction* fn = frame->function;
+      VMValue* jit_sp;
+      ip = code + fn->jit(locals, sp, (int) (ip - code), &jit_sp);
+      sp = jit_sp;
+      if (fn->jit_deopts > VM_JIT_MAX_DEOPTS) _vm_jit_discard(fn);
+      goto *handlers[ip->op];
+    }
+
+  // JUMP to an earlier instruction, in a function that isn't compiled yet.
+  vm_jump_back:
+    if (++frame->function->hotness == VM_JIT_THRESHOLD) _vm_jit_compile(vm, frame->function);
+    ip = code + ip->arg;
+    VM_DISPATCH();
+#endif
+
+#ifndef VM_THREADED
+    default:
+      vm_fail_chars(vm, "Invalid instruction.");
+      goto vm_error;
+  }
+#endif
+
+vm_error:
+  vm_fail(vm, _vm_locate_error(vm->error, frame->function, ip->line));
+  vm->frame_count = stop_frame_count;
+  return 0;
+
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_NEXT
+#undef VM_CHECK_ERROR
+#undef VM_ALLOCATED
+#undef VM_LOAD_FRAME
+#undef VM_ENTER_FRAME
+}
+
+// Turns a constant of the bytecode module into a value. Dictionaries become templates for CLONE_CONST,
+// with keys that are also string constants replaced by the constant so the inline caches match them.
+VMValue _vm_constant_value(VM* vm, Dictionary* strings, void* constant) {
+  switch (gc_get_type(constant)) {
+    case 'I': return vm_int(((Integer*) constant)->value);
+    case 'B': return vm_bool(((Boolean*) constant)->value);
+    case 'S': return constant;
+    case 'D':
+      {
+        Dictionary* original = (Dictionary*) constant;
+        Dictionary* dict = new_dictionary();
+        for (int i = 0; i < original->size; ++i) {
+          String* key = (String*) dictionary_get(strings, original->keys[i]);
+          dictionary_set(dict, key != NULL ? key : original->keys[i], _vm_constant_value(vm, strings, original->values[i]));
+        }
+        return dict;
+      }
+    default: return VM_NULL;
+  }
+}
+
+void _vm_prepare_function(VM* vm, VMFunction* fn) {
+  if (_vm_handlers == NULL) _vm_execute(NULL, 0);
+  BytecodeFunction* bytecode = fn->bytecode;
+
+  // Instruction index of each code word, to turn jump targets into instruction indexes.
+  int* positions = (int*) malloc(sizeof(int) * (bytecode->code_length + 1));
+  int count = 0;
+  for (int i = 0; i < bytecode->code_length; ++i) {
+    positions[i] = count++;
+    if (bytecode_has_extra_word(bytecode_op(bytecode->code[i]))) positions[++i] = count - 1;
+  }
+  positions[bytecode->code_length] = count;
+
+  int cache_count = 0;
+  for (int i = 0; i < bytecode->code_length; ++i) {
+    int op = bytecode_op(bytecode->code[i]);
+    if (op == BC_DOT_GET || op == BC_DOT_SET || op == BC_CALL_METHOD) cache_count++;
+    if (bytecode_has_extra_word(op)) ++i;
+  }
+  VMInlineCache* caches = (VMInlineCache*) gc_create_buffer(sizeof(VMInlineCache) * (cache_count + 1));
+  cache_count = 0;
+
+  VMInstruction* code = (VMInstruction*) gc_create_buffer(sizeof(VMInstruction) * (count + 1));
+  int n = 0;
+  for (int i = 0; i < bytecode->code_length; ++i) {
+    VMInstruction* instruction = &code[n++];
+    int op = bytecode_op(bytecode->code[i]);
+    int arg = bytecode_arg(bytecode->code[i]);
+    instruction->op = op;
+    instruction->arg = arg;
+    instruction->line = bytecode->lines[i];
+    if (bytecode_has_extra_word(op)) instruction->extra = bytecode->code[++i];
+    switch (op) {
+      case BC_PUSH_NULL: instruction->value = VM_NULL; break;
+      case BC_PUSH_TRUE: instruction->value = VM_TRUE; break;
+      case BC_PUSH_FALSE: instruction->value = VM_FALSE; break;
+      case BC_PUSH_INT: instruction->value = vm_int(arg); break;
+      case BC_PUSH_CONST:
+      case BC_CLONE_CONST:
+        instruction->value = vm->constants[arg];
+        break;
+      case BC_LOAD_CLASS: instruction->value = vm->classes[arg]; break;
+      case BC_DOT_GET:
+      case BC_DOT_SET:
+      case BC_CALL_METHOD:
+        instruction->value = vm->constants[arg];
+        instruction->cache = &caches[cache_count++];
+        break;
+      case BC_JUMP:
+      case BC_JUMP_IF_FALSE:
+      case BC_JUMP_IF_FALSE_OR_POP:
+      case BC_JUMP_IF_TRUE_OR_POP:
+        instruction->arg = positions[arg];
+        break;
+      case BC_ITER_NEXT:
+        instruction->extra = positions[instruction->extra];
+        break;
+    }
+#ifdef VM_THREADED
+    instruction->handler = _vm_handlers[op];
+#endif
+  }
+
+  int entry_count = bytecode->arg_count - bytecode->required_arg_count + 1;
+  int* entry_points = (int*) gc_create_buffer(sizeof(int) * entry_count);
+  for (int i = 0; i < entry_count; ++i) {
+    entry_points[i] = positions[bytecode->arg_entry_points[i]];
+  }
+  free(positions);
+  fn->code = code;
+  fn->instruction_count = count;
+  fn->entry_points = entry_points;
+  fn->caches = caches;
+#ifdef VM_JIT
+  for (int i = 0; i < count; ++i) {
+    if (code[i].op == BC_JUMP && code[i].arg <= i) code[i].handler = _vm_jump_back_handler;
+  }
+#endif
+}
+
+#ifdef VM_JIT
+/*
+  The JIT tier. Each instruction is translated on its own into machine code that works on the
+  interpreter's stack, with rbx as the stack pointer and r12 pointing to the locals. Within a run of
+  instructions the stack pointer is only moved in rbx where needed, and otherwise tracked here as an
+  offset. It is exact at every instruction where the machine code can start: the entry points, the
+  jump targets and the instruction after each one the interpreter runs.
+
+  A guard that fails leaves the stack as it was before the instruction and returns its index, so the
+  interpreter runs it again from the start. Integers are 32 bit immediates, so the fast paths untag
+  them, use the 32 bit instruction and its overflow flag, and tag the result again. The machine code
+  never allocates and never runs while the interpreter does, so the GC doesn't need to know about it,
+  and the code can be freed whenever the function isn't running it.
+*/
+
+#define VM_JIT_SP X64_RBX
+#define VM_JIT_LOCALS X64_R12
+#define VM_JIT_SP_OUT X64_R13
+
+typedef struct _VMJitStub {
+  int label;
+  int index; // of the instruction the interpreter runs
+  int delta; // from rbx to the stack pointer before that instruction
+} VMJitStub;
+
+typedef struct _VMJitEmitter {
+  X64Assembler* a;
+  int* labels; // of each instruction the machine code can start at, -1 for the others
+  int offset; // of the stack pointer from rbx, in bytes
+  VMJitStub* stubs;
+  int stub_count;
+  int stub_capacity;
+  int exit_label;
+  int deopt_label; // an exit that counts a guard failure
+} VMJitEmitter;
+
+// Whether the machine code runs an op itself rather than returning to the interpreter for it.
+int _vm_jit_supports(int op) {
+  switch (op) {
+    case BC_PUSH_NULL: case BC_PUSH_TRUE: case BC_PUSH_FALSE: case BC_PUSH_INT: case BC_PUSH_CONST:
+    case BC_LOAD_LOCAL: case BC_STORE_LOCAL: case BC_LOAD_FUNCTION: case BC_LOAD_CLASS:
+    case BC_GET_FIELD: case BC_SET_FIELD:
+    case BC_ADD: case BC_SUB: case BC_MUL: case BC_DIV: case BC_MOD:
+    case BC_BIT_AND: case BC_BIT_OR: case BC_BIT_XOR:
+    case BC_EQ: case BC_NE: case BC_LT: case BC_GT: case BC_LE: case BC_GE:
+    case BC_JUMP: case BC_JUMP_IF_FALSE: case BC_JUMP_IF_FALSE_OR_POP: case BC_JUMP_IF_TRUE_OR_POP:
+    case BC_POP: case BC_DUP: case BC_DUP2:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// The displacement from rbx of the stack slot at position from the top, -1 being the top value.
+int _vm_jit_slot(VMJitEmitter* e, int position) {
+  return e->offset + 8 * position;
+}
+
+// Moves rbx to the stack pointer. Uses lea, so the flags are kept.
+void _vm_jit_sync(VMJitEmitter* e) {
+  if (e->offset == 0) return;
+  x64_lea(e->a, VM_JIT_SP, VM_JIT_SP, e->offset);
+  e->offset = 0;
+}
+
+// A label that returns to the interpreter at the instruction, counting a guard failure.
+int _vm_jit_guard_stub(VMJitEmitter* e, int index, int delta) {
+  if (e->stub_count == e->stub_capacity) {
+    e->stub_capacity *= 2;
+    e->stubs = (VMJitStub*) realloc(e->stubs, sizeof(VMJitStub) * e->stub_capacity);
+  }
+  VMJitStub* stub = &e->stubs[e->stub_count++];
+  stub->label = x64_new_label(e->a);
+  stub->index = index;
+  stub->delta = delta;
+  return stub->label;
+}
+
+void _vm_jit_guard_int(VMJitEmitter* e, int reg, int stub) {
+  x64_mov(e->a, 0, X64_RDX, reg);
+  x64_alu_imm(e->a, X64_AND, 0, X64_RDX, 3);
+  x64_alu_imm(e->a, X64_CMP, 0, X64_RDX, 1);
+  x64_jcc(e->a, X64_NE, stub);
+}
+
+// Loads the operands of a binary op into rax and rcx, and checks that they are integers.
+void _vm_jit_int_operands(VMJitEmitter* e, int stub) {
+  x64_load(e->a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -2));
+  x64_load(e->a, X64_RCX, VM_JIT_SP, _vm_jit_slot(e, -1));
+  _vm_jit_guard_int(e, X64_RAX, stub);
+  _vm_jit_guard_int(e, X64_RCX, stub);
+}
+
+// Replaces the operands of a binary op with the integer in eax.
+void _vm_jit_int_result(VMJitEmitter* e) {
+  x64_movsxd(e->a, X64_RAX, X64_RAX);
+  x64_lea_scaled(e->a, X64_RAX, X64_RAX, 2, 1);
+  x64_store(e->a, VM_JIT_SP, _vm_jit_slot(e, -2), X64_RAX);
+  e->offset -= 8;
+}
+
+void _vm_jit_push(VMJitEmitter* e, VMValue value) {
+  if (x64_fits_int32((intptr_t) value)) {
+    x64_store_imm(e->a, VM_JIT_SP, _vm_jit_slot(e, 0), (int32_t) (intptr_t) value);
+  } else {
+    x64_mov_imm(e->a, X64_RAX, (intptr_t) value);
+    x64_store(e->a, VM_JIT_SP, _vm_jit_slot(e, 0), X64_RAX);
+  }
+  e->offset += 8;
+}
+
+// Returns to the interpreter at the instruction.
+void _vm_jit_exit(VMJitEmitter* e, int index) {
+  _vm_jit_sync(e);
+  x64_mov_imm(e->a, X64_RAX, index);
+  x64_jmp(e->a, e->exit_label);
+}
+
+/*
+  Branches on the truthiness of rax: to truthy if it is true or a non-zero integer, to falsy if it is
+  false, null or zero. A string or any other object goes to the stub, since its truthiness depends
+  on its contents. Either label can be -1 for the code right after.
+*/
+void _vm_jit_branch_truthy(VMJitEmitter* e, int truthy, int falsy, int stub) {
+  X64Assembler* a = e->a;
+  int next = x64_new_label(a);
+  if (truthy == -1) truthy = next;
+  if (falsy == -1) falsy = next;
+  x64_alu_imm(a, X64_CMP, 1, X64_RAX, (intptr_t) VM_TRUE);
+  x64_jcc(a, X64_E, truthy);
+  x64_alu_imm(a, X64_CMP, 1, X64_RAX, (intptr_t) VM_FALSE);
+  x64_jcc(a, X64_E, falsy);
+  x64_test(a, 1, X64_RAX, X64_RAX);
+  x64_jcc(a, X64_E, falsy);
+  _vm_jit_guard_int(e, X64_RAX, stub);
+  x64_alu_imm(a, X64_CMP, 1, X64_RAX, (intptr_t) vm_int(0));
+  x64_jcc(a, X64_E, falsy);
+  if (truthy != next) x64_jmp(a, truthy);
+  x64_bind(a, next);
+}
+
+// Emits the instruction at index, and the JUMP_IF_FALSE after it if fuse is set. A comparison then
+// jumps on its flags instead of pushing a boolean.
+void _vm_jit_instruction(VM* vm, VMJitEmitter* e, VMFunction* fn, int index, int fuse) {
+  X64Assembler* a = e->a;
+  VMInstruction* ins = &fn->code[index];
+  int stub = -1;
+  if (ins->op >= BC_ADD && ins->op <= BC_GE && _vm_jit_supports(ins->op)) {
+    stub = _vm_jit_guard_stub(e, index, e->offset);
+  }
+  switch (ins->op) {
+    case BC_PUSH_NULL:
+    case BC_PUSH_TRUE:
+    case BC_PUSH_FALSE:
+    case BC_PUSH_INT:
+    case BC_PUSH_CONST:
+    case BC_LOAD_CLASS:
+      _vm_jit_push(e, ins->value);
+      break;
+    case BC_LOAD_FUNCTION:
+      _vm_jit_push(e, vm->functions[ins->arg]);
+      break;
+    case BC_LOAD_LOCAL:
+      x64_load(a, X64_RAX, VM_JIT_LOCALS, 8 * ins->arg);
+      x64_store(a, VM_JIT_SP, _vm_jit_slot(e, 0), X64_RAX);
+      e->offset += 8;
+      break;
+    case BC_STORE_LOCAL:
+      x64_load(a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -1));
+      x64_store(a, VM_JIT_LOCALS, 8 * ins->arg, X64_RAX);
+      e->offset -= 8;
+      break;
+    case BC_GET_FIELD:
+      x64_load(a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -1));
+      x64_load(a, X64_RAX, X64_RAX, (int) (sizeof(VMObject) + 8 * ins->arg));
+      x64_store(a, VM_JIT_SP, _vm_jit_slot(e, -1), X64_RAX);
+      break;
+    case BC_SET_FIELD:
+      x64_load(a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -2));
+      x64_load(a, X64_RCX, VM_JIT_SP, _vm_jit_slot(e, -1));
+      x64_store(a, X64_RAX, (int) (sizeof(VMObject) + 8 * ins->arg), X64_RCX);
+      e->offset -= 16;
+      break;
+    case BC_ADD:
+    case BC_SUB:
+    case BC_MUL:
+      _vm_jit_int_operands(e, stub);
+      x64_sar(a, X64_RAX, 2);
+      x64_sar(a, X64_RCX, 2);
+      if (ins->op == BC_MUL) {
+        x64_imul32(a, X64_RAX, X64_RCX);
+      } else {
+        x64_alu(a, ins->op == BC_ADD ? X64_ADD : X64_SUB, 0, X64_RAX, X64_RCX);
+      }
+      x64_jcc(a, X64_O, stub);
+      _vm_jit_int_result(e);
+      break;
+    case BC_DIV:
+    case BC_MOD:
+      // Only non-negative dividends and positive divisors, where truncating is the same as flooring.
+      _vm_jit_int_operands(e, stub);
+      x64_sar(a, X64_RAX, 2);
+      x64_sar(a, X64_RCX, 2);
+      x64_test(a, 0, X64_RAX, X64_RAX);
+      x64_jcc(a, X64_S, stub);
+      x64_test(a, 0, X64_RCX, X64_RCX);
+      x64_jcc(a, X64_LE, stub);
+      x64_idiv32(a, X64_RCX);
+      if (ins->op == BC_MOD) x64_mov(a, 0, X64_RAX, X64_RDX);
+      _vm_jit_int_result(e);
+      break;
+    case BC_BIT_AND:
+    case BC_BIT_OR:
+    case BC_BIT_XOR:
+      // On the tagged words. Only xor clears the tag.
+      _vm_jit_int_operands(e, stub);
+      x64_alu(a, ins->op == BC_BIT_AND ? X64_AND : ins->op == BC_BIT_OR ? X64_OR : X64_XOR, 1, X64_RAX, X64_RCX);
+      if (ins->op == BC_BIT_XOR) x64_alu_imm(a, X64_OR, 1, X64_RAX, 1);
+      x64_store(a, VM_JIT_SP, _vm_jit_slot(e, -2), X64_RAX);
+      e->offset -= 8;
+      break;
+    case BC_LT:
+    case BC_GT:
+    case BC_LE:
+    case BC_GE:
+      {
+        // Integers are ordered the same as their tagged words.
+        int condition = ins->op == BC_LT ? X64_L : ins->op == BC_GT ? X64_G : ins->op == BC_LE ? X64_LE : X64_GE;
+        _vm_jit_int_operands(e, stub);
+        if (fuse) {
+          e->offset -= 16;
+          _vm_jit_sync(e);
+          x64_alu(a, X64_CMP, 1, X64_RAX, X64_RCX);
+          x64_jcc(a, condition ^ 1, e->labels[fn->code[index + 1].arg]);
+        } else {
+          x64_alu(a, X64_CMP, 1, X64_RAX, X64_RCX);
+          x64_setcc(a, condition, X64_RAX);
+          x64_lea_scaled(a, X64_RAX, X64_RAX, 2, (intptr_t) VM_FALSE);
+          x64_store(a, VM_JIT_SP, _vm_jit_slot(e, -2), X64_RAX);
+          e->offset -= 8;
+        }
+      }
+      break;
+    case BC_EQ:
+    case BC_NE:
+      {
+        // Equal words are equal values. Different words are different values unless both are
+        // objects, which could be two equal strings.
+        int equal = x64_new_label(a);
+        int different = x64_new_label(a);
+        int done = x64_new_label(a);
+        x64_load(a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -2));
+        x64_load(a, X64_RCX, VM_JIT_SP, _vm_jit_slot(e, -1));
+        x64_alu(a, X64_CMP, 1, X64_RAX, X64_RCX);
+        x64_jcc(a, X64_E, equal);
+        x64_mov(a, 1, X64_RDX, X64_RAX);
+        x64_alu(a, X64_OR, 1, X64_RDX, X64_RCX);
+        x64_alu_imm(a, X64_AND, 0, X64_RDX, 1);
+        x64_jcc(a, X64_NE, different);
+        x64_test(a, 1, X64_RAX, X64_RAX);
+        x64_jcc(a, X64_E, different);
+        x64_test(a, 1, X64_RCX, X64_RCX);
+        x64_jcc(a, X64_E, different);
+        x64_jmp(a, stub);
+        x64_bind(a, equal);
+        x64_mov_imm(a, X64_RAX, (intptr_t) vm_bool(ins->op == BC_EQ));
+        x64_jmp(a, done);
+        x64_bind(a, different);
+        x64_mov_imm(a, X64_RAX, (intptr_t) vm_bool(ins->op == BC_NE));
+        x64_bind(a, done);
+        if (fuse) {
+          e->offset -= 16;
+          _vm_jit_sync(e);
+          x64_alu_imm(a, X64_CMP, 1, X64_RAX, (intptr_t) VM_TRUE);
+          x64_jcc(a, X64_NE, e->labels[fn->code[index + 1].arg]);
+        } else {
+          x64_store(a, VM_JIT_SP, _vm_jit_slot(e, -2), X64_RAX);
+          e->offset -= 8;
+        }
+      }
+      break;
+    case BC_JUMP:
+      _vm_jit_sync(e);
+      x64_jmp(a, e->labels[ins->arg]);
+      break;
+    case BC_JUMP_IF_FALSE:
+      x64_load(a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -1));
+      e->offset -= 8;
+      _vm_jit_sync(e);
+      _vm_jit_branch_truthy(e, -1, e->labels[ins->arg], _vm_jit_guard_stub(e, index, 8));
+      break;
+    case BC_JUMP_IF_FALSE_OR_POP:
+    case BC_JUMP_IF_TRUE_OR_POP:
+      {
+        // The value stays on the stack when the jump is taken.
+        int pop = x64_new_label(a);
+        x64_load(a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -1));
+        _vm_jit_sync(e);
+        int guard = _vm_jit_guard_stub(e, index, 0);
+        if (ins->op == BC_JUMP_IF_FALSE_OR_POP) {
+          _vm_jit_branch_truthy(e, pop, e->labels[ins->arg], guard);
+        } else {
+          _vm_jit_branch_truthy(e, e->labels[ins->arg], pop, guard);
+        }
+        x64_bind(a, pop);
+        x64_lea(a, VM_JIT_SP, VM_JIT_SP, -8);
+      }
+      break;
+    case BC_POP:
+      e->offset -= 8;
+      break;
+    case BC_DUP:
+      x64_load(a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -1));
+      x64_store(a, VM_JIT_SP, _vm_jit_slot(e, 0), X64_RAX);
+      e->offset += 8;
+      break;
+    case BC_DUP2:
+      x64_load(a, X64_RAX, VM_JIT_SP, _vm_jit_slot(e, -2));
+      x64_load(a, X64_RCX, VM_JIT_SP, _vm_jit_slot(e, -1));
+      x64_store(a, VM_JIT_SP, _vm_jit_slot(e, 0), X64_RAX);
+      x64_store(a, VM_JIT_SP, _vm_jit_slot(e, 1), X64_RCX);
+      e->offset += 16;
+      break;
+    default:
+      _vm_jit_exit(e, index);
+      break;
+  }
+}
+
+/*
+  Compiles a function to machine code and points the handlers of the instructions it can start at
+  to it. The machine code starts with a jump through a table with the address of each of those
+  instructions, which follows the code in the same memory. Leaves the function interpreted if the
+  memory can't be mapped.
+*/
+void _vm_jit_compile(VM* vm, VMFunction* fn) {
+  int count = fn->instruction_count;
+  VMInstruction* code = fn->code;
+  char* entries = (char*) malloc_clean(count + 1);
+  for (int i = 0; i <= fn->bytecode->arg_count - fn->bytecode->required_arg_count; ++i) {
+    entries[fn->entry_points[i]] = 1;
+  }
+  for (int i = 0; i < count; ++i) {
+    int op = code[i].op;
+    if (op == BC_JUMP || op == BC_JUMP_IF_FALSE || op == BC_JUMP_IF_FALSE_OR_POP || op == BC_JUMP_IF_TRUE_OR_POP) {
+      entries[code[i].arg] = 1;
+    } else if (op == BC_ITER_NEXT) {
+      entries[code[i].extra] = 1;
+    }
+    if (!_vm_jit_supports(op)) entries[i + 1] = 1;
+  }
+
+  VMJitEmitter e;
+  X64Assembler* a = new_x64_assembler();
+  e.a = a;
+  e.offset = 0;
+  e.stub_capacity = 16;
+  e.stub_count = 0;
+  e.stubs = (VMJitStub*) malloc(sizeof(VMJitStub) * e.stub_capacity);
+  e.exit_label = x64_new_label(a);
+  e.deopt_label = x64_new_label(a);
+  e.labels = (int*) malloc(sizeof(int) * (count + 1));
+  for (int i = 0; i < count; ++i) {
+    e.labels[i] = entries[i] ? x64_new_label(a) : -1;
+  }
+  int table_label = x64_new_label(a);
+  int bad_entry_label = x64_new_label(a);
+
+  // VMJitCode(locals in rdi, sp in rsi, index in edx, sp_out in rcx)
+  x64_push(a, X64_RBX);
+  x64_push(a, X64_R12);
+  x64_push(a, X64_R13);
+  x64_mov(a, 1, VM_JIT_LOCALS, X64_RDI);
+  x64_mov(a, 1, VM_JIT_SP, X64_RSI);
+  x64_mov(a, 1, VM_JIT_SP_OUT, X64_RCX);
+  x64_lea_label(a, X64_RAX, table_label);
+  x64_movsxd(a, X64_RDX, X64_RDX);
+  x64_jmp_table(a, X64_RAX, X64_RDX);
+
+  for (int i = 0; i < count; ++i) {
+    if (entries[i]) {
+      _vm_jit_sync(&e);
+      x64_bind(a, e.labels[i]);
+    }
+    int fuse = code[i].op >= BC_EQ && code[i].op <= BC_GE && i + 1 < count &&
+      code[i + 1].op == BC_JUMP_IF_FALSE && !entries[i + 1];
+    _vm_jit_instruction(vm, &e, fn, i, fuse);
+    if (fuse) ++i;
+  }
+
+  for (int i = 0; i < e.stub_count; ++i) {
+    x64_bind(a, e.stubs[i].label);
+    if (e.stubs[i].delta != 0) x64_lea(a, VM_JIT_SP, VM_JIT_SP, e.stubs[i].delta);
+    x64_mov_imm(a, X64_RAX, e.stubs[i].index);
+    x64_jmp(a, e.deopt_label);
+  }
+  x64_bind(a, bad_entry_label);
+  x64_mov(a, 0, X64_RAX, X64_RDX);
+  x64_jmp(a, e.exit_label);
+  x64_bind(a, e.deopt_label);
+  x64_mov_imm(a, X64_RCX, (intptr_t) &fn->jit_deopts);
+  x64_inc_mem32(a, X64_RCX, 0);
+  x64_bind(a, e.exit_label);
+  x64_store(a, VM_JIT_SP_OUT, 0, VM_JIT_SP);
+  x64_pop(a, X64_R13);
+  x64_pop(a, X64_R12);
+  x64_pop(a, X64_RBX);
+  x64_ret(a);
+  while (a->length % 8 != 0) x64_byte(a, 0xCC);
+  x64_bind(a, table_label);
+  int table_offset = a->length;
+  int size = table_offset + 8 * count;
+
+  void* memory = x64_resolve(a) ? x64_map(size) : NULL;
+  if (memory != NULL) {
+    unsigned char* base = (unsigned char*) memory;
+    memcpy(base, a->code, table_offset);
+    void** table = (void**) (base + table_offset);
+    for (int i = 0; i < count; ++i) {
+      table[i] = base + a->labels[entries[i] ? e.labels[i] : bad_entry_label];
+    }
+    if (x64_make_executable(memory, size)) {
+      fn->jit = (VMJitCode) memory;
+      fn->jit_size = size;
+      for (int i = 0; i < count; ++i) {
+        if (entries[i]) code[i].handler = _vm_jit_enter_handler;
+      }
+    } else {
+      x64_unmap(memory, size);
+    }
+  }
+  free(entries);
+  free(e.labels);
+  free(e.stubs);
+  x64_assembler_free(a);
+}
+
+// Frees the machine code of a function and gives its instructions back their handlers. The function
+// isn't compiled again.
+void _vm_jit_discard(VMFunction* fn) {
+  for (int i = 0; i < fn->instruction_count; ++i) {
+    fn->code[i].handler = _vm_handlers[fn->code[i].op];
+  }
+  x64_unmap((void*) fn->jit, fn->jit_size);
+  fn->jit = NULL;
+  fn->jit_size = 0;
+}
+#endif
+
+VM* new_vm(BytecodeModule* module);
+
+// Defines the global name as a native function, if the module uses it.
+void vm_define_native(VM* vm, const char* name, VMNativeCallback callback) {
+  List* names = vm->module->global_names;
+  for (int i = 0; i < names->length; ++i) {
+    if (!string_equals_chars(list_get_string(names, i), name)) continue;
+    VMNativeFunction* native = (VMNativeFunction*) gc_create_struct(sizeof(VMNativeFunction), VM_NATIVE_FUNCTION_NAME, VM_NATIVE_FUNCTION_GC_FIELD_COUNT);
+    native->name = list_get_string(names, i);
+    native->callback = callback;
+    list_add(vm->roots, native);
+    vm->globals[i] = native;
+    vm->globals_defined[i] = 1;
+  }
+}
+
+VMValue _vm_native_print(VM* vm, VMValue* args, int argc) {
+  for (int i = 0; i < argc; ++i) {
+    if (i > 0) fputc(' ', stdout);
+    fputs(vm_value_to_string(args[i])->cstring, stdout);
+  }
+  fputc('\n', stdout);
+  return VM_NULL;
+}
+
+VM* new_vm(BytecodeModule* module) {
+  VM* vm = (VM*) malloc_clean(sizeof(VM));
+  vm->module = module;
+  gc_save_item(module);
+  vm->roots = new_list();
+  gc_save_item(vm->roots);
+
+  int constant_count = module->constants->length;
+  Dictionary* strings = new_dictionary();
+  for (int i = 0; i < constant_count; ++i) {
+    void* constant = list_get(module->constants, i);
+    if (gc_get_type(constant) == 'S') dictionary_set(strings, (String*) constant, constant);
+  }
+  vm->constants = (VMValue*) malloc_ptr_array(constant_count + 1);
+  for (int i = 0; i < constant_count; ++i) {
+    vm->constants[i] = _vm_constant_value(vm, strings, list_get(module->constants, i));
+    if (vm_is_object(vm->constants[i])) list_add(vm->roots, vm->constants[i]);
+  }
+
+  int function_count = module->functions->length;
+  vm->functions = (VMFunction**) malloc_ptr_array(function_count + 1);
+  for (int i = 0; i < function_count; ++i) {
+    VMFunction* fn = (VMFunction*) gc_create_struct(sizeof(VMFunction), VM_FUNCTION_NAME, VM_FUNCTION_GC_FIELD_COUNT);
+    fn->bytecode = (BytecodeFunction*) list_get(module->functions, i);
+    fn->code = NULL;
+    fn->entry_points = NULL;
+    fn->caches = NULL;
+    fn->local_count = fn->bytecode->local_count;
+    fn->instruction_count = 0;
+    fn->hotness = 0;
+    fn->jit_deopts = 0;
+    fn->jit = NULL;
+    fn->jit_size = 0;
+    list_add(vm->roots, fn);
+    vm->functions[i] = fn;
+  }
+
+  // Inherited methods go in first so the class's own replace the ones they override.
+  int class_count = module->classes->length;
+  vm->classes = (VMClass**) malloc_ptr_array(class_count + 1);
+  for (int i = 0; i < class_count; ++i) {
+    BytecodeClass* bytecode = (BytecodeClass*) list_get(module->classes, i);
+    VMClass* cls = (VMClass*) gc_create_struct(sizeof(VMClass), VM_CLASS_NAME, VM_CLASS_GC_FIELD_COUNT);
+    cls->name = bytecode->name;
+    cls->constructor = bytecode->constructor == -1 ? NULL : vm->functions[bytecode->constructor];
+    cls->methods = new_dictionary();
+    cls->field_slots = new_dictionary();
+    cls->field_count = bytecode->field_names->length;
+    cls->field_defaults = (VMValue*) gc_create_buffer(sizeof(VMValue) * (cls->field_count + 1));
+    for (int j = 0; j < cls->field_count; ++j) {
+      dictionary_set(cls->field_slots, list_get_string(bytecode->field_names, j), vm_int(j));
+      int constant = bytecode->field_defaults[j];
+      cls->field_defaults[j] = constant == -1 ? VM_NULL : vm->constants[constant];
+    }
+    list_add(vm->roots, cls);
+    vm->classes[i] = cls;
+  }
+  for (int i = 0; i < class_count; ++i) {
+    BytecodeClass* bytecode = (BytecodeClass*) list_get(module->classes, i);
+    vm->classes[i]->base = bytecode->base_class == -1 ? NULL : vm->classes[bytecode->base_class];
+    List* chain = new_list();
+    for (int c = i; c != -1; c = ((BytecodeClass*) list_get(module->classes, c))->base_class) {
+      list_add(chain, list_get(module->classes, c));
+    }
+    for (int j = chain->length - 1; j >= 0; --j) {
+      BytecodeClass* ancestor = (BytecodeClass*) list_get(chain, j);
+      for (int k = 0; k < ancestor->method_names->length; ++k) {
+        dictionary_set(vm->classes[i]->methods, list_get_string(ancestor->method_names, k), vm->functions[ancestor->method_functions[k]]);
+      }
+    }
+  }
+
+  int global_count = module->global_names->length;
+  vm->globals = (VMValue*) malloc_ptr_array(global_count + 1);
+  vm->globals_defined = (char*) malloc_clean(global_count + 1);
+
+  vm->stack = (VMValue*) malloc(sizeof(VMValue) * VM_STACK_SIZE);
+  vm->stack_end = vm->stack + VM_STACK_SIZE;
+  vm->sp = vm->stack;
+  vm->frames = (VMFrame*) malloc(sizeof(VMFrame) * VM_MAX_FRAMES);
+  vm->frame_count = 0;
+
+  vm_define_native(vm, "print", _vm_native_print);
+  return vm;
+}
+
+void vm_free(VM* vm) {
+  vm_fail(vm, NULL);
+#ifdef VM_JIT
+  for (int i = 0; i < vm->module->functions->length; ++i) {
+    if (vm->functions[i]->jit != NULL) _vm_jit_discard(vm->functions[i]);
+  }
+#endif
+  gc_release_item(vm->roots);
+  gc_release_item(vm->module);
+  free(vm->constants);
+  free(vm->functions);
+  free(vm->classes);
+  free(vm->globals);
+  free(vm->globals_defined);
+  free(vm->stack);
+  free(vm->frames);
+  free(vm);
+}
+
+// Returns the index of the module's function with the given name, or -1. Methods are not found.
+int vm_find_function(VM* vm, const char* name) {
+  for (int i = 0; i < vm->module->functions->length; ++i) {
+    BytecodeFunction* fn = (BytecodeFunction*) list_get(vm->module->functions, i);
+    if (!fn->is_method && string_equals_chars(fn->name, name)) return i;
+  }
+  return -1;
+}
+
+// Calls one of the module's functions. Returns the result, or VM_NULL with vm->error set if the call
+// failed. The result is only kept alive until the next call.
+VMValue vm_call(VM* vm, int function_index, VMValue* args, int argc) {
+  vm_fail(vm, NULL);
+  VMValue* start = vm->sp;
+  if (start + argc > vm->stack_end) {
+    vm_fail_chars(vm, "Stack overflow.");
+    return VM_NULL;
+  }
+  memcpy(start, args, sizeof(VMValue) * argc);
+  int frame_count = vm->frame_count;
+  if (!_vm_push_frame(vm, vm->functions[function_index], start, argc)) return VM_NULL;
+  vm->sp = start + vm->functions[function_index]->local_count;
+  int ok = _vm_execute(vm, frame_count);
+  vm->sp = start;
+  return ok ? vm->result : VM_NULL;
+}
+
+/*
+  Calls one of a module's functions with the given arguments, which are passed as integers if they
+  look like one and as strings otherwise. Prints the result unless it is null. path is the file
+  the module was loaded from. Returns the process exit code. This is waxcli --run.
+*/
+int vm_run_module(BytecodeModule* module, const char* path, const char* function_name, char** args, int argc) {
+  VM* vm = new_vm(module);
+  int index = vm_find_function(vm, function_name);
+  if (index == -1) {
+    printf("There is no function named '%s' in %s\n", function_name, path);
+    vm_free(vm);
+    return 1;
+  }
+  List* arg_values = new_list();
+  gc_save_item(arg_values);
+  for (int i = 0; i < argc; ++i) {
+    int value;
+    list_add(arg_values, try_parse_int(args[i], &value) ? vm_int(value) : (VMValue) new_string(args[i]));
+  }
+  VMValue result = vm_call(vm, index, arg_values->items, argc);
+  gc_release_item(arg_values);
+  int exit_code = 0;
+  if (vm->error != NULL) {
+    printf("%s\n", vm->error->cstring);
+    exit_code = 1;
+  } else if (result != VM_NULL) {
+    printf("%s\n", vm_value_to_string(result)->cstring);
+  }
+  vm_free(vm);
+  return exit_code;
+}
+
+// Loads a .waxbc file and runs one of its functions like vm_run_module.
+int vm_run_file(const char* path, const char* function_name, char** args, int argc) {
+  BytecodeModule* module = bytecode_module_load(path);
+  if (module == NULL) {
+    printf("Could not load bytecode file: %s\n", path);
+    return 1;
+  }
+  return vm_run_module(module, path, function_name, args, argc);
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef _WAX_WATCH_H
+#define _WAX_WATCH_H
+
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <poll.h>
+#include <signal.h>
+#endif
+
+#include "../util/filewatch.h"
+#include "../util/gcbase.h"
+#include "../util/localsocket.h"
+#include "../util/strings.h"
+#include "../util/util.h"
+#include "manifest.h"
+#include "session.h"
+
+#define WAX_WATCH_SETTLE_MS 50
+// How long the server waits for a client to send its command, or to take the response, before hanging up on it.
+#define WAX_SERVE_CLIENT_TIMEOUT_MS 2000
+
+FileWatcher* _wax_watch_module_sources(ProjectManifest* manifest) {
+  FileWatcher* watcher = new_file_watcher();
+  for (int i = 0; i < manifest->modules->length; ++i) {
+    ModuleMetadata* module = (ModuleMetadata*) list_get(manifest->modules, i);
+    if (module->lang == LANG_WAX) file_watcher_add_directory(watcher, module->src);
+  }
+  return watcher;
+}
+
+// Brings the session up to date and returns the full report. Sets *rebuilt_out to the number of
+// modules that had to be compiled again.
+String* _wax_watch_update(CompileSession* session, int* rebuilt_out) {
+  StringBuilder* output = new_string_builder();
+  *rebuilt_out = compile_session_update(session, output);
+  return string_builder_to_string_and_free(output);
+}
+
+/*
+  Compiles the project, then waits for changes to the module sources and recompiles whatever changed,
+  printing the full report each time something was rebuilt. Runs until the process is killed. The
+  manifest itself is not watched.
+*/
+int wax_watch(ProjectManifest* manifest, CompileOptions* options) {
+  CompileSession* session = new_compile_session(manifest, options);
+  gc_save_item(session);
+  FileWatcher* watcher = _wax_watch_module_sources(manifest);
+  if (watcher->fd == -1) {
+    printf("File change notifications are not available. Checking for changes every second instead.\n");
+  }
+
+  while (1) {
+    double start = get_time_millis();
+    int rebuilt;
+    String* report = _wax_watch_update(session, &rebuilt);
+    if (rebuilt > 0) {
+      printf("%s", report->cstring);
+      printf("Rebuilt %d module(s) in %d ms. Watching for changes...\n\n", rebuilt, (int) (get_time_millis() - start));
+      fflush(stdout);
+    }
+    file_watcher_wait(watcher, -1, WAX_WATCH_SETTLE_MS);
+  }
+  return 0;
+}
+
+/*
+  Serves compiles to clients over a Unix socket at socket_path, keeping the session warm in between.
+  A client connects, sends one command line and reads the response until the connection closes:
+    compile   responds with the full report, recompiling whatever changed first
+    stop      shuts the server down
+  Changes to module sources are picked up as they happen so that compile requests can usually be
+  answered right away.
+*/
+int wax_serve(ProjectManifest* manifest, CompileOptions* options, const char* socket_path) {
+#ifdef WINDOWS
+  printf("Server mode is not available on Windows.\n");
+  return 1;
+#else
+  int listen_fd = local_socket_listen(socket_path);
+  if (listen_fd == -1) {
+    printf("Could not listen on %s\n", socket_path);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN); // a client that hangs up early must not take the server down
+
+  CompileSession* session = new_compile_session(manifest, options);
+  gc_save_item(session);
+  FileWatcher* watcher = _wax_watch_module_sources(manifest);
+
+  int rebuilt;
+  String* report = _wax_watch_update(session, &rebuilt);
+  gc_save_item(report);
+  int stale = 0;
+  printf("Listening on %s\n", socket_path);
+  fflush(stdout);
+
+  int running = 1;
+  while (running) {
+    struct pollfd fds[2];
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = watcher->fd;
+    fds[1].events = POLLIN;
+    int fd_count = watcher->fd == -1 ? 1 : 2;
+    if (poll(fds, fd_count, -1) <= 0) continue;
+
+    if (fd_count == 2 && (fds[1].revents & POLLIN)) {
+      while (file_watcher_drain(watcher)) {
+        poll(NULL, 0, WAX_WATCH_SETTLE_MS);
+      }
+      stale = 1;
+    }
+
+    // Without change notifications there is no telling whether anything changed, so every request
+    // checks the files again.
+    if (stale || watcher->fd == -1) {
+      String* new_report = _wax_watch_update(session, &rebuilt);
+      gc_release_item(report);
+      report = new_report;
+      gc_save_item(report);
+      stale = 0;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int client = local_socket_accept(listen_fd);
+      if (client == -1) continue;
+      // Clients are served one at a time, so one that connects and then goes quiet must not stall the others.
+      local_socket_set_send_timeout(client, WAX_SERVE_CLIENT_TIMEOUT_MS);
+      String* command = local_socket_read_line(client, WAX_SERVE_CLIENT_TIMEOUT_MS);
+      if (command != NULL && string_equals_chars(command, "compile")) {
+        local_socket_write(client, report->cstring, report->length);
+      } else if (command != NULL && string_equals_chars(command, "stop")) {
+        local_socket_write(client, "Stopping.\n", 10);
+        running = 0;
+      } else {
+        String* response = string_concat3("Unknown command: ", command == NULL ? "" : command->cstring, "\n");
+        local_socket_write(client, response->cstring, response->length);
+      }
+      local_socket_close(client);
+    }
+  }
+
+  local_socket_close(listen_fd);
+  unlink(socket_path);
+  file_watcher_free(watcher);
+  gc_release_item(report);
+  gc_release_item(session);
+  return 0;
+#endif
+}
+
+// Sends a command to a server started with wax_serve and prints the response.
+int wax_serve_request(const char* socket_path, const char* command) {
+  int fd = local_socket_connect(socket_path);
+  if (fd == -1) {
+    printf("Could not connect to %s\n", socket_path);
+    return 1;
+  }
+  String* line = string_concat(command, "\n");
+  local_socket_write(fd, line->cstring, line->length);
+  char buffer[4096];
+  int bytes_read;
+  while ((bytes_read = local_socket_read(fd, buffer, sizeof(buffer))) > 0) {
+    fwrite(buffer, 1, bytes_read, stdout);
+  }
+  local_socket_close(fd);
+  return 0;
+}
+
+#endif
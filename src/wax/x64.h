@@ -0,0 +1,352 @@
+#ifndef _WAX_X64_H
+#define _WAX_X64_H
+
+/*
+  A small x86-64 assembler for the interpreter's JIT tier, and executable memory to put its output in.
+  Only the instructions the JIT emits are here.
+
+  Code is assembled into a growable buffer. Jumps refer to labels and are patched once assembly is
+  done, so the code is position independent and can be copied anywhere. Executable memory is mapped
+  writable, filled, and then switched to read and execute, so no page is ever writable and executable
+  at once. This needs nothing but mmap and mprotect, so it is only available on x86-64 Linux.
+*/
+
+#if defined(__x86_64__) && defined(__linux__)
+#define X64_SUPPORTED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+enum X64Register {
+  X64_RAX, X64_RCX, X64_RDX, X64_RBX, X64_RSP, X64_RBP, X64_RSI, X64_RDI,
+  X64_R8, X64_R9, X64_R10, X64_R11, X64_R12, X64_R13, X64_R14, X64_R15,
+};
+
+// Condition codes, as they appear in jcc and setcc. Flipping the low bit negates a condition.
+enum X64Condition {
+  X64_O = 0, X64_NO = 1, X64_B = 2, X64_AE = 3, X64_E = 4, X64_NE = 5, X64_BE = 6, X64_A = 7,
+  X64_S = 8, X64_NS = 9, X64_L = 12, X64_GE = 13, X64_LE = 14, X64_G = 15,
+};
+
+// The ALU ops by their /digit in the immediate forms. The register form's opcode is digit * 8 + 1.
+enum X64AluOp {
+  X64_ADD = 0, X64_OR = 1, X64_AND = 4, X64_SUB = 5, X64_XOR = 6, X64_CMP = 7,
+};
+
+typedef struct _X64Fixup {
+  int position; // of a rel32 field
+  int label;
+} X64Fixup;
+
+typedef struct _X64Assembler {
+  unsigned char* code;
+  int length;
+  int capacity;
+  int* labels; // code offset of each label, -1 until it is bound
+  int label_count;
+  int label_capacity;
+  X64Fixup* fixups;
+  int fixup_count;
+  int fixup_capacity;
+} X64Assembler;
+
+X64Assembler* new_x64_assembler() {
+  X64Assembler* a = (X64Assembler*) malloc(sizeof(X64Assembler));
+  a->capacity = 1024;
+  a->code = (unsigned char*) malloc(a->capacity);
+  a->length = 0;
+  a->label_capacity = 64;
+  a->labels = (int*) malloc(sizeof(int) * a->label_capacity);
+  a->label_count = 0;
+  a->fixup_capacity = 64;
+  a->fixups = (X64Fixup*) malloc(sizeof(X64Fixup) * a->fixup_capacity);
+  a->fixup_count = 0;
+  return a;
+}
+
+void x64_assembler_free(X64Assembler* a) {
+  free(a->code);
+  free(a->labels);
+  free(a->fixups);
+  free(a);
+}
+
+void x64_byte(X64Assembler* a, int value) {
+  if (a->length == a->capacity) {
+    a->capacity *= 2;
+    a->code = (unsigned char*) realloc(a->code, a->capacity);
+  }
+  a->code[a->length++] = (unsigned char) value;
+}
+
+void x64_int32(X64Assembler* a, int32_t value) {
+  uint32_t bits = (uint32_t) value;
+  for (int i = 0; i < 4; ++i) x64_byte(a, (bits >> (8 * i)) & 0xFF);
+}
+
+void x64_int64(X64Assembler* a, int64_t value) {
+  uint64_t bits = (uint64_t) value;
+  for (int i = 0; i < 8; ++i) x64_byte(a, (int) ((bits >> (8 * i)) & 0xFF));
+}
+
+int x64_fits_int8(int64_t value) {
+  return value >= -128 && value <= 127;
+}
+
+int x64_fits_int32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+int x64_new_label(X64Assembler* a) {
+  if (a->label_count == a->label_capacity) {
+    a->label_capacity *= 2;
+    a->labels = (int*) realloc(a->labels, sizeof(int) * a->label_capacity);
+  }
+  a->labels[a->label_count] = -1;
+  return a->label_count++;
+}
+
+void x64_bind(X64Assembler* a, int label) {
+  a->labels[label] = a->length;
+}
+
+// A rel32 field for the distance from the end of the field to the label.
+void _x64_rel32(X64Assembler* a, int label) {
+  if (a->fixup_count == a->fixup_capacity) {
+    a->fixup_capacity *= 2;
+    a->fixups = (X64Fixup*) realloc(a->fixups, sizeof(X64Fixup) * a->fixup_capacity);
+  }
+  a->fixups[a->fixup_count].position = a->length;
+  a->fixups[a->fixup_count].label = label;
+  a->fixup_count++;
+  x64_int32(a, 0);
+}
+
+// Fills in the jumps. Returns 0 if one goes to a label that was never bound.
+int x64_resolve(X64Assembler* a) {
+  for (int i = 0; i < a->fixup_count; ++i) {
+    X64Fixup* fixup = &a->fixups[i];
+    int target = a->labels[fixup->label];
+    if (target == -1) return 0;
+    int32_t distance = target - (fixup->position + 4);
+    memcpy(a->code + fixup->position, &distance, 4);
+  }
+  return 1;
+}
+
+void _x64_rex(X64Assembler* a, int wide, int reg, int index, int base) {
+  int rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+  if (rex != 0x40) x64_byte(a, rex);
+}
+
+void _x64_modrm_reg(X64Assembler* a, int reg, int rm) {
+  x64_byte(a, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// The ModRM byte, and the SIB byte and displacement it needs, for [base + disp].
+void _x64_modrm_mem(X64Assembler* a, int reg, int base, int32_t disp) {
+  int rm = base & 7;
+  int mod = disp == 0 && rm != 5 ? 0 : x64_fits_int8(disp) ? 1 : 2;
+  x64_byte(a, (mod << 6) | ((reg & 7) << 3) | rm);
+  if (rm == 4) x64_byte(a, 0x24);
+  if (mod == 1) x64_byte(a, disp & 0xFF);
+  if (mod == 2) x64_int32(a, disp);
+}
+
+// mov dst, [base + disp]
+void x64_load(X64Assembler* a, int dst, int base, int32_t disp) {
+  _x64_rex(a, 1, dst, 0, base);
+  x64_byte(a, 0x8B);
+  _x64_modrm_mem(a, dst, base, disp);
+}
+
+// mov [base + disp], src
+void x64_store(X64Assembler* a, int base, int32_t disp, int src) {
+  _x64_rex(a, 1, src, 0, base);
+  x64_byte(a, 0x89);
+  _x64_modrm_mem(a, src, base, disp);
+}
+
+// mov qword [base + disp], imm32 sign extended
+void x64_store_imm(X64Assembler* a, int base, int32_t disp, int32_t imm) {
+  _x64_rex(a, 1, 0, 0, base);
+  x64_byte(a, 0xC7);
+  _x64_modrm_mem(a, 0, base, disp);
+  x64_int32(a, imm);
+}
+
+// lea dst, [base + disp]. Doesn't change the flags.
+void x64_lea(X64Assembler* a, int dst, int base, int32_t disp) {
+  _x64_rex(a, 1, dst, 0, base);
+  x64_byte(a, 0x8D);
+  _x64_modrm_mem(a, dst, base, disp);
+}
+
+// lea dst, [index * (1 << shift) + disp]
+void x64_lea_scaled(X64Assembler* a, int dst, int index, int shift, int32_t disp) {
+  _x64_rex(a, 1, dst, index, 0);
+  x64_byte(a, 0x8D);
+  x64_byte(a, ((dst & 7) << 3) | 4);
+  x64_byte(a, (shift << 6) | ((index & 7) << 3) | 5);
+  x64_int32(a, disp);
+}
+
+// lea dst, [rip + label]
+void x64_lea_label(X64Assembler* a, int dst, int label) {
+  _x64_rex(a, 1, dst, 0, 0);
+  x64_byte(a, 0x8D);
+  x64_byte(a, ((dst & 7) << 3) | 5);
+  _x64_rel32(a, label);
+}
+
+// mov dst, src, on 64 bits or on the low 32 bits
+void x64_mov(X64Assembler* a, int wide, int dst, int src) {
+  _x64_rex(a, wide, src, 0, dst);
+  x64_byte(a, 0x89);
+  _x64_modrm_reg(a, src, dst);
+}
+
+// mov dst, imm, with the shortest encoding
+void x64_mov_imm(X64Assembler* a, int dst, int64_t imm) {
+  if (imm >= 0 && imm <= UINT32_MAX) {
+    _x64_rex(a, 0, 0, 0, dst);
+    x64_byte(a, 0xB8 + (dst & 7));
+    x64_int32(a, (int32_t) (uint32_t) imm);
+  } else if (x64_fits_int32(imm)) {
+    _x64_rex(a, 1, 0, 0, dst);
+    x64_byte(a, 0xC7);
+    _x64_modrm_reg(a, 0, dst);
+    x64_int32(a, (int32_t) imm);
+  } else {
+    _x64_rex(a, 1, 0, 0, dst);
+    x64_byte(a, 0xB8 + (dst & 7));
+    x64_int64(a, imm);
+  }
+}
+
+// op dst, src
+void x64_alu(X64Assembler* a, int op, int wide, int dst, int src) {
+  _x64_rex(a, wide, src, 0, dst);
+  x64_byte(a, op * 8 + 1);
+  _x64_modrm_reg(a, src, dst);
+}
+
+// op dst, imm
+void x64_alu_imm(X64Assembler* a, int op, int wide, int dst, int32_t imm) {
+  _x64_rex(a, wide, 0, 0, dst);
+  x64_byte(a, x64_fits_int8(imm) ? 0x83 : 0x81);
+  _x64_modrm_reg(a, op, dst);
+  if (x64_fits_int8(imm)) {
+    x64_byte(a, imm & 0xFF);
+  } else {
+    x64_int32(a, imm);
+  }
+}
+
+// test r1, r2
+void x64_test(X64Assembler* a, int wide, int r1, int r2) {
+  _x64_rex(a, wide, r2, 0, r1);
+  x64_byte(a, 0x85);
+  _x64_modrm_reg(a, r2, r1);
+}
+
+// sar reg, count
+void x64_sar(X64Assembler* a, int reg, int count) {
+  _x64_rex(a, 1, 0, 0, reg);
+  x64_byte(a, 0xC1);
+  _x64_modrm_reg(a, 7, reg);
+  x64_byte(a, count);
+}
+
+// imul dst, src on 32 bits, which sets the overflow flag if the product doesn't fit
+void x64_imul32(X64Assembler* a, int dst, int src) {
+  _x64_rex(a, 0, dst, 0, src);
+  x64_byte(a, 0x0F);
+  x64_byte(a, 0xAF);
+  _x64_modrm_reg(a, dst, src);
+}
+
+// cdq; idiv src. Divides edx:eax by src, with the quotient in eax and the remainder in edx.
+void x64_idiv32(X64Assembler* a, int src) {
+  x64_byte(a, 0x99);
+  _x64_rex(a, 0, 0, 0, src);
+  x64_byte(a, 0xF7);
+  _x64_modrm_reg(a, 7, src);
+}
+
+// movsxd dst, src
+void x64_movsxd(X64Assembler* a, int dst, int src) {
+  _x64_rex(a, 1, dst, 0, src);
+  x64_byte(a, 0x63);
+  _x64_modrm_reg(a, dst, src);
+}
+
+// setcc on the low byte of reg, then movzx reg, that byte. Only for rax, rcx, rdx and rbx.
+void x64_setcc(X64Assembler* a, int condition, int reg) {
+  x64_byte(a, 0x0F);
+  x64_byte(a, 0x90 + condition);
+  _x64_modrm_reg(a, 0, reg);
+  x64_byte(a, 0x0F);
+  x64_byte(a, 0xB6);
+  _x64_modrm_reg(a, reg, reg);
+}
+
+// inc dword [base + disp]
+void x64_inc_mem32(X64Assembler* a, int base, int32_t disp) {
+  _x64_rex(a, 0, 0, 0, base);
+  x64_byte(a, 0xFF);
+  _x64_modrm_mem(a, 0, base, disp);
+}
+
+void x64_jmp(X64Assembler* a, int label) {
+  x64_byte(a, 0xE9);
+  _x64_rel32(a, label);
+}
+
+void x64_jcc(X64Assembler* a, int condition, int label) {
+  x64_byte(a, 0x0F);
+  x64_byte(a, 0x80 + condition);
+  _x64_rel32(a, label);
+}
+
+// jmp [base + index * 8]. base can't be rbp or r13.
+void x64_jmp_table(X64Assembler* a, int base, int index) {
+  _x64_rex(a, 0, 0, index, base);
+  x64_byte(a, 0xFF);
+  x64_byte(a, (4 << 3) | 4);
+  x64_byte(a, (3 << 6) | ((index & 7) << 3) | (base & 7));
+}
+
+void x64_push(X64Assembler* a, int reg) {
+  _x64_rex(a, 0, 0, 0, reg);
+  x64_byte(a, 0x50 + (reg & 7));
+}
+
+void x64_pop(X64Assembler* a, int reg) {
+  _x64_rex(a, 0, 0, 0, reg);
+  x64_byte(a, 0x58 + (reg & 7));
+}
+
+void x64_ret(X64Assembler* a) {
+  x64_byte(a, 0xC3);
+}
+
+// Maps size bytes of writable memory, to be made executable with x64_make_executable. NULL on failure.
+void* x64_map(int size) {
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? NULL : memory;
+}
+
+int x64_make_executable(void* memory, int size) {
+  return mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+}
+
+void x64_unmap(void* memory, int size) {
+  munmap(memory, size);
+}
+
+#endif
+
+#endif
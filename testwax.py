@@ -0,0 +1,200 @@
+# End-to-end tests. Compiles the projects under src/test, calls their functions every way waxcli can
+# run a module and checks that they all print the same thing.
+#
+#   python3 testwax.py [--waxcli path] [--asttest path]
+#
+# Each case is run with waxcli --run on the module's saved bytecode and on its saved AST, and as the
+# program --emit-native builds from the module. The saved ASTs of these projects and of the samples
+# are also checked by the AST round trip program, which `make test` builds from src/test/asttest.c
+# as ./waxasttest. Last, a project is compiled twice by a server started with --serve, with a change
+# in between, to check that a recompile gives the same program as a fresh compile.
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+TEST_DIR = os.path.join('src', 'test')
+
+# Projects whose saved ASTs go through the round trip program.
+AST_PROJECTS = [
+    os.path.join(TEST_DIR, 'lang', 'manifest.json'),
+    os.path.join('src', 'bench', 'primes', 'manifest.json'),
+    os.path.join('samples', 'PrimeExample', 'manifest.web.json'),
+]
+
+# (project, module, function and arguments)
+CASES = [
+    ('lang', 'Lang', 'main 10'),
+    ('lang', 'Lang', 'churn 1000'),
+    ('lang', 'Lang', 'bad1'),
+    ('lang', 'Lang', 'bad2'),
+    ('lang', 'Lang', 'bad3'),
+    ('lang', 'Lang', 'bad4'),
+    ('lang', 'Lang', 'tern 0'),
+    ('lang', 'Lang', 'tern 5'),
+    ('lang', 'Lang', 'loops 30'),
+    ('lang', 'Lang', 'opsb 0'),
+    ('lang', 'Lang', 'opsb 3'),
+    ('lang', 'Lang', 'neg 1'),
+    ('lang', 'Lang', 'negshift 1'),
+    ('lang', 'Lang', 'bigshift 29'),
+    ('lang', 'Lang', 'bigshift 31'),
+    ('lang', 'Lang', 'usedef 4'),
+    ('lang', 'Lang', 'tooMany 1'),
+    ('lang', 'Lang', 'deep 1'),
+    ('lang', 'Lang', 'undef 1'),
+    ('lang', 'Lang', 'strs 1'),
+    ('lang', 'Lang', 'maybe 1'),
+    ('lang', 'Lang', 'maybe 3'),
+    ('lang', 'Lang', 'dicts 1'),
+    ('lang', 'Lang', 'badidx 5'),
+    ('lang', 'Lang', 'badidx a'),
+    ('lang', 'Lang', 'calln 1'),
+    ('lang', 'Lang', 'fib 20'),
+    ('lang', 'Lang', 'fib abc'),
+    ('lang', 'Lang', 'cmpmix 1'),
+    ('lang', 'Lang', 'iterbad 1'),
+    ('lang', 'Lang', 'popempty 1'),
+    ('lang', 'Lang', 'hasfunc 10'),
+    ('lang', 'Lang', 'keytype 1'),
+    ('lang', 'Lang', 'setidx 1'),
+    ('lang', 'Lang', 'printer 2'),
+    ('lang', 'Lang', 'addover 1'),
+    ('lang', 'Lang', 'addover 2'),
+    ('lang', 'Lang', 'subover 1'),
+    ('lang', 'Lang', 'subover 2'),
+    ('lang', 'Lang', 'mulover 2'),
+    ('lang', 'Lang', 'mulover 3'),
+    ('lang', 'Lang', 'powover 30'),
+    ('lang', 'Lang', 'powover 31'),
+    ('lang', 'Lang', 'shlover 30'),
+    ('lang', 'Lang', 'shlover 31'),
+    ('lang', 'Lang', 'divover 1'),
+    ('lang', 'Lang', 'divover -1'),
+    ('lang', 'Lang', 'negover 0'),
+    ('lang', 'Lang', 'negover 1'),
+]
+
+def run(command):
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, timeout=60)
+    return result.returncode, result.stdout.decode('utf-8', 'replace').strip()
+
+def build(command):
+    status, output = run(command)
+    if status != 0 or 'errors were countered' in output or 'Could not' in output:
+        raise Exception(' '.join(command) + ' failed:\n' + output)
+
+# A server started with --serve keeps the parse trees of unchanged files and resolves them again on
+# each compile. Sub.wax doesn't change between these, so its cached tree has to pick up the new
+# field that Base.wax gets before the second one.
+SESSION_FILES = {
+    'Sub.wax': 'class Sub : Base {\n  field b = 2;\n\n  function get() {\n    return this.b;\n  }\n}\n\nfunction get() {\n  return Sub().get();\n}\n',
+}
+SESSION_BASES = [
+    'class Base {\n  field a = 1;\n}\n',
+    'class Base {\n  field a = 1;\n  field c = 3;\n}\n',
+]
+
+def session_test(waxcli, temp_dir):
+    project_dir = os.path.join(temp_dir, 'session')
+    src_dir = os.path.join(project_dir, 'Session')
+    out_dir = os.path.join(project_dir, 'out')
+    os.makedirs(src_dir)
+    os.mkdir(out_dir)
+    manifest = os.path.join(project_dir, 'manifest.json')
+    with open(manifest, 'w') as f:
+        f.write('{ "output": "bin/Session", "outputType": "web", "mainModule": "Session",\n'
+            '  "moduleTargets": [ { "name": "Session", "src": "Session", "lang": "wax", "action": "bundle" } ] }\n')
+    for name, content in SESSION_FILES.items():
+        with open(os.path.join(src_dir, name), 'w') as f:
+            f.write(content)
+
+    socket_path = os.path.join(project_dir, 'serve.sock')
+    server = subprocess.Popen([waxcli, '--emit-bytecode', out_dir, '--serve', socket_path, manifest],
+        stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    failures = 0
+    try:
+        for i in range(100):
+            if os.path.exists(socket_path):
+                break
+            time.sleep(0.05)
+        for base in SESSION_BASES:
+            with open(os.path.join(src_dir, 'Base.wax'), 'w') as f:
+                f.write(base)
+            status, output = run([waxcli, '--send', socket_path, 'compile'])
+            if status != 0 or 'Success!' not in output:
+                print('FAIL: session compile\n' + output)
+                failures += 1
+                break
+            status, output = run([waxcli, '--run', os.path.join(out_dir, 'Session.waxbc'), 'get'])
+            if output != '2':
+                print('FAIL: session get printed ' + output + ' instead of 2')
+                failures += 1
+    finally:
+        run([waxcli, '--send', socket_path, 'stop'])
+        try:
+            server.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            server.kill()
+    return failures
+
+def main(args):
+    waxcli = './waxcli'
+    asttest = './waxasttest'
+    i = 0
+    while i < len(args):
+        if args[i] == '--waxcli' and i + 1 < len(args):
+            waxcli = args[i + 1]
+            i += 1
+        elif args[i] == '--asttest' and i + 1 < len(args):
+            asttest = args[i + 1]
+            i += 1
+        else:
+            print('Usage: python3 testwax.py [--waxcli path] [--asttest path]')
+            return 1
+        i += 1
+
+    temp_dir = tempfile.TemporaryDirectory(prefix='waxtest_')
+    failures = 0
+
+    ast_dir = os.path.join(temp_dir.name, 'ast')
+    os.mkdir(ast_dir)
+    for manifest in AST_PROJECTS:
+        build([waxcli, '--emit-ast', ast_dir, manifest])
+    ast_files = sorted(os.path.join(ast_dir, name) for name in os.listdir(ast_dir))
+    status, output = run([asttest] + ast_files)
+    print(output)
+    if status != 0:
+        print('FAIL: the AST round trip')
+        failures += 1
+
+    projects = sorted(set(case[0] for case in CASES))
+    for project in projects:
+        build([waxcli, '--emit-ast', temp_dir.name, '--emit-bytecode', temp_dir.name, '--emit-native', temp_dir.name,
+            os.path.join(TEST_DIR, project, 'manifest.json')])
+
+    for project, module, call in CASES:
+        call_args = call.split(' ')
+        expected_status, expected = run([waxcli, '--run', os.path.join(temp_dir.name, module + '.waxbc')] + call_args)
+        runs = [
+            ('ast', [waxcli, '--run', os.path.join(temp_dir.name, module + '.waxast')] + call_args),
+            ('native', [os.path.join(temp_dir.name, module)] + call_args),
+        ]
+        for name, command in runs:
+            status, output = run(command)
+            if status != expected_status or output != expected:
+                print('FAIL: ' + module + ' ' + call + ' (' + name + ')')
+                print('  bytecode printed: ' + expected)
+                print('  ' + name + ' printed: ' + output)
+                failures += 1
+
+    failures += session_test(waxcli, temp_dir.name)
+
+    temp_dir.cleanup()
+    print(str(len(CASES)) + ' cases, ' + str(failures) + ' failures')
+    return 1 if failures > 0 else 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))